@@ -31,6 +31,7 @@
 #include "fontcache.h"
 #include "mapagg.h"
 #include <assert.h>
+#include <limits.h>
 #include "renderers/agg/include/agg_color_rgba.h"
 #include "renderers/agg/include/agg_pixfmt_rgba.h"
 #include "renderers/agg/include/agg_renderer_base.h"
@@ -67,6 +68,12 @@
 #include <pixman.h>
 #endif
 
+/* SSE2 is part of the x86-64 baseline, other platforms use the AGG code */
+#if defined(__x86_64__) || defined(_M_X64)
+#define AGG_USE_SSE2
+#include <emmintrin.h>
+#endif
+
 #ifdef AGG_ALIASED_ENABLED
 #include "renderers/agg/include/agg_renderer_primitives.h"
 #include "renderers/agg/include/agg_rasterizer_outline.h"
@@ -83,10 +90,229 @@ typedef mapserver::pixel32_type pixel_type;
 typedef mapserver::blender_rgba_pre<color_type, band_order> blender_pre;
 typedef mapserver::comp_op_adaptor_rgba_pre<color_type, band_order> compop_blender_pre;
 
-typedef mapserver::pixfmt_alpha_blend_rgba<blender_pre, mapserver::rendering_buffer, pixel_type> pixel_format;
+typedef mapserver::pixfmt_alpha_blend_rgba<blender_pre, mapserver::rendering_buffer, pixel_type> pixel_format_base;
+typedef mapserver::copy_or_blend_rgba_wrapper<blender_pre> copy_or_blend_pre;
+
+/*
+** Blend a row of premultiplied pixels over dst, bit for bit the same as
+** pixel_format_base::blend_from(). Four pixels are done at a time with SSE2,
+** with alpha being the last byte of each pixel (band_order is bgra).
+*/
+static void aggBlendRow(band_type *dst, const band_type *src, unsigned len, unsigned cover)
+{
+  unsigned i = 0;
+#ifdef AGG_USE_SSE2
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i amask = _mm_set1_epi32((int)0xFF000000);
+  const __m128i c255 = _mm_set1_epi16(255);
+  const __m128i alane = _mm_set_epi16(-1,0,0,0,-1,0,0,0);
+  const __m128i cov = _mm_set1_epi16(cover + 1);
+  for(; i + 4 <= len; i += 4) {
+    __m128i s = _mm_loadu_si128((const __m128i*)(src + i*4));
+    __m128i transparent = _mm_cmpeq_epi32(_mm_and_si128(s, amask), zero);
+    __m128i d, res[2];
+    int h;
+    if(_mm_movemask_epi8(transparent) == 0xFFFF)
+      continue;
+    if(cover == 255 && _mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(s, amask), amask)) == 0xFFFF) {
+      _mm_storeu_si128((__m128i*)(dst + i*4), s);
+      continue;
+    }
+    d = _mm_loadu_si128((const __m128i*)(dst + i*4));
+    for(h = 0; h < 2; h++) {
+      /* two pixels as 16 bit lanes */
+      __m128i s16 = h ? _mm_unpackhi_epi8(s, zero) : _mm_unpacklo_epi8(s, zero);
+      __m128i d16 = h ? _mm_unpackhi_epi8(d, zero) : _mm_unpacklo_epi8(d, zero);
+      __m128i sa = _mm_shufflehi_epi16(_mm_shufflelo_epi16(s16, 0xFF), 0xFF);
+      __m128i ia, color, alpha;
+      if(cover == 255) {
+        ia = _mm_sub_epi16(c255, sa);
+        color = _mm_add_epi16(_mm_srli_epi16(_mm_mullo_epi16(d16, ia), 8), s16);
+      } else {
+        __m128i lo, hi;
+        ia = _mm_sub_epi16(c255, _mm_srli_epi16(_mm_mullo_epi16(sa, cov), 8));
+        lo = _mm_madd_epi16(_mm_unpacklo_epi16(d16, s16), _mm_unpacklo_epi16(ia, cov));
+        hi = _mm_madd_epi16(_mm_unpackhi_epi16(d16, s16), _mm_unpackhi_epi16(ia, cov));
+        color = _mm_packs_epi32(_mm_srli_epi32(lo, 8), _mm_srli_epi32(hi, 8));
+      }
+      color = _mm_and_si128(color, c255); /* value_type truncation */
+      alpha = _mm_sub_epi16(c255, _mm_srli_epi16(_mm_mullo_epi16(ia, _mm_sub_epi16(c255, d16)), 8));
+      res[h] = _mm_or_si128(_mm_andnot_si128(alane, color), _mm_and_si128(alane, alpha));
+    }
+    _mm_storeu_si128((__m128i*)(dst + i*4),
+                     _mm_or_si128(_mm_and_si128(transparent, d),
+                                  _mm_andnot_si128(transparent, _mm_packus_epi16(res[0], res[1]))));
+  }
+#endif
+  for(; i < len; i++) {
+    copy_or_blend_pre::copy_or_blend_pix(dst + i*4, src[i*4 + band_order::R], src[i*4 + band_order::G],
+                                         src[i*4 + band_order::B], src[i*4 + band_order::A], cover);
+  }
+}
+
+/*
+** pixel_format_base with the row blending used for layer compositing and
+** pixmap symbols going through aggBlendRow().
+*/
+class pixel_format : public pixel_format_base
+{
+public:
+  pixel_format() {}
+  explicit pixel_format(rbuf_type& rb) : pixel_format_base(rb) {}
+
+  template<class SrcPixelFormatRenderer>
+  void blend_from(const SrcPixelFormatRenderer& from, int xdst, int ydst, int xsrc, int ysrc,
+                  unsigned len, mapserver::int8u cover) {
+    pixel_format_base::blend_from(from, xdst, ydst, xsrc, ysrc, len, cover);
+  }
+
+  void blend_from(const pixel_format& from, int xdst, int ydst, int xsrc, int ysrc,
+                  unsigned len, mapserver::int8u cover) {
+    const band_type *psrc = from.row_ptr(ysrc);
+    band_type *pdst = row_ptr(ydst);
+    if(!psrc)
+      return;
+    psrc += xsrc * 4;
+    pdst += xdst * 4;
+    if(psrc < pdst + len * 4 && pdst < psrc + len * 4) {
+      /* overlapping rows of the same image */
+      pixel_format_base::blend_from(from, xdst, ydst, xsrc, ysrc, len, cover);
+      return;
+    }
+    aggBlendRow(pdst, psrc, len, cover);
+  }
+};
 typedef mapserver::pixfmt_custom_blend_rgba<compop_blender_pre, mapserver::rendering_buffer> compop_pixel_format;
 typedef mapserver::rendering_buffer rendering_buffer;
-typedef mapserver::renderer_base<pixel_format> renderer_base;
+
+/*
+** renderer_base that keeps the bounding box of the pixels it writes, so that
+** only that part of a temporary layer image has to be filtered and blended
+** onto the map (see agg2GetDirtyRect()). Pixels written directly to the
+** buffer, e.g. by raster layers, are not accounted for.
+*/
+template<class PixelFormat> class renderer_base_dirty : public mapserver::renderer_base<PixelFormat>
+{
+public:
+  typedef mapserver::renderer_base<PixelFormat> base_type;
+  typedef typename base_type::color_type color_type;
+  typedef mapserver::cover_type cover_type;
+  typedef mapserver::rect_i rect_i;
+
+  renderer_base_dirty() { reset_dirty(); }
+  explicit renderer_base_dirty(PixelFormat& ren) : base_type(ren) { reset_dirty(); }
+
+  void reset_dirty() { m_dirty = rect_i(INT_MAX, INT_MAX, INT_MIN, INT_MIN); }
+  void set_dirty(int x1, int y1, int x2, int y2) {
+    if(x1 > x2) { int t = x2; x2 = x1; x1 = t; }
+    if(y1 > y2) { int t = y2; y2 = y1; y1 = t; }
+    if(x2 < this->xmin() || x1 > this->xmax() || y2 < this->ymin() || y1 > this->ymax()) return;
+    if(x1 < m_dirty.x1) m_dirty.x1 = x1;
+    if(y1 < m_dirty.y1) m_dirty.y1 = y1;
+    if(x2 > m_dirty.x2) m_dirty.x2 = x2;
+    if(y2 > m_dirty.y2) m_dirty.y2 = y2;
+  }
+  const rect_i& dirty() const { return m_dirty; }
+
+  void clear(const color_type& c) {
+    base_type::clear(c);
+    set_dirty(0, 0, this->width() - 1, this->height() - 1);
+  }
+  void copy_pixel(int x, int y, const color_type& c) {
+    set_dirty(x, y, x, y);
+    base_type::copy_pixel(x, y, c);
+  }
+  void blend_pixel(int x, int y, const color_type& c, cover_type cover) {
+    set_dirty(x, y, x, y);
+    base_type::blend_pixel(x, y, c, cover);
+  }
+  void copy_hline(int x1, int y, int x2, const color_type& c) {
+    set_dirty(x1, y, x2, y);
+    base_type::copy_hline(x1, y, x2, c);
+  }
+  void copy_vline(int x, int y1, int y2, const color_type& c) {
+    set_dirty(x, y1, x, y2);
+    base_type::copy_vline(x, y1, y2, c);
+  }
+  void blend_hline(int x1, int y, int x2, const color_type& c, cover_type cover) {
+    set_dirty(x1, y, x2, y);
+    base_type::blend_hline(x1, y, x2, c, cover);
+  }
+  void blend_vline(int x, int y1, int y2, const color_type& c, cover_type cover) {
+    set_dirty(x, y1, x, y2);
+    base_type::blend_vline(x, y1, y2, c, cover);
+  }
+  void copy_bar(int x1, int y1, int x2, int y2, const color_type& c) {
+    set_dirty(x1, y1, x2, y2);
+    base_type::copy_bar(x1, y1, x2, y2, c);
+  }
+  void blend_bar(int x1, int y1, int x2, int y2, const color_type& c, cover_type cover) {
+    set_dirty(x1, y1, x2, y2);
+    base_type::blend_bar(x1, y1, x2, y2, c, cover);
+  }
+  void blend_solid_hspan(int x, int y, int len, const color_type& c, const cover_type* covers) {
+    set_dirty(x, y, x + len - 1, y);
+    base_type::blend_solid_hspan(x, y, len, c, covers);
+  }
+  void blend_solid_vspan(int x, int y, int len, const color_type& c, const cover_type* covers) {
+    set_dirty(x, y, x, y + len - 1);
+    base_type::blend_solid_vspan(x, y, len, c, covers);
+  }
+  void copy_color_hspan(int x, int y, int len, const color_type* colors) {
+    set_dirty(x, y, x + len - 1, y);
+    base_type::copy_color_hspan(x, y, len, colors);
+  }
+  void copy_color_vspan(int x, int y, int len, const color_type* colors) {
+    set_dirty(x, y, x, y + len - 1);
+    base_type::copy_color_vspan(x, y, len, colors);
+  }
+  void blend_color_hspan(int x, int y, int len, const color_type* colors, const cover_type* covers,
+                         cover_type cover = mapserver::cover_full) {
+    set_dirty(x, y, x + len - 1, y);
+    base_type::blend_color_hspan(x, y, len, colors, covers, cover);
+  }
+  void blend_color_vspan(int x, int y, int len, const color_type* colors, const cover_type* covers,
+                         cover_type cover = mapserver::cover_full) {
+    set_dirty(x, y, x, y + len - 1);
+    base_type::blend_color_vspan(x, y, len, colors, covers, cover);
+  }
+  template<class RenBuf>
+  void copy_from(const RenBuf& src, const rect_i* rect_src_ptr = 0, int dx = 0, int dy = 0) {
+    set_dirty_from(src.width(), src.height(), rect_src_ptr, dx, dy);
+    base_type::copy_from(src, rect_src_ptr, dx, dy);
+  }
+  template<class SrcPixelFormatRenderer>
+  void blend_from(const SrcPixelFormatRenderer& src, const rect_i* rect_src_ptr = 0,
+                  int dx = 0, int dy = 0, cover_type cover = mapserver::cover_full) {
+    set_dirty_from(src.width(), src.height(), rect_src_ptr, dx, dy);
+    base_type::blend_from(src, rect_src_ptr, dx, dy, cover);
+  }
+  template<class SrcPixelFormatRenderer>
+  void blend_from_color(const SrcPixelFormatRenderer& src, const color_type& color, const rect_i* rect_src_ptr = 0,
+                        int dx = 0, int dy = 0, cover_type cover = mapserver::cover_full) {
+    set_dirty_from(src.width(), src.height(), rect_src_ptr, dx, dy);
+    base_type::blend_from_color(src, color, rect_src_ptr, dx, dy, cover);
+  }
+  template<class SrcPixelFormatRenderer>
+  void blend_from_lut(const SrcPixelFormatRenderer& src, const color_type* color_lut, const rect_i* rect_src_ptr = 0,
+                      int dx = 0, int dy = 0, cover_type cover = mapserver::cover_full) {
+    set_dirty_from(src.width(), src.height(), rect_src_ptr, dx, dy);
+    base_type::blend_from_lut(src, color_lut, rect_src_ptr, dx, dy, cover);
+  }
+
+private:
+  void set_dirty_from(int width, int height, const rect_i* rect_src_ptr, int dx, int dy) {
+    /* same conventions as the *_from() methods: rect_src_ptr is inclusive */
+    if(rect_src_ptr)
+      set_dirty(rect_src_ptr->x1 + dx, rect_src_ptr->y1 + dy, rect_src_ptr->x2 + dx, rect_src_ptr->y2 + dy);
+    else
+      set_dirty(dx, dy, dx + width - 1, dy + height - 1);
+  }
+
+  rect_i m_dirty;
+};
+
+typedef renderer_base_dirty<pixel_format> renderer_base;
 typedef mapserver::renderer_base<compop_pixel_format> compop_renderer_base;
 typedef mapserver::renderer_scanline_aa_solid<renderer_base> renderer_scanline;
 typedef mapserver::rasterizer_scanline_aa<> rasterizer_scanline;
@@ -803,6 +1029,19 @@ int agg2MergeRasterBuffer(imageObj *dest, rasterBufferObj *overlay, double opaci
   return MS_SUCCESS;
 }
 
+int agg2GetDirtyRect(imageObj *img, rectObj *bounds)
+{
+  AGG2Renderer *r = AGG_RENDERER(img);
+  const mapserver::rect_i &dirty = r->m_renderer_base.dirty();
+  bounds->minx = MS_MAX(dirty.x1, 0);
+  bounds->miny = MS_MAX(dirty.y1, 0);
+  bounds->maxx = MS_MIN(dirty.x2 + 1, img->width);
+  bounds->maxy = MS_MIN(dirty.y2 + 1, img->height);
+  if(bounds->minx >= bounds->maxx || bounds->miny >= bounds->maxy)
+    bounds->minx = bounds->miny = bounds->maxx = bounds->maxy = 0;
+  return MS_SUCCESS;
+}
+
 /* image i/o */
 imageObj *agg2CreateImage(int width, int height, outputFormatObj *format, colorObj * bg)
 {
@@ -849,8 +1088,10 @@ imageObj *agg2CreateImage(int width, int height, outputFormatObj *format, colorO
   r->m_rasterizer_aa_gamma.gamma(r->gamma_function);
   if( bg && !format->transparent )
     r->m_renderer_base.clear(aggColor(bg));
-  else
+  else {
     r->m_renderer_base.clear(AGG_NO_COLOR);
+    r->m_renderer_base.reset_dirty();
+  }
 
   if (!bg || format->transparent || format->imagemode == MS_IMAGEMODE_RGBA ) {
     r->use_alpha = true;
@@ -1283,7 +1524,8 @@ static mapserver::comp_op_e ms2agg_compop(CompositingOperation c) {
 }
 #endif
 
-int aggCompositeRasterBuffer(imageObj *dest, rasterBufferObj *overlay, CompositingOperation comp, int opacity) {
+int aggCompositeRasterBuffer(imageObj *dest, rasterBufferObj *overlay, CompositingOperation comp, int opacity,
+                             int srcX, int srcY, int dstX, int dstY, int width, int height) {
   assert(overlay->type == MS_BUFFER_BYTE_RGBA);
   AGG2Renderer *r = AGG_RENDERER(dest);
 #ifdef USE_PIXMAN
@@ -1300,15 +1542,16 @@ int aggCompositeRasterBuffer(imageObj *dest, rasterBufferObj *overlay, Compositi
       } else {
           unsigned char alpha = (unsigned char)(opacity * 2.55);
           if(!alpha_mask_i) {
-              alpha_mask = (unsigned char*)msSmallMalloc(dest->width * dest->height);
-              alpha_mask_i = pixman_image_create_bits(PIXMAN_a8,dest->width,dest->height,
-                      (uint32_t*)alpha_mask,dest->width);
+              alpha_mask = (unsigned char*)msSmallMalloc(width * height);
+              alpha_mask_i = pixman_image_create_bits(PIXMAN_a8,width,height,
+                      (uint32_t*)alpha_mask,width);
           }
-          memset(alpha_mask,alpha,dest->width*dest->height);
+          memset(alpha_mask,alpha,width*height);
           alpha_mask_i_ptr = alpha_mask_i;
       }
       pixman_image_composite (ms2pixman_compop(comp), si, alpha_mask_i_ptr, bi,
-                  0, 0, 0, 0, 0, 0, dest->width,dest->height);
+                  srcX, srcY, 0, 0, dstX, dstY, width, height);
+      r->m_renderer_base.set_dirty(dstX, dstY, dstX + width - 1, dstY + height - 1);
     }
   pixman_image_unref(si);
   pixman_image_unref(bi);
@@ -1321,27 +1564,136 @@ int aggCompositeRasterBuffer(imageObj *dest, rasterBufferObj *overlay, Compositi
   rendering_buffer b(overlay->data.rgba.pixels, overlay->width, overlay->height, overlay->data.rgba.row_step);
   pixel_format pf(b);
   mapserver::comp_op_e comp_op = ms2agg_compop(comp);
+  mapserver::rect_i src_rect(srcX, srcY, srcX + width - 1, srcY + height - 1);
   if(comp_op == mapserver::comp_op_src_over) {
-    r->m_renderer_base.blend_from(pf,0,0,0,unsigned(opacity * 2.55));
+    r->m_renderer_base.blend_from(pf,&src_rect,dstX-srcX,dstY-srcY,unsigned(opacity * 2.55));
   } else {
     compop_pixel_format pixf(r->m_rendering_buffer);
     compop_renderer_base ren(pixf);
     pixf.comp_op(comp_op);
-    ren.blend_from(pf,0,0,0,unsigned(opacity * 2.55));
+    ren.blend_from(pf,&src_rect,dstX-srcX,dstY-srcY,unsigned(opacity * 2.55));
+    r->m_renderer_base.set_dirty(dstX, dstY, dstX + width - 1, dstY + height - 1);
   }
   return MS_SUCCESS;
 #endif
 }
 
+#ifdef AGG_USE_SSE2
+static inline __m128i aggLoadPixel(const band_type *p)
+{
+  int v;
+  memcpy(&v, p, 4);
+  return _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(v), _mm_setzero_si128()), _mm_setzero_si128());
+}
+
+/*
+** One pass of mapserver::stack_blur_rgba32() over count lines of n pixels,
+** the lines starting pitch bytes apart and their pixels step bytes apart.
+** The four channel sums of a line are held in the 32 bit lanes of a register,
+** with the same arithmetic including the wrapping of the products. Columns
+** are done several at a time so that each row read serves all of them.
+*/
+static void aggStackBlurLines(band_type *first, unsigned count, int pitch, unsigned n, int step,
+                              unsigned radius, unsigned mul_sum, unsigned shr_sum, __m128i *stack, __m128i *sums)
+{
+  unsigned div = radius * 2 + 1, wm = n - 1, i, k, x, xp, stack_ptr, stack_start;
+  __m128i *sum = sums, *sum_in = sums + count, *sum_out = sums + 2 * count;
+  __m128i mul = _mm_set1_epi32(mul_sum), shr = _mm_cvtsi32_si128(shr_sum), low = _mm_set1_epi32(0xFF);
+  const band_type *src = first;
+  band_type *dst = first;
+
+  for(k = 0; k < count; k++)
+    sum[k] = sum_in[k] = sum_out[k] = _mm_setzero_si128();
+  for(i = 0; i <= radius; i++) {
+    __m128i weight = _mm_set1_epi32(i + 1);
+    for(k = 0; k < count; k++) {
+      __m128i pix = aggLoadPixel(src + k * pitch);
+      stack[i * count + k] = pix;
+      sum[k] = _mm_add_epi32(sum[k], _mm_madd_epi16(pix, weight));
+      sum_out[k] = _mm_add_epi32(sum_out[k], pix);
+    }
+  }
+  for(i = 1; i <= radius; i++) {
+    __m128i weight = _mm_set1_epi32(radius + 1 - i);
+    if(i <= wm) src += step;
+    for(k = 0; k < count; k++) {
+      __m128i pix = aggLoadPixel(src + k * pitch);
+      stack[(i + radius) * count + k] = pix;
+      sum[k] = _mm_add_epi32(sum[k], _mm_madd_epi16(pix, weight));
+      sum_in[k] = _mm_add_epi32(sum_in[k], pix);
+    }
+  }
+
+  stack_ptr = radius;
+  xp = radius;
+  if(xp > wm) xp = wm;
+  src = first + xp * step;
+  for(x = 0; x < n; x++) {
+    __m128i *oldest, *next;
+    stack_start = stack_ptr + div - radius;
+    if(stack_start >= div) stack_start -= div;
+    if(++stack_ptr >= div) stack_ptr = 0;
+    if(xp < wm) {
+      src += step;
+      ++xp;
+    }
+    oldest = stack + stack_start * count;
+    next = stack + stack_ptr * count;
+    for(k = 0; k < count; k++) {
+      /* (sum * mul_sum) >> shr_sum on 32 bits, then truncated to a byte */
+      __m128i even = _mm_mul_epu32(sum[k], mul);
+      __m128i odd = _mm_mul_epu32(_mm_srli_epi64(sum[k], 32), mul);
+      __m128i out = _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0,0,2,0)),
+                                       _mm_shuffle_epi32(odd, _MM_SHUFFLE(0,0,2,0)));
+      int v;
+      out = _mm_and_si128(_mm_srl_epi32(out, shr), low);
+      out = _mm_packs_epi32(out, out);
+      v = _mm_cvtsi128_si32(_mm_packus_epi16(out, out));
+      memcpy(dst + k * pitch, &v, 4);
+
+      sum[k] = _mm_sub_epi32(sum[k], sum_out[k]);
+      sum_out[k] = _mm_sub_epi32(sum_out[k], oldest[k]);
+      oldest[k] = aggLoadPixel(src + k * pitch);
+      sum_in[k] = _mm_add_epi32(sum_in[k], oldest[k]);
+      sum[k] = _mm_add_epi32(sum[k], sum_in[k]);
+      sum_out[k] = _mm_add_epi32(sum_out[k], next[k]);
+      sum_in[k] = _mm_sub_epi32(sum_in[k], next[k]);
+    }
+    dst += step;
+  }
+}
+#endif
+
+#define AGG_BLUR_COLUMNS 16 /* one cache line of pixels */
+
 void msApplyBlurringCompositingFilter(rasterBufferObj *rb, unsigned int radius) {
+#ifdef AGG_USE_SSE2
+  unsigned int x, y, mul_sum, shr_sum;
+  __m128i *stack, sums[3 * AGG_BLUR_COLUMNS];
+  if(radius == 0 || rb->width == 0 || rb->height == 0)
+    return;
+  if(radius > 254) radius = 254;
+  mul_sum = mapserver::stack_blur_tables<int>::g_stack_blur8_mul[radius];
+  shr_sum = mapserver::stack_blur_tables<int>::g_stack_blur8_shr[radius];
+  stack = (__m128i*) msSmallMalloc(sizeof(__m128i) * (radius * 2 + 1) * AGG_BLUR_COLUMNS);
+  for(y = 0; y < rb->height; y++)
+    aggStackBlurLines(rb->data.rgba.pixels + y * rb->data.rgba.row_step, 1, 0, rb->width, 4,
+                      radius, mul_sum, shr_sum, stack, sums);
+  for(x = 0; x < rb->width; x += AGG_BLUR_COLUMNS)
+    aggStackBlurLines(rb->data.rgba.pixels + x * 4, MS_MIN(AGG_BLUR_COLUMNS, rb->width - x), 4,
+                      rb->height, rb->data.rgba.row_step, radius, mul_sum, shr_sum, stack, sums);
+  free(stack);
+#else
   rendering_buffer b(rb->data.rgba.pixels, rb->width, rb->height, rb->data.rgba.row_step);
   pixel_format pf(b);
   mapserver::stack_blur_rgba32(pf,radius,radius);
+#endif
 }
 
 int msPopulateRendererVTableAGG(rendererVTableObj * renderer)
 {
   renderer->compositeRasterBuffer = &aggCompositeRasterBuffer;
+  renderer->getDirtyRect = &agg2GetDirtyRect;
   renderer->supports_pixel_buffer = 1;
   renderer->use_imagecache = 0;
   renderer->supports_clipping = 0;
@@ -0,0 +1,163 @@
+/******************************************************************************
+ * $Id$
+ *
+ * Project:  MapServer
+ * Purpose:  Arena (bump) allocator for short lived per request storage.
+ * Author:   MapServer team.
+ *
+ ******************************************************************************
+ * Copyright (c) 1996-2016 Regents of the University of Minnesota.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *****************************************************************************/
+
+/*
+** An arenaObj hands out memory from a list of large blocks by bumping an
+** offset. Individual allocations are never freed: the owner calls
+** msArenaReset() when the data is no longer needed (e.g. once per request)
+** which keeps a single block around for reuse, or msArenaFree() to give
+** everything back.
+**
+** Memory obtained from an arena must never be passed to free() or realloc(),
+** so only use it for data whose lifetime is entirely controlled by the
+** owner of the arena.
+*/
+
+#include "mapserver.h"
+
+#define MS_ARENA_ALIGN 16 /* enough for doubles and pointers everywhere */
+#define MS_ARENA_ROUND(n) (((n) + (MS_ARENA_ALIGN-1)) & ~((size_t)MS_ARENA_ALIGN-1))
+
+struct arenaBlockObj {
+  arenaBlockObj *next;
+  size_t size; /* usable bytes after the header */
+  size_t used;
+};
+
+#define MS_ARENA_HEADER MS_ARENA_ROUND(sizeof(arenaBlockObj))
+
+static arenaBlockObj *arenaNewBlock(arenaObj *arena, size_t size)
+{
+  arenaBlockObj *block = (arenaBlockObj*) msSmallMalloc(MS_ARENA_HEADER + size);
+  block->size = size;
+  block->used = 0;
+  arena->numblocks++;
+  return block;
+}
+
+void msArenaInit(arenaObj *arena, size_t blocksize)
+{
+  arena->blocks = NULL;
+  arena->blocksize = blocksize;
+  arena->numallocs = 0;
+  arena->numbytes = 0;
+  arena->numblocks = 0;
+}
+
+/*
+** Return size bytes of uninitialized memory, aligned for any basic type.
+** Requests larger than a quarter of the block size get a dedicated block
+** which is inserted behind the current one so the free space left there
+** can still be used.
+*/
+void *msArenaAlloc(arenaObj *arena, size_t size)
+{
+  arenaBlockObj *block;
+  size_t blocksize = arena->blocksize ? arena->blocksize : MS_ARENA_BLOCKSIZE;
+
+  size = MS_ARENA_ROUND(size ? size : 1);
+  arena->numallocs++;
+  arena->numbytes += size;
+
+  block = arena->blocks;
+  if(block && block->size - block->used >= size) {
+    void *p = (char*)block + MS_ARENA_HEADER + block->used;
+    block->used += size;
+    return p;
+  }
+
+  if(size > blocksize / 4) {
+    arenaBlockObj *big = arenaNewBlock(arena, size);
+    big->used = size;
+    if(block) {
+      big->next = block->next;
+      block->next = big;
+    } else {
+      big->next = NULL;
+      arena->blocks = big;
+    }
+    return (char*)big + MS_ARENA_HEADER;
+  }
+
+  block = arenaNewBlock(arena, blocksize);
+  block->next = arena->blocks;
+  arena->blocks = block;
+  block->used = size;
+  return (char*)block + MS_ARENA_HEADER;
+}
+
+char *msArenaStrdup(arenaObj *arena, const char *str)
+{
+  size_t len;
+  char *copy;
+  if(!str) return NULL;
+  len = strlen(str) + 1;
+  copy = (char*) msArenaAlloc(arena, len);
+  memcpy(copy, str, len);
+  return copy;
+}
+
+/*
+** Invalidate everything allocated from the arena. One regular sized block is
+** kept so that the next round of allocations doesn't go back to malloc.
+*/
+void msArenaReset(arenaObj *arena)
+{
+  size_t blocksize = arena->blocksize ? arena->blocksize : MS_ARENA_BLOCKSIZE;
+  arenaBlockObj *keep = NULL, *block = arena->blocks;
+
+  while(block) {
+    arenaBlockObj *next = block->next;
+    if(!keep && block->size == blocksize) {
+      keep = block;
+    } else {
+      free(block);
+    }
+    block = next;
+  }
+  if(keep) {
+    keep->next = NULL;
+    keep->used = 0;
+  }
+  arena->blocks = keep;
+  arena->numallocs = 0;
+  arena->numbytes = 0;
+  arena->numblocks = keep ? 1 : 0;
+}
+
+void msArenaFree(arenaObj *arena)
+{
+  arenaBlockObj *block = arena->blocks;
+  while(block) {
+    arenaBlockObj *next = block->next;
+    free(block);
+    block = next;
+  }
+  msArenaInit(arena, arena->blocksize);
+}
@@ -235,6 +235,72 @@ int renderPolygonCairo(imageObj *img, shapeObj *p, colorObj *c)
   return MS_SUCCESS;
 }
 
+/* the shapes don't share any pixels (see rendererVTableObj), so they can go
+ * in a single path that is stroked or filled once. Only used for raster
+ * surfaces, vector outputs keep one path per feature */
+int renderLinesCairo(imageObj *img, shapeObj *shapes, int count, strokeStyleObj *stroke)
+{
+  int i,j,k;
+  cairo_renderer *r = CAIRO_RENDERER(img);
+  assert(stroke->color);
+  cairo_new_path(r->cr);
+  msCairoSetSourceColor(r->cr,stroke->color);
+  for(k=0; k<count; k++) {
+    shapeObj *p = &shapes[k];
+    for(i=0; i<p->numlines; i++) {
+      lineObj *l = &(p->line[i]);
+      if(l->numpoints == 0) continue;
+      cairo_move_to(r->cr,l->point[0].x,l->point[0].y);
+      for(j=1; j<l->numpoints; j++) {
+        cairo_line_to(r->cr,l->point[j].x,l->point[j].y);
+      }
+    }
+  }
+  if(stroke->patternlength>0) {
+    cairo_set_dash(r->cr,stroke->pattern,stroke->patternlength,-stroke->patternoffset);
+  }
+  switch(stroke->linecap) {
+    case MS_CJC_BUTT:
+      cairo_set_line_cap(r->cr,CAIRO_LINE_CAP_BUTT);
+      break;
+    case MS_CJC_SQUARE:
+      cairo_set_line_cap(r->cr,CAIRO_LINE_CAP_SQUARE);
+      break;
+    case MS_CJC_ROUND:
+    case MS_CJC_NONE:
+    default:
+      cairo_set_line_cap(r->cr,CAIRO_LINE_CAP_ROUND);
+  }
+  cairo_set_line_width (r->cr, stroke->width);
+  cairo_stroke (r->cr);
+  if(stroke->patternlength>0) {
+    cairo_set_dash(r->cr,stroke->pattern,0,0);
+  }
+  return MS_SUCCESS;
+}
+
+int renderPolygonsCairo(imageObj *img, shapeObj *shapes, int count, colorObj *c)
+{
+  cairo_renderer *r = CAIRO_RENDERER(img);
+  int i,j,k;
+  cairo_new_path(r->cr);
+  cairo_set_fill_rule(r->cr,CAIRO_FILL_RULE_EVEN_ODD);
+  msCairoSetSourceColor(r->cr,c);
+  for(k=0; k<count; k++) {
+    shapeObj *p = &shapes[k];
+    for(i=0; i<p->numlines; i++) {
+      lineObj *l = &(p->line[i]);
+      cairo_move_to(r->cr,l->point[0].x,l->point[0].y);
+      for(j=1; j<l->numpoints; j++) {
+        cairo_line_to(r->cr,l->point[j].x,l->point[j].y);
+      }
+      cairo_close_path(r->cr);
+    }
+  }
+  cairo_fill(r->cr);
+  return MS_SUCCESS;
+}
+
 int renderPolygonTiledCairo(imageObj *img, shapeObj *p,  imageObj *tile)
 {
   int i,j;
@@ -836,7 +902,8 @@ static cairo_operator_t ms2cairo_compop(CompositingOperation op) {
   }
 }
 
-int cairoCompositeRasterBuffer(imageObj *img, rasterBufferObj *rb, CompositingOperation comp, int opacity) {
+int cairoCompositeRasterBuffer(imageObj *img, rasterBufferObj *rb, CompositingOperation comp, int opacity,
+                               int srcX, int srcY, int dstX, int dstY, int width, int height) {
   cairo_surface_t *src;
   cairo_renderer *r;
   if(rb->type != MS_BUFFER_BYTE_RGBA) {
@@ -848,12 +915,17 @@ int cairoCompositeRasterBuffer(imageObj *img, rasterBufferObj *rb, CompositingOp
         rb->width,rb->height,
         rb->data.rgba.row_step);
 
-  cairo_set_source_surface (r->cr,src,0,0);
+  cairo_save(r->cr);
+  if(dstX||dstY||srcX||srcY||width!=img->width||height!=img->height) {
+    cairo_rectangle(r->cr, dstX, dstY, width, height);
+    cairo_clip(r->cr);
+  }
+  cairo_set_source_surface (r->cr, src, dstX - srcX, dstY - srcY);
   cairo_set_operator(r->cr, ms2cairo_compop(comp));
   cairo_paint_with_alpha(r->cr,opacity/100.0);
+  cairo_restore(r->cr);
   cairo_surface_finish(src);
   cairo_surface_destroy(src);
-  cairo_set_operator(r->cr,CAIRO_OPERATOR_OVER);
   return MS_SUCCESS;
 }
 
@@ -1118,6 +1190,8 @@ int msPopulateRendererVTableCairoRaster( rendererVTableObj *renderer )
   renderer->getRasterBufferHandle=&getRasterBufferHandleCairo;
   renderer->getRasterBufferCopy=&getRasterBufferCopyCairo;
   renderer->renderPolygon=&renderPolygonCairo;
+  renderer->renderLines=&renderLinesCairo;
+  renderer->renderPolygons=&renderPolygonsCairo;
   renderer->renderGlyphs=&renderGlyphs2Cairo;
   renderer->freeImage=&freeImageCairo;
   renderer->renderEllipseSymbol = &renderEllipseSymbolCairo;
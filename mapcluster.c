@@ -32,6 +32,7 @@
 /* $Id$ */
 #include <assert.h>
 #include "mapserver.h"
+#include "mapthread.h"
 
 
 
@@ -49,8 +50,13 @@
 #define MSCLUSTER_BASEFID    "Cluster_BaseFID"
 #define MSCLUSTER_BASEFIDINDEX   -102
 
+/* clustering algorithms, PROCESSING "CLUSTER_ALGORITHM=GRID|QUADTREE" */
+#define MSCLUSTER_ALGORITHM_GRID      0
+#define MSCLUSTER_ALGORITHM_QUADTREE  1
+
 typedef struct cluster_tree_node clusterTreeNode;
 typedef struct cluster_info clusterInfo;
+typedef struct cluster_info_block clusterInfoBlock;
 typedef struct cluster_layer_info msClusterLayerInfo;
 
 /* forward declarations */
@@ -64,6 +70,15 @@ typedef int (*clusterCompareRegionFunc)(clusterInfo* current, clusterInfo* other
 #define SPLITRATIO  0.55
 #define TREE_MAX_DEPTH  10
 
+/* grid constants */
+#define GRID_MAX_CELLS  (1024*1024)
+
+/* number of clusterInfo objects allocated at once */
+#define CLUSTER_BLOCK_SIZE  1024
+
+/* max number of cluster results kept by the cross request cache */
+#define CLUSTER_CACHE_MAX_ENTRIES  16
+
 /* cluster data */
 struct cluster_info {
   double x;    /* x position of the current point */
@@ -88,6 +103,16 @@ struct cluster_info {
   /* current group */
   char* group;
   int filter;
+  /* selection rank and position in the rank heap (grid algorithm) */
+  double rank;
+  int heappos;
+};
+
+/* block of clusterInfo objects, released all at once */
+struct cluster_info_block {
+  clusterInfoBlock* next;
+  int used;
+  clusterInfo items[CLUSTER_BLOCK_SIZE];
 };
 
 /* quadtree node */
@@ -135,6 +160,20 @@ struct cluster_layer_info {
   clusterCompareRegionFunc fnCompare;
   /* diagnostics */
   int depth;
+  /* clustering algorithm (MSCLUSTER_ALGORITHM_*) */
+  int algorithm;
+  /* grid index, each cell chains its shapes through clusterInfo->next */
+  clusterInfo** grid;
+  int gridnx;
+  int gridny;
+  rectObj gridrect;
+  double gridcellx;
+  double gridcelly;
+  /* tentative clusters ordered by rank (grid algorithm) */
+  clusterInfo** heap;
+  int numheap;
+  /* storage of the clusterInfo objects */
+  clusterInfoBlock* blocks;
 };
 
 
@@ -265,10 +304,35 @@ static void treeSplitBounds( rectObj *in, rectObj *out1, rectObj *out2)
   }
 }
 
+/* take a clusterInfo from the block storage */
+static clusterInfo *clusterInfoAlloc(clusterInfoBlock** blocks)
+{
+  clusterInfoBlock* block = *blocks;
+  if (!block || block->used == CLUSTER_BLOCK_SIZE) {
+    block = (clusterInfoBlock*)msSmallMalloc(sizeof(clusterInfoBlock));
+    block->used = 0;
+    block->next = *blocks;
+    *blocks = block;
+  }
+  return &block->items[block->used++];
+}
+
+/* release the block storage, the shapes must have been freed already */
+static void clusterInfoFreeBlocks(clusterInfoBlock** blocks)
+{
+  clusterInfoBlock* block = *blocks;
+  while (block) {
+    clusterInfoBlock* next = block->next;
+    msFree(block);
+    block = next;
+  }
+  *blocks = NULL;
+}
+
 /* alloc memory for a new tentative cluster */
 static clusterInfo *clusterInfoCreate(msClusterLayerInfo* layerinfo)
 {
-  clusterInfo* feature = (clusterInfo*)msSmallMalloc(sizeof(clusterInfo));
+  clusterInfo* feature = clusterInfoAlloc(&layerinfo->blocks);
   msInitShape(&feature->shape);
   feature->numsiblings = 0;
   feature->numcollected = 0;
@@ -279,10 +343,37 @@ static clusterInfo *clusterInfoCreate(msClusterLayerInfo* layerinfo)
   feature->siblings = NULL;
   feature->index = layerinfo->numFeatures;
   feature->filter = -1; /* not yet calculated */
+  feature->rank = 0;
+  feature->heappos = -1;
   ++layerinfo->numFeatures;
   return feature;
 }
 
+/* deep copy a cluster list (with the siblings) into the given block storage */
+static clusterInfo *clusterInfoCopyList(clusterInfoBlock** blocks, clusterInfo* feature, int* count)
+{
+  clusterInfo* head = NULL;
+  clusterInfo** tail = &head;
+
+  while (feature) {
+    clusterInfo* s = clusterInfoAlloc(blocks);
+    *s = *feature;
+    msInitShape(&s->shape);
+    msCopyShape(&feature->shape, &s->shape);
+    s->group = feature->group ? msStrdup(feature->group) : NULL;
+    s->node = NULL;
+    s->heappos = -1;
+    s->next = NULL;
+    s->siblings = clusterInfoCopyList(blocks, feature->siblings, count);
+    *tail = s;
+    tail = &s->next;
+    ++(*count);
+    feature = feature->next;
+  }
+
+  return head;
+}
+
 /* destroy memory of the cluster list */
 static void clusterInfoDestroyList(msClusterLayerInfo* layerinfo, clusterInfo* feature)
 {
@@ -296,8 +387,7 @@ static void clusterInfoDestroyList(msClusterLayerInfo* layerinfo, clusterInfo* f
     }
     msFreeShape(&s->shape);
     msFree(s->group);
-    msFree(s);
-    --layerinfo->numFeatures;
+    --layerinfo->numFeatures; /* the object itself goes with the blocks */
     s = next;
   }
 }
@@ -381,6 +471,78 @@ void clusterDestroyData(msClusterLayerInfo *layerinfo)
   }
 
   layerinfo->numNodes = 0;
+
+  if (layerinfo->grid) {
+    int i;
+    for (i = 0; i < layerinfo->gridnx * layerinfo->gridny; i++)
+      clusterInfoDestroyList(layerinfo, layerinfo->grid[i]);
+    msFree(layerinfo->grid);
+    layerinfo->grid = NULL;
+  }
+  layerinfo->gridnx = layerinfo->gridny = 0;
+
+  msFree(layerinfo->heap);
+  layerinfo->heap = NULL;
+  layerinfo->numheap = 0;
+
+  clusterInfoFreeBlocks(&layerinfo->blocks);
+}
+
+/* update the statistics of current and s when s falls into the region of current */
+static void clusterAddRelated(msClusterLayerInfo* layerinfo, clusterInfo* current, clusterInfo* s)
+{
+  if (!layerinfo->fnCompare(current, s))
+    return;
+
+  ++current->numsiblings;
+  /* calculating the average positions */
+  current->avgx = (current->avgx * current->numsiblings + s->x) / (current->numsiblings + 1);
+  current->avgy = (current->avgy * current->numsiblings + s->y) / (current->numsiblings + 1);
+  /* calculating the variance */
+  current->varx = current->varx * current->numsiblings / (current->numsiblings + 1) +
+                  (s->x - current->avgx) * (s->x - current->avgx) / (current->numsiblings + 1);
+  current->vary = current->vary * current->numsiblings / (current->numsiblings + 1) +
+                  (s->y - current->avgy) * (s->y - current->avgy) / (current->numsiblings + 1);
+
+  if (layerinfo->fnCompare(s, current)) {
+    /* this feature falls into the region of the other as well */
+    ++s->numsiblings;
+    /* calculating the average positions */
+    s->avgx = (s->avgx * s->numsiblings + current->x) / (s->numsiblings + 1);
+    s->avgy = (s->avgy * s->numsiblings + current->y) / (s->numsiblings + 1);
+    /* calculating the variance */
+    s->varx = s->varx * s->numsiblings / (s->numsiblings + 1) +
+              (current->x - s->avgx) * (current->x - s->avgx) / (s->numsiblings + 1);
+    s->vary = s->vary * s->numsiblings / (s->numsiblings + 1) +
+              (current->y - s->avgy) * (current->y - s->avgy) / (s->numsiblings + 1);
+  }
+}
+
+/* update the statistics of s when current (falling into its region) is removed,
+   returns MS_TRUE if s has been modified */
+static int clusterRemoveRelated(msClusterLayerInfo* layerinfo, clusterInfo* current, clusterInfo* s)
+{
+  if (!layerinfo->fnCompare(current, s) || s->numsiblings <= 0)
+    return MS_FALSE;
+
+  /* calculating the average positions */
+  s->avgx = (s->avgx * (s->numsiblings + 1) - current->x) / s->numsiblings;
+  s->avgy = (s->avgy * (s->numsiblings + 1) - current->y) / s->numsiblings;
+  /* calculating the variance */
+  s->varx = (s->varx - (current->x - s->avgx) * (current->x - s->avgx) / s->numsiblings) *
+            (s->numsiblings + 1) / s->numsiblings;
+  s->vary = (s->vary - (current->y - s->avgy) * (current->y - s->avgy) / s->numsiblings) *
+            (s->numsiblings + 1) / s->numsiblings;
+  --s->numsiblings;
+  ++s->numremoved;
+
+  return MS_TRUE;
+}
+
+/* the rank of a tentative cluster, the smallest is picked up first */
+static double clusterRank(clusterInfo* s)
+{
+  return (s->x - s->avgx) * (s->x - s->avgx) + (s->y - s->avgy) * (s->y - s->avgy) /*+ s->varx + s->vary*/ + (double)1/ (1 + s->numsiblings);
 }
 
 /* traverse the quadtree to find the neighbouring shapes and update some data
@@ -401,30 +563,7 @@ static void findRelatedShapes(msClusterLayerInfo* layerinfo,
   /* Modify the feature count of the related shapes */
   s = node->shapes;
   while (s) {
-    if (layerinfo->fnCompare(current, s)) {
-      ++current->numsiblings;
-      /* calculating the average positions */
-      current->avgx = (current->avgx * current->numsiblings + s->x) / (current->numsiblings + 1);
-      current->avgy = (current->avgy * current->numsiblings + s->y) / (current->numsiblings + 1);
-      /* calculating the variance */
-      current->varx = current->varx * current->numsiblings / (current->numsiblings + 1) +
-                      (s->x - current->avgx) * (s->x - current->avgx) / (current->numsiblings + 1);
-      current->vary = current->vary * current->numsiblings / (current->numsiblings + 1) +
-                      (s->y - current->avgy) * (s->y - current->avgy) / (current->numsiblings + 1);
-
-      if (layerinfo->fnCompare(s, current)) {
-        /* this feature falls into the region of the other as well */
-        ++s->numsiblings;
-        /* calculating the average positions */
-        s->avgx = (s->avgx * s->numsiblings + current->x) / (s->numsiblings + 1);
-        s->avgy = (s->avgy * s->numsiblings + current->y) / (s->numsiblings + 1);
-        /* calculating the variance */
-        s->varx = s->varx * s->numsiblings / (s->numsiblings + 1) +
-                  (current->x - s->avgx) * (current->x - s->avgx) / (s->numsiblings + 1);
-        s->vary = s->vary * s->numsiblings / (s->numsiblings + 1) +
-                  (current->y - s->avgy) * (current->y - s->avgy) / (s->numsiblings + 1);
-      }
-    }
+    clusterAddRelated(layerinfo, current, s);
     s = s->next;
   }
 
@@ -455,20 +594,7 @@ static void findRelatedShapesRemove(msClusterLayerInfo* layerinfo, clusterTreeNo
   /* Modify the feature count of the related shapes */
   s = node->shapes;
   while (s) {
-    if (layerinfo->fnCompare(current, s)) {
-      if (s->numsiblings > 0) {
-        /* calculating the average positions */
-        s->avgx = (s->avgx * (s->numsiblings + 1) - current->x) / s->numsiblings;
-        s->avgy = (s->avgy * (s->numsiblings + 1) - current->y) / s->numsiblings;
-        /* calculating the variance */
-        s->varx = (s->varx - (current->x - s->avgx) * (current->x - s->avgx) / s->numsiblings) *
-                  (s->numsiblings + 1) / s->numsiblings;
-        s->vary = (s->vary - (current->y - s->avgy) * (current->y - s->avgy) / s->numsiblings) *
-                  (s->numsiblings + 1) / s->numsiblings;
-        --s->numsiblings;
-        ++s->numremoved;
-      }
-    }
+    clusterRemoveRelated(layerinfo, current, s);
     s = s->next;
   }
 
@@ -615,7 +741,7 @@ static void findBestCluster(layerObj* layer, msClusterLayerInfo* layerinfo, clus
     }
 
     /* calculating the rank */
-    rank = (s->x - s->avgx) * (s->x - s->avgx) + (s->y - s->avgy) * (s->y - s->avgy) /*+ s->varx + s->vary*/ + (double)1/ (1 + s->numsiblings);
+    rank = clusterRank(s);
 
     if (rank < layerinfo->rank) {
       layerinfo->current = s;
@@ -700,18 +826,231 @@ static int treeNodeAddShape(msClusterLayerInfo* layerinfo, clusterTreeNode* node
   return MS_SUCCESS;
 }
 
-/* collecting the cluster shapes, returns true if this subnode must be removed */
-static int collectClusterShapes(msClusterLayerInfo* layerinfo, clusterTreeNode *node, clusterInfo* current)
+/* -------------------------------------------------------------------- */
+/*      Grid algorithm: the shapes are indexed in a regular grid with   */
+/*      cells as large as the cluster regions, and the tentative        */
+/*      clusters are kept in a heap ordered by their rank.              */
+/* -------------------------------------------------------------------- */
+
+/* individual or filtered shapes must be picked up first */
+static void clusterSetRank(clusterInfo* s)
 {
-  int i;
-  clusterInfo* prev = NULL;
-  clusterInfo* s = node->shapes;
+  if (s->numsiblings == 0 || s->filter == 0)
+    s->rank = -1;
+  else
+    s->rank = clusterRank(s);
+}
 
-  if(!msRectOverlap(&node->rect, &current->bounds))
-    return (!node->shapes && !node->subnode[0] && !node->subnode[1]
-            && !node->subnode[2] && !node->subnode[3]);
+/* the order in which the tentative clusters are picked up */
+static int clusterHeapLess(clusterInfo* a, clusterInfo* b)
+{
+  if (a->rank != b->rank)
+    return a->rank < b->rank;
+  return a->index < b->index;
+}
+
+static void clusterHeapSet(msClusterLayerInfo* layerinfo, int i, clusterInfo* s)
+{
+  layerinfo->heap[i] = s;
+  s->heappos = i;
+}
+
+static void clusterHeapUp(msClusterLayerInfo* layerinfo, int i)
+{
+  clusterInfo* s = layerinfo->heap[i];
+
+  while (i > 0) {
+    int parent = (i - 1) / 2;
+    if (!clusterHeapLess(s, layerinfo->heap[parent]))
+      break;
+    clusterHeapSet(layerinfo, i, layerinfo->heap[parent]);
+    i = parent;
+  }
+  clusterHeapSet(layerinfo, i, s);
+}
+
+static void clusterHeapDown(msClusterLayerInfo* layerinfo, int i)
+{
+  clusterInfo* s = layerinfo->heap[i];
+
+  for (;;) {
+    int child = 2 * i + 1;
+    if (child >= layerinfo->numheap)
+      break;
+    if (child + 1 < layerinfo->numheap &&
+        clusterHeapLess(layerinfo->heap[child + 1], layerinfo->heap[child]))
+      ++child;
+    if (!clusterHeapLess(layerinfo->heap[child], s))
+      break;
+    clusterHeapSet(layerinfo, i, layerinfo->heap[child]);
+    i = child;
+  }
+  clusterHeapSet(layerinfo, i, s);
+}
+
+/* remove a shape from the heap (if it is there) */
+static void clusterHeapRemove(msClusterLayerInfo* layerinfo, clusterInfo* s)
+{
+  int i = s->heappos;
+  clusterInfo* last;
+
+  if (i < 0)
+    return;
+
+  s->heappos = -1;
+  last = layerinfo->heap[--layerinfo->numheap];
+  if (last != s) {
+    clusterHeapSet(layerinfo, i, last);
+    clusterHeapUp(layerinfo, i);
+    clusterHeapDown(layerinfo, last->heappos);
+  }
+}
+
+/* recalculate the rank of a shape and restore the heap order */
+static void clusterHeapUpdate(msClusterLayerInfo* layerinfo, clusterInfo* s)
+{
+  clusterSetRank(s);
+
+  if (s->heappos >= 0) {
+    clusterHeapUp(layerinfo, s->heappos);
+    clusterHeapDown(layerinfo, s->heappos);
+  }
+}
+
+/* set up an empty grid covering rect */
+static void gridCreate(msClusterLayerInfo* layerinfo, rectObj rect, double cellx, double celly)
+{
+  double nx, ny;
+
+  if (cellx <= 0)
+    cellx = MS_MAX(rect.maxx - rect.minx, 1);
+  if (celly <= 0)
+    celly = MS_MAX(rect.maxy - rect.miny, 1);
+
+  /* use coarser cells rather than a huge grid */
+  for (;;) {
+    nx = MS_MAX(ceil((rect.maxx - rect.minx) / cellx), 1);
+    ny = MS_MAX(ceil((rect.maxy - rect.miny) / celly), 1);
+    if (nx * ny <= GRID_MAX_CELLS)
+      break;
+    cellx *= 2;
+    celly *= 2;
+  }
+
+  layerinfo->gridrect = rect;
+  layerinfo->gridcellx = cellx;
+  layerinfo->gridcelly = celly;
+  layerinfo->gridnx = (int)nx;
+  layerinfo->gridny = (int)ny;
+  layerinfo->grid = (clusterInfo**)msSmallCalloc(layerinfo->gridnx * layerinfo->gridny, sizeof(clusterInfo*));
+}
+
+static int gridClamp(double v, int n)
+{
+  if (!(v >= 0))
+    return 0;
+  if (v >= n)
+    return n - 1;
+  return (int)v;
+}
+
+/* range of the grid cells overlapping rect */
+static void gridCellRange(msClusterLayerInfo* layerinfo, rectObj* rect, int* minx, int* miny, int* maxx, int* maxy)
+{
+  *minx = gridClamp((rect->minx - layerinfo->gridrect.minx) / layerinfo->gridcellx, layerinfo->gridnx);
+  *maxx = gridClamp((rect->maxx - layerinfo->gridrect.minx) / layerinfo->gridcellx, layerinfo->gridnx);
+  *miny = gridClamp((rect->miny - layerinfo->gridrect.miny) / layerinfo->gridcelly, layerinfo->gridny);
+  *maxy = gridClamp((rect->maxy - layerinfo->gridrect.miny) / layerinfo->gridcelly, layerinfo->gridny);
+}
+
+/* add the shape to the cell of its position */
+static void gridAddShape(msClusterLayerInfo* layerinfo, clusterInfo* shape)
+{
+  int x = gridClamp((shape->x - layerinfo->gridrect.minx) / layerinfo->gridcellx, layerinfo->gridnx);
+  int y = gridClamp((shape->y - layerinfo->gridrect.miny) / layerinfo->gridcelly, layerinfo->gridny);
+  clusterInfo** cell = &layerinfo->grid[y * layerinfo->gridnx + x];
+
+  shape->next = *cell;
+  *cell = shape;
+}
+
+/* find the neighbouring shapes and update some data on the related shapes (when adding a new feature) */
+static void gridFindRelatedShapes(msClusterLayerInfo* layerinfo, clusterInfo* current)
+{
+  int x, y, minx, miny, maxx, maxy;
+  clusterInfo* s;
+
+  gridCellRange(layerinfo, &current->bounds, &minx, &miny, &maxx, &maxy);
+  for (y = miny; y <= maxy; y++)
+    for (x = minx; x <= maxx; x++)
+      for (s = layerinfo->grid[y * layerinfo->gridnx + x]; s; s = s->next)
+        clusterAddRelated(layerinfo, current, s);
+}
+
+/* find the neighbouring shapes and update some data on the related shapes (when removing a feature) */
+static void gridFindRelatedShapesRemove(msClusterLayerInfo* layerinfo, clusterInfo* current)
+{
+  int x, y, minx, miny, maxx, maxy;
+  clusterInfo* s;
+
+  gridCellRange(layerinfo, &current->bounds, &minx, &miny, &maxx, &maxy);
+  for (y = miny; y <= maxy; y++)
+    for (x = minx; x <= maxx; x++)
+      for (s = layerinfo->grid[y * layerinfo->gridnx + x]; s; s = s->next)
+        if (clusterRemoveRelated(layerinfo, current, s))
+          clusterHeapUpdate(layerinfo, s);
+}
+
+/* rank the tentative clusters once all the shapes are added */
+static void gridBuildHeap(msClusterLayerInfo* layerinfo)
+{
+  int i, n = 0;
+  clusterInfo* s;
+
+  for (i = 0; i < layerinfo->gridnx * layerinfo->gridny; i++)
+    for (s = layerinfo->grid[i]; s; s = s->next)
+      ++n;
+
+  layerinfo->heap = (clusterInfo**)msSmallMalloc(sizeof(clusterInfo*) * MS_MAX(n, 1));
+  layerinfo->numheap = 0;
+
+  for (i = 0; i < layerinfo->gridnx * layerinfo->gridny; i++) {
+    for (s = layerinfo->grid[i]; s; s = s->next) {
+      clusterSetRank(s);
+      clusterHeapSet(layerinfo, layerinfo->numheap++, s);
+    }
+  }
+
+  for (i = layerinfo->numheap / 2 - 1; i >= 0; i--)
+    clusterHeapDown(layerinfo, i);
+}
+
+/* get the best cluster from the top of the heap, the filter is evaluated
+   when a shape gets there with the actual feature count */
+static void gridFindBestCluster(layerObj* layer, msClusterLayerInfo* layerinfo)
+{
+  clusterInfo* s;
+
+  while (layerinfo->numheap > 0) {
+    s = layerinfo->heap[0];
+    if (s->filter < 0 && layer->cluster.filter.string != NULL) {
+      InitShapeAttributes(layer, s);
+      s->filter = msClusterEvaluateFilter(&layer->cluster.filter, &s->shape);
+      clusterHeapUpdate(layerinfo, s);
+      continue;
+    }
+    layerinfo->current = s;
+    layerinfo->rank = s->rank;
+    return;
+  }
+}
+
+/* move the shapes of a list belonging to the cluster to the finalization lists */
+static void collectListShapes(msClusterLayerInfo* layerinfo, clusterInfo** list, clusterInfo* current)
+{
+  clusterInfo* prev = NULL;
+  clusterInfo* s = *list;
 
-  /* removing the shapes from this node if overlap with the cluster */
   while (s) {
     if (s == current || layerinfo->fnCompare(current, s)) {
       if (s != current && current->filter == 0) {
@@ -723,12 +1062,15 @@ static int collectClusterShapes(msClusterLayerInfo* layerinfo, clusterTreeNode *
 
       /* removing from the list */
       if (!prev)
-        node->shapes = s->next;
+        *list = s->next;
       else
         prev->next = s->next;
 
       ++current->numcollected;
 
+      if (layerinfo->heap)
+        clusterHeapRemove(layerinfo, s);
+
       /* adding the shape to the finalization list */
       if (s == current) {
         if (s->filter) {
@@ -748,7 +1090,7 @@ static int collectClusterShapes(msClusterLayerInfo* layerinfo, clusterTreeNode *
       }
 
       if (!prev)
-        s = node->shapes;
+        s = *list;
       else
         s = prev->next;
     } else {
@@ -756,6 +1098,19 @@ static int collectClusterShapes(msClusterLayerInfo* layerinfo, clusterTreeNode *
       s = prev->next;
     }
   }
+}
+
+/* collecting the cluster shapes, returns true if this subnode must be removed */
+static int collectClusterShapes(msClusterLayerInfo* layerinfo, clusterTreeNode *node, clusterInfo* current)
+{
+  int i;
+
+  if(!msRectOverlap(&node->rect, &current->bounds))
+    return (!node->shapes && !node->subnode[0] && !node->subnode[1]
+            && !node->subnode[2] && !node->subnode[3]);
+
+  /* removing the shapes from this node if overlap with the cluster */
+  collectListShapes(layerinfo, &node->shapes, current);
 
   /* Recurse to subnodes if they exist */
   for (i = 0; i < 4; i++) {
@@ -773,6 +1128,26 @@ static int collectClusterShapes(msClusterLayerInfo* layerinfo, clusterTreeNode *
           && !node->subnode[2] && !node->subnode[3]);
 }
 
+/* collecting the cluster shapes from the grid */
+static void gridCollectClusterShapes(msClusterLayerInfo* layerinfo, clusterInfo* current)
+{
+  int x, y, minx, miny, maxx, maxy;
+
+  gridCellRange(layerinfo, &current->bounds, &minx, &miny, &maxx, &maxy);
+  for (y = miny; y <= maxy; y++)
+    for (x = minx; x <= maxx; x++)
+      collectListShapes(layerinfo, &layerinfo->grid[y * layerinfo->gridnx + x], current);
+}
+
+/* update the related shapes when a feature is removed */
+static void removeRelatedShapes(msClusterLayerInfo* layerinfo, clusterInfo* current)
+{
+  if (layerinfo->grid)
+    gridFindRelatedShapesRemove(layerinfo, current);
+  else
+    findRelatedShapesRemove(layerinfo, layerinfo->root, current);
+}
+
 int selectClusterShape(layerObj* layer, long shapeindex)
 {
   int i;
@@ -871,6 +1246,161 @@ static int ValidateTree(msClusterLayerInfo* layerinfo, clusterTreeNode *node)
 }
 #endif
 
+/* -------------------------------------------------------------------- */
+/*      Cluster results shared by the requests of a process, enabled    */
+/*      with PROCESSING "CLUSTER_CACHE_TIMEOUT=<seconds>".              */
+/* -------------------------------------------------------------------- */
+typedef struct cluster_cache_entry clusterCacheEntry;
+
+struct cluster_cache_entry {
+  char* key;
+  time_t expires;
+  clusterInfo* finalized;
+  int numFinalized;
+  clusterInfoBlock* blocks;
+  clusterCacheEntry* next;
+};
+
+static clusterCacheEntry* clusterCache = NULL;
+
+static void clusterCacheFreeList(clusterInfo* s)
+{
+  while (s) {
+    clusterCacheFreeList(s->siblings);
+    msFreeShape(&s->shape);
+    msFree(s->group);
+    s = s->next;
+  }
+}
+
+static void clusterCacheEntryFree(clusterCacheEntry* entry)
+{
+  clusterCacheFreeList(entry->finalized);
+  clusterInfoFreeBlocks(&entry->blocks);
+  msFree(entry->key);
+  msFree(entry);
+}
+
+static char* clusterCacheKeyAppend(char* key, const char* value)
+{
+  key = msStringConcatenate(key, value ? value : "");
+  return msStringConcatenate(key, "|");
+}
+
+/* everything the cluster results depend on: the source data and filter, the
+   requested items, the extent, the image size and the clustering parameters */
+static char* clusterCacheKey(layerObj* layer, msClusterLayerInfo* layerinfo, rectObj searchrect, int isQuery)
+{
+  char buffer[512];
+  char* key = NULL;
+  char* proj;
+  int i;
+  mapObj* map = layer->map;
+  layerObj* srcLayer = &layerinfo->srcLayer;
+
+  snprintf(buffer, sizeof(buffer), "%.15g %.15g %.15g %.15g %d %d %.15g %.15g %d %d %d %d %d %d %d",
+           searchrect.minx, searchrect.miny, searchrect.maxx, searchrect.maxy,
+           map->width, map->height, layer->cluster.maxdistance, layer->cluster.buffer,
+           layerinfo->algorithm, layerinfo->get_all_shapes, layerinfo->keep_locations,
+           layerinfo->use_map_units, isQuery, srcLayer->connectiontype, srcLayer->maxfeatures);
+  key = clusterCacheKeyAppend(key, buffer);
+  key = clusterCacheKeyAppend(key, map->mappath);
+  key = clusterCacheKeyAppend(key, map->shapepath);
+  key = clusterCacheKeyAppend(key, layer->name);
+  key = clusterCacheKeyAppend(key, srcLayer->data);
+  key = clusterCacheKeyAppend(key, srcLayer->connection);
+  key = clusterCacheKeyAppend(key, srcLayer->tileindex);
+  key = clusterCacheKeyAppend(key, srcLayer->filteritem);
+  key = clusterCacheKeyAppend(key, srcLayer->filter.string);
+  key = clusterCacheKeyAppend(key, layer->cluster.region);
+  key = clusterCacheKeyAppend(key, layer->cluster.group.string);
+  key = clusterCacheKeyAppend(key, layer->cluster.filter.string);
+
+  proj = msGetProjectionString(&map->projection);
+  key = clusterCacheKeyAppend(key, proj);
+  msFree(proj);
+  proj = msGetProjectionString(&layer->projection);
+  key = clusterCacheKeyAppend(key, proj);
+  msFree(proj);
+
+  for (i = 0; i < layer->numitems; i++)
+    key = clusterCacheKeyAppend(key, layer->items[i]);
+
+  return key;
+}
+
+/* copy the cached clusters to the layer, returns MS_TRUE if found */
+static int clusterCacheGet(msClusterLayerInfo* layerinfo, const char* key)
+{
+  clusterCacheEntry** link;
+  clusterCacheEntry* entry;
+  time_t now = time(NULL);
+  int found = MS_FALSE;
+
+  msAcquireLock(TLOCK_CLUSTER);
+  link = &clusterCache;
+  while ((entry = *link) != NULL) {
+    if (entry->expires <= now) {
+      *link = entry->next;
+      clusterCacheEntryFree(entry);
+      continue;
+    }
+    if (!found && strcmp(entry->key, key) == 0) {
+      int count = 0;
+      layerinfo->finalized = clusterInfoCopyList(&layerinfo->blocks, entry->finalized, &count);
+      layerinfo->numFinalized = entry->numFinalized;
+      layerinfo->numFeatures += count;
+      found = MS_TRUE;
+    }
+    link = &entry->next;
+  }
+  msReleaseLock(TLOCK_CLUSTER);
+
+  return found;
+}
+
+/* keep a copy of the clusters of the layer, takes the ownership of key */
+static void clusterCachePut(msClusterLayerInfo* layerinfo, char* key, int timeout)
+{
+  clusterCacheEntry** link;
+  clusterCacheEntry* entry;
+  int count = 0, n = 0;
+
+  entry = (clusterCacheEntry*)msSmallCalloc(1, sizeof(clusterCacheEntry));
+  entry->key = key;
+  entry->expires = time(NULL) + timeout;
+  entry->finalized = clusterInfoCopyList(&entry->blocks, layerinfo->finalized, &count);
+  entry->numFinalized = layerinfo->numFinalized;
+
+  msAcquireLock(TLOCK_CLUSTER);
+  /* replace the same results, drop the oldest ones beyond the limit */
+  link = &clusterCache;
+  while (*link) {
+    clusterCacheEntry* e = *link;
+    if (strcmp(e->key, key) == 0 || ++n >= CLUSTER_CACHE_MAX_ENTRIES) {
+      *link = e->next;
+      clusterCacheEntryFree(e);
+      continue;
+    }
+    link = &e->next;
+  }
+  entry->next = clusterCache;
+  clusterCache = entry;
+  msReleaseLock(TLOCK_CLUSTER);
+}
+
+/* release the cluster results cache, called from msCleanup() */
+void msClusterCleanup(void)
+{
+  msAcquireLock(TLOCK_CLUSTER);
+  while (clusterCache) {
+    clusterCacheEntry* next = clusterCache->next;
+    clusterCacheEntryFree(clusterCache);
+    clusterCache = next;
+  }
+  msReleaseLock(TLOCK_CLUSTER);
+}
+
 /* rebuild the clusters according to the current extent */
 int RebuildClusters(layerObj *layer, int isQuery)
 {
@@ -881,6 +1411,8 @@ int RebuildClusters(layerObj *layer, int isQuery)
   int status;
   clusterInfo* current;
   int depth;
+  int cachetimeout;
+  const char* pszProcessing;
 #ifdef USE_CLUSTER_EXTERNAL
   int layerIndex;
 #endif
@@ -923,6 +1455,18 @@ int RebuildClusters(layerObj *layer, int isQuery)
   else
     layerinfo->use_map_units = MS_FALSE;
 
+  /* the grid algorithm may pick other clusters among equally ranked ones */
+  /* and evaluates the FILTER in another order, so it has to be asked for */
+  pszProcessing = msLayerGetProcessingKey(layer, "CLUSTER_ALGORITHM");
+  if (pszProcessing && EQUAL(pszProcessing, "GRID"))
+    layerinfo->algorithm = MSCLUSTER_ALGORITHM_GRID;
+  else
+    layerinfo->algorithm = MSCLUSTER_ALGORITHM_QUADTREE;
+
+  /* reuse the results of the previous requests */
+  pszProcessing = msLayerGetProcessingKey(layer, "CLUSTER_CACHE_TIMEOUT");
+  cachetimeout = pszProcessing ? atoi(pszProcessing) : 0;
+
   /* identify the current extent */
   if(layer->transform == MS_TRUE)
     searchrect = map->extent;
@@ -945,6 +1489,19 @@ int RebuildClusters(layerObj *layer, int isQuery)
 
   layerinfo->searchRect = searchrect;
 
+  if (cachetimeout > 0) {
+    char* key = clusterCacheKey(layer, layerinfo, searchrect, isQuery);
+    int found = clusterCacheGet(layerinfo, key);
+    msFree(key);
+    if (found) {
+      MS_TRACE_COUNT(MS_TRACE_CACHEHITS, 1);
+      if (layer->debug >= MS_DEBUGLEVEL_VVV)
+        msDebug("Clustering skipped, %d clusters found in the cache.\n", layerinfo->numFinalized);
+      layerinfo->current = layerinfo->finalized;
+      return MS_SUCCESS;
+    }
+  }
+
   /* reproject the rectangle to layer coordinates */
 #ifdef USE_PROJ
   if((map->projection.numargs > 0) && (layer->projection.numargs > 0))
@@ -989,10 +1546,20 @@ int RebuildClusters(layerObj *layer, int isQuery)
   searchrect.miny -= layer->cluster.buffer * cellSizeY;
   searchrect.maxy += layer->cluster.buffer * cellSizeY;
 
-  /* create the root node */
-  if (layerinfo->root)
-    clusterTreeNodeDestroy(layerinfo, layerinfo->root);
-  layerinfo->root = clusterTreeNodeCreate(layerinfo, searchrect);
+  if (layerinfo->algorithm == MSCLUSTER_ALGORITHM_GRID) {
+    /* the grid also holds the shapes just outside of the search rectangle */
+    rectObj gridrect = searchrect;
+    gridrect.minx -= maxDistanceX;
+    gridrect.miny -= maxDistanceY;
+    gridrect.maxx += maxDistanceX;
+    gridrect.maxy += maxDistanceY;
+    gridCreate(layerinfo, gridrect, 2 * maxDistanceX, 2 * maxDistanceY);
+  } else {
+    /* create the root node */
+    if (layerinfo->root)
+      clusterTreeNodeDestroy(layerinfo, layerinfo->root);
+    layerinfo->root = clusterTreeNodeCreate(layerinfo, searchrect);
+  }
 
   srcLayer = &layerinfo->srcLayer;
 
@@ -1042,13 +1609,21 @@ int RebuildClusters(layerObj *layer, int isQuery)
     if (layer->cluster.group.string)
       current->group = msClusterGetGroupText(&layer->cluster.group, &current->shape);
 
-    /*start a query for the related shapes */
-    findRelatedShapes(layerinfo, layerinfo->root, current);
+    if (layerinfo->grid) {
+      /*start a query for the related shapes */
+      gridFindRelatedShapes(layerinfo, current);
 
-    /* add this shape to the tree */
-    if (treeNodeAddShape(layerinfo, layerinfo->root, current, depth) != MS_SUCCESS) {
-      clusterInfoDestroyList(layerinfo, current);
-      return MS_FAILURE;
+      /* add this shape to the grid */
+      gridAddShape(layerinfo, current);
+    } else {
+      /*start a query for the related shapes */
+      findRelatedShapes(layerinfo, layerinfo->root, current);
+
+      /* add this shape to the tree */
+      if (treeNodeAddShape(layerinfo, layerinfo->root, current, depth) != MS_SUCCESS) {
+        clusterInfoDestroyList(layerinfo, current);
+        return MS_FAILURE;
+      }
     }
 
     if ((current = clusterInfoCreate(layerinfo)) == NULL) {
@@ -1059,7 +1634,10 @@ int RebuildClusters(layerObj *layer, int isQuery)
 
   clusterInfoDestroyList(layerinfo, current);
 
-  while (layerinfo->root) {
+  if (layerinfo->grid)
+    gridBuildHeap(layerinfo);
+
+  for (;;) {
 #ifdef TESTCOUNT
     int n;
     double avgx, avgy;
@@ -1071,7 +1649,10 @@ int RebuildClusters(layerObj *layer, int isQuery)
                       (searchrect.maxy - searchrect.miny) * (searchrect.maxy - searchrect.miny) + 1;
 
     layerinfo->current = NULL;
-    findBestCluster(layer, layerinfo, layerinfo->root);
+    if (layerinfo->grid)
+      gridFindBestCluster(layer, layerinfo);
+    else
+      findBestCluster(layer, layerinfo, layerinfo->root);
 
     if (layerinfo->current == NULL) {
       if (layer->debug >= MS_DEBUGLEVEL_VVV)
@@ -1083,7 +1664,10 @@ int RebuildClusters(layerObj *layer, int isQuery)
     InitShapeAttributes(layer, layerinfo->current);
 
     /* collecting the shapes of the cluster */
-    collectClusterShapes(layerinfo, layerinfo->root, layerinfo->current);
+    if (layerinfo->grid)
+      gridCollectClusterShapes(layerinfo, layerinfo->current);
+    else
+      collectClusterShapes(layerinfo, layerinfo->root, layerinfo->current);
 
     if (layer->debug >= MS_DEBUGLEVEL_VVV) {
       msDebug("processing cluster %p: rank=%lf fcount=%d ncoll=%d nfin=%d nfins=%d nflt=%d bounds={%lf %lf %lf %lf}\n", layerinfo->current, layerinfo->rank, layerinfo->current->numsiblings + 1,
@@ -1117,7 +1701,7 @@ int RebuildClusters(layerObj *layer, int isQuery)
 
     if (layerinfo->current->numsiblings > 0) {
       /* update the parameters due to the shape removal */
-      findRelatedShapesRemove(layerinfo, layerinfo->root, layerinfo->current);
+      removeRelatedShapes(layerinfo, layerinfo->current);
 
       if (layerinfo->current->filter == 0) {
         /* filtered shapes has no siblings */
@@ -1131,7 +1715,7 @@ int RebuildClusters(layerObj *layer, int isQuery)
         current = layerinfo->finalizedSiblings;
         while(current) {
           /* update the parameters due to the shape removal */
-          findRelatedShapesRemove(layerinfo, layerinfo->root, current);
+          removeRelatedShapes(layerinfo, current);
           UpdateShapeAttributes(layer, layerinfo->current, current);
 #ifdef TESTCOUNT
           avgx += current->x;
@@ -1176,6 +1760,9 @@ int RebuildClusters(layerObj *layer, int isQuery)
 #endif
   }
 
+  if (cachetimeout > 0)
+    clusterCachePut(layerinfo, clusterCacheKey(layer, layerinfo, layerinfo->searchRect, isQuery), cachetimeout);
+
   /* set the pointer to the first shape */
   layerinfo->current = layerinfo->finalized;
 
@@ -1424,6 +2011,14 @@ msClusterLayerInfo* msClusterInitialize(layerObj *layer)
   layerinfo->finalizedNodes = NULL;
   layerinfo->numFinalizedNodes = 0;
 
+  layerinfo->algorithm = MSCLUSTER_ALGORITHM_QUADTREE;
+  layerinfo->grid = NULL;
+  layerinfo->gridnx = 0;
+  layerinfo->gridny = 0;
+  layerinfo->heap = NULL;
+  layerinfo->numheap = 0;
+  layerinfo->blocks = NULL;
+
   return layerinfo;
 }
 
@@ -1577,6 +2172,8 @@ void msClusterLayerCopyVirtualTable(layerVTableObj* vtable)
   vtable->LayerEnablePaging = msClusterLayerEnablePaging;
   vtable->LayerGetPaging = msClusterLayerGetPaging;
   vtable->LayerGetAutoProjection = msClusterLayerGetAutoProjection;
+  /* cluster shapes are not owned by the source driver */
+  vtable->LayerRecycleShape = LayerDefaultRecycleShape;
 }
 
 #ifdef USE_CLUSTER_PLUGIN
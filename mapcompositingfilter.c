@@ -27,88 +27,45 @@
  *****************************************************************************/
 #include "mapserver.h"
 #include <regex.h>
-#define pixmove(rb,srcx,srcy,dstx,dsty) \
-  memcpy(rb->data.rgba.pixels+dsty*rb->data.rgba.row_step+dstx*4,\
-          rb->data.rgba.pixels+srcy*rb->data.rgba.row_step+srcx*4,\
-          4)
-#define pixerase(rb,x,y) memset(rb->data.rgba.pixels+y*rb->data.rgba.row_step+x*4,0,4)
+
+/*
+** The per pixel filters have SSE2 versions working on four pixels at a time.
+** SSE2 is part of the x86-64 baseline so no runtime check is needed, other
+** platforms use the plain loops.
+*/
+#if defined(__x86_64__) || defined(_M_X64)
+#define MS_COMPOSITING_SSE2
+#include <emmintrin.h>
+
+/* bit offset of alpha in a little endian 32 bit pixel, -1 if the buffer
+ * doesn't have 4 byte pixels with an alpha channel */
+static int msCompositingAlphaShift(rasterBufferObj *rb) {
+  if(rb->data.rgba.pixel_step != 4 || !rb->data.rgba.a)
+    return -1;
+  return (int)(rb->data.rgba.a - rb->data.rgba.pixels) * 8;
+}
+#endif
 
 void msApplyTranslationCompositingFilter(rasterBufferObj *rb, int xtrans, int ytrans) {
-  int src_sx,src_sy,dst_sx,dst_sy,x,y,dst_x,dst_y;
-  if(abs(xtrans)>=rb->width || abs(ytrans)>=rb->height) {
-    for(y = 0; y<rb->height; y++)
-      for(x = 0; x<rb->width; x++)
-        pixerase(rb,x,y);
-  }
+  int y, len, row_step = rb->data.rgba.row_step;
+  unsigned char *pixels = rb->data.rgba.pixels;
   if(xtrans == 0 && ytrans == 0)
     return;
-  if(xtrans>=0) {
-    if(ytrans>=0) {
-      src_sx = rb->width - xtrans - 1;
-      src_sy = rb->height - ytrans - 1;
-      dst_sx = rb->width - 1;
-      dst_sy = rb->height -1;
-      for(y = src_sy,dst_y= dst_sy;y>=0;y--,dst_y--) {
-        for(x = src_sx,dst_x= dst_sx;x>=0;x--,dst_x--) {
-          pixmove(rb,x,y,dst_x,dst_y);
-        }
-      }
-      for(y=0;y<ytrans;y++)
-        for(x=0;x<rb->width;x++)
-          pixerase(rb,x,y);  
-      for(y=ytrans;y<rb->height;y++)
-        for(x=0;x<xtrans;x++)
-          pixerase(rb,x,y);
-    } else {
-      src_sx = rb->width - xtrans - 1;
-      src_sy = - ytrans;
-      dst_sx = rb->width - 1;
-      dst_sy = 0;
-      for(y = src_sy,dst_y= dst_sy;y<rb->height;y++,dst_y++) {
-        for(x = src_sx,dst_x= dst_sx;x>=0;x--,dst_x--) {
-          pixmove(rb,x,y,dst_x,dst_y);
-        }
-      }
-      for(y=0;y<rb->height+ytrans;y++)
-        for(x=0;x<xtrans;x++)
-          pixerase(rb,x,y);  
-      for(y=rb->height+ytrans;y<rb->height;y++)
-        for(x=0;x<rb->width;x++)
-          pixerase(rb,x,y);
-    }
-  } else {
-    if(ytrans>=0) {
-      src_sx = - xtrans;
-      src_sy = rb->height - ytrans - 1;
-      dst_sx = 0;
-      dst_sy = rb->height -1;
-      for(y = src_sy,dst_y= dst_sy;y>=0;y--,dst_y--) {
-        for(x = src_sx,dst_x= dst_sx;x<rb->width;x++,dst_x++) {
-          pixmove(rb,x,y,dst_x,dst_y);
-        }
-      }
-      for(y=0;y<ytrans;y++)
-        for(x=0;x<rb->width;x++)
-          pixerase(rb,x,y);
-      for(y=ytrans;y<rb->height;y++)
-        for(x=rb->width+xtrans;x<rb->width;x++)
-          pixerase(rb,x,y);
+  /* whole rows are moved, walking away from the direction of the move so
+   * that source rows are read before being overwritten */
+  len = rb->width - abs(xtrans);
+  for(y = 0; y < rb->height; y++) {
+    int dst_y = (ytrans > 0) ? rb->height - 1 - y : y;
+    int src_y = dst_y - ytrans;
+    unsigned char *dst = pixels + dst_y*row_step;
+    if(len <= 0 || src_y < 0 || src_y >= rb->height) {
+      memset(dst, 0, rb->width*4);
+    } else if(xtrans >= 0) {
+      memmove(dst + xtrans*4, pixels + src_y*row_step, len*4);
+      memset(dst, 0, xtrans*4);
     } else {
-      src_sx = - xtrans;
-      src_sy = - ytrans;
-      dst_sx = 0;
-      dst_sy = 0;
-      for(y = src_sy,dst_y= dst_sy;y<rb->height;y++,dst_y++) {
-        for(x = src_sx,dst_x= dst_sx;x<rb->width;x++,dst_x++) {
-          pixmove(rb,x,y,dst_x,dst_y);
-        }
-      }
-      for(y=0;y<rb->height+ytrans;y++)
-        for(x=rb->width+xtrans;x<rb->width;x++)
-          pixerase(rb,x,y);
-      for(y=rb->height+ytrans;y<rb->height;y++)
-        for(x=0;x<rb->width;x++)
-          pixerase(rb,x,y);
+      memmove(dst, pixels + src_y*row_step - xtrans*4, len*4);
+      memset(dst + len*4, 0, -xtrans*4);
     }
   }
 }
@@ -116,11 +73,24 @@ void msApplyTranslationCompositingFilter(rasterBufferObj *rb, int xtrans, int yt
 void msApplyBlackeningCompositingFilter(rasterBufferObj *rb) {
   int row,col;
   unsigned char *r,*g,*b;
+#ifdef MS_COMPOSITING_SSE2
+  int ashift = msCompositingAlphaShift(rb);
+  __m128i amask = _mm_set1_epi32(ashift >= 0 ? (int)(0xFFu << ashift) : 0);
+#endif
   for(row=0;row<rb->height;row++) {
     r = rb->data.rgba.r + row*rb->data.rgba.row_step;
     g = rb->data.rgba.g + row*rb->data.rgba.row_step;
     b = rb->data.rgba.b + row*rb->data.rgba.row_step;
-    for(col=0;col<rb->width;col++) {
+    col = 0;
+#ifdef MS_COMPOSITING_SSE2
+    if(ashift >= 0) {
+      __m128i *p = (__m128i*)(rb->data.rgba.pixels + row*rb->data.rgba.row_step);
+      for(;col+4<=rb->width;col+=4,p++)
+        _mm_storeu_si128(p, _mm_and_si128(_mm_loadu_si128(p), amask));
+      r+=col*4;g+=col*4;b+=col*4;
+    }
+#endif
+    for(;col<rb->width;col++) {
       *r = *g = *b = 0;
       r+=4;g+=4;b+=4;
     }    
@@ -130,12 +100,28 @@ void msApplyBlackeningCompositingFilter(rasterBufferObj *rb) {
 void msApplyWhiteningCompositingFilter(rasterBufferObj *rb) {
   int row,col;
   unsigned char *r,*g,*b,*a;
+#ifdef MS_COMPOSITING_SSE2
+  int ashift = msCompositingAlphaShift(rb);
+  __m128i count = _mm_cvtsi32_si128(ashift), low = _mm_set1_epi32(0xFF);
+#endif
   for(row=0;row<rb->height;row++) {
     r = rb->data.rgba.r + row*rb->data.rgba.row_step;
     g = rb->data.rgba.g + row*rb->data.rgba.row_step;
     b = rb->data.rgba.b + row*rb->data.rgba.row_step;
     a = rb->data.rgba.a + row*rb->data.rgba.row_step;
-    for(col=0;col<rb->width;col++) {
+    col = 0;
+#ifdef MS_COMPOSITING_SSE2
+    if(ashift >= 0) {
+      __m128i *p = (__m128i*)(rb->data.rgba.pixels + row*rb->data.rgba.row_step);
+      for(;col+4<=rb->width;col+=4,p++) {
+        __m128i v = _mm_and_si128(_mm_srl_epi32(_mm_loadu_si128(p), count), low);
+        v = _mm_or_si128(v, _mm_slli_epi32(v, 8));
+        _mm_storeu_si128(p, _mm_or_si128(v, _mm_slli_epi32(v, 16)));
+      }
+      r+=col*4;g+=col*4;b+=col*4;a+=col*4;
+    }
+#endif
+    for(;col<rb->width;col++) {
       *r = *g = *b = *a;
       r+=4;g+=4;b+=4;a+=4;
     }    
@@ -145,11 +131,36 @@ void msApplyWhiteningCompositingFilter(rasterBufferObj *rb) {
 void msApplyGrayscaleCompositingFilter(rasterBufferObj *rb) {
   int row,col;
   unsigned char *r,*g,*b;
+#ifdef MS_COMPOSITING_SSE2
+  int ashift = msCompositingAlphaShift(rb);
+  __m128i count = _mm_cvtsi32_si128(ashift), low = _mm_set1_epi32(0xFF);
+  __m128i amask = _mm_set1_epi32(ashift >= 0 ? (int)(0xFFu << ashift) : 0);
+  __m128i bytes = _mm_set1_epi32(0x00FF00FF), words = _mm_set1_epi32(0xFFFF);
+  __m128i third = _mm_set1_epi32(43691); /* x/3 == (x*43691)>>17 for x < 2^16 */
+#endif
   for(row=0;row<rb->height;row++) {
     r = rb->data.rgba.r + row*rb->data.rgba.row_step;
     g = rb->data.rgba.g + row*rb->data.rgba.row_step;
     b = rb->data.rgba.b + row*rb->data.rgba.row_step;
-    for(col=0;col<rb->width;col++) {
+    col = 0;
+#ifdef MS_COMPOSITING_SSE2
+    if(ashift >= 0) {
+      __m128i *p = (__m128i*)(rb->data.rgba.pixels + row*rb->data.rgba.row_step);
+      for(;col+4<=rb->width;col+=4,p++) {
+        __m128i v = _mm_loadu_si128(p), sum, mix;
+        /* r+g+b is the sum of the four bytes minus alpha */
+        sum = _mm_add_epi32(_mm_and_si128(v, bytes), _mm_and_si128(_mm_srli_epi32(v, 8), bytes));
+        sum = _mm_add_epi32(_mm_and_si128(sum, words), _mm_srli_epi32(sum, 16));
+        sum = _mm_sub_epi32(sum, _mm_and_si128(_mm_srl_epi32(v, count), low));
+        mix = _mm_srli_epi32(_mm_mulhi_epu16(sum, third), 1);
+        mix = _mm_or_si128(mix, _mm_slli_epi32(mix, 8));
+        mix = _mm_or_si128(mix, _mm_slli_epi32(mix, 16));
+        _mm_storeu_si128(p, _mm_or_si128(_mm_andnot_si128(amask, mix), _mm_and_si128(amask, v)));
+      }
+      r+=col*4;g+=col*4;b+=col*4;
+    }
+#endif
+    for(;col<rb->width;col++) {
       unsigned int mix = (unsigned int)*r + (unsigned int)*g + (unsigned int)*b;
       mix /=3;
       *r = *g = *b = (unsigned char)mix;
@@ -158,10 +169,36 @@ void msApplyGrayscaleCompositingFilter(rasterBufferObj *rb) {
   }
 }
 
-int msApplyCompositingFilter(mapObj *map, rasterBufferObj *rb, CompositingFilter *filter) {
+/*
+** Restrict a filter to the part of rb it can affect. region is grown by the
+** given number of pixels on each side and clamped to the buffer, and view is
+** set up to cover it. Returns NULL if there is nothing to filter.
+*/
+static rasterBufferObj* msCompositingFilterWindow(rasterBufferObj *rb, rectObj *region, rasterBufferObj *view,
+    int left, int top, int right, int bottom) {
+  if(!region)
+    return rb;
+  if(region->maxx <= region->minx || region->maxy <= region->miny)
+    return NULL;
+  region->minx = MS_MAX(region->minx - left, 0);
+  region->miny = MS_MAX(region->miny - top, 0);
+  region->maxx = MS_MIN(region->maxx + right, rb->width);
+  region->maxy = MS_MIN(region->maxy + bottom, rb->height);
+  msRasterBufferWindow(rb, view, (int)region->minx, (int)region->miny,
+                       (int)(region->maxx - region->minx), (int)(region->maxy - region->miny));
+  return view;
+}
+
+/*
+** region holds the pixel bounds (max exclusive) of the drawn part of rb, the
+** rest being fully transparent, or NULL to work on the whole buffer. It is
+** updated to include the pixels the filter spread or moved the content to.
+*/
+int msApplyCompositingFilter(mapObj *map, rasterBufferObj *rb, CompositingFilter *filter, rectObj *region) {
   int rstatus;
   regex_t regex;
   regmatch_t pmatch[3];
+  rasterBufferObj view, *target;
   
   /* test for blurring filter */
   regcomp(&regex, "blur\\(([0-9]+)\\)", REG_EXTENDED);
@@ -176,7 +213,9 @@ int msApplyCompositingFilter(mapObj *map, rasterBufferObj *rb, CompositingFilter
     irad = atoi(rad);
     free(rad);
     irad = MS_NINT(irad*map->resolution/map->defresolution);
-    msApplyBlurringCompositingFilter(rb,irad);
+    target = msCompositingFilterWindow(rb,region,&view,irad+1,irad+1,irad+1,irad+1);
+    if(target)
+      msApplyBlurringCompositingFilter(target,irad);
     return MS_SUCCESS;
   }
   
@@ -200,21 +239,39 @@ int msApplyCompositingFilter(mapObj *map, rasterBufferObj *rb, CompositingFilter
     //msDebug("got translation filter of radius %d,%d\n",xtrans,ytrans);
     xtrans = MS_NINT(xtrans*map->resolution/map->defresolution);
     ytrans = MS_NINT(ytrans*map->resolution/map->defresolution);
-    msApplyTranslationCompositingFilter(rb,xtrans,ytrans);
+    if(region && (region->maxx + xtrans <= 0 || region->minx + xtrans >= rb->width ||
+                  region->maxy + ytrans <= 0 || region->miny + ytrans >= rb->height)) {
+      /* everything is moved off the image */
+      int y;
+      target = msCompositingFilterWindow(rb,region,&view,0,0,0,0);
+      for(y=0; target && y<target->height; y++)
+        memset(target->data.rgba.pixels+y*target->data.rgba.row_step,0,target->width*4);
+      region->minx = region->miny = region->maxx = region->maxy = 0;
+      return MS_SUCCESS;
+    }
+    target = msCompositingFilterWindow(rb,region,&view,MS_MAX(-xtrans,0),MS_MAX(-ytrans,0),MS_MAX(xtrans,0),MS_MAX(ytrans,0));
+    if(target)
+      msApplyTranslationCompositingFilter(target,xtrans,ytrans);
     return MS_SUCCESS;
   }
   
   /* test for grayscale filter */
   if(!strncmp(filter->filter,"grayscale()",strlen("grayscale()"))) {
-    msApplyGrayscaleCompositingFilter(rb);
+    target = msCompositingFilterWindow(rb,region,&view,0,0,0,0);
+    if(target)
+      msApplyGrayscaleCompositingFilter(target);
     return MS_SUCCESS;
   }
   if(!strncmp(filter->filter,"blacken()",strlen("blacken()"))) {
-    msApplyBlackeningCompositingFilter(rb);
+    target = msCompositingFilterWindow(rb,region,&view,0,0,0,0);
+    if(target)
+      msApplyBlackeningCompositingFilter(target);
     return MS_SUCCESS;
   }
   if(!strncmp(filter->filter,"whiten()",strlen("whiten()"))) {
-    msApplyWhiteningCompositingFilter(rb);
+    target = msCompositingFilterWindow(rb,region,&view,0,0,0,0);
+    if(target)
+      msApplyWhiteningCompositingFilter(target);
     return MS_SUCCESS;
   }
   
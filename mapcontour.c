@@ -40,7 +40,9 @@
 
 #include "mapthread.h"
 #include "mapraster.h"
+#include "maptime.h"
 #include "cpl_string.h"
+#include "cpl_multiproc.h"
 
 #define GEO_TRANS(tr,x,y)  ((tr)[0]+(tr)[1]*(x)+(tr)[2]*(y))
 
@@ -59,6 +61,17 @@ typedef struct {
   OGRDataSourceH hOGRDS;
   double cellsize;
 
+  /* tiled generation, see msContourLayerGenerateTiles() */
+  char *path; /* dataset, names the cached tiles */
+  int band;
+  int tiled; /* set by msContourLayerReadRaster() instead of reading */
+  int cachetimeout;
+  int numthreads;
+  int step_x, step_y; /* sampling step in raster pixels */
+  int grid_xsize, grid_ysize; /* size of the raster in samples */
+  int win_x0, win_y0, win_x1, win_y1; /* requested window in samples */
+  double gt[6]; /* raster geotransform */
+
 } contourLayerInfo;
 
 
@@ -122,11 +135,22 @@ static void msContourLayerInfoFree(layerObj *layer)
     return;
 
   freeLayer(&clinfo->ogrLayer);
+  msFree(clinfo->path);
   free(clinfo);
 
   layer->layerinfo = NULL;
 }
 
+static void msContourLayerSetCellsize(layerObj *layer, double cellsize)
+{
+  contourLayerInfo *clinfo = (contourLayerInfo *) layer->layerinfo;
+  char buf[64];
+
+  clinfo->cellsize = cellsize;
+  sprintf(buf, "%lf", clinfo->cellsize);
+  msInsertHashTable(&layer->metadata, "__data_cellsize__", buf);
+}
+
 static int msContourLayerReadRaster(layerObj *layer, rectObj rect)
 {
   mapObj *map = layer->map;  
@@ -154,6 +178,8 @@ static int msContourLayerReadRaster(layerObj *layer, rectObj rect)
     return MS_FAILURE;    
   }
 
+  clinfo->tiled = MS_FALSE;
+
   bands = CSLTokenizeStringComplex(
                CSLFetchNameValue(layer->processing,"BANDS"), " ,", FALSE, FALSE );
   if (CSLCount(bands) > 0) {
@@ -177,6 +203,7 @@ static int msContourLayerReadRaster(layerObj *layer, rectObj rect)
                "msContourLayerReadRaster()", band);
     return MS_FAILURE;
   }
+  clinfo->band = band;
 
   if (layer->projection.numargs > 0 &&
       EQUAL(layer->projection.args[0], "auto")) {
@@ -383,6 +410,25 @@ static int msContourLayerReadRaster(layerObj *layer, rectObj rect)
       msDebug( "msContourLayerReadRaster(): src=%d,%d,%d,%d, dst=%d,%d,%d,%d\n",
                src_xoff, src_yoff, src_xsize, src_ysize,
                0, 0, dst_xsize, dst_ysize );
+
+    /* the contours are generated by msContourLayerGenerateTiles() */
+    if (clinfo->cachetimeout > 0 || clinfo->numthreads > 1) {
+      clinfo->tiled = MS_TRUE;
+      clinfo->step_x = virtual_grid_step_x;
+      clinfo->step_y = virtual_grid_step_y;
+      /* a trailing partial step is kept as a sample of its own */
+      clinfo->grid_xsize = (GDALGetRasterXSize(clinfo->hOrigDS) + virtual_grid_step_x - 1) / virtual_grid_step_x;
+      clinfo->grid_ysize = (GDALGetRasterYSize(clinfo->hOrigDS) + virtual_grid_step_y - 1) / virtual_grid_step_y;
+      clinfo->win_x0 = src_xoff / virtual_grid_step_x;
+      clinfo->win_y0 = src_yoff / virtual_grid_step_y;
+      clinfo->win_x1 = MS_MIN(clinfo->win_x0 + dst_xsize, clinfo->grid_xsize);
+      clinfo->win_y1 = MS_MIN(clinfo->win_y0 + dst_ysize, clinfo->grid_ysize);
+      memcpy(clinfo->gt, adfGeoTransform, sizeof(clinfo->gt));
+      if (clinfo->win_x1 - clinfo->win_x0 < 2 || clinfo->win_y1 - clinfo->win_y0 < 2)
+        clinfo->tiled = MS_FALSE; /* too small */
+      msContourLayerSetCellsize(layer, MS_MAX(dst_cellsize_x, dst_cellsize_y));
+      return MS_SUCCESS;
+    }
   } else {
     src_xoff = 0;
     src_yoff = 0;
@@ -436,13 +482,8 @@ static int msContourLayerReadRaster(layerObj *layer, rectObj rect)
   adfGeoTransform[4] = 0;
   adfGeoTransform[5] = -dst_cellsize_y;
 
-  clinfo->cellsize = MS_MAX(dst_cellsize_x, dst_cellsize_y);
-  {
-    char buf[64];
-    sprintf(buf, "%lf", clinfo->cellsize);
-    msInsertHashTable(&layer->metadata, "__data_cellsize__", buf);
-  }
-      
+  msContourLayerSetCellsize(layer, MS_MAX(dst_cellsize_x, dst_cellsize_y));
+
   GDALSetGeoTransform(clinfo->hDS, adfGeoTransform);
   return MS_SUCCESS;
 }
@@ -505,48 +546,23 @@ static char* msContourGetOption(layerObj *layer, const char *name)
   return value;
 }
 
-static int msContourLayerGenerateContour(layerObj *layer)
+/*
+** Create the OGR memory layer the contours are written to, with an ID field
+** and, if set, the CONTOUR_ITEM field holding the level.
+*/
+static OGRLayerH msContourLayerCreateOGRLayer(layerObj *layer, const char *elevItem)
 {
   OGRSFDriverH hDriver;
   OGRFieldDefnH hFld;
   OGRLayerH hLayer;
-  const char *elevItem;
-  char *option;
-  double interval = 1.0, levels[1000];
-  int levelCount = 0;
-  GDALRasterBandH hBand = NULL;
-  CPLErr eErr;
-
   contourLayerInfo *clinfo = (contourLayerInfo *) layer->layerinfo;
 
-  OGRRegisterAll();
-
-  if (clinfo == NULL) {
-    msSetError(MS_MISCERR, "Assertion failed: Contour layer not opened!!!",
-               "msContourLayerCreateOGRDataSource()");
-    return MS_FAILURE;
-  }
-
-  if (!clinfo->hDS) { /* no overlap */
-    return MS_SUCCESS;
-  }
-  
-  hBand = GDALGetRasterBand(clinfo->hDS, 1);
-  if (hBand == NULL)
-  {
-    msSetError(MS_IMGERR,
-               "Band %d does not exist on dataset.",
-               "msContourLayerGenerateContour()", 1);
-    return MS_FAILURE;
-  }
-
-  /* Create the OGR DataSource */
   hDriver = OGRGetDriverByName("Memory");
   if (hDriver == NULL) {
     msSetError(MS_OGRERR,
                "Unable to get OGR driver 'Memory'.",
                "msContourLayerCreateOGRDataSource()");
-    return MS_FAILURE;
+    return NULL;
   }
 
   clinfo->hOGRDS = OGR_Dr_CreateDataSource(hDriver, "", NULL);
@@ -554,7 +570,7 @@ static int msContourLayerGenerateContour(layerObj *layer)
     msSetError(MS_OGRERR,
                "Unable to create OGR DataSource.",
                "msContourLayerCreateOGRDataSource()");
-    return MS_FAILURE;
+    return NULL;
   }
 
   hLayer = OGR_DS_CreateLayer(clinfo->hOGRDS, clinfo->ogrLayer.name, NULL,
@@ -565,22 +581,26 @@ static int msContourLayerGenerateContour(layerObj *layer)
   OGR_L_CreateField(hLayer, hFld, FALSE);
   OGR_Fld_Destroy(hFld);
 
-  /* Check if we have a coutour item specified */
-  elevItem = CSLFetchNameValue(layer->processing,"CONTOUR_ITEM");
-  if (elevItem && strlen(elevItem) > 0) {
+  if (elevItem) {
     hFld = OGR_Fld_Create(elevItem, OFTReal);
     OGR_Fld_SetWidth(hFld, 12);
     OGR_Fld_SetPrecision(hFld, 3);
     OGR_L_CreateField(hLayer, hFld, FALSE);
     OGR_Fld_Destroy(hFld);
   }
-  else {
-    elevItem = NULL;
-  }
+
+  return hLayer;
+}
+
+/* fill levels from CONTOUR_LEVELS, returns their number */
+static int msContourLayerGetLevels(layerObj *layer, double *interval, double *levels, int maxlevels)
+{
+  char *option;
+  int levelCount = 0;
 
   option = msContourGetOption(layer, "CONTOUR_INTERVAL");
   if (option) {
-    interval = atof(option);
+    *interval = atof(option);
     free(option);
   }
 
@@ -590,28 +610,840 @@ static int msContourLayerGenerateContour(layerObj *layer)
     char **levelsTmp;
     levelsTmp = CSLTokenizeStringComplex(option, ",", FALSE, FALSE);
     c = CSLCount(levelsTmp);
-    for (i=0;i<c && i<(int)(sizeof(levels)/sizeof(double)) ;++i)
+    for (i=0;i<c && i<maxlevels;++i)
       levels[levelCount++] = atof(levelsTmp[i]);
 
     CSLDestroy(levelsTmp);
     free(option);
   }
-    
-  eErr = GDALContourGenerate( hBand, interval, 0.0,
-                              levelCount, levels,
-                              FALSE, 0.0, hLayer,
-                              OGR_FD_GetFieldIndex(OGR_L_GetLayerDefn( hLayer),
-                                                    "ID" ),
-                              (elevItem == NULL) ? -1 :
-                              OGR_FD_GetFieldIndex(OGR_L_GetLayerDefn( hLayer), 
-                                                    elevItem ),
-                              NULL, NULL );
 
+  return levelCount;
+}
+
+/*
+** Tiled generation
+**
+** With PROCESSING "CONTOUR_CACHE_TIMEOUT=<seconds>" the contours are generated
+** for tiles of CONTOUR_TILE_SIZE samples aligned on the sampled raster grid
+** and kept in memory, so that the next requests covering the same tiles at the
+** same resolution and levels don't go back to the raster. With PROCESSING
+** "CONTOUR_THREADS=<n>" (or ALL_CPUS) the tiles, or without the cache the
+** parts of the requested window, are generated by n threads.
+**
+** Each tile reads CONTOUR_TILE_MARGIN samples around it, so that GDAL sees the
+** same cells on both sides of its seams, and its lines are clipped to the
+** tile. The pieces meeting on the seams are joined again once all tiles are
+** there, the result matches what a single read of the window gives.
+*/
+#define CONTOUR_TILE_SIZE 256 /* in samples */
+#define CONTOUR_TILE_MIN_SIZE 64 /* smallest part of a window split for threads */
+#define CONTOUR_TILE_MARGIN 2
+#define CONTOUR_CACHE_MAX_BYTES (32*1024*1024)
+#define CONTOUR_STITCH_EPSILON 1e-7 /* in samples */
+#define CONTOUR_UNCLIPPED 1e300
+
+#if defined(GDAL_COMPUTE_VERSION)
+#if GDAL_VERSION_NUM >= GDAL_COMPUTE_VERSION(2,0,0)
+#define MS_CONTOUR_THREADS
+#endif
+#endif
+
+typedef struct {
+  int numlines, maxlines;
+  lineObj *lines; /* in samples from the raster origin */
+  double *levels;
+} contourLines;
+
+typedef struct {
+  char *key; /* cache key, NULL if not cached */
+  GDALDatasetH hDS; /* memory dataset over buffer */
+  double *buffer;
+  int xoff, yoff; /* position of buffer in samples */
+  rectObj clip; /* part of the contours belonging to the tile */
+  contourLines contours;
+  CPLErr eErr;
+  char *errmsg;
+} contourTile;
+
+typedef struct {
+  contourTile *tiles;
+  int numtiles, first, stride;
+  double interval;
+  double *levels;
+  int levelCount;
+} contourWorker;
+
+typedef struct contour_cache_entry contourCacheEntry;
+struct contour_cache_entry {
+  char *key;
+  time_t expires;
+  contourLines contours;
+  size_t size;
+  contourCacheEntry *next; /* most recently used first */
+};
+
+static contourCacheEntry *contourCache = NULL;
+static size_t contourCacheBytes = 0;
+
+static void contourLinesAdd(contourLines *c, pointObj *points, int numpoints, double level)
+{
+  lineObj *line;
+
+  if (c->numlines == c->maxlines) {
+    c->maxlines = MS_MAX(64, c->maxlines*2);
+    c->lines = (lineObj *) msSmallRealloc(c->lines, sizeof(lineObj)*c->maxlines);
+    c->levels = (double *) msSmallRealloc(c->levels, sizeof(double)*c->maxlines);
+  }
+  line = &c->lines[c->numlines];
+  line->numpoints = numpoints;
+  line->point = (pointObj *) msSmallMalloc(sizeof(pointObj)*numpoints);
+  memcpy(line->point, points, sizeof(pointObj)*numpoints);
+  c->levels[c->numlines++] = level;
+}
+
+static void contourLinesAppend(contourLines *dst, contourLines *src)
+{
+  int i;
+  for (i=0; i<src->numlines; i++)
+    contourLinesAdd(dst, src->lines[i].point, src->lines[i].numpoints, src->levels[i]);
+}
+
+static void contourLinesFree(contourLines *c)
+{
+  int i;
+  for (i=0; i<c->numlines; i++)
+    free(c->lines[i].point);
+  free(c->lines);
+  free(c->levels);
+  memset(c, 0, sizeof(contourLines));
+}
+
+static size_t contourLinesSize(contourLines *c)
+{
+  size_t size = 0;
+  int i;
+  for (i=0; i<c->numlines; i++)
+    size += sizeof(lineObj) + sizeof(double) + sizeof(pointObj)*c->lines[i].numpoints;
+  return size;
+}
+
+static void contourCacheEntryFree(contourCacheEntry *entry)
+{
+  contourCacheBytes -= entry->size;
+  contourLinesFree(&entry->contours);
+  msFree(entry->key);
+  msFree(entry);
+}
+
+/* append the contours of the tile to c, returns MS_TRUE if found */
+static int contourCacheGet(const char *key, contourLines *c)
+{
+  contourCacheEntry **link, *entry, *found = NULL;
+  time_t now = time(NULL);
+
+  msAcquireLock(TLOCK_CONTOUR);
+  link = &contourCache;
+  while ((entry = *link) != NULL) {
+    if (entry->expires <= now) {
+      *link = entry->next;
+      contourCacheEntryFree(entry);
+      continue;
+    }
+    if (!found && strcmp(entry->key, key) == 0) {
+      found = entry;
+      *link = entry->next;
+      continue;
+    }
+    link = &entry->next;
+  }
+  if (found) {
+    contourLinesAppend(c, &found->contours);
+    found->next = contourCache;
+    contourCache = found;
+  }
+  msReleaseLock(TLOCK_CONTOUR);
+
+  return found ? MS_TRUE : MS_FALSE;
+}
+
+static void contourCachePut(const char *key, int timeout, contourLines *c)
+{
+  contourCacheEntry **link, *entry;
+  size_t size = contourLinesSize(c) + strlen(key);
+
+  if (size > CONTOUR_CACHE_MAX_BYTES / 4)
+    return; /* would push too many other tiles out */
+
+  entry = (contourCacheEntry *) msSmallCalloc(1, sizeof(contourCacheEntry));
+  entry->key = msStrdup(key);
+  entry->expires = time(NULL) + timeout;
+  contourLinesAppend(&entry->contours, c);
+  entry->size = size;
+
+  msAcquireLock(TLOCK_CONTOUR);
+  link = &contourCache;
+  while (*link) {
+    contourCacheEntry *e = *link;
+    if (strcmp(e->key, key) == 0) {
+      *link = e->next;
+      contourCacheEntryFree(e);
+      continue;
+    }
+    link = &e->next;
+  }
+  entry->next = contourCache;
+  contourCache = entry;
+  contourCacheBytes += entry->size;
+
+  /* drop the least recently used tiles beyond the size limit */
+  link = &contourCache->next;
+  while (contourCacheBytes > CONTOUR_CACHE_MAX_BYTES && *link) {
+    contourCacheEntry *e;
+    contourCacheEntry **last = link;
+    while ((*last)->next)
+      last = &(*last)->next;
+    e = *last;
+    *last = NULL;
+    contourCacheEntryFree(e);
+  }
+  msReleaseLock(TLOCK_CONTOUR);
+}
+
+/* release the cached tiles, called from msCleanup() */
+void msContourCleanup(void)
+{
+  msAcquireLock(TLOCK_CONTOUR);
+  while (contourCache) {
+    contourCacheEntry *next = contourCache->next;
+    contourCacheEntryFree(contourCache);
+    contourCache = next;
+  }
+  msReleaseLock(TLOCK_CONTOUR);
+}
+
+static void contourFlushPiece(contourLines *c, pointObj *piece, int *numpoints, double level)
+{
+  if (*numpoints >= 2)
+    contourLinesAdd(c, piece, *numpoints, level);
+  *numpoints = 0;
+}
+
+/*
+** End point of a clipped segment. Points cut by a side of the clip rectangle
+** are put exactly on it so that both tiles agree on them.
+*/
+static void contourClipPoint(pointObj *p, double x0, double y0, double x1, double y1,
+                             double t, int side, rectObj *clip)
+{
+  if (side == -1) {
+    p->x = (t == 0) ? x0 : x1;
+    p->y = (t == 0) ? y0 : y1;
+    return;
+  }
+  p->x = x0 + t*(x1 - x0);
+  p->y = y0 + t*(y1 - y0);
+  switch (side) {
+    case 0: p->x = clip->minx; break;
+    case 1: p->x = clip->maxx; break;
+    case 2: p->y = clip->miny; break;
+    case 3: p->y = clip->maxy; break;
+  }
+}
+
+/*
+** Clip a contour of the tile (Liang-Barsky) and add the pieces inside to c.
+** Segments running along the right or bottom side belong to the next tile.
+*/
+static void contourClipLine(contourLines *c, OGRGeometryH hGeom, int xoff, int yoff,
+                            double level, rectObj *clip, pointObj **piece, int *piecesize)
+{
+  int i, n = OGR_G_GetPointCount(hGeom), numpoints = 0;
+  double x0, y0;
+
+  if (n > *piecesize) {
+    *piecesize = n;
+    *piece = (pointObj *) msSmallRealloc(*piece, sizeof(pointObj)*n);
+  }
+
+  x0 = OGR_G_GetX(hGeom, 0) + xoff;
+  y0 = OGR_G_GetY(hGeom, 0) + yoff;
+  for (i=1; i<n; i++) {
+    double x1 = OGR_G_GetX(hGeom, i) + xoff, y1 = OGR_G_GetY(hGeom, i) + yoff;
+    double t0 = 0, t1 = 1, p[4], q[4];
+    int k, side0 = -1, side1 = -1, visible = MS_TRUE;
+
+    if (x1 == x0 && y1 == y0)
+      continue;
+
+    p[0] = x0 - x1; q[0] = x0 - clip->minx;
+    p[1] = x1 - x0; q[1] = clip->maxx - x0;
+    p[2] = y0 - y1; q[2] = y0 - clip->miny;
+    p[3] = y1 - y0; q[3] = clip->maxy - y0;
+    for (k=0; k<4 && visible; k++) {
+      double r;
+      if (p[k] == 0) {
+        if (q[k] < 0) visible = MS_FALSE;
+        continue;
+      }
+      r = q[k] / p[k];
+      if (p[k] < 0) {
+        if (r > t1) visible = MS_FALSE;
+        else if (r > t0) { t0 = r; side0 = k; }
+      } else {
+        if (r < t0) visible = MS_FALSE;
+        else if (r < t1) { t1 = r; side1 = k; }
+      }
+    }
+
+    if (visible) {
+      pointObj a, b;
+      contourClipPoint(&a, x0, y0, x1, y1, t0, side0, clip);
+      contourClipPoint(&b, x0, y0, x1, y1, t1, side1, clip);
+      if ((a.x == b.x && a.y == b.y) ||
+          (a.x == clip->maxx && b.x == clip->maxx) ||
+          (a.y == clip->maxy && b.y == clip->maxy)) {
+        visible = MS_FALSE;
+      } else {
+        if (numpoints == 0 || side0 != -1) {
+          contourFlushPiece(c, *piece, &numpoints, level);
+          (*piece)[numpoints++] = a;
+        }
+        (*piece)[numpoints++] = b;
+        if (side1 != -1)
+          contourFlushPiece(c, *piece, &numpoints, level);
+      }
+    }
+    if (!visible)
+      contourFlushPiece(c, *piece, &numpoints, level);
+
+    x0 = x1;
+    y0 = y1;
+  }
+  contourFlushPiece(c, *piece, &numpoints, level);
+}
+
+/* run GDALContourGenerate() on the buffer of the tile, may be called from any thread */
+static void contourGenerateTile(contourTile *tile, contourWorker *w)
+{
+  OGRSFDriverH hDriver;
+  OGRDataSourceH hOGRDS;
+  OGRLayerH hLayer;
+  OGRFieldDefnH hFld;
+  OGRFeatureH hFeat;
+  pointObj *piece = NULL;
+  int piecesize = 0;
+
+  hDriver = OGRGetDriverByName("Memory");
+  hOGRDS = hDriver ? OGR_Dr_CreateDataSource(hDriver, "", NULL) : NULL;
+  if (hOGRDS == NULL) {
+    tile->eErr = CE_Failure;
+    tile->errmsg = msStrdup("Unable to create OGR DataSource.");
+    return;
+  }
+
+  hLayer = OGR_DS_CreateLayer(hOGRDS, "contour", NULL, wkbLineString, NULL);
+  hFld = OGR_Fld_Create("ID", OFTInteger);
+  OGR_L_CreateField(hLayer, hFld, FALSE);
+  OGR_Fld_Destroy(hFld);
+  hFld = OGR_Fld_Create("level", OFTReal);
+  OGR_L_CreateField(hLayer, hFld, FALSE);
+  OGR_Fld_Destroy(hFld);
+
+  tile->eErr = GDALContourGenerate(GDALGetRasterBand(tile->hDS, 1), w->interval, 0.0,
+                                   w->levelCount, w->levels, FALSE, 0.0,
+                                   hLayer, 0, 1, NULL, NULL);
+  if (tile->eErr != CE_None) {
+    tile->errmsg = msStrdup(CPLGetLastErrorMsg());
+  } else {
+    OGR_L_ResetReading(hLayer);
+    while ((hFeat = OGR_L_GetNextFeature(hLayer)) != NULL) {
+      OGRGeometryH hGeom = OGR_F_GetGeometryRef(hFeat);
+      if (hGeom && OGR_G_GetPointCount(hGeom) >= 2)
+        contourClipLine(&tile->contours, hGeom, tile->xoff, tile->yoff,
+                        OGR_F_GetFieldAsDouble(hFeat, 1), &tile->clip,
+                        &piece, &piecesize);
+      OGR_F_Destroy(hFeat);
+    }
+  }
+
+  free(piece);
+  OGR_DS_Destroy(hOGRDS);
+}
+
+static void contourWorkerRun(void *arg)
+{
+  contourWorker *w = (contourWorker *) arg;
+  int i;
+
+  CPLPushErrorHandler(CPLQuietErrorHandler);
+  for (i=w->first; i<w->numtiles; i+=w->stride) {
+    if (w->tiles[i].hDS) /* no data otherwise */
+      contourGenerateTile(&w->tiles[i], w);
+  }
+  CPLPopErrorHandler();
+}
+
+typedef struct {
+  double x, y, level;
+  int end; /* 2*line for its first point, 2*line+1 for the last one */
+} contourEnd;
+
+static int contourEndCompare(const void *a, const void *b)
+{
+  const contourEnd *ea = (const contourEnd *) a, *eb = (const contourEnd *) b;
+  if (ea->level != eb->level) return (ea->level < eb->level) ? -1 : 1;
+  if (ea->x != eb->x) return (ea->x < eb->x) ? -1 : 1;
+  if (ea->y != eb->y) return (ea->y < eb->y) ? -1 : 1;
+  return ea->end - eb->end;
+}
+
+/*
+** Join the pieces of in that meet on the tile seams into the lines of out.
+** Open chains are walked from their free end, what is left are rings.
+*/
+static void contourStitch(contourLines *in, contourLines *out)
+{
+  int i, pass, n = in->numlines, numends = 0, numpoints, maxpoints = 0;
+  contourEnd *ends = (contourEnd *) msSmallMalloc(sizeof(contourEnd)*2*MS_MAX(n,1));
+  int *partner = (int *) msSmallMalloc(sizeof(int)*2*MS_MAX(n,1));
+  char *used = (char *) msSmallCalloc(MS_MAX(n,1), 1);
+  pointObj *points = NULL;
+
+  for (i=0; i<n; i++) {
+    lineObj *line = &in->lines[i];
+    pointObj *first = &line->point[0], *last = &line->point[line->numpoints-1];
+
+    partner[2*i] = partner[2*i+1] = -1;
+    maxpoints += line->numpoints;
+    if (first->x == last->x && first->y == last->y)
+      continue; /* ring within a tile */
+    ends[numends].x = first->x;
+    ends[numends].y = first->y;
+    ends[numends].level = in->levels[i];
+    ends[numends++].end = 2*i;
+    ends[numends].x = last->x;
+    ends[numends].y = last->y;
+    ends[numends].level = in->levels[i];
+    ends[numends++].end = 2*i+1;
+  }
+
+  qsort(ends, numends, sizeof(contourEnd), contourEndCompare);
+  for (i=0; i+1<numends; i++) {
+    contourEnd *a = &ends[i], *b = &ends[i+1];
+    if (a->level == b->level && a->end/2 != b->end/2 &&
+        fabs(a->x - b->x) < CONTOUR_STITCH_EPSILON &&
+        fabs(a->y - b->y) < CONTOUR_STITCH_EPSILON) {
+      partner[a->end] = b->end;
+      partner[b->end] = a->end;
+      i++;
+    }
+  }
+  free(ends);
+
+  points = (pointObj *) msSmallMalloc(sizeof(pointObj)*MS_MAX(maxpoints,1));
+  for (pass=0; pass<2; pass++) {
+    for (i=0; i<n; i++) {
+      int end;
+
+      if (used[i])
+        continue;
+      if (pass == 0) {
+        if (partner[2*i] != -1 && partner[2*i+1] != -1)
+          continue; /* not the start of a chain */
+        end = (partner[2*i] == -1) ? 2*i : 2*i+1;
+      } else {
+        end = 2*i;
+      }
+
+      numpoints = 0;
+      while (1) {
+        lineObj *line = &in->lines[end/2];
+        int j;
+
+        used[end/2] = 1;
+        for (j=(numpoints > 0) ? 1 : 0; j<line->numpoints; j++)
+          points[numpoints++] = line->point[(end & 1) ? line->numpoints-1-j : j];
+
+        end = partner[end ^ 1];
+        if (end == -1 || used[end/2])
+          break;
+      }
+      if (pass == 1)
+        points[numpoints-1] = points[0];
+      contourLinesAdd(out, points, numpoints, in->levels[i]);
+    }
+  }
+
+  free(points);
+  free(partner);
+  free(used);
+}
+
+/*
+** Read nx by ny samples starting at sample x0,y0 into buffer. A sample covers
+** step_x by step_y raster pixels, except those of the last column and row of
+** the grid which only cover what is left of the raster, so these are read
+** separately.
+*/
+static CPLErr contourReadSamples(contourLayerInfo *clinfo, GDALRasterBandH hBand, double *buffer,
+                                 int x0, int y0, int nx, int ny)
+{
+  int xsize = GDALGetRasterXSize(clinfo->hOrigDS), ysize = GDALGetRasterYSize(clinfo->hOrigDS);
+  int fx = nx, fy = ny; /* number of full samples */
+  int i, j;
+  CPLErr eErr;
+
+  if (x0 + nx == clinfo->grid_xsize && xsize % clinfo->step_x != 0) fx--;
+  if (y0 + ny == clinfo->grid_ysize && ysize % clinfo->step_y != 0) fy--;
+
+  for (j=0; j<2; j++) {
+    for (i=0; i<2; i++) {
+      int bx = i ? fx : 0, by = j ? fy : 0;
+      int bnx = i ? nx - fx : fx, bny = j ? ny - fy : fy;
+      int sx = (x0 + bx) * clinfo->step_x, sy = (y0 + by) * clinfo->step_y;
+
+      if (bnx == 0 || bny == 0)
+        continue;
+      eErr = GDALRasterIO(hBand, GF_Read, sx, sy,
+                          i ? xsize - sx : bnx * clinfo->step_x,
+                          j ? ysize - sy : bny * clinfo->step_y,
+                          buffer + by * nx + bx, bnx, bny, GDT_Float64,
+                          sizeof(double), sizeof(double) * nx);
+      if (eErr != CE_None)
+        return eErr;
+    }
+  }
+
+  return CE_None;
+}
+
+/* read the samples of the tile (plus margin) clamped to bounds */
+static int contourReadTile(layerObj *layer, GDALRasterBandH hBand, contourTile *tile,
+                           int cx0, int cy0, int cx1, int cy1, rectObj *bounds)
+{
+  contourLayerInfo *clinfo = (contourLayerInfo *) layer->layerinfo;
+  GDALDriverH hMemDriver;
+  char pointer[64], **options = NULL;
+  double gt[6] = { 0, 1, 0, 0, 0, 1 };
+  int x0, y0, nx, ny;
+  CPLErr eErr;
+
+  tile->clip.minx = (cx0 == bounds->minx) ? -CONTOUR_UNCLIPPED : cx0;
+  tile->clip.miny = (cy0 == bounds->miny) ? -CONTOUR_UNCLIPPED : cy0;
+  tile->clip.maxx = (cx1 == bounds->maxx) ? CONTOUR_UNCLIPPED : cx1;
+  tile->clip.maxy = (cy1 == bounds->maxy) ? CONTOUR_UNCLIPPED : cy1;
+
+  x0 = MS_MAX((int)bounds->minx, cx0 - CONTOUR_TILE_MARGIN);
+  y0 = MS_MAX((int)bounds->miny, cy0 - CONTOUR_TILE_MARGIN);
+  nx = MS_MIN((int)bounds->maxx, cx1 + CONTOUR_TILE_MARGIN) - x0;
+  ny = MS_MIN((int)bounds->maxy, cy1 + CONTOUR_TILE_MARGIN) - y0;
+  tile->xoff = x0;
+  tile->yoff = y0;
+  if (nx < 2 || ny < 2)
+    return MS_SUCCESS; /* no contours */
+
+  tile->buffer = (double *) malloc(sizeof(double) * nx * ny);
+  if (tile->buffer == NULL) {
+    msSetError(MS_MEMERR, "Malloc(): Out of memory.", "msContourLayerGenerateTiles()");
+    return MS_FAILURE;
+  }
+
+  eErr = contourReadSamples(clinfo, hBand, tile->buffer, x0, y0, nx, ny);
+  if (eErr != CE_None) {
+    msSetError(MS_IOERR, "GDALRasterIO() failed: %s",
+               "msContourLayerGenerateTiles()", CPLGetLastErrorMsg());
+    return MS_FAILURE;
+  }
+
+  hMemDriver = GDALGetDriverByName("MEM");
+  tile->hDS = hMemDriver ? GDALCreate(hMemDriver, "", nx, ny, 0, GDT_Float64, NULL) : NULL;
+  if (tile->hDS == NULL) {
+    msSetError(MS_IMGERR,
+               "Unable to open GDAL Memory dataset.",
+               "msContourLayerGenerateTiles()");
+    return MS_FAILURE;
+  }
+  memset(pointer, 0, sizeof(pointer));
+  CPLPrintPointer(pointer, tile->buffer, sizeof(pointer));
+  options = CSLSetNameValue(options, "DATAPOINTER", pointer);
+  eErr = GDALAddBand(tile->hDS, GDT_Float64, options);
+  CSLDestroy(options);
   if (eErr != CE_None) {
-    msSetError( MS_IOERR, "GDALContourGenerate() failed: %s",
-                "msContourLayerGenerateContour()", CPLGetLastErrorMsg() );
+    msSetError(MS_IMGERR,
+               "Unable to open GDAL Memory dataset.",
+               "msContourLayerGenerateTiles()");
+    return MS_FAILURE;
+  }
+  GDALSetGeoTransform(tile->hDS, gt);
+
+  return MS_SUCCESS;
+}
+
+static int msContourLayerGenerateTiles(layerObj *layer, OGRLayerH hLayer, const char *elevItem,
+                                       double interval, double *levels, int levelCount)
+{
+  contourLayerInfo *clinfo = (contourLayerInfo *) layer->layerinfo;
+  contourTile *tiles;
+  contourWorker *workers;
+  contourLines all, stitched;
+  GDALRasterBandH hBand;
+  rectObj bounds;
+  char *keyprefix = NULL;
+  int tilesize, ox, oy, tx, ty, tx0, ty0, tx1, ty1, i;
+  int numtiles = 0, numcached = 0, numthreads, status = MS_SUCCESS;
+  int idField, elevField = -1;
+  struct mstimeval starttime, endtime;
+
+  if (layer->debug)
+    msGettimeofday(&starttime, NULL);
+
+  hBand = GDALGetRasterBand(clinfo->hOrigDS, clinfo->band);
+  if (hBand == NULL) {
+    msSetError(MS_IMGERR,
+               "Band %d does not exist on dataset.",
+               "msContourLayerGenerateTiles()", clinfo->band);
     return MS_FAILURE;
   }
+
+  if (clinfo->cachetimeout > 0) {
+    /* fixed tiles over the whole raster so that they can be shared */
+    char buf[64];
+    tilesize = CONTOUR_TILE_SIZE;
+    ox = oy = 0;
+    bounds.minx = bounds.miny = 0;
+    bounds.maxx = clinfo->grid_xsize;
+    bounds.maxy = clinfo->grid_ysize;
+
+    keyprefix = msStringConcatenate(keyprefix, clinfo->path ? clinfo->path : "");
+    snprintf(buf, sizeof(buf), "|%d|%d,%d|%d,%d|%.15g|",
+             clinfo->band, clinfo->step_x, clinfo->step_y,
+             clinfo->grid_xsize, clinfo->grid_ysize, interval);
+    keyprefix = msStringConcatenate(keyprefix, buf);
+    for (i=0; i<levelCount; i++) {
+      snprintf(buf, sizeof(buf), "%.15g,", levels[i]);
+      keyprefix = msStringConcatenate(keyprefix, buf);
+    }
+  } else {
+    /* about one part of the window per thread */
+    double area = (double)(clinfo->win_x1 - clinfo->win_x0) * (clinfo->win_y1 - clinfo->win_y0);
+    tilesize = MS_MAX(CONTOUR_TILE_MIN_SIZE, (int)ceil(sqrt(area / clinfo->numthreads)));
+    ox = clinfo->win_x0;
+    oy = clinfo->win_y0;
+    bounds.minx = clinfo->win_x0;
+    bounds.miny = clinfo->win_y0;
+    bounds.maxx = clinfo->win_x1;
+    bounds.maxy = clinfo->win_y1;
+  }
+
+  tx0 = (clinfo->win_x0 - ox) / tilesize;
+  ty0 = (clinfo->win_y0 - oy) / tilesize;
+  tx1 = (clinfo->win_x1 - 1 - ox) / tilesize;
+  ty1 = (clinfo->win_y1 - 1 - oy) / tilesize;
+
+  memset(&all, 0, sizeof(contourLines));
+  memset(&stitched, 0, sizeof(contourLines));
+  tiles = (contourTile *) msSmallCalloc((tx1-tx0+1)*(ty1-ty0+1), sizeof(contourTile));
+
+  for (ty=ty0; ty<=ty1 && status == MS_SUCCESS; ty++) {
+    for (tx=tx0; tx<=tx1; tx++) {
+      int cx0 = ox + tx*tilesize, cy0 = oy + ty*tilesize;
+      int cx1 = MS_MIN(cx0 + tilesize, (int)bounds.maxx);
+      int cy1 = MS_MIN(cy0 + tilesize, (int)bounds.maxy);
+      contourTile *tile = &tiles[numtiles];
+
+      if (keyprefix) {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%d,%d", tx, ty);
+        tile->key = msStringConcatenate(msStrdup(keyprefix), buf);
+        if (contourCacheGet(tile->key, &all)) {
+          msFree(tile->key);
+          tile->key = NULL;
+          numcached++;
+          continue;
+        }
+      }
+
+      numtiles++;
+      if (contourReadTile(layer, hBand, tile, cx0, cy0, cx1, cy1, &bounds) != MS_SUCCESS) {
+        status = MS_FAILURE;
+        break;
+      }
+    }
+  }
+  msFree(keyprefix);
+  MS_TRACE_COUNT(MS_TRACE_CACHEHITS, numcached);
+
+  /* generate the tiles not found in the cache, tile i goes to worker i % numthreads */
+  numthreads = MS_MAX(1, MS_MIN(clinfo->numthreads, numtiles));
+  workers = (contourWorker *) msSmallCalloc(numthreads, sizeof(contourWorker));
+  for (i=0; i<numthreads; i++) {
+    workers[i].tiles = tiles;
+    workers[i].numtiles = (status == MS_SUCCESS) ? numtiles : 0;
+    workers[i].first = i;
+    workers[i].stride = numthreads;
+    workers[i].interval = interval;
+    workers[i].levels = levels;
+    workers[i].levelCount = levelCount;
+  }
+#ifdef MS_CONTOUR_THREADS
+  {
+    CPLJoinableThread **threads = (CPLJoinableThread **) msSmallCalloc(numthreads, sizeof(CPLJoinableThread *));
+    for (i=1; i<numthreads; i++)
+      threads[i] = CPLCreateJoinableThread(contourWorkerRun, &workers[i]);
+    contourWorkerRun(&workers[0]);
+    for (i=1; i<numthreads; i++) {
+      if (threads[i])
+        CPLJoinThread(threads[i]);
+      else
+        contourWorkerRun(&workers[i]); /* could not start it */
+    }
+    free(threads);
+  }
+#else
+  for (i=0; i<numthreads; i++)
+    contourWorkerRun(&workers[i]);
+#endif
+  free(workers);
+
+  for (i=0; i<numtiles; i++) {
+    contourTile *tile = &tiles[i];
+    if (status == MS_SUCCESS && tile->hDS && tile->eErr != CE_None) {
+      msSetError(MS_IOERR, "GDALContourGenerate() failed: %s",
+                 "msContourLayerGenerateTiles()", tile->errmsg ? tile->errmsg : "");
+      status = MS_FAILURE;
+    }
+    if (status == MS_SUCCESS) {
+      if (tile->key)
+        contourCachePut(tile->key, clinfo->cachetimeout, &tile->contours);
+      contourLinesAppend(&all, &tile->contours);
+    }
+    if (tile->hDS)
+      GDALClose(tile->hDS);
+    free(tile->buffer);
+    msFree(tile->key);
+    msFree(tile->errmsg);
+    contourLinesFree(&tile->contours);
+  }
+  free(tiles);
+
+  if (status == MS_SUCCESS) {
+    OGRFeatureDefnH hDefn = OGR_L_GetLayerDefn(hLayer);
+    double *gt = clinfo->gt;
+    double xsize = GDALGetRasterXSize(clinfo->hOrigDS), ysize = GDALGetRasterYSize(clinfo->hOrigDS);
+
+    contourStitch(&all, &stitched);
+
+    idField = OGR_FD_GetFieldIndex(hDefn, "ID");
+    if (elevItem)
+      elevField = OGR_FD_GetFieldIndex(hDefn, elevItem);
+    for (i=0; i<stitched.numlines; i++) {
+      lineObj *line = &stitched.lines[i];
+      OGRFeatureH hFeat = OGR_F_Create(hDefn);
+      OGRGeometryH hGeom = OGR_G_CreateGeometry(wkbLineString);
+      int j;
+
+      for (j=0; j<line->numpoints; j++) {
+        /* the center of a partial last sample lies past the raster edge */
+        double x = MS_MIN(line->point[j].x * clinfo->step_x, xsize);
+        double y = MS_MIN(line->point[j].y * clinfo->step_y, ysize);
+        OGR_G_AddPoint_2D(hGeom, GEO_TRANS(gt, x, y), GEO_TRANS(gt+3, x, y));
+      }
+      OGR_F_SetFieldInteger(hFeat, idField, i);
+      if (elevField >= 0)
+        OGR_F_SetFieldDouble(hFeat, elevField, stitched.levels[i]);
+      OGR_F_SetGeometryDirectly(hFeat, hGeom);
+      if (OGR_L_CreateFeature(hLayer, hFeat) != OGRERR_NONE) {
+        msSetError(MS_OGRERR, "Unable to write contour: %s",
+                   "msContourLayerGenerateTiles()", CPLGetLastErrorMsg());
+        status = MS_FAILURE;
+      }
+      OGR_F_Destroy(hFeat);
+      if (status != MS_SUCCESS)
+        break;
+    }
+
+    if (layer->debug) {
+      msGettimeofday(&endtime, NULL);
+      msDebug("msContourLayerGenerateTiles(%s): %d tiles cached, %d generated with %d threads, %d lines in %.3fs.\n",
+              layer->name, numcached, numtiles, numthreads, stitched.numlines,
+              (endtime.tv_sec+endtime.tv_usec/1.0e6)-
+              (starttime.tv_sec+starttime.tv_usec/1.0e6));
+    }
+  }
+
+  contourLinesFree(&all);
+  contourLinesFree(&stitched);
+  return status;
+}
+
+static int msContourLayerGenerateContour(layerObj *layer)
+{
+  OGRLayerH hLayer;
+  const char *elevItem;
+  double interval = 1.0, levels[1000];
+  int levelCount = 0;
+  GDALRasterBandH hBand = NULL;
+  CPLErr eErr;
+
+  contourLayerInfo *clinfo = (contourLayerInfo *) layer->layerinfo;
+
+  OGRRegisterAll();
+
+  if (clinfo == NULL) {
+    msSetError(MS_MISCERR, "Assertion failed: Contour layer not opened!!!",
+               "msContourLayerCreateOGRDataSource()");
+    return MS_FAILURE;
+  }
+
+  if (!clinfo->hDS && !clinfo->tiled) { /* no overlap */
+    return MS_SUCCESS;
+  }
+  
+  if (!clinfo->tiled) {
+    hBand = GDALGetRasterBand(clinfo->hDS, 1);
+    if (hBand == NULL)
+    {
+      msSetError(MS_IMGERR,
+                 "Band %d does not exist on dataset.",
+                 "msContourLayerGenerateContour()", 1);
+      return MS_FAILURE;
+    }
+  }
+
+  /* Check if we have a coutour item specified */
+  elevItem = CSLFetchNameValue(layer->processing,"CONTOUR_ITEM");
+  if (elevItem == NULL || strlen(elevItem) == 0)
+    elevItem = NULL;
+
+  /* Create the OGR DataSource */
+  hLayer = msContourLayerCreateOGRLayer(layer, elevItem);
+  if (hLayer == NULL)
+    return MS_FAILURE;
+
+  levelCount = msContourLayerGetLevels(layer, &interval, levels,
+                                       (int)(sizeof(levels)/sizeof(double)));
+
+  if (clinfo->tiled) {
+    if (msContourLayerGenerateTiles(layer, hLayer, elevItem,
+                                    interval, levels, levelCount) != MS_SUCCESS)
+      return MS_FAILURE;
+  } else {
+    eErr = GDALContourGenerate( hBand, interval, 0.0,
+                                levelCount, levels,
+                                FALSE, 0.0, hLayer,
+                                OGR_FD_GetFieldIndex(OGR_L_GetLayerDefn( hLayer),
+                                                      "ID" ),
+                                (elevItem == NULL) ? -1 :
+                                OGR_FD_GetFieldIndex(OGR_L_GetLayerDefn( hLayer), 
+                                                      elevItem ),
+                                NULL, NULL );
+
+    if (eErr != CE_None) {
+      msSetError( MS_IOERR, "GDALContourGenerate() failed: %s",
+                  "msContourLayerGenerateContour()", CPLGetLastErrorMsg() );
+      return MS_FAILURE;
+    }
+  }
   
   msConnPoolRegister(&clinfo->ogrLayer, clinfo->hOGRDS, msContourOGRCloseConnection);
 
@@ -622,6 +1454,7 @@ static int msContourLayerGenerateContour(layerObj *layer)
 int msContourLayerOpen(layerObj *layer)
 {
   char *decrypted_path;
+  const char *value;
   char szPath[MS_MAXPATHLEN];
   contourLayerInfo *clinfo;
 
@@ -697,6 +1530,18 @@ int msContourLayerOpen(layerObj *layer)
   
   GDALAllRegister();
 
+  /* tiled generation options, see msContourLayerGenerateTiles() */
+  value = msLayerGetProcessingKey(layer, "CONTOUR_CACHE_TIMEOUT");
+  clinfo->cachetimeout = value ? atoi(value) : 0;
+  value = msLayerGetProcessingKey(layer, "CONTOUR_THREADS");
+  if (value && strcasecmp(value, "ALL_CPUS") == 0)
+    clinfo->numthreads = CPLGetNumCPUs();
+  else
+    clinfo->numthreads = value ? atoi(value) : 1;
+  clinfo->numthreads = MS_MAX(1, clinfo->numthreads);
+  msFree(clinfo->path);
+  clinfo->path = decrypted_path ? msStrdup(decrypted_path) : NULL;
+
   /* Open the original Dataset */
 
   msAcquireLock(TLOCK_GDAL);
@@ -998,5 +1843,9 @@ int msContourLayerInitializeVirtualTable(layerObj *layer)
   msSetError(MS_MISCERR, "Contour Layer needs GDAL support, but it it not compiled in", "msContourLayerInitializeVirtualTable()");
   return MS_FAILURE;
 }
+
+void msContourCleanup(void)
+{
+}
 #endif
 
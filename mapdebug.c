@@ -39,6 +39,8 @@
 #include <unistd.h>
 #endif
 #include <stdarg.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 
 #ifdef NEED_NONBLOCKING_STDERR
 #include <fcntl.h>
@@ -48,6 +50,8 @@
 #include <windows.h> /* OutputDebugStringA() */
 #endif
 
+static void msTraceCleanup(void);
+
 
 
 
@@ -270,6 +274,11 @@ int msDebugInitFromEnv()
   if( (val=getenv( "MS_DEBUGLEVEL" )) != NULL )
     msSetGlobalDebugLevel(atoi(val));
 
+  if( (val=getenv( "MS_TRACE" )) != NULL ) {
+    if ( msTraceSetOutput(val, getenv( "MS_TRACE_FORMAT" )) != MS_SUCCESS )
+      return MS_FAILURE;
+  }
+
   return MS_SUCCESS;
 }
 
@@ -283,6 +292,8 @@ void msDebugCleanup()
   /* make sure file is closed */
   msCloseErrorFile();
 
+  msTraceCleanup();
+
 #ifdef USE_THREAD
   {
     void*  thread_id = msGetThreadId();
@@ -375,3 +386,340 @@ void msDebug( const char * pszFormat, ... )
 void msDebug2( int level, ... )
 {
 }
+
+
+/* ------------------------------------------------------------------------- */
+/*      Request tracing                                                      */
+/* ------------------------------------------------------------------------- */
+
+#define MS_TRACE_FORMAT_JSON   0
+#define MS_TRACE_FORMAT_CHROME 1
+
+#define MS_TRACE_MAX_DEPTH  32
+#define MS_TRACE_MAX_SPANS  4096
+
+typedef struct {
+  msTraceStage stage;
+  char name[64];
+  int depth;
+  double start; /* microseconds since the request start */
+  double end;
+  double times[MS_TRACE_STAGE_COUNT]; /* from msTraceLap() */
+  long counters[MS_TRACE_COUNTER_COUNT];
+} traceSpanObj;
+
+typedef struct {
+  double start; /* microseconds since the epoch */
+  traceSpanObj *spans;
+  int numspans;
+  int maxspans;
+  int droppedspans;
+  int open[MS_TRACE_MAX_DEPTH];
+  int numopen;
+  double totals[MS_TRACE_STAGE_COUNT];
+  long counters[MS_TRACE_COUNTER_COUNT];
+} traceObj;
+
+static const char *trace_stage_names[] = { "request", "mapload", "drawlayer", "layeropen",
+                                           "whichshapes", "nextshape", "classify", "render",
+                                           "labelcache", "encode"
+                                         };
+static const char *trace_counter_names[] = { "features", "vertices", "bytes", "cache_hits" };
+
+int msTraceEnabled = MS_FALSE;
+static char *trace_target = NULL;
+static int trace_format = MS_TRACE_FORMAT_JSON;
+/* the "[" of the chrome event array was written to stdout, stderr */
+static int trace_chrome_started[2] = { MS_FALSE, MS_FALSE };
+
+/* the trace of the request being processed by this thread */
+static MS_THREAD_LOCAL traceObj *trace = NULL;
+
+/* msTraceSetOutput()
+**
+** Set the tracing target (a file name, "stderr" or "stdout") and format
+** ("json" or "chrome"). A NULL or empty target disables tracing. When
+** serving a CGI or FastCGI request "stdout" goes to stderr instead, so the
+** trace doesn't end up in the response.
+** Called from msDebugInitFromEnv() with MS_TRACE and MS_TRACE_FORMAT.
+**
+** Returns MS_SUCCESS/MS_FAILURE
+*/
+int msTraceSetOutput(const char *pszTarget, const char *pszFormat)
+{
+  int format = MS_TRACE_FORMAT_JSON;
+
+  if (pszFormat && strcasecmp(pszFormat, "chrome") == 0)
+    format = MS_TRACE_FORMAT_CHROME;
+  else if (pszFormat && *pszFormat && strcasecmp(pszFormat, "json") != 0) {
+    msSetError(MS_MISCERR, "Unsupported MS_TRACE_FORMAT %s, expected json or chrome.", "msTraceSetOutput()", pszFormat);
+    return MS_FAILURE;
+  }
+
+  msAcquireLock( TLOCK_DEBUGOBJ );
+  msFree(trace_target);
+  trace_target = (pszTarget && *pszTarget) ? msStrdup(pszTarget) : NULL;
+  trace_format = format;
+  msTraceEnabled = (trace_target != NULL);
+  msReleaseLock( TLOCK_DEBUGOBJ );
+
+  return MS_SUCCESS;
+}
+
+double msTraceClock()
+{
+  struct mstimeval tv;
+  msGettimeofday(&tv, NULL);
+  return tv.tv_sec * 1.0e6 + tv.tv_usec;
+}
+
+/* msTraceStart()
+**
+** Start tracing a request on this thread, if tracing is enabled.
+*/
+void msTraceStart()
+{
+  if (!msTraceEnabled)
+    return;
+
+  if (trace != NULL) { /* a previous request did not finish */
+    msFree(trace->spans);
+    msFree(trace);
+  }
+  trace = (traceObj *) msSmallCalloc(1, sizeof(traceObj));
+  trace->start = msTraceClock();
+}
+
+int msTraceSpanBegin(msTraceStage stage, const char *pszName)
+{
+  traceSpanObj *span;
+
+  if (trace == NULL || trace->numopen == MS_TRACE_MAX_DEPTH)
+    return -1;
+
+  if (trace->numspans == MS_TRACE_MAX_SPANS) {
+    trace->droppedspans++;
+    return -1;
+  }
+
+  if (trace->numspans == trace->maxspans) {
+    trace->maxspans = trace->maxspans ? trace->maxspans * 2 : 64;
+    trace->spans = (traceSpanObj *) msSmallRealloc(trace->spans, trace->maxspans * sizeof(traceSpanObj));
+  }
+
+  span = &trace->spans[trace->numspans];
+  memset(span, 0, sizeof(traceSpanObj));
+  span->stage = stage;
+  if (pszName)
+    strlcpy(span->name, pszName, sizeof(span->name));
+  span->depth = trace->numopen;
+  span->start = msTraceClock() - trace->start;
+  span->end = -1;
+
+  trace->open[trace->numopen++] = trace->numspans;
+  return trace->numspans++;
+}
+
+void msTraceSpanEnd(int span)
+{
+  traceSpanObj *s;
+
+  if (trace == NULL || span < 0 || span >= trace->numspans)
+    return;
+
+  s = &trace->spans[span];
+  if (s->end >= 0)
+    return;
+  s->end = msTraceClock() - trace->start;
+  trace->totals[s->stage] += s->end - s->start;
+
+  /* close the spans left open by an error path as well */
+  while (trace->numopen > 0 && trace->open[trace->numopen - 1] >= span) {
+    int i = trace->open[--trace->numopen];
+    if (trace->spans[i].end < 0) {
+      trace->spans[i].end = s->end;
+      trace->totals[trace->spans[i].stage] += s->end - trace->spans[i].start;
+    }
+  }
+}
+
+/* counters go to the innermost open span and to the request */
+void msTraceCount(msTraceCounter counter, long value)
+{
+  if (trace == NULL)
+    return;
+
+  trace->counters[counter] += value;
+  if (trace->numopen > 0)
+    trace->spans[trace->open[trace->numopen - 1]].counters[counter] += value;
+}
+
+/* msTraceLap()
+**
+** Account the time elapsed since *lap to stage, for the work done per
+** feature where a span would be too costly, and restart the lap.
+*/
+void msTraceLap(msTraceStage stage, double *lap)
+{
+  double now, elapsed;
+
+  if (trace == NULL)
+    return;
+
+  now = msTraceClock();
+  elapsed = now - *lap;
+  *lap = now;
+
+  trace->totals[stage] += elapsed;
+  if (trace->numopen > 0)
+    trace->spans[trace->open[trace->numopen - 1]].times[stage] += elapsed;
+}
+
+static void msTraceWriteString(FILE *fp, const char *str)
+{
+  fputc('"', fp);
+  for (; str && *str; str++) {
+    unsigned char c = (unsigned char) *str;
+    if (c == '"' || c == '\\')
+      fprintf(fp, "\\%c", c);
+    else if (c < 0x20)
+      fprintf(fp, "\\u%04x", c);
+    else
+      fputc(c, fp);
+  }
+  fputc('"', fp);
+}
+
+static void msTraceWriteValues(FILE *fp, const double *times, const long *counters, int first)
+{
+  int i;
+
+  for (i = 0; i < MS_TRACE_STAGE_COUNT; i++) {
+    if (times[i] > 0) {
+      fprintf(fp, "%s\"%s_ms\":%.3f", first ? "" : ",", trace_stage_names[i], times[i] / 1000.0);
+      first = MS_FALSE;
+    }
+  }
+  for (i = 0; i < MS_TRACE_COUNTER_COUNT; i++) {
+    if (counters[i] > 0) {
+      fprintf(fp, "%s\"%s\":%ld", first ? "" : ",", trace_counter_names[i], counters[i]);
+      first = MS_FALSE;
+    }
+  }
+}
+
+static void msTraceWriteJSON(FILE *fp, const char *pszLabel, double duration)
+{
+  int i;
+
+  fprintf(fp, "{\"time\":%.0f,\"pid\":%d,\"request\":", trace->start / 1.0e6, (int)getpid());
+  msTraceWriteString(fp, pszLabel);
+  fprintf(fp, ",\"duration_ms\":%.3f", duration / 1000.0);
+  msTraceWriteValues(fp, trace->totals, trace->counters, MS_FALSE);
+  if (trace->droppedspans > 0)
+    fprintf(fp, ",\"dropped_spans\":%d", trace->droppedspans);
+  fprintf(fp, ",\"spans\":[");
+  for (i = 0; i < trace->numspans; i++) {
+    traceSpanObj *s = &trace->spans[i];
+    fprintf(fp, "%s{\"stage\":\"%s\",\"name\":", i ? "," : "", trace_stage_names[s->stage]);
+    msTraceWriteString(fp, s->name);
+    fprintf(fp, ",\"depth\":%d,\"start_ms\":%.3f,\"duration_ms\":%.3f", s->depth, s->start / 1000.0, (s->end - s->start) / 1000.0);
+    msTraceWriteValues(fp, s->times, s->counters, MS_FALSE);
+    fprintf(fp, "}");
+  }
+  fprintf(fp, "]}\n");
+}
+
+static void msTraceWriteChromeEvent(FILE *fp, const char *pszName, msTraceStage stage, double start, double duration,
+                                    const double *times, const long *counters)
+{
+  fprintf(fp, "{\"name\":");
+  msTraceWriteString(fp, (pszName && *pszName) ? pszName : trace_stage_names[stage]);
+  fprintf(fp, ",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.0f,\"dur\":%.0f,\"pid\":%d,\"tid\":%lu,\"args\":{",
+          trace_stage_names[stage], trace->start + start, duration, (int)getpid(), (unsigned long)(size_t)msGetThreadId());
+  msTraceWriteValues(fp, times, counters, MS_TRUE);
+  fprintf(fp, "}},\n");
+}
+
+static void msTraceWriteChrome(FILE *fp, const char *pszLabel, double duration)
+{
+  int i;
+
+  /* the closing bracket of the event array is optional, which allows
+     appending. The opening one goes before the first event of a stream, or
+     of an empty file. stdout and stderr may be a pipe or tty, where the
+     position can't tell, so the events written there are remembered for
+     the life of the process. */
+  if (fp == stdout || fp == stderr) {
+    int *started = &trace_chrome_started[fp == stderr];
+    if (!*started)
+      fprintf(fp, "[\n");
+    *started = MS_TRUE;
+  } else {
+    struct stat st;
+    if (fstat(fileno(fp), &st) != 0 || st.st_size == 0)
+      fprintf(fp, "[\n");
+  }
+
+  msTraceWriteChromeEvent(fp, pszLabel, MS_TRACE_REQUEST, 0, duration, trace->totals, trace->counters);
+  for (i = 0; i < trace->numspans; i++) {
+    traceSpanObj *s = &trace->spans[i];
+    msTraceWriteChromeEvent(fp, s->name, s->stage, s->start, s->end - s->start, s->times, s->counters);
+  }
+}
+
+/* drop an unfinished trace and the tracing target, see msDebugCleanup() */
+static void msTraceCleanup()
+{
+  if (trace != NULL) {
+    msFree(trace->spans);
+    msFree(trace);
+    trace = NULL;
+  }
+  msTraceSetOutput(NULL, NULL);
+}
+
+/* msTraceFinish()
+**
+** Write the trace of the request processed by this thread and reset it.
+*/
+void msTraceFinish(const char *pszLabel)
+{
+  FILE *fp;
+  double duration;
+
+  if (trace == NULL)
+    return;
+
+  duration = msTraceClock() - trace->start;
+  while (trace->numopen > 0)
+    msTraceSpanEnd(trace->open[0]);
+
+  msAcquireLock( TLOCK_DEBUGOBJ );
+  if (trace_target == NULL)
+    fp = NULL;
+  else if (strcmp(trace_target, "stderr") == 0)
+    fp = stderr;
+  else if (strcmp(trace_target, "stdout") == 0)
+    /* stdout carries the response of a CGI or FastCGI request */
+    fp = getenv("GATEWAY_INTERFACE") ? stderr : stdout;
+  else
+    fp = fopen(trace_target, "a");
+
+  if (fp) {
+    if (trace_format == MS_TRACE_FORMAT_CHROME)
+      msTraceWriteChrome(fp, pszLabel, duration);
+    else
+      msTraceWriteJSON(fp, pszLabel, duration);
+
+    if (fp == stderr || fp == stdout)
+      fflush(fp);
+    else
+      fclose(fp);
+  }
+  msReleaseLock( TLOCK_DEBUGOBJ );
+
+  msFree(trace->spans);
+  msFree(trace);
+  trace = NULL;
+}
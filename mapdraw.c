@@ -179,12 +179,22 @@ imageObj *msPrepareImage(mapObj *map, int allow_nonsquare)
   
 }
 
-static int msCompositeRasterBuffer(mapObj *map, imageObj *img, rasterBufferObj *rb, LayerCompositer *comp) {
+/*
+** region holds the pixel bounds of the drawn part of rb (the rest is
+** transparent), or NULL if unknown. It limits the filters and, for SRC_OVER
+** which leaves the destination untouched under transparent pixels, the blend.
+*/
+static int msCompositeRasterBuffer(mapObj *map, imageObj *img, rasterBufferObj *rb, LayerCompositer *comp, rectObj *region) {
   int ret = MS_SUCCESS;
   if(MS_IMAGE_RENDERER(img)->compositeRasterBuffer) {
     while(comp && ret == MS_SUCCESS) {
       rasterBufferObj *rb_ptr = rb;
       CompositingFilter *filter = comp->filter;
+      rectObj area, *area_ptr = NULL;
+      if(region) {
+        area = *region;
+        area_ptr = &area;
+      }
       if(filter && comp->next) {
        /* if we have another compositor to apply, then we need to copy the rasterBufferObj. Otherwise
        * we can work on it directly */
@@ -192,11 +202,18 @@ static int msCompositeRasterBuffer(mapObj *map, imageObj *img, rasterBufferObj *
 	msCopyRasterBuffer(rb_ptr,rb);
       }
       while(filter && ret == MS_SUCCESS) {
-        ret = msApplyCompositingFilter(map,rb_ptr,filter);
+        ret = msApplyCompositingFilter(map,rb_ptr,filter,area_ptr);
         filter = filter->next;
       }
-      if(ret == MS_SUCCESS)
-      	ret = MS_IMAGE_RENDERER(img)->compositeRasterBuffer(img,rb_ptr,comp->comp_op, comp->opacity);
+      if(ret == MS_SUCCESS) {
+        if(!area_ptr || comp->comp_op != MS_COMPOP_SRC_OVER)
+          ret = MS_IMAGE_RENDERER(img)->compositeRasterBuffer(img,rb_ptr,comp->comp_op, comp->opacity,
+                  0,0,0,0,rb_ptr->width,rb_ptr->height);
+        else if(area.maxx > area.minx && area.maxy > area.miny)
+          ret = MS_IMAGE_RENDERER(img)->compositeRasterBuffer(img,rb_ptr,comp->comp_op, comp->opacity,
+                  (int)area.minx,(int)area.miny,(int)area.minx,(int)area.miny,
+                  (int)(area.maxx-area.minx),(int)(area.maxy-area.miny));
+      }
       if(rb_ptr != rb) {
         msFreeRasterBuffer(rb_ptr);
         msFree(rb_ptr);
@@ -339,6 +356,7 @@ imageObj *msDrawMap(mapObj *map, int querymap)
 
     if(map->layerorder[i] != -1) {
       char *force_draw_label_cache = NULL;
+      int span;
 
       lp = (GET_LAYER(map,  map->layerorder[i]));
 
@@ -349,6 +367,8 @@ imageObj *msDrawMap(mapObj *map, int querymap)
 
       if(!msLayerIsVisible(map, lp)) continue;
 
+      span = MS_TRACE_BEGIN(MS_TRACE_DRAWLAYER, lp->name);
+
       if(lp->connectiontype == MS_WMS) {
 #ifdef USE_WMS_LYR
         if(MS_RENDERER_PLUGIN(image->format) || MS_RENDERER_RAWDATA(image->format))
@@ -394,6 +414,7 @@ imageObj *msDrawMap(mapObj *map, int querymap)
           return(NULL);
         }
       }
+      MS_TRACE_END(span);
       if(map->debug >= MS_DEBUGLEVEL_TUNING || lp->debug >= MS_DEBUGLEVEL_TUNING) {
         msGettimeofday(&endtime, NULL);
         msDebug("msDrawMap(): Layer %d (%s), %.3fs\n",
@@ -667,6 +688,8 @@ int msDrawLayer(mapObj *map, layerObj *layer, imageObj *image)
   int retcode=MS_SUCCESS;
   const char *alternativeFomatString = NULL;
   layerObj *maskLayer = NULL;
+  char *cachekey = NULL;
+  int cachetimeout;
 
   if(!msLayerIsVisible(map, layer))
     return MS_SUCCESS;
@@ -754,6 +777,24 @@ int msDrawLayer(mapObj *map, layerObj *layer, imageObj *image)
   /* inform the rendering device that layer draw is starting. */
   msImageStartLayer(map, layer, image);
 
+  /* reuse the image of this layer if it was rendered recently with the same parameters */
+  cachetimeout = msLayerCacheTimeout(map, layer, image);
+  if(cachetimeout > 0)
+    cachekey = msLayerCacheKey(map, layer, image);
+  if(cachekey) {
+    rasterBufferObj rb;
+    if(msLayerCacheGet(layer, cachekey, cachetimeout, &rb)) {
+      if(!layer->compositer)
+        retcode = MS_IMAGE_RENDERER(image)->mergeRasterBuffer(image,&rb,1.0,0,0,0,0,rb.width,rb.height);
+      else
+        retcode = msCompositeRasterBuffer(map,image,&rb,layer->compositer,NULL);
+      msFreeRasterBuffer(&rb);
+      msFree(cachekey);
+      msImageEndLayer(map,layer,image);
+      return(retcode);
+    }
+  }
+
 
   /*check if an alternative renderer should be used for this layer*/
   alternativeFomatString = msLayerGetProcessingKey( layer, "RENDERER");
@@ -768,16 +809,17 @@ int msDrawLayer(mapObj *map, layerObj *layer, imageObj *image)
     renderer->startLayer(image_draw,map,layer);
   } else if (MS_RENDERER_PLUGIN(image_draw->format)) {
     rendererVTableObj *renderer = MS_IMAGE_RENDERER(image_draw);
-    if ((layer->mask && layer->connectiontype!=MS_WMS && layer->type != MS_LAYER_RASTER) || layer->compositer) {
+    if ((layer->mask && layer->connectiontype!=MS_WMS && layer->type != MS_LAYER_RASTER) || layer->compositer || cachekey) {
       /* masking occurs at the pixel/layer level for raster images, so we don't need to create a temporary image
-       in these cases
+       in these cases. cached layers are drawn on their own to keep their image.
        */
-      if (layer->mask || renderer->compositeRasterBuffer) {
+      if (layer->mask || cachekey || renderer->compositeRasterBuffer) {
         image_draw = msImageCreate(image->width, image->height,
                                    image->format, image->imagepath, image->imageurl, map->resolution, map->defresolution, NULL);
         if (!image_draw) {
           msSetError(MS_MISCERR, "Unable to initialize temporary transparent image.",
                      "msDrawLayer()");
+          msFree(cachekey);
           return (MS_FAILURE);
         }
         image_draw->map = map;
@@ -843,6 +885,8 @@ altformat_cleanup:
   } else if( image != image_draw) {
     rendererVTableObj *renderer = MS_IMAGE_RENDERER(image_draw);
     rasterBufferObj rb;
+    rectObj dirty, *region = NULL;
+    int drawn = (retcode == MS_SUCCESS);
     memset(&rb,0,sizeof(rasterBufferObj));
 
     renderer->endLayer(image_draw,map,layer);
@@ -851,25 +895,46 @@ altformat_cleanup:
     if(UNLIKELY(retcode == MS_FAILURE)) {
       goto imagedraw_cleanup;
     }
+    /* store before the compositing filters modify the buffer */
+    if(cachekey && drawn)
+      msLayerCachePut(layer, cachekey, cachetimeout, &rb);
+
+    /* only the part of the temporary image that was drawn on needs to be masked
+       and blended. raster layers write to the pixels directly, so the renderer
+       can't tell for them. */
+    if(renderer->getDirtyRect && layer->type != MS_LAYER_RASTER && layer->connectiontype != MS_WMS &&
+        renderer->getDirtyRect(image_draw,&dirty) == MS_SUCCESS) {
+      region = &dirty;
+      if(map->debug >= MS_DEBUGLEVEL_TUNING || layer->debug >= MS_DEBUGLEVEL_TUNING)
+        msDebug("msDrawLayer(): Layer %s touched %dx%d of %dx%d pixels\n", layer->name,
+                (int)(dirty.maxx-dirty.minx), (int)(dirty.maxy-dirty.miny), rb.width, rb.height);
+    }
+
     if(maskLayer && maskLayer->maskimage) {
       rasterBufferObj mask;
-      unsigned int row,col;
+      unsigned int row,col,minrow=0,maxrow=rb.height,mincol=0,maxcol=rb.width;
       memset(&mask,0,sizeof(rasterBufferObj));
       retcode = MS_IMAGE_RENDERER(maskLayer->maskimage)->getRasterBufferHandle(maskLayer->maskimage,&mask);
       if(UNLIKELY(retcode == MS_FAILURE)) {
         goto imagedraw_cleanup;
       }
       /* modify the pixels of the overlay */
+      if(region) {
+        minrow = (unsigned int)region->miny;
+        maxrow = (unsigned int)region->maxy;
+        mincol = (unsigned int)region->minx;
+        maxcol = (unsigned int)region->maxx;
+      }
 
       if(rb.type == MS_BUFFER_BYTE_RGBA) {
-        for(row=0; row<rb.height; row++) {
+        for(row=minrow; row<maxrow; row++) {
           unsigned char *ma,*a,*r,*g,*b;
-          r=rb.data.rgba.r+row*rb.data.rgba.row_step;
-          g=rb.data.rgba.g+row*rb.data.rgba.row_step;
-          b=rb.data.rgba.b+row*rb.data.rgba.row_step;
-          a=rb.data.rgba.a+row*rb.data.rgba.row_step;
-          ma=mask.data.rgba.a+row*mask.data.rgba.row_step;
-          for(col=0; col<rb.width; col++) {
+          r=rb.data.rgba.r+row*rb.data.rgba.row_step+mincol*rb.data.rgba.pixel_step;
+          g=rb.data.rgba.g+row*rb.data.rgba.row_step+mincol*rb.data.rgba.pixel_step;
+          b=rb.data.rgba.b+row*rb.data.rgba.row_step+mincol*rb.data.rgba.pixel_step;
+          a=rb.data.rgba.a+row*rb.data.rgba.row_step+mincol*rb.data.rgba.pixel_step;
+          ma=mask.data.rgba.a+row*mask.data.rgba.row_step+mincol*mask.data.rgba.pixel_step;
+          for(col=mincol; col<maxcol; col++) {
             if(*ma == 0) {
               *a = *r = *g = *b = 0;
             }
@@ -884,9 +949,14 @@ altformat_cleanup:
     }
     if(!layer->compositer) {
       /*we have a mask layer with no composition configured, do a nomral blend */
-      retcode = renderer->mergeRasterBuffer(image,&rb,1.0,0,0,0,0,rb.width,rb.height);
+      if(!region)
+        retcode = renderer->mergeRasterBuffer(image,&rb,1.0,0,0,0,0,rb.width,rb.height);
+      else if(region->maxx > region->minx && region->maxy > region->miny)
+        retcode = renderer->mergeRasterBuffer(image,&rb,1.0,(int)region->minx,(int)region->miny,
+                                              (int)region->minx,(int)region->miny,
+                                              (int)(region->maxx-region->minx),(int)(region->maxy-region->miny));
     } else {
-      retcode = msCompositeRasterBuffer(map,image,&rb,layer->compositer);
+      retcode = msCompositeRasterBuffer(map,image,&rb,layer->compositer,region);
     }
     if(UNLIKELY(retcode == MS_FAILURE)) {
       goto imagedraw_cleanup;
@@ -896,6 +966,7 @@ imagedraw_cleanup:
     msFreeImage(image_draw);
   }
 
+  msFree(cachekey);
   msImageEndLayer(map,layer,image);
   return(retcode);
 }
@@ -915,6 +986,7 @@ int msDrawVectorLayer(mapObj *map, layerObj *layer, imageObj *image)
   double minfeaturesize = -1;
   int maxfeatures=-1;
   int featuresdrawn=0;
+  double lap;
 
   if (image)
     maxfeatures=msLayerGetMaxFeaturesToDraw(layer, image->format);
@@ -968,6 +1040,13 @@ int msDrawVectorLayer(mapObj *map, layerObj *layer, imageObj *image)
   /* step through the target shapes */
   msInitShape(&shape);
 
+  /* collect consecutive simple lines and polygons into batches for the renderer */
+  msBeginRenderBatch(image);
+
+  /* stamp small markers from cached rasters */
+  if(msLayerGetProcessingKey(layer, "MARKER_CACHE") && strcasecmp(msLayerGetProcessingKey(layer, "MARKER_CACHE"), "ON") == 0)
+    msBeginMarkerCache(image);
+
   nclasses = 0;
   classgroup = NULL;
   if(layer->classgroup && layer->numclasses > 0)
@@ -976,24 +1055,36 @@ int msDrawVectorLayer(mapObj *map, layerObj *layer, imageObj *image)
   if(layer->minfeaturesize > 0)
     minfeaturesize = Pix2LayerGeoref(map, layer, layer->minfeaturesize);
 
+  MS_TRACE_LAP_START(lap);
   while((status = msLayerNextShape(layer, &shape)) == MS_SUCCESS) {
 
+    if (msTraceEnabled) {
+      int i;
+      long numpoints = 0;
+      for(i=0; i<shape.numlines; i++)
+        numpoints += shape.line[i].numpoints;
+      msTraceCount(MS_TRACE_FEATURES, 1);
+      msTraceCount(MS_TRACE_VERTICES, numpoints);
+      msTraceLap(MS_TRACE_NEXTSHAPE, &lap);
+    }
+
     /* Check if the shape size is ok to be drawn */
     if((shape.type == MS_SHAPE_LINE || shape.type == MS_SHAPE_POLYGON) && (minfeaturesize > 0) && (msShapeCheckSize(&shape, minfeaturesize) == MS_FALSE)) {
       if(layer->debug >= MS_DEBUGLEVEL_V)
         msDebug("msDrawVectorLayer(): Skipping shape (%ld) because LAYER::MINFEATURESIZE is bigger than shape size\n", shape.index);
-      msFreeShape(&shape);
+      msLayerRecycleShape(layer, &shape);
       continue;
     }
 
     shape.classindex = msShapeGetClass(layer, map, &shape, classgroup, nclasses);
+    MS_TRACE_LAP(MS_TRACE_CLASSIFY, lap);
     if((shape.classindex == -1) || (layer->class[shape.classindex]->status == MS_OFF)) {
-      msFreeShape(&shape);
+      msLayerRecycleShape(layer, &shape);
       continue;
     }
 
     if(maxfeatures >=0 && featuresdrawn >= maxfeatures) {
-      msFreeShape(&shape);
+      msLayerRecycleShape(layer, &shape);
       status = MS_DONE;
       break;
     }
@@ -1016,14 +1107,14 @@ int msDrawVectorLayer(mapObj *map, layerObj *layer, imageObj *image)
       if(strcasecmp(layer->styleitem, "AUTO") == 0) {
         if(msLayerGetAutoStyle(map, layer, layer->class[shape.classindex], &shape) != MS_SUCCESS) {
           retcode = MS_FAILURE;
-          msFreeShape(&shape);
+          msLayerRecycleShape(layer, &shape);
           break;
         }
       } else {
         /* Generic feature style handling as per RFC-61 */
         if(msLayerGetFeatureStyle(map, layer, layer->class[shape.classindex], &shape) != MS_SUCCESS) {
           retcode = MS_FAILURE;
-          msFreeShape(&shape);
+          msLayerRecycleShape(layer, &shape);
           break;
         }
       }
@@ -1070,20 +1161,21 @@ int msDrawVectorLayer(mapObj *map, layerObj *layer, imageObj *image)
 
     else
       status = msDrawShape(map, layer, &shape, image, -1, drawmode); /* all styles  */
+    MS_TRACE_LAP(MS_TRACE_RENDER, lap);
     if(status != MS_SUCCESS) {
-      msFreeShape(&shape);
+      msLayerRecycleShape(layer, &shape);
       retcode = MS_FAILURE;
       break;
     }
     
     if(shape.numlines == 0) { /* once clipped the shape didn't need to be drawn */
-      msFreeShape(&shape);
+      msLayerRecycleShape(layer, &shape);
       continue;
     }
 
     if(cache) {
       if(insertFeatureList(&shpcache, &shape) == NULL) {
-        msFreeShape(&shape);
+        msLayerRecycleShape(layer, &shape);
         retcode = MS_FAILURE; /* problem adding to the cache */
         break;
       }
@@ -1091,13 +1183,15 @@ int msDrawVectorLayer(mapObj *map, layerObj *layer, imageObj *image)
 
     maxnumstyles = MS_MAX(maxnumstyles, layer->class[shape.classindex]->numstyles);
 
-    msFreeShape(&shape);
+    msLayerRecycleShape(layer, &shape);
   }
 
   if (classgroup)
     msFree(classgroup);
 
   if(status != MS_DONE || retcode == MS_FAILURE) {
+    msEndRenderBatch(image);
+    msEndMarkerCache(image);
     msLayerClose(layer);
     if(shpcache) {
       freeFeatureList(shpcache);
@@ -1122,6 +1216,8 @@ int msDrawVectorLayer(mapObj *map, layerObj *layer, imageObj *image)
           }
           if(s==0 && pStyle->outlinewidth>0 && MS_VALID_COLOR(pStyle->color)) {
             if(UNLIKELY(MS_FAILURE == msDrawLineSymbol(map, image, &current->shape, pStyle, layer->scalefactor))) {
+              msEndRenderBatch(image);
+              msEndMarkerCache(image);
               return MS_FAILURE;
             }
           } else if(s>0) {
@@ -1136,6 +1232,8 @@ int msDrawVectorLayer(mapObj *map, layerObj *layer, imageObj *image)
                */
 	      msOutlineRenderingPrepareStyle(pStyle, map, layer, image);
               if(UNLIKELY(MS_FAILURE == msDrawLineSymbol(map, image, &current->shape, pStyle, layer->scalefactor))) {
+                msEndRenderBatch(image);
+                msEndMarkerCache(image);
                 return MS_FAILURE;
               }
               /*
@@ -1155,8 +1253,11 @@ int msDrawVectorLayer(mapObj *map, layerObj *layer, imageObj *image)
                       )
                     )
               ) {
-              if(UNLIKELY(MS_FAILURE == msDrawLineSymbol(map, image, &current->shape, pStyle, layer->scalefactor)))
+              if(UNLIKELY(MS_FAILURE == msDrawLineSymbol(map, image, &current->shape, pStyle, layer->scalefactor))) {
+                msEndRenderBatch(image);
+                msEndMarkerCache(image);
                 return MS_FAILURE;
+              }
             }
           }
         }
@@ -1167,6 +1268,12 @@ int msDrawVectorLayer(mapObj *map, layerObj *layer, imageObj *image)
     shpcache = NULL;
   }
 
+  msEndMarkerCache(image);
+  if(msEndRenderBatch(image) != MS_SUCCESS) {
+    msLayerClose(layer);
+    return MS_FAILURE;
+  }
+
   msLayerClose(layer);
   return MS_SUCCESS;
 
@@ -2299,9 +2406,9 @@ void offsetAndTest(mapObj *map, labelCacheMemberObj *cachePtr, double ox, double
 
 
   /* the current offset is ok */
-  cachePtr->leaderbbox = msSmallMalloc(sizeof(rectObj));
-  cachePtr->leaderline = msSmallMalloc(sizeof(lineObj));
-  cachePtr->leaderline->point = msSmallMalloc(2 * sizeof(pointObj));
+  cachePtr->leaderbbox = msArenaAlloc(&map->labelcache.arena, sizeof(rectObj));
+  cachePtr->leaderline = msArenaAlloc(&map->labelcache.arena, sizeof(lineObj));
+  cachePtr->leaderline->point = msArenaAlloc(&map->labelcache.arena, 2 * sizeof(pointObj));
   cachePtr->leaderline->numpoints = 2;
   cachePtr->leaderline->point[0] = cachePtr->point;
   cachePtr->leaderline->point[1] = leaderpt;
@@ -2699,8 +2806,10 @@ int msDrawLabelCache(mapObj *map, imageObj *image)
 {
   int nReturnVal = MS_SUCCESS;
   struct mstimeval starttime, endtime;
+  int span;
 
   if(map->debug >= MS_DEBUGLEVEL_TUNING) msGettimeofday(&starttime, NULL);
+  span = MS_TRACE_BEGIN(MS_TRACE_LABELCACHE, NULL);
 
   if(image) {
     if(MS_RENDERER_PLUGIN(image->format)) {
@@ -3164,11 +3273,16 @@ int msDrawLabelCache(mapObj *map, imageObj *image)
     }
   }
 
+  MS_TRACE_END(span);
+
   if(map->debug >= MS_DEBUGLEVEL_TUNING) {
     msGettimeofday(&endtime, NULL);
     msDebug("msDrawMap(): Drawing Label Cache, %.3fs\n",
             (endtime.tv_sec+endtime.tv_usec/1.0e6)-
             (starttime.tv_sec+starttime.tv_usec/1.0e6) );
+    msDebug("msDrawMap(): Label Cache arena, %d allocations, %ld bytes in %d blocks\n",
+            map->labelcache.arena.numallocs, (long)map->labelcache.arena.numbytes,
+            map->labelcache.arena.numblocks);
   }
 
   return nReturnVal;
@@ -178,6 +178,49 @@ extern "C" {
   MS_DLL_EXPORT int msDebugInitFromEnv( void );
   MS_DLL_EXPORT void msDebugCleanup( void );
 
+  /*
+  ** Request tracing: per stage timings and counters of a request written as
+  ** one JSON line (MS_TRACE_FORMAT=json) or as Chrome trace events
+  ** (MS_TRACE_FORMAT=chrome) to the MS_TRACE target. The macros cost a test
+  ** of msTraceEnabled when tracing is not configured.
+  */
+  typedef enum { MS_TRACE_REQUEST,
+                 MS_TRACE_MAPLOAD,
+                 MS_TRACE_DRAWLAYER,
+                 MS_TRACE_LAYEROPEN,
+                 MS_TRACE_WHICHSHAPES,
+                 MS_TRACE_NEXTSHAPE,
+                 MS_TRACE_CLASSIFY,
+                 MS_TRACE_RENDER,
+                 MS_TRACE_LABELCACHE,
+                 MS_TRACE_ENCODE,
+                 MS_TRACE_STAGE_COUNT
+               } msTraceStage;
+
+  typedef enum { MS_TRACE_FEATURES,
+                 MS_TRACE_VERTICES,
+                 MS_TRACE_BYTES,
+                 MS_TRACE_CACHEHITS,
+                 MS_TRACE_COUNTER_COUNT
+               } msTraceCounter;
+
+  extern int msTraceEnabled;
+
+  MS_DLL_EXPORT int msTraceSetOutput(const char *pszTarget, const char *pszFormat);
+  MS_DLL_EXPORT void msTraceStart( void );
+  MS_DLL_EXPORT void msTraceFinish(const char *pszLabel);
+  MS_DLL_EXPORT int msTraceSpanBegin(msTraceStage stage, const char *pszName);
+  MS_DLL_EXPORT void msTraceSpanEnd(int span);
+  MS_DLL_EXPORT void msTraceCount(msTraceCounter counter, long value);
+  MS_DLL_EXPORT double msTraceClock( void );
+  MS_DLL_EXPORT void msTraceLap(msTraceStage stage, double *lap);
+
+#define MS_TRACE_BEGIN(stage, name) (msTraceEnabled ? msTraceSpanBegin((stage), (name)) : -1)
+#define MS_TRACE_END(span) do { if ((span) >= 0) msTraceSpanEnd(span); } while (0)
+#define MS_TRACE_COUNT(counter, value) do { if (msTraceEnabled) msTraceCount((counter), (value)); } while (0)
+#define MS_TRACE_LAP_START(lap) ((lap) = msTraceEnabled ? msTraceClock() : 0)
+#define MS_TRACE_LAP(stage, lap) do { if (msTraceEnabled) msTraceLap((stage), &(lap)); } while (0)
+
 #endif /* SWIG */
 
 #ifdef __cplusplus
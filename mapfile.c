@@ -52,17 +52,17 @@ extern int msyylex(void);
 extern void msyyrestart(FILE *);
 extern int msyylex_destroy(void);
 
-extern double msyynumber;
-extern int msyylineno;
-extern FILE *msyyin;
-
-extern int msyysource;
-extern int msyystate;
-extern char *msyystring;
-extern char *msyybasepath;
-extern int msyyreturncomments;
-extern char *msyystring_buffer;
-extern int msyystring_icase;
+extern MS_THREAD_LOCAL double msyynumber;
+extern MS_THREAD_LOCAL int msyylineno;
+extern MS_THREAD_LOCAL FILE *msyyin;
+
+extern MS_THREAD_LOCAL int msyysource;
+extern MS_THREAD_LOCAL int msyystate;
+extern MS_THREAD_LOCAL char *msyystring;
+extern MS_THREAD_LOCAL char *msyybasepath;
+extern MS_THREAD_LOCAL int msyyreturncomments;
+extern MS_THREAD_LOCAL char *msyystring_buffer;
+extern MS_THREAD_LOCAL int msyystring_icase;
 
 extern int loadSymbol(symbolObj *s, char *symbolpath); /* in mapsymbol.c */
 extern void writeSymbol(symbolObj *s, FILE *stream); /* in mapsymbol.c */
@@ -1042,6 +1042,12 @@ void freeGrid( graticuleObj *pGraticule )
   msFree(pGraticule->labelformat);
   msFree(pGraticule->pboundingpoints);
   msFree(pGraticule->pboundinglines);
+  if(pGraticule->parcs) {
+    int i;
+    for(i=0; i<pGraticule->inumarcs; i++)
+      msFreeShape(&pGraticule->parcs[i]);
+    msFree(pGraticule->parcs);
+  }
 }
 
 static int loadGrid( layerObj *pLayer )
@@ -2014,7 +2020,6 @@ int msUpdateLabelFromString(labelObj *label, char *string, int url_string)
 {
   if(!label || !string) return MS_FAILURE;
 
-  msAcquireLock( TLOCK_PARSER );
   
   if(url_string)
     msyystate = MS_TOKENIZE_URL_STRING;
@@ -2027,10 +2032,8 @@ int msUpdateLabelFromString(labelObj *label, char *string, int url_string)
   msyylineno = 1; /* start at line 1 */
 
   if(loadLabel(label) == -1) {
-    msReleaseLock( TLOCK_PARSER );
     return MS_FAILURE; /* parse error */;
   }
-  msReleaseLock( TLOCK_PARSER );
 
   msyylex_destroy();
   return MS_SUCCESS;
@@ -2252,9 +2255,7 @@ int msLoadExpressionString(expressionObj *exp, char *value)
 {
   int retval = MS_FAILURE;
 
-  msAcquireLock( TLOCK_PARSER );
   retval = loadExpressionString( exp, value );
-  msReleaseLock( TLOCK_PARSER );
 
   return retval;
 }
@@ -2490,7 +2491,6 @@ int msUpdateClusterFromString(clusterObj *cluster, char *string)
 {
   if(!cluster || !string) return MS_FAILURE;
 
-  msAcquireLock( TLOCK_PARSER );
 
   msyystate = MS_TOKENIZE_STRING;
   msyystring = string;
@@ -2499,10 +2499,8 @@ int msUpdateClusterFromString(clusterObj *cluster, char *string)
   msyylineno = 1; /* start at line 1 */
 
   if(loadCluster(cluster) == -1) {
-    msReleaseLock( TLOCK_PARSER );
     return MS_FAILURE; /* parse error */;
   }
-  msReleaseLock( TLOCK_PARSER );
 
   msyylex_destroy();
   return MS_SUCCESS;
@@ -2884,7 +2882,6 @@ int msUpdateStyleFromString(styleObj *style, char *string, int url_string)
 {
   if(!style || !string) return MS_FAILURE;
 
-  msAcquireLock( TLOCK_PARSER );
 
   if(url_string)
     msyystate = MS_TOKENIZE_URL_STRING;
@@ -2896,10 +2893,8 @@ int msUpdateStyleFromString(styleObj *style, char *string, int url_string)
   msyylineno = 1; /* start at line 1 */
 
   if(loadStyle(style) == -1) {
-    msReleaseLock( TLOCK_PARSER );
     return MS_FAILURE; /* parse error */;
   }
-  msReleaseLock( TLOCK_PARSER );
 
   msyylex_destroy();
   return MS_SUCCESS;
@@ -3621,7 +3616,6 @@ int msUpdateClassFromString(classObj *class, char *string, int url_string)
 {
   if(!class || !string) return MS_FAILURE;
 
-  msAcquireLock( TLOCK_PARSER );
 
   if(url_string)
     msyystate = MS_TOKENIZE_URL_STRING;
@@ -3633,10 +3627,8 @@ int msUpdateClassFromString(classObj *class, char *string, int url_string)
   msyylineno = 1; /* start at line 1 */
 
   if(loadClass(class, class->layer) == -1) {
-    msReleaseLock( TLOCK_PARSER );
     return MS_FAILURE; /* parse error */;
   }
-  msReleaseLock( TLOCK_PARSER );
 
   msyylex_destroy();
 
@@ -4719,7 +4711,6 @@ int msUpdateLayerFromString(layerObj *layer, char *string, int url_string)
 
   if(!layer || !string) return MS_FAILURE;
 
-  msAcquireLock( TLOCK_PARSER );
 
   if(url_string)
     msyystate = MS_TOKENIZE_URL_STRING;
@@ -4731,10 +4722,8 @@ int msUpdateLayerFromString(layerObj *layer, char *string, int url_string)
   msyylineno = 1; /* start at line 1 */
 
   if(loadLayer(layer, layer->map) == -1) {
-    msReleaseLock( TLOCK_PARSER );
     return MS_FAILURE; /* parse error */;
   }
-  msReleaseLock( TLOCK_PARSER );
 
   msyylex_destroy();
 
@@ -5074,7 +5063,6 @@ int msUpdateReferenceMapFromString(referenceMapObj *ref, char *string, int url_s
 {
   if(!ref || !string) return MS_FAILURE;
 
-  msAcquireLock( TLOCK_PARSER );
 
   if(url_string)
     msyystate = MS_TOKENIZE_URL_STRING;
@@ -5086,10 +5074,8 @@ int msUpdateReferenceMapFromString(referenceMapObj *ref, char *string, int url_s
   msyylineno = 1; /* start at line 1 */
 
   if(loadReferenceMap(ref, ref->map) == -1) {
-    msReleaseLock( TLOCK_PARSER );
     return MS_FAILURE; /* parse error */;
   }
-  msReleaseLock( TLOCK_PARSER );
 
   msyylex_destroy();
   return MS_SUCCESS;
@@ -5447,7 +5433,6 @@ int msUpdateLegendFromString(legendObj *legend, char *string, int url_string)
 {
   if(!legend || !string) return MS_FAILURE;
 
-  msAcquireLock( TLOCK_PARSER );
 
   if(url_string)
     msyystate = MS_TOKENIZE_URL_STRING;
@@ -5459,10 +5444,8 @@ int msUpdateLegendFromString(legendObj *legend, char *string, int url_string)
   msyylineno = 1; /* start at line 1 */
 
   if(loadLegend(legend, legend->map) == -1) {
-    msReleaseLock( TLOCK_PARSER );
     return MS_FAILURE; /* parse error */;
   }
-  msReleaseLock( TLOCK_PARSER );
 
   msyylex_destroy();
   return MS_SUCCESS;
@@ -5617,7 +5600,6 @@ int msUpdateScalebarFromString(scalebarObj *scalebar, char *string, int url_stri
 {
   if(!scalebar || !string) return MS_FAILURE;
 
-  msAcquireLock( TLOCK_PARSER );
 
   if(url_string)
     msyystate = MS_TOKENIZE_URL_STRING;
@@ -5629,10 +5611,8 @@ int msUpdateScalebarFromString(scalebarObj *scalebar, char *string, int url_stri
   msyylineno = 1; /* start at line 1 */
 
   if(loadScalebar(scalebar) == -1) {
-    msReleaseLock( TLOCK_PARSER );
     return MS_FAILURE; /* parse error */;
   }
-  msReleaseLock( TLOCK_PARSER );
 
   msyylex_destroy();
   return MS_SUCCESS;
@@ -5739,7 +5719,6 @@ int msUpdateQueryMapFromString(queryMapObj *querymap, char *string, int url_stri
 {
   if(!querymap || !string) return MS_FAILURE;
 
-  msAcquireLock( TLOCK_PARSER );
 
   if(url_string)
     msyystate = MS_TOKENIZE_URL_STRING;
@@ -5751,10 +5730,8 @@ int msUpdateQueryMapFromString(queryMapObj *querymap, char *string, int url_stri
   msyylineno = 1; /* start at line 1 */
 
   if(loadQueryMap(querymap) == -1) {
-    msReleaseLock( TLOCK_PARSER );
     return MS_FAILURE; /* parse error */;
   }
-  msReleaseLock( TLOCK_PARSER );
 
   msyylex_destroy();
   return MS_SUCCESS;
@@ -6018,7 +5995,6 @@ int msUpdateWebFromString(webObj *web, char *string, int url_string)
 {
   if(!web || !string) return MS_FAILURE;
 
-  msAcquireLock( TLOCK_PARSER );
 
   if(url_string)
     msyystate = MS_TOKENIZE_URL_STRING;
@@ -6030,10 +6006,8 @@ int msUpdateWebFromString(webObj *web, char *string, int url_string)
   msyylineno = 1; /* start at line 1 */
 
   if(loadWeb(web, web->map) == -1) {
-    msReleaseLock( TLOCK_PARSER );
     return MS_FAILURE; /* parse error */;
   }
-  msReleaseLock( TLOCK_PARSER );
 
   msyylex_destroy();
   return MS_SUCCESS;
@@ -6214,17 +6188,12 @@ int msFreeLabelCacheSlot(labelCacheSlotObj *cacheslot)
         freeTextSymbol(cacheslot->labels[i].textsymbols[j]);
         free(cacheslot->labels[i].textsymbols[j]);
       }
-      msFree(cacheslot->labels[i].textsymbols);
+      /* the textsymbols array and the leader geometry live in the labelCacheObj arena */
 
 #ifdef include_deprecated
       for(j=0; j<cacheslot->labels[i].numstyles; j++) freeStyle(&(cacheslot->labels[i].styles[j]));
       msFree(cacheslot->labels[i].styles);
 #endif
-      if(cacheslot->labels[i].leaderline) {
-        msFree(cacheslot->labels[i].leaderline->point);
-        msFree(cacheslot->labels[i].leaderline);
-        msFree(cacheslot->labels[i].leaderbbox);
-      }
     }
   }
   msFree(cacheslot->labels);
@@ -6251,6 +6220,7 @@ int msFreeLabelCache(labelCacheObj *cache)
 
   cache->num_allocated_rendered_members = cache->num_rendered_members = 0;
   msFree(cache->rendered_text_symbols);
+  msArenaFree(&cache->arena);
 
   return MS_SUCCESS;
 }
@@ -6284,6 +6254,8 @@ int msInitLabelCache(labelCacheObj *cache)
     if (msInitLabelCacheSlot(&(cache->slots[p])) != MS_SUCCESS)
       return MS_FAILURE;
   }
+  /* the slots no longer reference anything allocated from the arena */
+  msArenaReset(&cache->arena);
   cache->gutter = 0;
   cache->num_allocated_rendered_members = cache->num_rendered_members = 0;
   cache->rendered_text_symbols = NULL;
@@ -6630,7 +6602,6 @@ mapObj *msLoadMapFromString(char *buffer, char *new_mappath)
     return(NULL);
   }
 
-  msAcquireLock( TLOCK_PARSER ); /* might need to move this lock a bit higher, yup (bug 2108) */
 
   msyystate = MS_TOKENIZE_STRING;
   msyystring = buffer;
@@ -6642,7 +6613,6 @@ mapObj *msLoadMapFromString(char *buffer, char *new_mappath)
   if(NULL == getcwd(szCWDPath, MS_MAXPATHLEN)) {
     msSetError(MS_MISCERR, "getcwd() returned a too long path", "msLoadMapFromString()");
     msFreeMap(map);
-    msReleaseLock( TLOCK_PARSER );
   }
   if (new_mappath) {
     mappath = msStrdup(new_mappath);
@@ -6654,7 +6624,6 @@ mapObj *msLoadMapFromString(char *buffer, char *new_mappath)
 
   if(loadMapInternal(map) != MS_SUCCESS) {
     msFreeMap(map);
-    msReleaseLock( TLOCK_PARSER );
     if(mappath != NULL) free(mappath);
     return NULL;
   }
@@ -6662,7 +6631,6 @@ mapObj *msLoadMapFromString(char *buffer, char *new_mappath)
   if (mappath != NULL) free(mappath);
   msyylex_destroy();
 
-  msReleaseLock( TLOCK_PARSER );
 
   if (debuglevel >= MS_DEBUGLEVEL_TUNING) {
     /* In debug mode, report time spent loading/parsing mapfile. */
@@ -6686,6 +6654,7 @@ mapObj *msLoadMap(char *filename, char *new_mappath)
   struct mstimeval starttime, endtime;
   char szPath[MS_MAXPATHLEN], szCWDPath[MS_MAXPATHLEN];
   int debuglevel;
+  int span;
 
   debuglevel = (int)msGetGlobalDebugLevel();
 
@@ -6722,7 +6691,6 @@ mapObj *msLoadMap(char *filename, char *new_mappath)
     return(NULL);
   }
 
-  msAcquireLock( TLOCK_PARSER );  /* Steve: might need to move this lock a bit higher; Umberto: done */
 
 #ifdef USE_XMLMAPFILE
   /* If the mapfile is an xml mapfile, transform it */
@@ -6732,7 +6700,6 @@ mapObj *msLoadMap(char *filename, char *new_mappath)
     msyyin = tmpfile();
     if (msyyin == NULL) {
       msSetError(MS_IOERR, "tmpfile() failed to create temporary file", "msLoadMap()");
-      msReleaseLock( TLOCK_PARSER );
     }
 
     if (msTransformXmlMapfile(getenv("MS_XMLMAPFILE_XSLT"), filename, msyyin) != MS_SUCCESS) {
@@ -6744,13 +6711,14 @@ mapObj *msLoadMap(char *filename, char *new_mappath)
 #endif
     if((msyyin = fopen(filename,"r")) == NULL) {
       msSetError(MS_IOERR, "(%s)", "msLoadMap()", filename);
-      msReleaseLock( TLOCK_PARSER );
       return NULL;
     }
 #ifdef USE_XMLMAPFILE
   }
 #endif
 
+  span = MS_TRACE_BEGIN(MS_TRACE_MAPLOAD, filename);
+
   msyystate = MS_TOKENIZE_FILE;
   msyylex(); /* sets things up, but doesn't process any tokens */
 
@@ -6762,7 +6730,6 @@ mapObj *msLoadMap(char *filename, char *new_mappath)
   if(NULL == getcwd(szCWDPath, MS_MAXPATHLEN)) {
     msSetError(MS_MISCERR, "getcwd() returned a too long path", "msLoadMap()");
     msFreeMap(map);
-    msReleaseLock( TLOCK_PARSER );
   }
 
   if (new_mappath)
@@ -6777,14 +6744,15 @@ mapObj *msLoadMap(char *filename, char *new_mappath)
 
   if(loadMapInternal(map) != MS_SUCCESS) {
     msFreeMap(map);
-    msReleaseLock( TLOCK_PARSER );
     if( msyyin ) {
       fclose(msyyin);
       msyyin = NULL;
     }
+    MS_TRACE_END(span);
     return NULL;
   }
-  msReleaseLock( TLOCK_PARSER );
+
+  MS_TRACE_END(span);
 
   if (debuglevel >= MS_DEBUGLEVEL_TUNING) {
     /* In debug mode, report time spent loading/parsing mapfile. */
@@ -7374,9 +7342,7 @@ char **msTokenizeMap(char *filename, int *numtokens)
 {
   char **tokens;
 
-  msAcquireLock( TLOCK_PARSER );
   tokens = tokenizeMapInternal( filename, numtokens );
-  msReleaseLock( TLOCK_PARSER );
 
   return tokens;
 }
@@ -139,6 +139,73 @@ void CleanVSIDir( const char *pszDir )
   CSLDestroy( papszFiles );
 }
 
+/************************************************************************/
+/*                         msGDALAddMemBand()                           */
+/*                                                                      */
+/*      Add a band to a MEM dataset that refers to our own buffer       */
+/*      rather than a copy of it.  The buffer has to stay around        */
+/*      until the dataset is closed.                                    */
+/************************************************************************/
+
+static int msGDALAddMemBand( GDALDatasetH hMemDS, GDALDataType eDataType,
+                             void *data, int pixel_offset, int line_offset )
+
+{
+  char pointer[64], option[64];
+  char **papszBandOptions = NULL;
+  CPLErr eErr;
+
+  memset(pointer, 0, sizeof(pointer));
+  CPLPrintPointer(pointer, data, sizeof(pointer));
+  papszBandOptions = CSLSetNameValue(papszBandOptions, "DATAPOINTER", pointer);
+  snprintf(option, sizeof(option), "%d", pixel_offset);
+  papszBandOptions = CSLSetNameValue(papszBandOptions, "PIXELOFFSET", option);
+  snprintf(option, sizeof(option), "%d", line_offset);
+  papszBandOptions = CSLSetNameValue(papszBandOptions, "LINEOFFSET", option);
+
+  eErr = GDALAddBand( hMemDS, eDataType, papszBandOptions );
+  CSLDestroy( papszBandOptions );
+
+  return (eErr == CE_None) ? MS_SUCCESS : MS_FAILURE;
+}
+
+#if defined(GDAL_COMPUTE_VERSION)
+#if GDAL_VERSION_NUM >= GDAL_COMPUTE_VERSION(2,0,0)
+#define MS_GDAL_STREAM_OUTPUT
+/************************************************************************/
+/*                      msGDALStdoutWriteFunction()                     */
+/************************************************************************/
+
+/* Used by /vsistdout/ */
+static size_t msGDALStdoutWriteFunction(const void* ptr, size_t size, size_t nmemb, FILE* stream)
+{
+  msIOContext *ioctx = (msIOContext*) stream;
+  return msIO_contextWrite(ioctx, ptr, size * nmemb ) / size;
+}
+#endif
+#endif
+
+/************************************************************************/
+/*                       msGDALFormatCanStream()                        */
+/*                                                                      */
+/*      Drivers whose CreateCopy() writes the file front to back, and   */
+/*      so can write straight to /vsistdout/.  GTiff only does so       */
+/*      with STREAMABLE_OUTPUT=YES, which rules out compression.        */
+/************************************************************************/
+
+static int msGDALFormatCanStream( outputFormatObj *format )
+
+{
+  const char *driver = format->driver+5;
+
+  if( EQUAL(driver,"GTiff") )
+    return EQUAL(msGetOutputFormatOption(format,"COMPRESS","NONE"),"NONE")
+           && !CSLTestBoolean(msGetOutputFormatOption(format,"SPARSE_OK","NO"))
+           && !CSLTestBoolean(msGetOutputFormatOption(format,"COPY_SRC_OVERVIEWS","NO"));
+
+  return EQUAL(driver,"PNG") || EQUAL(driver,"JPEG") || EQUAL(driver,"GIF");
+}
+
 /************************************************************************/
 /*                          msSaveImageGDAL()                           */
 /************************************************************************/
@@ -147,11 +214,12 @@ int msSaveImageGDAL( mapObj *map, imageObj *image, char *filename )
 
 {
   int  bFileIsTemporary = MS_FALSE;
+  int  bStreaming = MS_FALSE;
   GDALDatasetH hMemDS, hOutputDS;
   GDALDriverH  hMemDriver, hOutputDriver;
   int          nBands = 1;
-  int          iLine;
-  GByte       *pabyAlphaLine = NULL;
+  int          iBand, i;
+  GByte       *pabyUPM = NULL;
   char        **papszOptions = NULL;
   outputFormatObj *format = image->format;
   rasterBufferObj rb;
@@ -181,18 +249,36 @@ int msSaveImageGDAL( mapObj *map, imageObj *image, char *filename )
   }
 
   /* -------------------------------------------------------------------- */
-  /*      We will need to write the output to a temporary file and        */
-  /*      then stream to stdout if no filename is passed.  If the         */
-  /*      driver supports virtualio then we hold the temporary file in    */
-  /*      memory, otherwise we try to put it in a reasonable temporary    */
-  /*      file location.                                                  */
+  /*      If no filename is passed the output goes to stdout.  Drivers    */
+  /*      that write sequentially do so directly through /vsistdout/.     */
+  /*      Otherwise we write to a temporary file and then stream it to    */
+  /*      stdout.  If the driver supports virtualio then we hold the      */
+  /*      temporary file in memory, otherwise we try to put it in a       */
+  /*      reasonable temporary file location.  The STORAGE format         */
+  /*      option (stream, memory or filesystem) overrides the choice.     */
   /* -------------------------------------------------------------------- */
   if( filename == NULL ) {
     const char *pszExtension = format->extension;
+    const char *storage;
     if( pszExtension == NULL )
       pszExtension = "img.tmp";
 
-    if( bUseXmp == MS_FALSE && GDALGetMetadataItem( hOutputDriver, GDAL_DCAP_VIRTUALIO, NULL )
+    storage = msGetOutputFormatOption( format, "STORAGE", NULL );
+    if( storage == NULL )
+      storage = msGDALFormatCanStream( format ) ? "stream" : "memory";
+
+#ifdef MS_GDAL_STREAM_OUTPUT
+    if( bUseXmp == MS_FALSE && EQUAL(storage,"stream") ) {
+      msIOContext *ioctx = msIO_getHandler( stdout );
+      if( ioctx != NULL ) {
+        filename = msStrdup( "/vsistdout/" );
+        bStreaming = MS_TRUE;
+      }
+    }
+#endif
+
+    if( filename == NULL && bUseXmp == MS_FALSE && !EQUAL(storage,"filesystem")
+        && GDALGetMetadataItem( hOutputDriver, GDAL_DCAP_VIRTUALIO, NULL )
         != NULL ) {
       CleanVSIDir( "/vsimem/msout" );
       filename = msTmpFile(map, NULL, "/vsimem/msout/", pszExtension );
@@ -204,6 +290,8 @@ int msSaveImageGDAL( mapObj *map, imageObj *image, char *filename )
       filename = msTmpFile(map, NULL, NULL, pszExtension );
     }
 
+    /* filename is ours from here on, including /vsistdout/, so every
+       return below must free it */
     bFileIsTemporary = MS_TRUE;
   }
 
@@ -217,19 +305,15 @@ int msSaveImageGDAL( mapObj *map, imageObj *image, char *filename )
     assert( MS_RENDERER_PLUGIN(format) && format->vtable->supports_pixel_buffer );
     if(UNLIKELY(MS_FAILURE == format->vtable->getRasterBufferHandle(image,&rb))) {
       msReleaseLock( TLOCK_GDAL );
+      if( bFileIsTemporary ) free( filename );
       return MS_FAILURE;
     }
   } else if( format->imagemode == MS_IMAGEMODE_RGBA ) {
-    pabyAlphaLine = (GByte *) calloc(image->width,1);
-    if (pabyAlphaLine == NULL) {
-      msReleaseLock( TLOCK_GDAL );
-      msSetError( MS_MEMERR, "Out of memory allocating %u bytes.\n", "msSaveImageGDAL()", image->width);
-      return MS_FAILURE;
-    }
     nBands = 4;
     assert( MS_RENDERER_PLUGIN(format) && format->vtable->supports_pixel_buffer );
     if(UNLIKELY(MS_FAILURE == format->vtable->getRasterBufferHandle(image,&rb))) {
       msReleaseLock( TLOCK_GDAL );
+      if( bFileIsTemporary ) free( filename );
       return MS_FAILURE;
     }
   } else if( format->imagemode == MS_IMAGEMODE_INT16 ) {
@@ -243,119 +327,138 @@ int msSaveImageGDAL( mapObj *map, imageObj *image, char *filename )
     eDataType = GDT_Byte;
   } else {
     msReleaseLock( TLOCK_GDAL );
+    if( bFileIsTemporary ) free( filename );
     msSetError( MS_MEMERR, "Unknown format. This is a bug.", "msSaveImageGDAL()");
     return MS_FAILURE;
   }
 
   /* -------------------------------------------------------------------- */
   /*      Create a memory dataset which we can use as a source for a      */
-  /*      CreateCopy().                                                   */
+  /*      CreateCopy().  Its bands point into the image buffers, only     */
+  /*      premultiplied colors need a copy.                               */
   /* -------------------------------------------------------------------- */
   hMemDriver = GDALGetDriverByName( "MEM" );
   if( hMemDriver == NULL ) {
     msReleaseLock( TLOCK_GDAL );
+    if( bFileIsTemporary ) free( filename );
     msSetError( MS_MISCERR, "Failed to find MEM driver.",
                 "msSaveImageGDAL()" );
     return MS_FAILURE;
   }
 
   hMemDS = GDALCreate( hMemDriver, "msSaveImageGDAL_temp",
-                       image->width, image->height, nBands,
+                       image->width, image->height, 0,
                        eDataType, NULL );
   if( hMemDS == NULL ) {
     msReleaseLock( TLOCK_GDAL );
+    if( bFileIsTemporary ) free( filename );
     msSetError( MS_MISCERR, "Failed to create MEM dataset.",
                 "msSaveImageGDAL()" );
     return MS_FAILURE;
   }
 
   /* -------------------------------------------------------------------- */
-  /*      Copy the gd image into the memory dataset.                      */
+  /*      We need to un-pre-multiply RGB by alpha.                        */
   /* -------------------------------------------------------------------- */
-  for( iLine = 0; iLine < image->height; iLine++ ) {
-    int iBand;
-
-    for( iBand = 0; iBand < nBands; iBand++ ) {
-      GDALRasterBandH hBand = GDALGetRasterBand( hMemDS, iBand+1 );
+  if( rb.type == MS_BUFFER_BYTE_RGBA && rb.data.rgba.a != NULL ) {
+    int iLine;
 
-      if( format->imagemode == MS_IMAGEMODE_INT16 ) {
-        GDALRasterIO( hBand, GF_Write, 0, iLine, image->width, 1,
-                      image->img.raw_16bit + iLine * image->width
-                      + iBand * image->width * image->height,
-                      image->width, 1, GDT_Int16, 2, 0 );
-
-      } else if( format->imagemode == MS_IMAGEMODE_FLOAT32 ) {
-        GDALRasterIO( hBand, GF_Write, 0, iLine, image->width, 1,
-                      image->img.raw_float + iLine * image->width
-                      + iBand * image->width * image->height,
-                      image->width, 1, GDT_Float32, 4, 0 );
-      } else if( format->imagemode == MS_IMAGEMODE_BYTE ) {
-        GDALRasterIO( hBand, GF_Write, 0, iLine, image->width, 1,
-                      image->img.raw_byte + iLine * image->width
-                      + iBand * image->width * image->height,
-                      image->width, 1, GDT_Byte, 1, 0 );
-      } else {
-        GByte *pabyData;
-        unsigned char *pixptr = NULL;
-        assert( rb.type == MS_BUFFER_BYTE_RGBA );
-        switch(iBand) {
-          case 0:
-            pixptr = rb.data.rgba.r;
-            break;
-          case 1:
-            pixptr = rb.data.rgba.g;
-            break;
-          case 2:
-            pixptr = rb.data.rgba.b;
-            break;
-          case 3:
-            pixptr = rb.data.rgba.a;
-            break;
-        }
-        assert(pixptr);
-        if( pixptr == NULL ) {
-          msReleaseLock( TLOCK_GDAL );
-          msSetError( MS_MISCERR, "Missing RGB or A buffer.\n",
-                      "msSaveImageGDAL()" );
-          return MS_FAILURE;
-        }
-
-        pabyData = (GByte *)(pixptr + iLine*rb.data.rgba.row_step);
-
-        if( rb.data.rgba.a == NULL || iBand == 3 ) {
-          GDALRasterIO( hBand, GF_Write, 0, iLine, image->width, 1,
-                        pabyData, image->width, 1, GDT_Byte,
-                        rb.data.rgba.pixel_step, 0 );
-        } else { /* We need to un-pre-multiple RGB by alpha. */
-          GByte *pabyUPM = (GByte*) malloc(image->width);
-          GByte *pabyAlpha= (GByte *)(rb.data.rgba.a + iLine*rb.data.rgba.row_step);
-          int i;
-
-          for( i = 0; i < image->width; i++ ) {
-            int alpha = pabyAlpha[i*rb.data.rgba.pixel_step];
-
-            if( alpha == 0 )
-              pabyUPM[i] = 0;
-            else {
-              int result = (pabyData[i*rb.data.rgba.pixel_step] * 255) / alpha;
-
-              if( result > 255 )
-                result = 255;
-
-              pabyUPM[i] = result;
-            }
-          }
+    pabyUPM = (GByte *) malloc((size_t)image->width * image->height * 3);
+    if( pabyUPM == NULL ) {
+      GDALClose( hMemDS );
+      msReleaseLock( TLOCK_GDAL );
+      if( bFileIsTemporary ) free( filename );
+      msSetError( MS_MEMERR, "Out of memory allocating %u bytes.\n", "msSaveImageGDAL()",
+                  (unsigned int)(image->width * image->height * 3));
+      return MS_FAILURE;
+    }
 
-          GDALRasterIO( hBand, GF_Write, 0, iLine, image->width, 1,
-                        pabyUPM, image->width, 1, GDT_Byte, 1, 0 );
-          free( pabyUPM );
+    for( iLine = 0; iLine < image->height; iLine++ ) {
+      GByte *pabyOut = pabyUPM + (size_t)iLine * image->width * 3;
+      unsigned char *pixel = rb.data.rgba.pixels + iLine*rb.data.rgba.row_step;
+      int roff = rb.data.rgba.r - rb.data.rgba.pixels;
+      int goff = rb.data.rgba.g - rb.data.rgba.pixels;
+      int boff = rb.data.rgba.b - rb.data.rgba.pixels;
+      int aoff = rb.data.rgba.a - rb.data.rgba.pixels;
+
+      for( i = 0; i < image->width; i++, pixel += rb.data.rgba.pixel_step, pabyOut += 3 ) {
+        int alpha = pixel[aoff];
+
+        if( alpha == 0 ) {
+          pabyOut[0] = pabyOut[1] = pabyOut[2] = 0;
+        } else if( alpha == 255 ) {
+          pabyOut[0] = pixel[roff];
+          pabyOut[1] = pixel[goff];
+          pabyOut[2] = pixel[boff];
+        } else {
+          pabyOut[0] = MS_MIN(255, (pixel[roff] * 255) / alpha);
+          pabyOut[1] = MS_MIN(255, (pixel[goff] * 255) / alpha);
+          pabyOut[2] = MS_MIN(255, (pixel[boff] * 255) / alpha);
         }
       }
     }
   }
 
-  if( pabyAlphaLine != NULL )
-    free( pabyAlphaLine );
+  for( iBand = 0; iBand < nBands; iBand++ ) {
+    int status;
+    size_t nBandOffset = (size_t)iBand * image->width * image->height;
+
+    if( format->imagemode == MS_IMAGEMODE_INT16 ) {
+      status = msGDALAddMemBand( hMemDS, GDT_Int16,
+                                 image->img.raw_16bit + nBandOffset,
+                                 2, image->width * 2 );
+    } else if( format->imagemode == MS_IMAGEMODE_FLOAT32 ) {
+      status = msGDALAddMemBand( hMemDS, GDT_Float32,
+                                 image->img.raw_float + nBandOffset,
+                                 4, image->width * 4 );
+    } else if( format->imagemode == MS_IMAGEMODE_BYTE ) {
+      status = msGDALAddMemBand( hMemDS, GDT_Byte,
+                                 image->img.raw_byte + nBandOffset,
+                                 1, image->width );
+    } else if( pabyUPM != NULL && iBand < 3 ) {
+      status = msGDALAddMemBand( hMemDS, GDT_Byte, pabyUPM + iBand,
+                                 3, image->width * 3 );
+    } else {
+      unsigned char *pixptr = NULL;
+      assert( rb.type == MS_BUFFER_BYTE_RGBA );
+      switch(iBand) {
+        case 0:
+          pixptr = rb.data.rgba.r;
+          break;
+        case 1:
+          pixptr = rb.data.rgba.g;
+          break;
+        case 2:
+          pixptr = rb.data.rgba.b;
+          break;
+        case 3:
+          pixptr = rb.data.rgba.a;
+          break;
+      }
+      assert(pixptr);
+      if( pixptr == NULL ) {
+        GDALClose( hMemDS );
+        msReleaseLock( TLOCK_GDAL );
+        free( pabyUPM );
+        if( bFileIsTemporary ) free( filename );
+        msSetError( MS_MISCERR, "Missing RGB or A buffer.\n",
+                    "msSaveImageGDAL()" );
+        return MS_FAILURE;
+      }
+      status = msGDALAddMemBand( hMemDS, GDT_Byte, pixptr,
+                                 rb.data.rgba.pixel_step, rb.data.rgba.row_step );
+    }
+
+    if( status != MS_SUCCESS ) {
+      GDALClose( hMemDS );
+      msReleaseLock( TLOCK_GDAL );
+      free( pabyUPM );
+      if( bFileIsTemporary ) free( filename );
+      msSetError( MS_MISCERR, "Failed to add band to MEM dataset.\n%s",
+                  "msSaveImageGDAL()", CPLGetLastErrorMsg() );
+      return MS_FAILURE;
+    }
+  }
 
   /* -------------------------------------------------------------------- */
   /*      Attach the palette if appropriate.                              */
@@ -399,7 +502,6 @@ int msSaveImageGDAL( mapObj *map, imageObj *image, char *filename )
   /*      Possibly assign a nodata value.                                 */
   /* -------------------------------------------------------------------- */
   if( msGetOutputFormatOption(format,"NULLVALUE",NULL) != NULL ) {
-    int iBand;
     const char *nullvalue = msGetOutputFormatOption(format,
                             "NULLVALUE",NULL);
 
@@ -421,32 +523,52 @@ int msSaveImageGDAL( mapObj *map, imageObj *image, char *filename )
     GDALSetMetadataItem( hMemDS, "TIFFTAG_RESOLUTIONUNIT", "2", NULL );
   }
 
+
   /* -------------------------------------------------------------------- */
   /*      Create a disk image in the selected output format from the      */
   /*      memory image.                                                   */
   /* -------------------------------------------------------------------- */
-  papszOptions = (char**)calloc(sizeof(char *),(format->numformatoptions+1));
-  if (papszOptions == NULL) {
-    msReleaseLock( TLOCK_GDAL );
-    msSetError( MS_MEMERR, "Out of memory allocating %u bytes.\n", "msSaveImageGDAL()",
-                (unsigned int)(sizeof(char *)*(format->numformatoptions+1)));
-    return MS_FAILURE;
+  for( i = 0; i < format->numformatoptions; i++ ) {
+    if( strncasecmp(format->formatoptions[i],"STORAGE=",8) != 0 )
+      papszOptions = CSLAddString( papszOptions, format->formatoptions[i] );
   }
 
-  memcpy( papszOptions, format->formatoptions,
-          sizeof(char *) * format->numformatoptions );
+#ifdef MS_GDAL_STREAM_OUTPUT
+  if( bStreaming ) {
+    if( EQUAL(format->driver+5,"GTiff")
+        && CSLFetchNameValue( papszOptions, "STREAMABLE_OUTPUT" ) == NULL )
+      papszOptions = CSLSetNameValue( papszOptions, "STREAMABLE_OUTPUT", "YES" );
+
+    if( msIO_needBinaryStdout() == MS_FAILURE ) {
+      GDALClose( hMemDS );
+      msReleaseLock( TLOCK_GDAL );
+      CSLDestroy( papszOptions );
+      free( pabyUPM );
+      free( filename );
+      return MS_FAILURE;
+    }
+    VSIStdoutSetRedirection( msGDALStdoutWriteFunction,
+                             (FILE*) msIO_getHandler( stdout ) );
+  }
+#endif
 
   hOutputDS = GDALCreateCopy( hOutputDriver, filename, hMemDS, FALSE,
                               papszOptions, NULL, NULL );
 
-  free( papszOptions );
+  CSLDestroy( papszOptions );
 
   if( hOutputDS == NULL ) {
+#ifdef MS_GDAL_STREAM_OUTPUT
+    if( bStreaming )
+      VSIStdoutSetRedirection( fwrite, stdout );
+#endif
     GDALClose( hMemDS );
     msReleaseLock( TLOCK_GDAL );
+    free( pabyUPM );
     msSetError( MS_MISCERR, "Failed to create output %s file.\n%s",
                 "msSaveImageGDAL()", format->driver+5,
                 CPLGetLastErrorMsg() );
+    if( bFileIsTemporary ) free( filename );
     return MS_FAILURE;
   }
 
@@ -454,8 +576,18 @@ int msSaveImageGDAL( mapObj *map, imageObj *image, char *filename )
   GDALClose( hMemDS );
 
   GDALClose( hOutputDS );
+#ifdef MS_GDAL_STREAM_OUTPUT
+  if( bStreaming )
+    VSIStdoutSetRedirection( fwrite, stdout );
+#endif
   msReleaseLock( TLOCK_GDAL );
 
+  free( pabyUPM );
+
+  if( bStreaming ) {
+    free( filename );
+    return MS_SUCCESS;
+  }
 
   /* -------------------------------------------------------------------- */
   /*      Are we writing license info into the image?                     */
@@ -467,6 +599,7 @@ int msSaveImageGDAL( mapObj *map, imageObj *image, char *filename )
       /* Something bad happened. */
       msSetError( MS_MISCERR, "XMP write to %s failed.\n",
                   "msSaveImageGDAL()", filename);
+      if( bFileIsTemporary ) free( filename );
       return MS_FAILURE;
     }
   }
@@ -481,8 +614,24 @@ int msSaveImageGDAL( mapObj *map, imageObj *image, char *filename )
     unsigned char block[4000];
     int bytes_read;
 
-    if( msIO_needBinaryStdout() == MS_FAILURE )
+    if( msIO_needBinaryStdout() == MS_FAILURE ) {
+      free( filename );
       return MS_FAILURE;
+    }
+
+    /* A file held in memory is written out in one go, without copying */
+    if( strncmp(filename, "/vsimem/", 8) == 0 ) {
+      vsi_l_offset length = 0;
+      GByte *data = VSIGetMemFileBuffer( filename, &length, FALSE );
+
+      if( data != NULL ) {
+        msIO_fwrite( data, 1, (size_t)length, stdout );
+        VSIUnlink( filename );
+        CleanVSIDir( "/vsimem/msout" );
+        free( filename );
+        return MS_SUCCESS;
+      }
+    }
 
     /* We aren't sure how far back GDAL exports the VSI*L API, so
        we only use it if we suspect we need it.  But we do need it if
@@ -492,6 +641,7 @@ int msSaveImageGDAL( mapObj *map, imageObj *image, char *filename )
       msSetError( MS_MISCERR,
                   "Failed to open %s for streaming to stdout.",
                   "msSaveImageGDAL()", filename );
+      free( filename );
       return MS_FAILURE;
     }
 
@@ -377,6 +377,20 @@ GEOSGeom msGEOSShape2Geometry(shapeObj *shape)
   return NULL; /* should not get here */
 }
 
+/*
+** Build the GEOS geometry to be cached on a shape. The shape bounds are
+** recomputed at the same time: callers may build or edit shapes without
+** maintaining them, and the predicates use the bounds of shapes with a
+** cached geometry as a precheck.
+*/
+static GEOSGeom msGEOSCacheGeometry(shapeObj *shape)
+{
+  GEOSGeom g = msGEOSShape2Geometry(shape);
+  if(g)
+    msComputeBounds(shape);
+  return g;
+}
+
 static shapeObj *msGEOSGeometry2Shape_point(GEOSGeom g)
 {
   GEOSCoordSeq coords;
@@ -718,6 +732,11 @@ void msGEOSFreeGeometry(shapeObj *shape)
   if(!shape || !shape->geometry)
     return;
 
+  if(shape->prepared_geometry) {
+    GEOSPreparedGeom_destroy_r(handle, (const GEOSPreparedGeometry *) shape->prepared_geometry);
+    shape->prepared_geometry = NULL;
+  }
+
   g = (GEOSGeom) shape->geometry;
   GEOSGeom_destroy_r(handle,g);
   shape->geometry = NULL;
@@ -766,7 +785,7 @@ char *msGEOSShapeToWKT(shapeObj *shape)
   /* if we have a geometry, we should update it*/
   msGEOSFreeGeometry(shape);
 
-  shape->geometry = (GEOSGeom) msGEOSShape2Geometry(shape);
+  shape->geometry = (GEOSGeom) msGEOSCacheGeometry(shape);
   g = (GEOSGeom) shape->geometry;
   if(!g) return NULL;
 
@@ -798,7 +817,7 @@ shapeObj *msGEOSOffsetCurve(shapeObj *p, double offset) {
     return NULL;
 
   if(!p->geometry) /* if no geometry for the shape then build one */
-    p->geometry = (GEOSGeom) msGEOSShape2Geometry(p);
+    p->geometry = (GEOSGeom) msGEOSCacheGeometry(p);
 
   g1 = (GEOSGeom) p->geometry;
   if(!g1) return NULL;
@@ -825,7 +844,7 @@ shapeObj *msGEOSBuffer(shapeObj *shape, double width)
     return NULL;
 
   if(!shape->geometry) /* if no geometry for the shape then build one */
-    shape->geometry = (GEOSGeom) msGEOSShape2Geometry(shape);
+    shape->geometry = (GEOSGeom) msGEOSCacheGeometry(shape);
 
   g1 = (GEOSGeom) shape->geometry;
   if(!g1) return NULL;
@@ -848,7 +867,7 @@ shapeObj *msGEOSSimplify(shapeObj *shape, double tolerance)
     return NULL;
 
   if(!shape->geometry) /* if no geometry for the shape then build one */
-    shape->geometry = (GEOSGeom) msGEOSShape2Geometry(shape);
+    shape->geometry = (GEOSGeom) msGEOSCacheGeometry(shape);
 
   g1 = (GEOSGeom) shape->geometry;
   if(!g1) return NULL;
@@ -871,7 +890,7 @@ shapeObj *msGEOSTopologyPreservingSimplify(shapeObj *shape, double tolerance)
     return NULL;
 
   if(!shape->geometry) /* if no geometry for the shape then build one */
-    shape->geometry = (GEOSGeom) msGEOSShape2Geometry(shape);
+    shape->geometry = (GEOSGeom) msGEOSCacheGeometry(shape);
 
   g1 = (GEOSGeom) shape->geometry;
   if(!g1) return NULL;
@@ -893,7 +912,7 @@ shapeObj *msGEOSConvexHull(shapeObj *shape)
   if(!shape) return NULL;
 
   if(!shape->geometry) /* if no geometry for the shape then build one */
-    shape->geometry = (GEOSGeom) msGEOSShape2Geometry(shape);
+    shape->geometry = (GEOSGeom) msGEOSCacheGeometry(shape);
   g1 = (GEOSGeom) shape->geometry;
   if(!g1) return NULL;
 
@@ -914,7 +933,7 @@ shapeObj *msGEOSBoundary(shapeObj *shape)
   if(!shape) return NULL;
 
   if(!shape->geometry) /* if no geometry for the shape then build one */
-    shape->geometry = (GEOSGeom) msGEOSShape2Geometry(shape);
+    shape->geometry = (GEOSGeom) msGEOSCacheGeometry(shape);
   g1 = (GEOSGeom) shape->geometry;
   if(!g1) return NULL;
 
@@ -937,7 +956,7 @@ pointObj *msGEOSGetCentroid(shapeObj *shape)
   if(!shape) return NULL;
 
   if(!shape->geometry) /* if no geometry for the shape then build one */
-    shape->geometry = (GEOSGeom) msGEOSShape2Geometry(shape);
+    shape->geometry = (GEOSGeom) msGEOSCacheGeometry(shape);
   g1 = (GEOSGeom) shape->geometry;
   if(!g1) return NULL;
 
@@ -970,12 +989,12 @@ shapeObj *msGEOSUnion(shapeObj *shape1, shapeObj *shape2)
     return NULL;
 
   if(!shape1->geometry) /* if no geometry for the shape then build one */
-    shape1->geometry = (GEOSGeom) msGEOSShape2Geometry(shape1);
+    shape1->geometry = (GEOSGeom) msGEOSCacheGeometry(shape1);
   g1 = (GEOSGeom) shape1->geometry;
   if(!g1) return NULL;
 
   if(!shape2->geometry) /* if no geometry for the shape then build one */
-    shape2->geometry = (GEOSGeom) msGEOSShape2Geometry(shape2);
+    shape2->geometry = (GEOSGeom) msGEOSCacheGeometry(shape2);
   g2 = (GEOSGeom) shape2->geometry;
   if(!g2) return NULL;
 
@@ -997,12 +1016,12 @@ shapeObj *msGEOSIntersection(shapeObj *shape1, shapeObj *shape2)
     return NULL;
 
   if(!shape1->geometry) /* if no geometry for the shape then build one */
-    shape1->geometry = (GEOSGeom) msGEOSShape2Geometry(shape1);
+    shape1->geometry = (GEOSGeom) msGEOSCacheGeometry(shape1);
   g1 = (GEOSGeom) shape1->geometry;
   if(!g1) return NULL;
 
   if(!shape2->geometry) /* if no geometry for the shape then build one */
-    shape2->geometry = (GEOSGeom) msGEOSShape2Geometry(shape2);
+    shape2->geometry = (GEOSGeom) msGEOSCacheGeometry(shape2);
   g2 = (GEOSGeom) shape2->geometry;
   if(!g2) return NULL;
 
@@ -1024,12 +1043,12 @@ shapeObj *msGEOSDifference(shapeObj *shape1, shapeObj *shape2)
     return NULL;
 
   if(!shape1->geometry) /* if no geometry for the shape then build one */
-    shape1->geometry = (GEOSGeom) msGEOSShape2Geometry(shape1);
+    shape1->geometry = (GEOSGeom) msGEOSCacheGeometry(shape1);
   g1 = (GEOSGeom) shape1->geometry;
   if(!g1) return NULL;
 
   if(!shape2->geometry) /* if no geometry for the shape then build one */
-    shape2->geometry = (GEOSGeom) msGEOSShape2Geometry(shape2);
+    shape2->geometry = (GEOSGeom) msGEOSCacheGeometry(shape2);
   g2 = (GEOSGeom) shape2->geometry;
   if(!g2) return NULL;
 
@@ -1051,12 +1070,12 @@ shapeObj *msGEOSSymDifference(shapeObj *shape1, shapeObj *shape2)
     return NULL;
 
   if(!shape1->geometry) /* if no geometry for the shape then build one */
-    shape1->geometry = (GEOSGeom) msGEOSShape2Geometry(shape1);
+    shape1->geometry = (GEOSGeom) msGEOSCacheGeometry(shape1);
   g1 = (GEOSGeom) shape1->geometry;
   if(!g1) return NULL;
 
   if(!shape2->geometry) /* if no geometry for the shape then build one */
-    shape2->geometry = (GEOSGeom) msGEOSShape2Geometry(shape2);
+    shape2->geometry = (GEOSGeom) msGEOSCacheGeometry(shape2);
   g2 = (GEOSGeom) shape2->geometry;
   if(!g2) return NULL;
 
@@ -1072,31 +1091,145 @@ shapeObj *msGEOSSymDifference(shapeObj *shape1, shapeObj *shape2)
 ** Binary predicates exposed to MapServer/MapScript
 */
 
+#ifdef USE_GEOS
+
+#if GEOS_VERSION_MAJOR > 3 || (GEOS_VERSION_MAJOR == 3 && GEOS_VERSION_MINOR >= 3)
+#define USE_GEOS_PREPARED
+#endif
+
+enum MS_GEOS_PREDICATE { MS_GEOS_PREDICATE_CONTAINS, MS_GEOS_PREDICATE_OVERLAPS, MS_GEOS_PREDICATE_WITHIN,
+                         MS_GEOS_PREDICATE_CROSSES, MS_GEOS_PREDICATE_INTERSECTS, MS_GEOS_PREDICATE_TOUCHES,
+                         MS_GEOS_PREDICATE_EQUALS, MS_GEOS_PREDICATE_DISJOINT
+                       };
+
 /*
-** Does shape1 contain shape2, returns MS_TRUE/MS_FALSE or -1 for an error.
+** Current bounds of a shape. Those of a shape with a cached geometry were
+** computed with it (see msGEOSCacheGeometry()), others are computed now.
 */
-int msGEOSContains(shapeObj *shape1, shapeObj *shape2)
+static rectObj *msGEOSGetBounds(shapeObj *shape)
+{
+  if(!shape->geometry)
+    msComputeBounds(shape);
+  return &(shape->bounds);
+}
+
+/*
+** Answer a predicate from the shape bounds alone when possible, returns
+** MS_TRUE/MS_FALSE or -1 when the geometries need to be compared.
+*/
+static int msGEOSBoundsPredicate(shapeObj *shape1, shapeObj *shape2, int predicate)
+{
+  rectObj *r1 = msGEOSGetBounds(shape1);
+  rectObj *r2 = msGEOSGetBounds(shape2);
+
+  if(!msRectOverlap(r1, r2))
+    return (predicate == MS_GEOS_PREDICATE_DISJOINT) ? MS_TRUE : MS_FALSE;
+
+  if(predicate == MS_GEOS_PREDICATE_CONTAINS && !msRectContained(r2, r1))
+    return MS_FALSE;
+  if(predicate == MS_GEOS_PREDICATE_WITHIN && !msRectContained(r1, r2))
+    return MS_FALSE;
+
+  return -1;
+}
+
+/*
+** Evaluate a binary predicate. The GEOS geometries are cached on the
+** shapes; a shape whose geometry was already built by an earlier call
+** (typically a query or filter shape tested against many features) also
+** gets a cached prepared geometry, which makes later tests much cheaper.
+*/
+static int msGEOSPredicate(shapeObj *shape1, shapeObj *shape2, int predicate)
 {
-#ifdef USE_GEOS
   GEOSGeom g1, g2;
-  int result;
+  int result, reused1, reused2;
   GEOSContextHandle_t handle = msGetGeosContextHandle();
 
   if(!shape1 || !shape2)
     return -1;
 
+  if(shape1->numlines > 0 && shape2->numlines > 0) {
+    result = msGEOSBoundsPredicate(shape1, shape2, predicate);
+    if(result != -1) return result;
+  }
+
+  reused1 = (shape1->geometry != NULL);
+  reused2 = (shape2->geometry != NULL);
+
   if(!shape1->geometry) /* if no geometry for shape1 then build one */
-    shape1->geometry = (GEOSGeom) msGEOSShape2Geometry(shape1);
-  g1 = shape1->geometry;
+    shape1->geometry = (GEOSGeom) msGEOSCacheGeometry(shape1);
+  g1 = (GEOSGeom) shape1->geometry;
   if(!g1) return -1;
 
   if(!shape2->geometry) /* if no geometry for shape2 then build one */
-    shape2->geometry = (GEOSGeom) msGEOSShape2Geometry(shape2);
-  g2 = shape2->geometry;
+    shape2->geometry = (GEOSGeom) msGEOSCacheGeometry(shape2);
+  g2 = (GEOSGeom) shape2->geometry;
   if(!g2) return -1;
 
-  result = GEOSContains_r(handle,g1, g2);
+#ifdef USE_GEOS_PREPARED
+  if(predicate != MS_GEOS_PREDICATE_EQUALS) {
+    if(!shape1->prepared_geometry && !shape2->prepared_geometry) {
+      if(reused2)
+        shape2->prepared_geometry = (void *) GEOSPrepare_r(handle, g2);
+      else if(reused1)
+        shape1->prepared_geometry = (void *) GEOSPrepare_r(handle, g1);
+    }
+
+    if(shape1->prepared_geometry) {
+      const GEOSPreparedGeometry *pg1 = (const GEOSPreparedGeometry *) shape1->prepared_geometry;
+      switch(predicate) {
+        case MS_GEOS_PREDICATE_CONTAINS: result = GEOSPreparedContains_r(handle, pg1, g2); break;
+        case MS_GEOS_PREDICATE_OVERLAPS: result = GEOSPreparedOverlaps_r(handle, pg1, g2); break;
+        case MS_GEOS_PREDICATE_WITHIN: result = GEOSPreparedWithin_r(handle, pg1, g2); break;
+        case MS_GEOS_PREDICATE_CROSSES: result = GEOSPreparedCrosses_r(handle, pg1, g2); break;
+        case MS_GEOS_PREDICATE_INTERSECTS: result = GEOSPreparedIntersects_r(handle, pg1, g2); break;
+        case MS_GEOS_PREDICATE_TOUCHES: result = GEOSPreparedTouches_r(handle, pg1, g2); break;
+        default: result = GEOSPreparedDisjoint_r(handle, pg1, g2); break;
+      }
+      return ((result==2) ? -1 : result);
+    }
+
+    if(shape2->prepared_geometry) { /* swap the arguments, contains and within trade places */
+      const GEOSPreparedGeometry *pg2 = (const GEOSPreparedGeometry *) shape2->prepared_geometry;
+      switch(predicate) {
+        case MS_GEOS_PREDICATE_CONTAINS: result = GEOSPreparedWithin_r(handle, pg2, g1); break;
+        case MS_GEOS_PREDICATE_OVERLAPS: result = GEOSPreparedOverlaps_r(handle, pg2, g1); break;
+        case MS_GEOS_PREDICATE_WITHIN: result = GEOSPreparedContains_r(handle, pg2, g1); break;
+        case MS_GEOS_PREDICATE_CROSSES: result = GEOSPreparedCrosses_r(handle, pg2, g1); break;
+        case MS_GEOS_PREDICATE_INTERSECTS: result = GEOSPreparedIntersects_r(handle, pg2, g1); break;
+        case MS_GEOS_PREDICATE_TOUCHES: result = GEOSPreparedTouches_r(handle, pg2, g1); break;
+        default: result = GEOSPreparedDisjoint_r(handle, pg2, g1); break;
+      }
+      return ((result==2) ? -1 : result);
+    }
+  }
+#else
+  (void) reused1;
+  (void) reused2;
+#endif
+
+  switch(predicate) {
+    case MS_GEOS_PREDICATE_CONTAINS: result = GEOSContains_r(handle, g1, g2); break;
+    case MS_GEOS_PREDICATE_OVERLAPS: result = GEOSOverlaps_r(handle, g1, g2); break;
+    case MS_GEOS_PREDICATE_WITHIN: result = GEOSWithin_r(handle, g1, g2); break;
+    case MS_GEOS_PREDICATE_CROSSES: result = GEOSCrosses_r(handle, g1, g2); break;
+    case MS_GEOS_PREDICATE_INTERSECTS: result = GEOSIntersects_r(handle, g1, g2); break;
+    case MS_GEOS_PREDICATE_TOUCHES: result = GEOSTouches_r(handle, g1, g2); break;
+    case MS_GEOS_PREDICATE_EQUALS: result = GEOSEquals_r(handle, g1, g2); break;
+    default: result = GEOSDisjoint_r(handle, g1, g2); break;
+  }
   return ((result==2) ? -1 : result);
+}
+
+#endif
+
+/*
+** Does shape1 contain shape2, returns MS_TRUE/MS_FALSE or -1 for an error.
+*/
+int msGEOSContains(shapeObj *shape1, shapeObj *shape2)
+{
+#ifdef USE_GEOS
+  return msGEOSPredicate(shape1, shape2, MS_GEOS_PREDICATE_CONTAINS);
 #else
   msSetError(MS_GEOSERR, "GEOS support is not available.", "msGEOSContains()");
   return -1;
@@ -1109,25 +1242,7 @@ int msGEOSContains(shapeObj *shape1, shapeObj *shape2)
 int msGEOSOverlaps(shapeObj *shape1, shapeObj *shape2)
 {
 #ifdef USE_GEOS
-  GEOSGeom g1, g2;
-  int result;
-  GEOSContextHandle_t handle = msGetGeosContextHandle();
-
-  if(!shape1 || !shape2)
-    return -1;
-
-  if(!shape1->geometry) /* if no geometry for shape1 then build one */
-    shape1->geometry = (GEOSGeom) msGEOSShape2Geometry(shape1);
-  g1 = shape1->geometry;
-  if(!g1) return -1;
-
-  if(!shape2->geometry) /* if no geometry for shape2 then build one */
-    shape2->geometry = (GEOSGeom) msGEOSShape2Geometry(shape2);
-  g2 = shape2->geometry;
-  if(!g2) return -1;
-
-  result = GEOSOverlaps_r(handle,g1, g2);
-  return ((result==2) ? -1 : result);
+  return msGEOSPredicate(shape1, shape2, MS_GEOS_PREDICATE_OVERLAPS);
 #else
   msSetError(MS_GEOSERR, "GEOS support is not available.", "msGEOSOverlaps()");
   return -1;
@@ -1140,25 +1255,7 @@ int msGEOSOverlaps(shapeObj *shape1, shapeObj *shape2)
 int msGEOSWithin(shapeObj *shape1, shapeObj *shape2)
 {
 #ifdef USE_GEOS
-  GEOSGeom g1, g2;
-  int result;
-  GEOSContextHandle_t handle = msGetGeosContextHandle();
-
-  if(!shape1 || !shape2)
-    return -1;
-
-  if(!shape1->geometry) /* if no geometry for shape1 then build one */
-    shape1->geometry = (GEOSGeom) msGEOSShape2Geometry(shape1);
-  g1 = shape1->geometry;
-  if(!g1) return -1;
-
-  if(!shape2->geometry) /* if no geometry for shape2 then build one */
-    shape2->geometry = (GEOSGeom) msGEOSShape2Geometry(shape2);
-  g2 = shape2->geometry;
-  if(!g2) return -1;
-
-  result = GEOSWithin_r(handle,g1, g2);
-  return ((result==2) ? -1 : result);
+  return msGEOSPredicate(shape1, shape2, MS_GEOS_PREDICATE_WITHIN);
 #else
   msSetError(MS_GEOSERR, "GEOS support is not available.", "msGEOSWithin()");
   return -1;
@@ -1171,25 +1268,7 @@ int msGEOSWithin(shapeObj *shape1, shapeObj *shape2)
 int msGEOSCrosses(shapeObj *shape1, shapeObj *shape2)
 {
 #ifdef USE_GEOS
-  GEOSGeom g1, g2;
-  int result;
-  GEOSContextHandle_t handle = msGetGeosContextHandle();
-
-  if(!shape1 || !shape2)
-    return -1;
-
-  if(!shape1->geometry) /* if no geometry for shape1 then build one */
-    shape1->geometry = (GEOSGeom) msGEOSShape2Geometry(shape1);
-  g1 = shape1->geometry;
-  if(!g1) return -1;
-
-  if(!shape2->geometry) /* if no geometry for shape2 then build one */
-    shape2->geometry = (GEOSGeom) msGEOSShape2Geometry(shape2);
-  g2 = shape2->geometry;
-  if(!g2) return -1;
-
-  result = GEOSCrosses_r(handle,g1, g2);
-  return ((result==2) ? -1 : result);
+  return msGEOSPredicate(shape1, shape2, MS_GEOS_PREDICATE_CROSSES);
 #else
   msSetError(MS_GEOSERR, "GEOS support is not available.", "msGEOSCrosses()");
   return -1;
@@ -1202,25 +1281,7 @@ int msGEOSCrosses(shapeObj *shape1, shapeObj *shape2)
 int msGEOSIntersects(shapeObj *shape1, shapeObj *shape2)
 {
 #ifdef USE_GEOS
-  GEOSGeom g1, g2;
-  int result;
-  GEOSContextHandle_t handle = msGetGeosContextHandle();
-
-  if(!shape1 || !shape2)
-    return -1;
-
-  if(!shape1->geometry) /* if no geometry for shape1 then build one */
-    shape1->geometry = (GEOSGeom) msGEOSShape2Geometry(shape1);
-  g1 = (GEOSGeom) shape1->geometry;
-  if(!g1) return -1;
-
-  if(!shape2->geometry) /* if no geometry for shape2 then build one */
-    shape2->geometry = (GEOSGeom) msGEOSShape2Geometry(shape2);
-  g2 = (GEOSGeom) shape2->geometry;
-  if(!g2) return -1;
-
-  result = GEOSIntersects_r(handle,g1, g2);
-  return ((result==2) ? -1 : result);
+  return msGEOSPredicate(shape1, shape2, MS_GEOS_PREDICATE_INTERSECTS);
 #else
   if(!shape1 || !shape2)
     return -1;
@@ -1254,25 +1315,7 @@ int msGEOSIntersects(shapeObj *shape1, shapeObj *shape2)
 int msGEOSTouches(shapeObj *shape1, shapeObj *shape2)
 {
 #ifdef USE_GEOS
-  GEOSGeom g1, g2;
-  int result;
-  GEOSContextHandle_t handle = msGetGeosContextHandle();
-
-  if(!shape1 || !shape2)
-    return -1;
-
-  if(!shape1->geometry) /* if no geometry for shape1 then build one */
-    shape1->geometry = (GEOSGeom) msGEOSShape2Geometry(shape1);
-  g1 = (GEOSGeom) shape1->geometry;
-  if(!g1) return -1;
-
-  if(!shape2->geometry) /* if no geometry for shape2 then build one */
-    shape2->geometry = (GEOSGeom) msGEOSShape2Geometry(shape2);
-  g2 = (GEOSGeom) shape2->geometry;
-  if(!g2) return -1;
-
-  result = GEOSTouches_r(handle,g1, g2);
-  return ((result==2) ? -1 : result);
+  return msGEOSPredicate(shape1, shape2, MS_GEOS_PREDICATE_TOUCHES);
 #else
   msSetError(MS_GEOSERR, "GEOS support is not available.", "msGEOSTouches()");
   return -1;
@@ -1285,25 +1328,7 @@ int msGEOSTouches(shapeObj *shape1, shapeObj *shape2)
 int msGEOSEquals(shapeObj *shape1, shapeObj *shape2)
 {
 #ifdef USE_GEOS
-  GEOSGeom g1, g2;
-  int result;
-  GEOSContextHandle_t handle = msGetGeosContextHandle();
-
-  if(!shape1 || !shape2)
-    return -1;
-
-  if(!shape1->geometry) /* if no geometry for shape1 then build one */
-    shape1->geometry = (GEOSGeom) msGEOSShape2Geometry(shape1);
-  g1 = (GEOSGeom) shape1->geometry;
-  if(!g1) return -1;
-
-  if(!shape2->geometry) /* if no geometry for shape2 then build one */
-    shape2->geometry = (GEOSGeom) msGEOSShape2Geometry(shape2);
-  g2 = (GEOSGeom) shape2->geometry;
-  if(!g2) return -1;
-
-  result = GEOSEquals_r(handle,g1, g2);
-  return ((result==2) ? -1 : result);
+  return msGEOSPredicate(shape1, shape2, MS_GEOS_PREDICATE_EQUALS);
 #else
   msSetError(MS_GEOSERR, "GEOS support is not available.", "msGEOSEquals()");
   return -1;
@@ -1316,25 +1341,7 @@ int msGEOSEquals(shapeObj *shape1, shapeObj *shape2)
 int msGEOSDisjoint(shapeObj *shape1, shapeObj *shape2)
 {
 #ifdef USE_GEOS
-  GEOSGeom g1, g2;
-  int result;
-  GEOSContextHandle_t handle = msGetGeosContextHandle();
-
-  if(!shape1 || !shape2)
-    return -1;
-
-  if(!shape1->geometry) /* if no geometry for shape1 then build one */
-    shape1->geometry = (GEOSGeom) msGEOSShape2Geometry(shape1);
-  g1 = (GEOSGeom) shape1->geometry;
-  if(!g1) return -1;
-
-  if(!shape2->geometry) /* if no geometry for shape2 then build one */
-    shape2->geometry = (GEOSGeom) msGEOSShape2Geometry(shape2);
-  g2 = (GEOSGeom) shape2->geometry;
-  if(!g2) return -1;
-
-  result = GEOSDisjoint_r(handle,g1, g2);
-  return ((result==2) ? -1 : result);
+  return msGEOSPredicate(shape1, shape2, MS_GEOS_PREDICATE_DISJOINT);
 #else
   msSetError(MS_GEOSERR, "GEOS support is not available.", "msGEOSDisjoint()");
   return -1;
@@ -1355,7 +1362,7 @@ double msGEOSArea(shapeObj *shape)
   if(!shape) return -1;
 
   if(!shape->geometry) /* if no geometry for the shape then build one */
-    shape->geometry = (GEOSGeom) msGEOSShape2Geometry(shape);
+    shape->geometry = (GEOSGeom) msGEOSCacheGeometry(shape);
   g = (GEOSGeom) shape->geometry;
   if(!g) return -1;
 
@@ -1382,7 +1389,7 @@ double msGEOSLength(shapeObj *shape)
   if(!shape) return -1;
 
   if(!shape->geometry) /* if no geometry for the shape then build one */
-    shape->geometry = (GEOSGeom) msGEOSShape2Geometry(shape);
+    shape->geometry = (GEOSGeom) msGEOSCacheGeometry(shape);
   g = (GEOSGeom) shape->geometry;
   if(!g) return -1;
 
@@ -1409,12 +1416,12 @@ double msGEOSDistance(shapeObj *shape1, shapeObj *shape2)
     return -1;
 
   if(!shape1->geometry) /* if no geometry for shape1 then build one */
-    shape1->geometry = (GEOSGeom) msGEOSShape2Geometry(shape1);
+    shape1->geometry = (GEOSGeom) msGEOSCacheGeometry(shape1);
   g1 = (GEOSGeom) shape1->geometry;
   if(!g1) return -1;
 
   if(!shape2->geometry) /* if no geometry for shape2 then build one */
-    shape2->geometry = (GEOSGeom) msGEOSShape2Geometry(shape2);
+    shape2->geometry = (GEOSGeom) msGEOSCacheGeometry(shape2);
   g2 = (GEOSGeom) shape2->geometry;
   if(!g2) return -1;
 
@@ -54,6 +54,7 @@ static int _AdjustLabelPosition( layerObj *pLayer, shapeObj *pShape, msGraticule
 static void _FormatLabel( layerObj *pLayer, shapeObj *pShape, double dDataToFormat );
 
 int msGraticuleLayerInitItemInfo(layerObj *layer);
+int msGraticuleLayerNextShape(layerObj *layer, shapeObj *shape);
 
 #define MAPGRATICULE_ARC_SUBDIVISION_DEFAULT   (256)
 #define MAPGRATICULE_ARC_MINIMUM             (16)
@@ -61,6 +62,211 @@ int msGraticuleLayerInitItemInfo(layerObj *layer);
 #define MAPGRATICULE_FORMAT_STRING_DDMMSS      "%3d %02d %02d"
 #define MAPGRATICULE_FORMAT_STRING_DDMM         "%3d %02d"
 #define MAPGRATICULE_FORMAT_STRING_DD                   "%3d"
+#define MAPGRATICULE_CACHE_MAX_BYTES           (8*1024*1024)
+
+/**********************************************************************************************************************
+ * Reprojected arcs cache
+ *
+ * Densifying and reprojecting the arcs is most of the work of drawing a graticule in a projected map, and gives the
+ * same lines for every extent that DefineAxis() rounds to the same start, end and increment. The reprojected arcs are
+ * kept here keyed on the projections and those values, and handed out by msGraticuleLayerNextShape() in place of the
+ * arcs in the layer projection.
+ */
+typedef struct graticule_cache_entry graticuleCacheEntry;
+struct graticule_cache_entry {
+  char *key;
+  int numarcs;
+  shapeObj *arcs;
+  size_t size;
+  graticuleCacheEntry *next; /* most recently used first */
+};
+
+static graticuleCacheEntry *graticuleCache = NULL;
+static size_t graticuleCacheBytes = 0;
+
+static void graticuleFreeArcs( shapeObj *arcs, int numarcs )
+{
+  int i;
+  for( i = 0; i < numarcs; i++ )
+    msFreeShape( &arcs[i] );
+  msFree( arcs );
+}
+
+static void graticuleCacheEntryFree( graticuleCacheEntry *entry )
+{
+  graticuleCacheBytes -= entry->size;
+  graticuleFreeArcs( entry->arcs, entry->numarcs );
+  msFree( entry->key );
+  msFree( entry );
+}
+
+/* release the cached arcs, called from msCleanup() */
+void msGraticuleCleanup(void)
+{
+  msAcquireLock( TLOCK_GRATICULE );
+  while( graticuleCache ) {
+    graticuleCacheEntry *next = graticuleCache->next;
+    graticuleCacheEntryFree( graticuleCache );
+    graticuleCache = next;
+  }
+  msReleaseLock( TLOCK_GRATICULE );
+}
+
+static void graticuleResetArcs( graticuleObj *pInfo )
+{
+  if( pInfo->parcs )
+    graticuleFreeArcs( pInfo->parcs, pInfo->inumarcs );
+  pInfo->parcs = NULL;
+  pInfo->inumarcs = 0;
+  pInfo->iwhicharc = 0;
+  pInfo->bprojectedarcs = MS_FALSE;
+}
+
+#ifdef USE_PROJ
+static shapeObj *graticuleCopyArcs( shapeObj *arcs, int numarcs )
+{
+  int i;
+  shapeObj *copy = (shapeObj *) msSmallMalloc( sizeof( shapeObj ) * MS_MAX( numarcs, 1 ) );
+  for( i = 0; i < numarcs; i++ ) {
+    msInitShape( &copy[i] );
+    msCopyShape( &arcs[i], &copy[i] );
+  }
+  return copy;
+}
+
+/* copy the cached arcs into pInfo, returns MS_TRUE if found */
+static int graticuleCacheGet( const char *key, graticuleObj *pInfo )
+{
+  graticuleCacheEntry **link, *entry;
+
+  msAcquireLock( TLOCK_GRATICULE );
+  for( link = &graticuleCache; (entry = *link) != NULL; link = &entry->next ) {
+    if( strcmp( entry->key, key ) == 0 ) {
+      pInfo->parcs = graticuleCopyArcs( entry->arcs, entry->numarcs );
+      pInfo->inumarcs = entry->numarcs;
+      *link = entry->next;
+      entry->next = graticuleCache;
+      graticuleCache = entry;
+      break;
+    }
+  }
+  msReleaseLock( TLOCK_GRATICULE );
+
+  if( entry )
+    MS_TRACE_COUNT( MS_TRACE_CACHEHITS, 1 );
+  return entry ? MS_TRUE : MS_FALSE;
+}
+
+static void graticuleCachePut( const char *key, graticuleObj *pInfo )
+{
+  graticuleCacheEntry **link, *entry;
+  size_t size = strlen( key );
+  int i, j;
+
+  for( i = 0; i < pInfo->inumarcs; i++ ) {
+    size += sizeof( shapeObj );
+    for( j = 0; j < pInfo->parcs[i].numlines; j++ )
+      size += sizeof( lineObj ) + sizeof( pointObj ) * pInfo->parcs[i].line[j].numpoints;
+  }
+  if( size > MAPGRATICULE_CACHE_MAX_BYTES / 4 )
+    return; /* would push too many other graticules out */
+
+  entry = (graticuleCacheEntry *) msSmallCalloc( 1, sizeof( graticuleCacheEntry ) );
+  entry->key = msStrdup( key );
+  entry->arcs = graticuleCopyArcs( pInfo->parcs, pInfo->inumarcs );
+  entry->numarcs = pInfo->inumarcs;
+  entry->size = size;
+
+  msAcquireLock( TLOCK_GRATICULE );
+  link = &graticuleCache;
+  while( *link ) {
+    graticuleCacheEntry *e = *link;
+    if( strcmp( e->key, key ) == 0 ) {
+      *link = e->next;
+      graticuleCacheEntryFree( e );
+      continue;
+    }
+    link = &e->next;
+  }
+  entry->next = graticuleCache;
+  graticuleCache = entry;
+  graticuleCacheBytes += entry->size;
+
+  /* drop the least recently used graticules beyond the size limit */
+  link = &graticuleCache->next;
+  while( graticuleCacheBytes > MAPGRATICULE_CACHE_MAX_BYTES && *link ) {
+    graticuleCacheEntry *e;
+    graticuleCacheEntry **last = link;
+    while( (*last)->next )
+      last = &(*last)->next;
+    e = *last;
+    *last = NULL;
+    graticuleCacheEntryFree( e );
+  }
+  msReleaseLock( TLOCK_GRATICULE );
+}
+
+static char *graticuleCacheKey( layerObj *layer )
+{
+  graticuleObj *pInfo = layer->grid;
+  char *key, *proj, buffer[256];
+
+  snprintf( buffer, sizeof( buffer ), "%.17g %.17g %.17g %.17g %.17g %.17g %.17g|",
+            pInfo->dstartlongitude, pInfo->dendlongitude, pInfo->dincrementlongitude,
+            pInfo->dstartlatitude, pInfo->dendlatitude, pInfo->dincrementlatitude, pInfo->maxsubdivides );
+  key = msStrdup( buffer );
+  proj = msGetProjectionString( &layer->projection );
+  key = msStringConcatenate( key, proj );
+  msFree( proj );
+  key = msStringConcatenate( key, "|" );
+  proj = msGetProjectionString( &layer->map->projection );
+  key = msStringConcatenate( key, proj );
+  msFree( proj );
+  return key;
+}
+
+/*
+ * Generate the arcs msGraticuleLayerNextShape() would return for the current extent, without the labels, and
+ * reproject them to the map projection the way msDrawShape() does.
+ */
+static void graticuleGenerateArcs( layerObj *layer )
+{
+  graticuleObj *pInfo = layer->grid;
+  int blabelaxes = pInfo->blabelaxes, maxarcs = 0;
+  shapeObj shape;
+
+  pInfo->blabelaxes = 0;
+  msInitShape( &shape );
+  while( msGraticuleLayerNextShape( layer, &shape ) == MS_SUCCESS ) {
+    if( shape.numlines > 0 ) {
+      msProjectShape( &layer->projection, &layer->map->projection, &shape );
+      if( pInfo->inumarcs == maxarcs ) {
+        maxarcs = MS_MAX( 64, maxarcs * 2 );
+        pInfo->parcs = (shapeObj *) msSmallRealloc( pInfo->parcs, sizeof( shapeObj ) * maxarcs );
+      }
+      pInfo->parcs[pInfo->inumarcs++] = shape; /* kept even if empty, the arcs are handed out in order */
+    } else
+      msFreeShape( &shape );
+    msInitShape( &shape );
+  }
+
+  pInfo->blabelaxes = blabelaxes;
+  pInfo->dwhichlatitude = pInfo->dstartlatitude;
+  pInfo->dwhichlongitude = pInfo->dstartlongitude;
+  pInfo->bvertical = 1;
+  pInfo->ilabelstate = 0;
+}
+#endif
+
+/* hand out the next reprojected arc in place of the one in the layer projection */
+static void graticuleNextArc( graticuleObj *pInfo, shapeObj *shape )
+{
+  msFree( shape->line );
+  shape->line = NULL;
+  shape->numlines = 0;
+  if( pInfo->iwhicharc < pInfo->inumarcs )
+    msCopyShape( &pInfo->parcs[pInfo->iwhicharc++], shape );
+}
 
 /**********************************************************************************************************************
  *
@@ -127,6 +333,13 @@ int msGraticuleLayerIsOpen(layerObj *layer)
  */
 int msGraticuleLayerClose(layerObj *layer)
 {
+  graticuleObj *pInfo = layer->grid;
+
+  if( pInfo && pInfo->bprojectedarcs )
+    layer->project = MS_TRUE;
+  if( pInfo )
+    graticuleResetArcs( pInfo );
+
   return MS_SUCCESS;
 }
 
@@ -142,6 +355,8 @@ int msGraticuleLayerWhichShapes(layerObj *layer, rectObj rect, int isQuery)
   if(msCheckParentPointer(layer->map,"map") == MS_FAILURE)
     return MS_FAILURE;
 
+  graticuleResetArcs( pInfo );
+
   pInfo->dstartlatitude = rect.miny;
   pInfo->dstartlongitude = rect.minx;
   pInfo->dendlatitude = rect.maxy;
@@ -256,6 +471,30 @@ int msGraticuleLayerWhichShapes(layerObj *layer, rectObj rect, int isQuery)
 #endif
   }
 
+#ifdef USE_PROJ
+  /*
+   * When drawing, return the arcs already in the map projection from the cache, the layer is then drawn without
+   * reprojection until it is closed.
+   */
+  if( !isQuery && layer->project && layer->transform == MS_TRUE ) {
+    char *key;
+
+    if( pInfo->minsubdivides <= 0.0 || pInfo->maxsubdivides <= 0.0 )
+      pInfo->minsubdivides = pInfo->maxsubdivides = MAPGRATICULE_ARC_SUBDIVISION_DEFAULT;
+
+    key = graticuleCacheKey( layer );
+    if( !graticuleCacheGet( key, pInfo ) ) {
+      graticuleGenerateArcs( layer );
+      graticuleCachePut( key, pInfo );
+    } else if( layer->debug >= MS_DEBUGLEVEL_VV )
+      msDebug( "msGraticuleLayerWhichShapes(): using %d cached arcs.\n", pInfo->inumarcs );
+    msFree( key );
+
+    pInfo->bprojectedarcs = MS_TRUE;
+    layer->project = MS_FALSE;
+  }
+#endif
+
   return MS_SUCCESS;
 }
 
@@ -307,6 +546,10 @@ int msGraticuleLayerNextShape(layerObj *layer, shapeObj *shape)
         _FormatLabel( layer, shape, shape->line->point[0].x );
         if(_AdjustLabelPosition( layer, shape, posBottom ) != MS_SUCCESS)
           return MS_FAILURE;
+#ifdef USE_PROJ
+        if( pInfo->bprojectedarcs )
+          msProjectShape( &layer->projection, &layer->map->projection, shape );
+#endif
 
         pInfo->ilabelstate++;
         return MS_SUCCESS;
@@ -334,22 +577,30 @@ int msGraticuleLayerNextShape(layerObj *layer, shapeObj *shape)
         _FormatLabel( layer, shape, shape->line->point[0].x );
         if(_AdjustLabelPosition( layer, shape, posTop ) != MS_SUCCESS)
           return MS_FAILURE;
+#ifdef USE_PROJ
+        if( pInfo->bprojectedarcs )
+          msProjectShape( &layer->projection, &layer->map->projection, shape );
+#endif
 
         pInfo->ilabelstate++;
         return MS_SUCCESS;
 
       case 2:
-        shape->line->numpoints = (int) shape->line->numpoints + 1;
-        shape->line->point = (pointObj *) msSmallMalloc( sizeof( pointObj ) * shape->line->numpoints );
+        if( pInfo->bprojectedarcs ) {
+          graticuleNextArc( pInfo, shape );
+        } else {
+          shape->line->numpoints = (int) shape->line->numpoints + 1;
+          shape->line->point = (pointObj *) msSmallMalloc( sizeof( pointObj ) * shape->line->numpoints );
 
-        shape->line->point[0].x = pInfo->dwhichlongitude;
-        shape->line->point[0].y = pInfo->dstartlatitude;
+          shape->line->point[0].x = pInfo->dwhichlongitude;
+          shape->line->point[0].y = pInfo->dstartlatitude;
 
-        for( iPointIndex = 1; iPointIndex < shape->line->numpoints; iPointIndex++ ) {
-          shape->line->point[iPointIndex].x   = pInfo->dwhichlongitude;
-          shape->line->point[iPointIndex].y   = dArcPosition;
+          for( iPointIndex = 1; iPointIndex < shape->line->numpoints; iPointIndex++ ) {
+            shape->line->point[iPointIndex].x   = pInfo->dwhichlongitude;
+            shape->line->point[iPointIndex].y   = dArcPosition;
 
-          dArcPosition += dArcDelta;
+            dArcPosition += dArcDelta;
+          }
         }
 
         pInfo->ilabelstate = 0;
@@ -392,6 +643,10 @@ int msGraticuleLayerNextShape(layerObj *layer, shapeObj *shape)
         _FormatLabel( layer, shape, shape->line->point[0].y );
         if(_AdjustLabelPosition( layer, shape, posLeft ) != MS_SUCCESS)
           return MS_FAILURE;
+#ifdef USE_PROJ
+        if( pInfo->bprojectedarcs )
+          msProjectShape( &layer->projection, &layer->map->projection, shape );
+#endif
 
         pInfo->ilabelstate++;
         return MS_SUCCESS;
@@ -419,22 +674,30 @@ int msGraticuleLayerNextShape(layerObj *layer, shapeObj *shape)
         _FormatLabel( layer, shape, shape->line->point[0].y );
         if(_AdjustLabelPosition( layer, shape, posRight ) != MS_SUCCESS)
           return MS_FAILURE;
+#ifdef USE_PROJ
+        if( pInfo->bprojectedarcs )
+          msProjectShape( &layer->projection, &layer->map->projection, shape );
+#endif
 
         pInfo->ilabelstate++;
         return MS_SUCCESS;
 
       case 2:
-        shape->line->numpoints = (int) shape->line->numpoints + 1;
-        shape->line->point = (pointObj *) msSmallMalloc( sizeof( pointObj ) * shape->line->numpoints );
+        if( pInfo->bprojectedarcs ) {
+          graticuleNextArc( pInfo, shape );
+        } else {
+          shape->line->numpoints = (int) shape->line->numpoints + 1;
+          shape->line->point = (pointObj *) msSmallMalloc( sizeof( pointObj ) * shape->line->numpoints );
 
-        shape->line->point[0].x = pInfo->dstartlongitude;
-        shape->line->point[0].y = pInfo->dwhichlatitude;
+          shape->line->point[0].x = pInfo->dstartlongitude;
+          shape->line->point[0].y = pInfo->dwhichlatitude;
 
-        for(iPointIndex = 1; iPointIndex < shape->line->numpoints; iPointIndex++) {
-          shape->line->point[iPointIndex].x   = dArcPosition;
-          shape->line->point[iPointIndex].y   = pInfo->dwhichlatitude;
+          for(iPointIndex = 1; iPointIndex < shape->line->numpoints; iPointIndex++) {
+            shape->line->point[iPointIndex].x   = dArcPosition;
+            shape->line->point[iPointIndex].y   = pInfo->dwhichlatitude;
 
-          dArcPosition += dArcDelta;
+            dArcPosition += dArcDelta;
+          }
         }
 
         pInfo->ilabelstate    = 0;
@@ -598,7 +861,7 @@ graticuleIntersectionObj *msGraticuleLayerGetIntersectionPoints(mapObj *map,
     layerObj *layer)
 {
 
-  shapeObj    shapegrid, tmpshape;
+  shapeObj    shapegrid;
   rectObj     searchrect;
   int         status;
   pointObj oFirstPoint;
@@ -606,7 +869,8 @@ graticuleIntersectionObj *msGraticuleLayerGetIntersectionPoints(mapObj *map,
   lineObj oLineObj;
   rectObj cliprect;
   graticuleObj   *pInfo  = NULL;
-  double dfTmp;
+  double dfTmp, dfValue;
+  int bVertical, bLabelAxes;
   graticuleIntersectionObj *psValues = NULL;
   int i=0;
 
@@ -649,7 +913,9 @@ graticuleIntersectionObj *msGraticuleLayerGetIntersectionPoints(mapObj *map,
     return NULL;
   }
 
-  /* step through the target shapes */
+  /* step through the arcs, the label positions are not needed */
+  bLabelAxes = pInfo->blabelaxes;
+  pInfo->blabelaxes = 0;
   msInitShape(&shapegrid);
   cliprect.minx = map->extent.minx- map->cellsize;
   cliprect.miny = map->extent.miny- map->cellsize;
@@ -659,22 +925,20 @@ graticuleIntersectionObj *msGraticuleLayerGetIntersectionPoints(mapObj *map,
   /* clip using the layer projection */
   /* msProjectRect(&map->projection , &layer->projection,  &cliprect); */
 
-  while((status = msLayerNextShape(layer, &shapegrid)) == MS_SUCCESS) {
-    /*don't really need a class here*/
-    /*
-      shapegrid.classindex = msShapeGetClass(layer, &shapegrid, map->scaledenom, NULL, 0);
-      if((shapegrid.classindex == -1) || (layer->class[shapegrid.classindex]->status == MS_OFF)) {
-    msFreeShape(&shapegrid);
-    continue;
-    }
-    */
+  for(;;) {
+    msFreeShape(&shapegrid); /* the arcs skipped below are not freed there */
 
-    msInitShape(&tmpshape);
-    msCopyShape(&shapegrid, &tmpshape);
-    /* status = msDrawShape(map, layer, &tmpshape, image, -1); */
+    /* the arc about to be returned, and its value for the label */
+    bVertical = pInfo->bvertical;
+    dfValue = bVertical ? pInfo->dwhichlongitude : pInfo->dwhichlatitude;
+    if((status = msLayerNextShape(layer, &shapegrid)) != MS_SUCCESS)
+      break;
 
+    /* already in the map projection if it came from the cache */
     if(layer->project)
       msProjectShape(&layer->projection, &map->projection, &shapegrid);
+    else
+      msComputeBounds(&shapegrid); /* or the clipping is skipped */
 
     msClipPolylineRect(&shapegrid, cliprect);
 
@@ -685,7 +949,6 @@ graticuleIntersectionObj *msGraticuleLayerGetIntersectionPoints(mapObj *map,
 
     if(shapegrid.numlines <= 0 || shapegrid.line[0].numpoints < 2) { /* once clipped the shape didn't need to be drawn */
       msFreeShape(&shapegrid);
-      msFreeShape(&tmpshape);
       continue;
     }
 
@@ -713,7 +976,9 @@ graticuleIntersectionObj *msGraticuleLayerGetIntersectionPoints(mapObj *map,
       oLastPoint.x = oLineObj.point[oLineObj.numpoints-1].x;
       oLastPoint.y = oLineObj.point[oLineObj.numpoints-1].y;
 
-      if ( pInfo->bvertical) { /*vertical*/
+      _FormatLabel(layer, &shapegrid, dfValue);
+
+      if (bVertical) { /*vertical*/
         /*SHAPES ARE DRAWN FROM BOTTOM TO TOP.*/
         /*Normally lines are drawn FROM BOTTOM TO TOP but not always for some reason, so
           make sure that firstpoint < lastpoint in y, We are in pixel coordinates so y increases as we
@@ -742,15 +1007,7 @@ graticuleIntersectionObj *msGraticuleLayerGetIntersectionPoints(mapObj *map,
           if (oLastPoint.x < 0 || oLastPoint.x > map->width)
             continue;
 
-          if (shapegrid.text)
-            pszLabel =  msStrdup(shapegrid.text);
-          else {
-            _FormatLabel(layer, &tmpshape, tmpshape.line[0].point[tmpshape.line[0].numpoints-1].x );
-            if (tmpshape.text)
-              pszLabel = msStrdup(tmpshape.text);
-            else
-              pszLabel = msStrdup("unknown");
-          }
+          pszLabel = msStrdup(shapegrid.text);
           /*validate that the  value is not already in the array*/
           if ( psValues->nBottom > 0) {
             /* if (psValues->pasBottom[psValues->nBottom-1].x == oFirstPoint.x)
@@ -789,15 +1046,7 @@ graticuleIntersectionObj *msGraticuleLayerGetIntersectionPoints(mapObj *map,
           if (oLastPoint.x < 0 || oLastPoint.x > map->width)
             continue;
 
-          if (shapegrid.text)
-            pszLabel =  msStrdup(shapegrid.text);
-          else {
-            _FormatLabel(layer, &tmpshape, tmpshape.line[0].point[tmpshape.line[0].numpoints-1].x );
-            if (tmpshape.text)
-              pszLabel = msStrdup(tmpshape.text);
-            else
-              pszLabel = msStrdup("unknown");
-          }
+          pszLabel = msStrdup(shapegrid.text);
           /*validate if same value is not already there*/
           if ( psValues->nTop > 0) {
             /* if (psValues->pasTop[psValues->nTop-1].x == oLastPoint.x)
@@ -851,15 +1100,7 @@ graticuleIntersectionObj *msGraticuleLayerGetIntersectionPoints(mapObj *map,
           if (oFirstPoint.y < 0 || oFirstPoint.y > map->height)
             continue;
 
-          if (shapegrid.text)
-            pszLabel =  msStrdup(shapegrid.text);
-          else {
-            _FormatLabel(layer, &tmpshape, tmpshape.line[0].point[tmpshape.line[0].numpoints-1].y );
-            if (tmpshape.text)
-              pszLabel = msStrdup(tmpshape.text);
-            else
-              pszLabel = msStrdup("unknown");
-          }
+          pszLabel = msStrdup(shapegrid.text);
 
           /*validate that the previous value is not the same*/
           if ( psValues->nLeft > 0) {
@@ -898,15 +1139,7 @@ graticuleIntersectionObj *msGraticuleLayerGetIntersectionPoints(mapObj *map,
           if (oLastPoint.y < 0 || oLastPoint.y > map->height)
             continue;
 
-          if (shapegrid.text)
-            pszLabel =  msStrdup(shapegrid.text);
-          else {
-            _FormatLabel(layer, &tmpshape, tmpshape.line[0].point[tmpshape.line[0].numpoints-1].y );
-            if (tmpshape.text)
-              pszLabel = msStrdup(tmpshape.text);
-            else
-              pszLabel = msStrdup("unknown");
-          }
+          pszLabel = msStrdup(shapegrid.text);
 
           /*validate that the previous value is not the same*/
           if ( psValues->nRight > 0) {
@@ -937,13 +1170,13 @@ graticuleIntersectionObj *msGraticuleLayerGetIntersectionPoints(mapObj *map,
         }
       }
       msFreeShape(&shapegrid);
-      msFreeShape(&tmpshape);
     }
     msInitShape(&shapegrid);
 
 
 
   }
+  pInfo->blabelaxes = bLabelAxes;
   msLayerClose(layer);
   return psValues;
 
@@ -1039,7 +1272,7 @@ static int _AdjustLabelPosition( layerObj *pLayer, shapeObj *pShape, msGraticule
   ptPoint = pShape->line->point[0];
 
 #ifdef USE_PROJ
-  if(pLayer->project)
+  if(pLayer->project || pInfo->bprojectedarcs)
     msProjectShape( &pLayer->projection, &pLayer->map->projection, pShape );
 #endif
 
@@ -1081,7 +1314,7 @@ static int _AdjustLabelPosition( layerObj *pLayer, shapeObj *pShape, msGraticule
     msTransformPixelToShape( pShape, pLayer->map->extent, pLayer->map->cellsize );
 
 #ifdef USE_PROJ
-  if(pLayer->project)
+  if(pLayer->project || pInfo->bprojectedarcs)
     msProjectShape( &pLayer->map->projection, &pLayer->projection, pShape );
 #endif
 
@@ -28,11 +28,18 @@
  ****************************************************************************/
 
 #include "mapserver.h"
+#include "mapthread.h"
+#include "uthash.h"
+
+#include <sys/stat.h>
 
 
 
 #define ROW_ALLOCATION_SIZE 10
 
+/* max number of join tables kept by the per process index cache */
+#define JOIN_CACHE_MAX_ENTRIES 16
+
 
 /* DBF/XBase function prototypes */
 int msDBFJoinConnect(layerObj *layer, joinObj *join);
@@ -154,6 +161,226 @@ int msJoinClose(joinObj *join)
   return MS_FAILURE;
 }
 
+/*  */
+/* Join table index cache (XBase and CSV) */
+/*  */
+
+/*
+** Rows of a file based join table are looked up through a hash on the "to"
+** column that is built once when the join is connected. The index (and, for
+** CSV, the parsed rows) are kept for the life of the process and shared by
+** every join on the same file and column, until the file changes on disk.
+** At most JOIN_CACHE_MAX_ENTRIES tables are kept, least recently used go first.
+*/
+typedef struct {
+  char *key;
+  int numrecords;
+  int maxrecords;
+  int *records; /* matching rows, in file order */
+  UT_hash_handle hh;
+} msJoinIndexEntry;
+
+typedef struct msJoinTableCache_t {
+  int type; /* MS_DB_XBASE or MS_DB_CSV */
+  char *path;
+  int column;
+  time_t mtime;
+  off_t size;
+  int refcount;
+  int stale;
+
+  msJoinIndexEntry *index;
+
+  /* CSV only */
+  char ***rows;
+  int *rowitems;
+  int numrows;
+  int numitems;
+
+  struct msJoinTableCache_t *next;
+} msJoinTableCache;
+
+static msJoinTableCache *joinTableCache = NULL;
+
+static int msJoinIndexAdd(msJoinTableCache *table, const char *key, int record)
+{
+  msJoinIndexEntry *entry = NULL;
+
+  UT_HASH_FIND_STR(table->index, key, entry);
+  if(!entry) {
+    entry = (msJoinIndexEntry *) msSmallCalloc(1, sizeof(msJoinIndexEntry));
+    entry->key = msStrdup(key);
+    UT_HASH_ADD_KEYPTR(hh, table->index, entry->key, strlen(entry->key), entry);
+  }
+
+  if(entry->numrecords == entry->maxrecords) {
+    entry->maxrecords = entry->maxrecords ? entry->maxrecords * 2 : 1;
+    entry->records = (int *) msSmallRealloc(entry->records, sizeof(int)*entry->maxrecords);
+  }
+  entry->records[entry->numrecords++] = record;
+
+  return(MS_SUCCESS);
+}
+
+static msJoinIndexEntry *msJoinIndexFind(msJoinTableCache *table, const char *key)
+{
+  msJoinIndexEntry *entry = NULL;
+
+  if(table && table->index && key)
+    UT_HASH_FIND_STR(table->index, key, entry);
+
+  return(entry);
+}
+
+static void msJoinTableCacheFree(msJoinTableCache *table)
+{
+  int i;
+  msJoinIndexEntry *entry, *tmp;
+
+  if(!table) return;
+
+  UT_HASH_ITER(hh, table->index, entry, tmp) {
+    UT_HASH_DEL(table->index, entry);
+    free(entry->key);
+    free(entry->records);
+    free(entry);
+  }
+
+  if(table->rows) {
+    for(i=0; i<table->numrows; i++)
+      msFreeCharArray(table->rows[i], table->rowitems[i]);
+    free(table->rows);
+  }
+  free(table->rowitems);
+  free(table->path);
+  free(table);
+}
+
+/* unlink a table from the cache, freeing it now if nobody else holds it */
+static void msJoinTableCacheUnlink(msJoinTableCache *table)
+{
+  msJoinTableCache **link;
+
+  for(link = &joinTableCache; *link; link = &((*link)->next)) {
+    if(*link == table) {
+      *link = table->next;
+      break;
+    }
+  }
+
+  table->next = NULL;
+  table->stale = MS_TRUE;
+  if(table->refcount == 0)
+    msJoinTableCacheFree(table);
+}
+
+/*
+** Return a referenced cached table for path/column if the file is unchanged,
+** dropping any out of date entry on the way. Returns NULL on a miss.
+*/
+static msJoinTableCache *msJoinTableCacheAcquire(int type, const char *path, int column, struct stat *st)
+{
+  msJoinTableCache **link, *table;
+
+  msAcquireLock(TLOCK_JOIN);
+  for(link = &joinTableCache; (table = *link) != NULL; ) {
+    if(table->type != type || table->column != column || strcmp(table->path, path) != 0) {
+      link = &table->next;
+      continue;
+    }
+
+    if(table->mtime == st->st_mtime && table->size == st->st_size) {
+      table->refcount++;
+      *link = table->next; /* move to the front of the LRU list */
+      table->next = joinTableCache;
+      joinTableCache = table;
+      msReleaseLock(TLOCK_JOIN);
+      MS_TRACE_COUNT(MS_TRACE_CACHEHITS, 1);
+      return(table);
+    }
+
+    msJoinTableCacheUnlink(table); /* file changed on disk */
+  }
+  msReleaseLock(TLOCK_JOIN);
+
+  return(NULL);
+}
+
+/*
+** Add a freshly built table to the cache. If another thread got there first
+** the new table is discarded and the cached one is returned instead.
+*/
+static msJoinTableCache *msJoinTableCacheInsert(msJoinTableCache *table)
+{
+  int n;
+  msJoinTableCache *cached;
+
+  msAcquireLock(TLOCK_JOIN);
+  for(cached = joinTableCache; cached; cached = cached->next) {
+    if(cached->type == table->type && cached->column == table->column &&
+        cached->mtime == table->mtime && cached->size == table->size &&
+        strcmp(cached->path, table->path) == 0) {
+      cached->refcount++;
+      msReleaseLock(TLOCK_JOIN);
+      msJoinTableCacheFree(table);
+      return(cached);
+    }
+  }
+
+  table->refcount = 1;
+  table->next = joinTableCache;
+  joinTableCache = table;
+
+  /* drop the least recently used tables beyond the cache limit */
+  for(n = 1, cached = table; cached->next; ) {
+    if(n < JOIN_CACHE_MAX_ENTRIES) {
+      cached = cached->next;
+      n++;
+    } else
+      msJoinTableCacheUnlink(cached->next);
+  }
+  msReleaseLock(TLOCK_JOIN);
+
+  return(table);
+}
+
+static void msJoinTableCacheRelease(msJoinTableCache *table)
+{
+  if(!table) return;
+
+  msAcquireLock(TLOCK_JOIN);
+  table->refcount--;
+  if(table->stale && table->refcount == 0)
+    msJoinTableCacheFree(table);
+  msReleaseLock(TLOCK_JOIN);
+}
+
+static msJoinTableCache *msJoinTableCacheCreate(int type, const char *path, int column, struct stat *st)
+{
+  msJoinTableCache *table;
+
+  table = (msJoinTableCache *) msSmallCalloc(1, sizeof(msJoinTableCache));
+  table->type = type;
+  table->path = msStrdup(path);
+  table->column = column;
+  table->mtime = st->st_mtime;
+  table->size = st->st_size;
+
+  return(table);
+}
+
+/*
+** Free all cached join tables, called from msCleanup(). Tables still in use
+** are only unlinked and go away with their last msJoinClose().
+*/
+void msJoinCleanup(void)
+{
+  msAcquireLock(TLOCK_JOIN);
+  while(joinTableCache)
+    msJoinTableCacheUnlink(joinTableCache);
+  msReleaseLock(TLOCK_JOIN);
+}
+
 /*  */
 /* XBASE join functions */
 /*  */
@@ -161,13 +388,16 @@ typedef struct {
   DBFHandle hDBF;
   int fromindex, toindex;
   char *target;
-  int nextrecord;
+  msJoinTableCache *table;
+  msJoinIndexEntry *match;
+  int nextmatch;
 } msDBFJoinInfo;
 
 int msDBFJoinConnect(layerObj *layer, joinObj *join)
 {
-  int i;
+  int i, n;
   char szPath[MS_MAXPATHLEN];
+  struct stat st;
   msDBFJoinInfo *joininfo;
 
   if(join->joininfo) return(MS_SUCCESS); /* already open */
@@ -185,7 +415,9 @@ int msDBFJoinConnect(layerObj *layer, joinObj *join)
 
   /* initialize any members that won't get set later on in this function */
   joininfo->target = NULL;
-  joininfo->nextrecord = 0;
+  joininfo->table = NULL;
+  joininfo->match = NULL;
+  joininfo->nextmatch = 0;
 
   join->joininfo = joininfo;
 
@@ -203,6 +435,26 @@ int msDBFJoinConnect(layerObj *layer, joinObj *join)
     return(MS_FAILURE);
   }
 
+  /* index the "to" column, or reuse the index of an unchanged table. The */
+  /* handle is checked rather than szPath, msDBFOpen() may have opened a   */
+  /* .dbf/.DBF sibling of the configured name.                              */
+  if(fstat(fileno(joininfo->hDBF->fp), &st) != 0) {
+    msSetError(MS_IOERR, "(%s)", "msDBFJoinConnect()", join->table);
+    return(MS_FAILURE);
+  }
+
+  if((joininfo->table = msJoinTableCacheAcquire(MS_DB_XBASE, szPath, joininfo->toindex, &st)) == NULL) {
+    msJoinTableCache *table = msJoinTableCacheCreate(MS_DB_XBASE, szPath, joininfo->toindex, &st);
+
+    n = msDBFGetRecordCount(joininfo->hDBF);
+    for(i=0; i<n; i++) {
+      const char *key = msDBFReadStringAttribute(joininfo->hDBF, i, joininfo->toindex);
+      if(key) msJoinIndexAdd(table, key, i);
+    }
+
+    joininfo->table = msJoinTableCacheInsert(table);
+  }
+
   /* get "from" item index   */
   for(i=0; i<layer->numitems; i++) {
     if(strcasecmp(layer->items[i],join->from) == 0) { /* found it */
@@ -243,17 +495,18 @@ int msDBFJoinPrepare(joinObj *join, shapeObj *shape)
     return(MS_FAILURE);
   }
 
-  joininfo->nextrecord = 0; /* starting with the first record */
-
   if(joininfo->target) free(joininfo->target); /* clear last target */
   joininfo->target = msStrdup(shape->values[joininfo->fromindex]);
 
+  joininfo->match = msJoinIndexFind(joininfo->table, joininfo->target);
+  joininfo->nextmatch = 0; /* starting with the first matching record */
+
   return(MS_SUCCESS);
 }
 
 int msDBFJoinNext(joinObj *join)
 {
-  int i, n;
+  int i;
   msDBFJoinInfo *joininfo = join->joininfo;
 
   if(!joininfo) {
@@ -272,13 +525,7 @@ int msDBFJoinNext(joinObj *join)
     join->values = NULL;
   }
 
-  n = msDBFGetRecordCount(joininfo->hDBF);
-
-  for(i=joininfo->nextrecord; i<n; i++) { /* find a match */
-    if(strcmp(joininfo->target, msDBFReadStringAttribute(joininfo->hDBF, i, joininfo->toindex)) == 0) break;
-  }
-
-  if(i == n) { /* unable to do the join */
+  if(!joininfo->match || joininfo->nextmatch >= joininfo->match->numrecords) { /* unable to do the join */
     if((join->values = (char **)malloc(sizeof(char *)*join->numitems)) == NULL) {
       msSetError(MS_MEMERR, NULL, "msDBFJoinNext()");
       return(MS_FAILURE);
@@ -286,14 +533,14 @@ int msDBFJoinNext(joinObj *join)
     for(i=0; i<join->numitems; i++)
       join->values[i] = msStrdup("\0"); /* intialize to zero length strings */
 
-    joininfo->nextrecord = n;
     return(MS_DONE);
   }
 
+  i = joininfo->match->records[joininfo->nextmatch];
   if((join->values = msDBFGetValues(joininfo->hDBF,i)) == NULL)
     return(MS_FAILURE);
 
-  joininfo->nextrecord = i+1; /* so we know where to start looking next time through */
+  joininfo->nextmatch++; /* so we know where to start looking next time through */
 
   return(MS_SUCCESS);
 }
@@ -305,6 +552,7 @@ int msDBFJoinClose(joinObj *join)
   if(!joininfo) return(MS_SUCCESS); /* already closed */
 
   if(joininfo->hDBF) msDBFClose(joininfo->hDBF);
+  msJoinTableCacheRelease(joininfo->table);
   if(joininfo->target) free(joininfo->target);
   free(joininfo);
   joininfo = NULL;
@@ -318,18 +566,65 @@ int msDBFJoinClose(joinObj *join)
 typedef struct {
   int fromindex, toindex;
   char *target;
-  char ***rows;
-  int numrows;
-  int nextrow;
+  msJoinTableCache *table;
+  msJoinIndexEntry *match;
+  int nextmatch;
 } msCSVJoinInfo;
 
+/* load and index a CSV file, returns NULL on failure */
+static msJoinTableCache *msCSVJoinLoadTable(FILE *stream, const char *path, int column, struct stat *st)
+{
+  int i;
+  msJoinTableCache *table;
+  char buffer[MS_BUFFER_LENGTH];
+
+  table = msJoinTableCacheCreate(MS_DB_CSV, path, column, st);
+
+  /* once through to get the number of rows */
+  while(fgets(buffer, MS_BUFFER_LENGTH, stream) != NULL) table->numrows++;
+  rewind(stream);
+
+  table->rows = (char ***) malloc(table->numrows*sizeof(char **));
+  table->rowitems = (int *) malloc(table->numrows*sizeof(int));
+  if(table->numrows > 0 && (!table->rows || !table->rowitems)) {
+    table->numrows = 0;
+    msJoinTableCacheFree(table);
+    msSetError(MS_MEMERR, "Error allocating rows.", "msCSVJoinConnect()");
+    return(NULL);
+  }
+
+  /* load the rows */
+  i = 0;
+  while(i < table->numrows && fgets(buffer, MS_BUFFER_LENGTH, stream) != NULL) {
+    msStringTrimEOL(buffer);
+    table->rows[i] = msStringSplitComplex(buffer, ",", &(table->rowitems[i]), MS_ALLOWEMPTYTOKENS);
+    table->numitems = table->rowitems[i];
+    i++;
+  }
+  table->numrows = i;
+
+  if(column < 0 || column > table->numitems) {
+    msJoinTableCacheFree(table);
+    msSetError(MS_JOINERR, "Invalid column index %d.", "msCSVJoinConnect()", column+1);
+    return(NULL);
+  }
+
+  /* index the join column */
+  for(i=0; i<table->numrows; i++) {
+    if(column < table->rowitems[i])
+      msJoinIndexAdd(table, table->rows[i][column], i);
+  }
+
+  return(table);
+}
+
 int msCSVJoinConnect(layerObj *layer, joinObj *join)
 {
   int i;
   FILE *stream;
   char szPath[MS_MAXPATHLEN];
+  struct stat st;
   msCSVJoinInfo *joininfo;
-  char buffer[MS_BUFFER_LENGTH];
 
   if(join->joininfo) return(MS_SUCCESS); /* already open */
   if ( msCheckParentPointer(layer->map,"map")==MS_FAILURE )
@@ -344,7 +639,9 @@ int msCSVJoinConnect(layerObj *layer, joinObj *join)
 
   /* initialize any members that won't get set later on in this function */
   joininfo->target = NULL;
-  joininfo->nextrow = 0;
+  joininfo->table = NULL;
+  joininfo->match = NULL;
+  joininfo->nextmatch = 0;
 
   join->joininfo = joininfo;
 
@@ -356,26 +653,28 @@ int msCSVJoinConnect(layerObj *layer, joinObj *join)
     }
   }
 
-  /* once through to get the number of rows */
-  joininfo->numrows = 0;
-  while(fgets(buffer, MS_BUFFER_LENGTH, stream) != NULL) joininfo->numrows++;
-  rewind(stream);
+  /* get "to" index (for now the user tells us which column, 1..n) */
+  joininfo->toindex = atoi(join->to) - 1;
 
-  if((joininfo->rows = (char ***) malloc(joininfo->numrows*sizeof(char **))) == NULL) {
+  /* parse and index the rows, or reuse those of an unchanged file */
+  if(fstat(fileno(stream), &st) != 0) {
     fclose(stream);
-    msSetError(MS_MEMERR, "Error allocating rows.", "msCSVJoinConnect()");
+    msSetError(MS_IOERR, "(%s)", "msCSVJoinConnect()", join->table);
     return(MS_FAILURE);
   }
 
-  /* load the rows */
-  i = 0;
-  while(fgets(buffer, MS_BUFFER_LENGTH, stream) != NULL) {
-    msStringTrimEOL(buffer);
-    joininfo->rows[i] = msStringSplitComplex(buffer, ",", &(join->numitems), MS_ALLOWEMPTYTOKENS);
-    i++;
+  if((joininfo->table = msJoinTableCacheAcquire(MS_DB_CSV, szPath, joininfo->toindex, &st)) == NULL) {
+    msJoinTableCache *table = msCSVJoinLoadTable(stream, szPath, joininfo->toindex, &st);
+    if(!table) {
+      fclose(stream);
+      return(MS_FAILURE);
+    }
+    joininfo->table = msJoinTableCacheInsert(table);
   }
   fclose(stream);
 
+  join->numitems = joininfo->table->numitems;
+
   /* get "from" item index   */
   for(i=0; i<layer->numitems; i++) {
     if(strcasecmp(layer->items[i],join->from) == 0) { /* found it */
@@ -389,13 +688,6 @@ int msCSVJoinConnect(layerObj *layer, joinObj *join)
     return(MS_FAILURE);
   }
 
-  /* get "to" index (for now the user tells us which column, 1..n) */
-  joininfo->toindex = atoi(join->to) - 1;
-  if(joininfo->toindex < 0 || joininfo->toindex > join->numitems) {
-    msSetError(MS_JOINERR, "Invalid column index %s.", "msCSVJoinConnect()", join->to);
-    return(MS_FAILURE);
-  }
-
   /* store away the column names (1..n) */
   if((join->items = (char **) malloc(sizeof(char *)*join->numitems)) == NULL) {
     msSetError(MS_MEMERR, "Error allocating space for join item names.", "msCSVJoinConnect()");
@@ -428,11 +720,12 @@ int msCSVJoinPrepare(joinObj *join, shapeObj *shape)
     return(MS_FAILURE);
   }
 
-  joininfo->nextrow = 0; /* starting with the first record */
-
   if(joininfo->target) free(joininfo->target); /* clear last target */
   joininfo->target = msStrdup(shape->values[joininfo->fromindex]);
 
+  joininfo->match = msJoinIndexFind(joininfo->table, joininfo->target);
+  joininfo->nextmatch = 0; /* starting with the first matching row */
+
   return(MS_SUCCESS);
 }
 
@@ -440,11 +733,13 @@ int msCSVJoinNext(joinObj *join)
 {
   int i,j;
   msCSVJoinInfo *joininfo = join->joininfo;
+  msJoinTableCache *table;
 
   if(!joininfo) {
     msSetError(MS_JOINERR, "Join connection has not be created.", "msCSVJoinNext()");
     return(MS_FAILURE);
   }
+  table = joininfo->table;
 
   /* clear any old data */
   if(join->values) {
@@ -452,41 +747,34 @@ int msCSVJoinNext(joinObj *join)
     join->values = NULL;
   }
 
-  for(i=joininfo->nextrow; i<joininfo->numrows; i++) { /* find a match     */
-    if(strcmp(joininfo->target, joininfo->rows[i][joininfo->toindex]) == 0) break;
-  }
-
   if((join->values = (char ** )malloc(sizeof(char *)*join->numitems)) == NULL) {
     msSetError(MS_MEMERR, NULL, "msCSVJoinNext()");
     return(MS_FAILURE);
   }
 
-  if(i == joininfo->numrows) { /* unable to do the join     */
+  if(!joininfo->match || joininfo->nextmatch >= joininfo->match->numrecords) { /* unable to do the join     */
     for(j=0; j<join->numitems; j++)
       join->values[j] = msStrdup("\0"); /* intialize to zero length strings */
 
-    joininfo->nextrow = joininfo->numrows;
     return(MS_DONE);
   }
 
+  i = joininfo->match->records[joininfo->nextmatch];
   for(j=0; j<join->numitems; j++)
-    join->values[j] = msStrdup(joininfo->rows[i][j]);
+    join->values[j] = msStrdup(j < table->rowitems[i] ? table->rows[i][j] : "");
 
-  joininfo->nextrow = i+1; /* so we know where to start looking next time through */
+  joininfo->nextmatch++; /* so we know where to start looking next time through */
 
   return(MS_SUCCESS);
 }
 
 int msCSVJoinClose(joinObj *join)
 {
-  int i;
   msCSVJoinInfo *joininfo = join->joininfo;
 
   if(!joininfo) return(MS_SUCCESS); /* already closed */
 
-  for(i=0; i<joininfo->numrows; i++)
-    msFreeCharArray(joininfo->rows[i], join->numitems);
-  free(joininfo->rows);
+  msJoinTableCacheRelease(joininfo->table);
   if(joininfo->target) free(joininfo->target);
   free(joininfo);
   joininfo = NULL;
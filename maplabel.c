@@ -324,7 +324,7 @@ int msAddLabelGroup(mapObj *map, imageObj *image, layerObj* layer, int classinde
     }
   }
   
-  textsymbols = msSmallMalloc(classPtr->numlabels * sizeof(textSymbolObj*));
+  textsymbols = msArenaAlloc(&map->labelcache.arena, classPtr->numlabels * sizeof(textSymbolObj*));
   
   for(l=0; l<classPtr->numlabels; l++) {
     labelObj *lbl = classPtr->labels[l];
@@ -361,8 +361,7 @@ int msAddLabelGroup(mapObj *map, imageObj *image, layerObj* layer, int classinde
   }
   
   if(numtextsymbols == 0) {
-    free(textsymbols);
-    return MS_SUCCESS;
+    return MS_SUCCESS; /* textsymbols is released with the label cache arena */
   }
   
   /* Validate label priority value and get ref on label cache for it */
@@ -589,7 +588,7 @@ int msAddLabel(mapObj *map, imageObj *image, labelObj *label, int layerindex, in
 
   /* copy the label */
   cachePtr->numtextsymbols = 1;
-  cachePtr->textsymbols = (textSymbolObj **) msSmallMalloc(sizeof(textSymbolObj*));
+  cachePtr->textsymbols = (textSymbolObj **) msArenaAlloc(&map->labelcache.arena, sizeof(textSymbolObj*));
   cachePtr->textsymbols[0] = ts;
   cachePtr->markerid = -1;
 
@@ -213,7 +213,7 @@ int msLayerApplyScaletokens(layerObj *layer, double scale)
 */
 int msLayerOpen(layerObj *layer)
 {
-  int rv;
+  int rv, span;
 
   /* RFC-86 Scale dependant token replacements*/
   rv = msLayerApplyScaletokens(layer,(layer->map)?layer->map->scaledenom:-1);
@@ -237,7 +237,11 @@ int msLayerOpen(layerObj *layer)
     if (rv != MS_SUCCESS)
       return rv;
   }
-  return layer->vtable->LayerOpen(layer);
+
+  span = MS_TRACE_BEGIN(MS_TRACE_LAYEROPEN, layer->name);
+  rv = layer->vtable->LayerOpen(layer);
+  MS_TRACE_END(span);
+  return rv;
 }
 
 /*
@@ -288,15 +292,21 @@ int msLayerTranslateFilter(layerObj *layer, expressionObj *filter, char *filteri
 */
 int msLayerWhichShapes(layerObj *layer, rectObj rect, int isQuery)
 {
+  int rv, span;
+
   if(!msLayerSupportsCommonFilters(layer))
     msLayerTranslateFilter(layer, &layer->filter, layer->filteritem);
 
   if ( ! layer->vtable) {
-    int rv =  msInitializeVirtualTable(layer);
+    rv =  msInitializeVirtualTable(layer);
     if (rv != MS_SUCCESS)
       return rv;
   }
-  return layer->vtable->LayerWhichShapes(layer, rect, isQuery);
+
+  span = MS_TRACE_BEGIN(MS_TRACE_WHICHSHAPES, layer->name);
+  rv = layer->vtable->LayerWhichShapes(layer, rect, isQuery);
+  MS_TRACE_END(span);
+  return rv;
 }
 
 /*
@@ -595,11 +605,11 @@ static int string2list(char **list, int *listsize, char *string)
 extern int msyylex(void);
 extern int msyylex_destroy(void);
 
-extern int msyystate;
-extern char *msyystring; /* string to tokenize */
+extern MS_THREAD_LOCAL int msyystate;
+extern MS_THREAD_LOCAL char *msyystring; /* string to tokenize */
 
-extern double msyynumber; /* token containers */
-extern char *msyystring_buffer;
+extern MS_THREAD_LOCAL double msyynumber; /* token containers */
+extern MS_THREAD_LOCAL char *msyystring_buffer;
 
 const char *msExpressionTokenToString(int token) {
   switch(token) {
@@ -661,7 +671,6 @@ int msTokenizeExpression(expressionObj *expression, char **list, int *listsize)
   /* TODO: make sure the constants can't somehow reference invalid expression types */
   /* if(expression->type != MS_EXPRESSION && expression->type != MS_GEOMTRANSFORM_EXPRESSION) return MS_SUCCESS; */
 
-  msAcquireLock(TLOCK_PARSER);
   msyystate = MS_TOKENIZE_EXPRESSION;
   msyystring = expression->string; /* the thing we're tokenizing */
 
@@ -767,11 +776,9 @@ int msTokenizeExpression(expressionObj *expression, char **list, int *listsize)
 
   expression->curtoken = expression->tokens; /* point at the first token */
 
-  msReleaseLock(TLOCK_PARSER);
   return MS_SUCCESS;
 
 parse_error:
-  msReleaseLock(TLOCK_PARSER);
   return MS_FAILURE;
 }
 
@@ -1751,6 +1758,19 @@ void msLayerEnablePaging(layerObj *layer, int value)
   return layer->vtable->LayerEnablePaging(layer, value);
 }
 
+/*
+** Release a shape returned by msLayerNextShape(). Equivalent to msFreeShape()
+** but lets the provider keep the geometry buffers for the next shape it reads.
+*/
+void msLayerRecycleShape(layerObj *layer, shapeObj *shape)
+{
+  if ( ! layer->vtable) {
+    msFreeShape(shape);
+    return;
+  }
+  layer->vtable->LayerRecycleShape(layer, shape);
+}
+
 int LayerDefaultGetExtent(layerObj *layer, rectObj *extent)
 {
   return MS_FAILURE;
@@ -1813,6 +1833,11 @@ void msLayerDefaultEnablePaging(layerObj *layer, int value)
   return;
 }
 
+void LayerDefaultRecycleShape(layerObj *layer, shapeObj *shape)
+{
+  msFreeShape(shape);
+}
+
 /************************************************************************/
 /*                          LayerDefaultEscapeSQLParam                  */
 /*                                                                      */
@@ -1950,6 +1975,8 @@ static int populateVirtualTable(layerVTableObj *vtable)
   vtable->LayerEnablePaging = msLayerDefaultEnablePaging;
   vtable->LayerGetPaging = msLayerDefaultGetPaging;
 
+  vtable->LayerRecycleShape = LayerDefaultRecycleShape;
+
   return MS_SUCCESS;
 }
 
@@ -0,0 +1,447 @@
+/******************************************************************************
+ * $Id$
+ *
+ * Project:  MapServer
+ * Purpose:  Cache of rendered layer images.
+ * Author:   MapServer team.
+ *
+ ******************************************************************************
+ * Copyright (c) 1996-2016 Regents of the University of Minnesota.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *****************************************************************************/
+
+/*
+** Layers with PROCESSING "LAYER_CACHE_TIMEOUT=<seconds>" keep the premultiplied
+** RGBA buffer they were rendered to, and msDrawLayer() composites that buffer
+** instead of going back to the data source when the same layer is drawn again
+** with the same extent, size, projection and styling. Buffers are kept in
+** memory, shared by all the requests of the process, or in the directory
+** given by PROCESSING "LAYER_CACHE_DIR=<path>" so that they can be shared
+** between processes.
+*/
+
+#include "mapserver.h"
+#include "mapthread.h"
+
+#include <sys/stat.h>
+
+#define LAYER_CACHE_MAX_BYTES (64*1024*1024) /* memory store size limit */
+#define LAYER_CACHE_MAGIC "MSLYRC1"
+
+typedef struct layer_cache_entry layerCacheEntry;
+
+struct layer_cache_entry {
+  char *key;
+  time_t expires;
+  rasterBufferObj rb;
+  size_t size;
+  layerCacheEntry *next;
+};
+
+static layerCacheEntry *layerCache = NULL; /* most recently used first */
+static size_t layerCacheBytes = 0;
+
+/* header of the files of the disk store, followed by the key and the pixels */
+typedef struct {
+  char magic[8];
+  int width, height;
+  int pixel_step, row_step;
+  int offset_r, offset_g, offset_b, offset_a;
+  int keylen;
+} layerCacheFileHeader;
+
+/*
+** Returns the cache timeout of the layer in seconds, or 0 if the layer
+** should not be cached when drawn on this image.
+*/
+int msLayerCacheTimeout(mapObj *map, layerObj *layer, imageObj *image)
+{
+  const char *value;
+  rendererVTableObj *renderer;
+  int i, timeout;
+
+  value = msLayerGetProcessingKey(layer, "LAYER_CACHE_TIMEOUT");
+  if(!value || (timeout = atoi(value)) <= 0)
+    return 0;
+
+  if(!MS_RENDERER_PLUGIN(image->format))
+    return 0;
+  renderer = MS_IMAGE_RENDERER(image);
+  if(!renderer->supports_pixel_buffer || !renderer->getRasterBufferHandle || !renderer->mergeRasterBuffer)
+    return 0;
+  if(layer->compositer && !renderer->compositeRasterBuffer)
+    return 0;
+
+  /* the output of these depends on more than the layer itself */
+  if(layer->mask || layer->connectiontype == MS_WMS || msLayerGetProcessingKey(layer, "RENDERER"))
+    return 0;
+
+  /* labels going to the label cache need the features of the layer */
+  if(layer->labelcache) {
+    for(i=0; i<layer->numclasses; i++) {
+      if(layer->class[i]->numlabels > 0)
+        return 0;
+    }
+  }
+
+  return timeout;
+}
+
+static char *layerCacheKeyAppend(char *key, const char *value)
+{
+  key = msStringConcatenate(key, value ? value : "");
+  return msStringConcatenate(key, "|");
+}
+
+/*
+** The serialized layer covers the data, filters, classes and styles, including
+** the ones created by an SLD. msWriteLayerToString() resets the msIO handlers
+** so the current ones (e.g. a buffered stdout) are restored afterwards.
+*/
+static char *layerCacheDescribeLayer(layerObj *layer)
+{
+  msIOContext *in = msIO_getHandler(stdin);
+  msIOContext *out = msIO_getHandler(stdout);
+  msIOContext *err = msIO_getHandler(stderr);
+  msIOContext saved_in, saved_out, saved_err;
+  char *desc;
+
+  if(!in || !out || !err)
+    return NULL;
+  saved_in = *in;
+  saved_out = *out;
+  saved_err = *err;
+  desc = msWriteLayerToString(layer);
+  msIO_installHandlers(&saved_in, &saved_out, &saved_err);
+
+  return desc;
+}
+
+/*
+** Everything the rendered image depends on. Returns NULL if the layer
+** can't be described, in which case it is drawn without the cache.
+*/
+char *msLayerCacheKey(mapObj *map, layerObj *layer, imageObj *image)
+{
+  char buffer[512];
+  char *key = NULL;
+  char *desc;
+  char *proj;
+
+  desc = layerCacheDescribeLayer(layer);
+  if(!desc)
+    return NULL;
+
+  snprintf(buffer, sizeof(buffer), "%.15g %.15g %.15g %.15g %d %d %.15g %.15g %.15g %.15g",
+           map->extent.minx, map->extent.miny, map->extent.maxx, map->extent.maxy,
+           image->width, image->height, image->resolution, map->defresolution,
+           map->scaledenom, map->gt.rotation_angle);
+  key = layerCacheKeyAppend(key, buffer);
+  key = layerCacheKeyAppend(key, image->format->driver);
+  key = layerCacheKeyAppend(key, image->format->name);
+  key = layerCacheKeyAppend(key, map->name);
+  key = layerCacheKeyAppend(key, map->mappath);
+  key = layerCacheKeyAppend(key, map->shapepath);
+  key = layerCacheKeyAppend(key, map->symbolset.filename);
+  key = layerCacheKeyAppend(key, map->fontset.filename);
+
+  proj = msGetProjectionString(&map->projection);
+  key = layerCacheKeyAppend(key, proj);
+  msFree(proj);
+
+  key = layerCacheKeyAppend(key, desc);
+  msFree(desc);
+
+  return key;
+}
+
+/* 64 bit FNV-1a, names the files of the disk store */
+static void layerCacheHash(const char *key, char *hex)
+{
+  unsigned long long h = 14695981039346656037ULL;
+  for(; *key; key++) {
+    h ^= (unsigned char)*key;
+    h *= 1099511628211ULL;
+  }
+  sprintf(hex, "%016llx", h);
+}
+
+/*
+** Builds the path of the file of the disk store in path. Returns MS_FALSE
+** when the memory store is used, MS_TRUE when path was set and -1 if it
+** didn't fit, in which case the layer isn't cached at all: a
+** truncated path could name the file of another image.
+*/
+static int layerCacheFilename(layerObj *layer, const char *key, char *path)
+{
+  char szPath[MS_MAXPATHLEN];
+  char hex[17];
+  const char *dir = msLayerGetProcessingKey(layer, "LAYER_CACHE_DIR");
+
+  if(!dir)
+    return MS_FALSE;
+  layerCacheHash(key, hex);
+  msBuildPath(szPath, layer->map ? layer->map->mappath : NULL, dir);
+  if(snprintf(path, MS_MAXPATHLEN, "%s/%s.lyrcache", szPath, hex) >= MS_MAXPATHLEN) {
+    if(layer->debug)
+      msDebug("layerCacheFilename(%s): cache path too long, not caching.\n", layer->name);
+    return -1;
+  }
+  return MS_TRUE;
+}
+
+static int layerCacheReadFile(layerObj *layer, const char *path, const char *key, int timeout, rasterBufferObj *rb)
+{
+  layerCacheFileHeader header;
+  struct stat st;
+  FILE *fp;
+  char *filekey = NULL;
+  size_t keylen = strlen(key);
+  int status = MS_FALSE;
+
+  if(stat(path, &st) != 0)
+    return MS_FALSE;
+  if(st.st_mtime + timeout <= time(NULL)) {
+    remove(path); /* expired */
+    return MS_FALSE;
+  }
+
+  fp = fopen(path, "rb");
+  if(!fp)
+    return MS_FALSE;
+
+  /* the header has to describe an RGBA buffer matching the file size */
+  if(fread(&header, sizeof(header), 1, fp) != 1 ||
+      memcmp(header.magic, LAYER_CACHE_MAGIC, sizeof(header.magic)) != 0 ||
+      header.keylen != (int)keylen || header.width <= 0 || header.height <= 0 ||
+      header.pixel_step < 3 || header.pixel_step > 4 ||
+      (long long)header.row_step < (long long)header.width * header.pixel_step ||
+      header.offset_r < 0 || header.offset_r >= header.pixel_step ||
+      header.offset_g < 0 || header.offset_g >= header.pixel_step ||
+      header.offset_b < 0 || header.offset_b >= header.pixel_step ||
+      header.offset_a < -1 || header.offset_a >= header.pixel_step ||
+      (long long)st.st_size != (long long)sizeof(header) + keylen + (long long)header.row_step * header.height)
+    goto done;
+
+  /* different keys may share a hash, check it is the right one */
+  filekey = (char*) msSmallMalloc(keylen);
+  if(fread(filekey, 1, keylen, fp) != keylen || memcmp(filekey, key, keylen) != 0)
+    goto done;
+
+  memset(rb, 0, sizeof(rasterBufferObj));
+  rb->type = MS_BUFFER_BYTE_RGBA;
+  rb->width = header.width;
+  rb->height = header.height;
+  rb->data.rgba.pixel_step = header.pixel_step;
+  rb->data.rgba.row_step = header.row_step;
+  rb->data.rgba.pixels = (unsigned char*) msSmallMalloc((size_t)header.row_step * header.height);
+  if(fread(rb->data.rgba.pixels, header.row_step, header.height, fp) != (size_t)header.height) {
+    msFreeRasterBuffer(rb);
+    goto done;
+  }
+  rb->data.rgba.r = rb->data.rgba.pixels + header.offset_r;
+  rb->data.rgba.g = rb->data.rgba.pixels + header.offset_g;
+  rb->data.rgba.b = rb->data.rgba.pixels + header.offset_b;
+  rb->data.rgba.a = (header.offset_a >= 0) ? rb->data.rgba.pixels + header.offset_a : NULL;
+  status = MS_TRUE;
+
+done:
+  msFree(filekey);
+  fclose(fp);
+  if(!status && layer->debug)
+    msDebug("layerCacheReadFile(%s): ignoring invalid cache file %s\n", layer->name, path);
+  return status;
+}
+
+static void layerCacheWriteFile(layerObj *layer, const char *path, const char *key, rasterBufferObj *rb)
+{
+  char tmppath[MS_MAXPATHLEN];
+  char *tmpname;
+  layerCacheFileHeader header;
+  FILE *fp;
+  int status;
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, LAYER_CACHE_MAGIC, sizeof(header.magic));
+  header.width = rb->width;
+  header.height = rb->height;
+  header.pixel_step = rb->data.rgba.pixel_step;
+  header.row_step = rb->data.rgba.row_step;
+  header.offset_r = (int)(rb->data.rgba.r - rb->data.rgba.pixels);
+  header.offset_g = (int)(rb->data.rgba.g - rb->data.rgba.pixels);
+  header.offset_b = (int)(rb->data.rgba.b - rb->data.rgba.pixels);
+  header.offset_a = rb->data.rgba.a ? (int)(rb->data.rgba.a - rb->data.rgba.pixels) : -1;
+  header.keylen = (int)strlen(key);
+
+  /* write to a private file first so readers never see a partial image */
+  tmpname = msTmpFilename("tmp");
+  snprintf(tmppath, sizeof(tmppath), "%s.%s", path, tmpname);
+  msFree(tmpname);
+
+  fp = fopen(tmppath, "wb");
+  if(!fp) {
+    if(layer->debug)
+      msDebug("layerCacheWriteFile(%s): unable to create %s\n", layer->name, tmppath);
+    return;
+  }
+  status = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+           fwrite(key, 1, header.keylen, fp) == (size_t)header.keylen &&
+           fwrite(rb->data.rgba.pixels, header.row_step, header.height, fp) == (size_t)header.height;
+  if(fclose(fp) != 0)
+    status = MS_FALSE;
+
+  if(status && rename(tmppath, path) != 0) {
+    remove(path); /* rename() doesn't replace existing files on windows */
+    status = (rename(tmppath, path) == 0);
+  }
+  if(!status) {
+    remove(tmppath);
+    if(layer->debug)
+      msDebug("layerCacheWriteFile(%s): unable to write %s\n", layer->name, path);
+  }
+}
+
+static void layerCacheEntryFree(layerCacheEntry *entry)
+{
+  layerCacheBytes -= entry->size;
+  msFreeRasterBuffer(&entry->rb);
+  msFree(entry->key);
+  msFree(entry);
+}
+
+/*
+** Look up the image of the layer, fills rb with a copy the caller has to free
+** with msFreeRasterBuffer(). Returns MS_TRUE if found.
+*/
+int msLayerCacheGet(layerObj *layer, const char *key, int timeout, rasterBufferObj *rb)
+{
+  char path[MS_MAXPATHLEN];
+  layerCacheEntry **link, *entry, *found = NULL;
+  time_t now = time(NULL);
+  int status;
+
+  status = layerCacheFilename(layer, key, path);
+  if(status < 0)
+    return MS_FALSE;
+  if(status == MS_TRUE) {
+    if(!layerCacheReadFile(layer, path, key, timeout, rb))
+      return MS_FALSE;
+  } else {
+    msAcquireLock(TLOCK_LAYERCACHE);
+    link = &layerCache;
+    while((entry = *link) != NULL) {
+      if(entry->expires <= now) {
+        *link = entry->next;
+        layerCacheEntryFree(entry);
+        continue;
+      }
+      if(!found && strcmp(entry->key, key) == 0) {
+        found = entry;
+        *link = entry->next;
+        continue;
+      }
+      link = &entry->next;
+    }
+    if(found) {
+      msCopyRasterBuffer(rb, &found->rb);
+      found->next = layerCache;
+      layerCache = found;
+    }
+    msReleaseLock(TLOCK_LAYERCACHE);
+    if(!found)
+      return MS_FALSE;
+  }
+
+  MS_TRACE_COUNT(MS_TRACE_CACHEHITS, 1);
+  if(layer->debug >= MS_DEBUGLEVEL_V)
+    msDebug("msLayerCacheGet(%s): using cached image.\n", layer->name);
+  return MS_TRUE;
+}
+
+/* keep a copy of the image of the layer */
+void msLayerCachePut(layerObj *layer, const char *key, int timeout, rasterBufferObj *rb)
+{
+  char path[MS_MAXPATHLEN];
+  layerCacheEntry **link, *entry;
+  size_t size;
+  int status;
+
+  if(rb->type != MS_BUFFER_BYTE_RGBA)
+    return;
+
+  status = layerCacheFilename(layer, key, path);
+  if(status < 0)
+    return;
+  if(status == MS_TRUE) {
+    layerCacheWriteFile(layer, path, key, rb);
+    return;
+  }
+
+  size = (size_t)rb->data.rgba.row_step * rb->height + strlen(key);
+  if(size > LAYER_CACHE_MAX_BYTES / 4)
+    return; /* would push too many other images out */
+
+  entry = (layerCacheEntry*) msSmallCalloc(1, sizeof(layerCacheEntry));
+  entry->key = msStrdup(key);
+  entry->expires = time(NULL) + timeout;
+  msCopyRasterBuffer(&entry->rb, rb);
+  entry->size = size;
+
+  msAcquireLock(TLOCK_LAYERCACHE);
+  /* replace the same image */
+  link = &layerCache;
+  while(*link) {
+    layerCacheEntry *e = *link;
+    if(strcmp(e->key, key) == 0) {
+      *link = e->next;
+      layerCacheEntryFree(e);
+      continue;
+    }
+    link = &e->next;
+  }
+  entry->next = layerCache;
+  layerCache = entry;
+  layerCacheBytes += entry->size;
+
+  /* drop the least recently used images beyond the size limit */
+  link = &layerCache->next;
+  while(layerCacheBytes > LAYER_CACHE_MAX_BYTES && *link) {
+    layerCacheEntry *e;
+    layerCacheEntry **last = link;
+    while((*last)->next)
+      last = &(*last)->next;
+    e = *last;
+    *last = NULL;
+    layerCacheEntryFree(e);
+  }
+  msReleaseLock(TLOCK_LAYERCACHE);
+}
+
+/* release the memory store, called from msCleanup() */
+void msLayerCacheCleanup(void)
+{
+  msAcquireLock(TLOCK_LAYERCACHE);
+  while(layerCache) {
+    layerCacheEntry *next = layerCache->next;
+    layerCacheEntryFree(layerCache);
+    layerCache = next;
+  }
+  msReleaseLock(TLOCK_LAYERCACHE);
+}
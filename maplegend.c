@@ -461,6 +461,8 @@ imageObj *msCreateLegendIcon(mapObj* map, layerObj* lp, classObj* class, int wid
   imageObj *image;
   outputFormatObj *format = NULL;
   int i = 0;
+  int cachetimeout;
+  char *cachekey = NULL;
 
   rendererVTableObj *renderer = MS_MAP_RENDERER(map);
 
@@ -469,6 +471,15 @@ imageObj *msCreateLegendIcon(mapObj* map, layerObj* lp, classObj* class, int wid
     return(NULL);
   }
 
+  cachetimeout = lp ? msLegendCacheTimeout(map) : 0;
+  if(cachetimeout > 0) {
+    cachekey = msLegendCacheKey(map, lp, class, width, height, scale_independant);
+    if(cachekey && (image = msLegendCacheGetImage(map, cachekey)) != NULL) {
+      msFree(cachekey);
+      return image;
+    }
+  }
+
   /* ensure we have an image format representing the options for the legend */
   msApplyOutputFormat(&format, map->outputformat, map->legend.transparent, map->legend.interlace, MS_NOOVERRIDE);
 
@@ -480,6 +491,7 @@ imageObj *msCreateLegendIcon(mapObj* map, layerObj* lp, classObj* class, int wid
 
   if(image == NULL) {
     msSetError(MS_IMGERR, "Unable to initialize image.","msCreateLegendIcon()");
+    msFree(cachekey);
     return(NULL);
   }
   image->map = map;
@@ -492,17 +504,24 @@ imageObj *msCreateLegendIcon(mapObj* map, layerObj* lp, classObj* class, int wid
     if (class) {
       if(UNLIKELY(MS_FAILURE == msDrawLegendIcon(map, lp, class, width, height, image, 0, 0, scale_independant, NULL))) {
         msFreeImage(image);
+        msFree(cachekey);
         return NULL;
       }
     } else {
       for (i=0; i<lp->numclasses; i++) {
         if(UNLIKELY(MS_FAILURE == msDrawLegendIcon(map, lp, lp->class[i], width, height, image, 0, 0, scale_independant, NULL))) {
           msFreeImage(image);
+          msFree(cachekey);
           return NULL;
         }
       }
     }
   }
+
+  if(cachekey) {
+    msLegendCachePutImage(cachekey, cachetimeout, image);
+    msFree(cachekey);
+  }
   return image;
 }
 
@@ -641,13 +660,34 @@ imageObj *msDrawLegend(mapObj *map, int scale_independent, map_hittest *hittest)
   };
   typedef struct legend_struct legendlabel;
   legendlabel *head=NULL,*cur=NULL;
+  int cachetimeout;
+  char *cachekey = NULL;
 
   if(!MS_RENDERER_PLUGIN(map->outputformat)) {
     msSetError(MS_MISCERR,"unsupported output format","msDrawLegend()");
     return NULL;
   }
   if(msValidateContexts(map) != MS_SUCCESS) return NULL; /* make sure there are no recursive REQUIRES or LABELREQUIRES expressions */
-  if(msLegendCalcSize(map, scale_independent, &size_x, &size_y, NULL, 0, hittest, map->resolution/map->defresolution) != MS_SUCCESS) return NULL;
+
+  /* legends of the features of the map (hittest) are never cached */
+  cachetimeout = hittest ? 0 : msLegendCacheTimeout(map);
+  if(cachetimeout > 0) {
+    if(!scale_independent) { /* as msLegendCalcSize() would */
+      map->cellsize = msAdjustExtent(&(map->extent), map->width, map->height);
+      if(msCalculateScale(map->extent, map->units, map->width, map->height, map->resolution, &map->scaledenom) != MS_SUCCESS)
+        return NULL;
+    }
+    cachekey = msLegendCacheKey(map, NULL, NULL, 0, 0, scale_independent);
+    if(cachekey && (image = msLegendCacheGetImage(map, cachekey)) != NULL) {
+      msFree(cachekey);
+      return image;
+    }
+  }
+
+  if(msLegendCalcSize(map, scale_independent, &size_x, &size_y, NULL, 0, hittest, map->resolution/map->defresolution) != MS_SUCCESS) {
+    msFree(cachekey);
+    return NULL;
+  }
 
   /*
    * step through all map classes, and for each one that will be displayed
@@ -728,6 +768,7 @@ imageObj *msDrawLegend(mapObj *map, int scale_independent, map_hittest *hittest)
   image = msImageCreate(size_x, size_y, format, map->web.imagepath, map->web.imageurl, map->resolution, map->defresolution, &map->legend.imagecolor);
   if(!image) {
     msSetError(MS_MISCERR, "Unable to initialize image.", "msDrawLegend()");
+    msFree(cachekey);
     return NULL;
   }
   image->map = map;
@@ -785,8 +826,13 @@ cleanup:
   }
   if(UNLIKELY(ret != MS_SUCCESS)) {
     if(image) msFreeImage(image);
+    msFree(cachekey);
     return NULL;
   }
+  if(cachekey) {
+    msLegendCachePutImage(cachekey, cachetimeout, image);
+    msFree(cachekey);
+  }
   return(image);
 }
 
@@ -0,0 +1,419 @@
+/******************************************************************************
+ * $Id$
+ *
+ * Project:  MapServer
+ * Purpose:  Cache of rendered legends and legend icons.
+ * Author:   MapServer team.
+ *
+ ******************************************************************************
+ * Copyright (c) 1996-2016 Regents of the University of Minnesota.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *****************************************************************************/
+
+/*
+** With CONFIG "MS_LEGEND_CACHE_TIMEOUT" "<seconds>" the images built by
+** msDrawLegend() and msCreateLegendIcon() are kept in memory, shared by all
+** the requests of the process, and handed out again while the map, the
+** layers and the legend settings they were drawn from are unchanged. WMS
+** GetLegendGraphic additionally keeps the encoded image of AGG PNG and JPEG
+** legends so that it doesn't have to be compressed again.
+**
+** The key is built from the serialized legend and layers (so classes added
+** or changed by an SLD give different entries), the output format, the
+** resolution and, for scale dependent legends, the scale. The extent is left
+** out so that panning reuses the legend, only layers sized in other units
+** than pixels or limited by GEOWIDTH add the cell size or extent width.
+** Legends that depend on the map content (hittests) are never cached.
+*/
+
+#include "mapserver.h"
+#include "mapthread.h"
+
+#define LEGEND_CACHE_MAX_BYTES (16*1024*1024) /* memory store size limit */
+
+typedef struct legend_cache_entry legendCacheEntry;
+
+struct legend_cache_entry {
+  char *key;
+  int encoded; /* data holds the encoded image, otherwise rb the pixels */
+  time_t expires;
+  rasterBufferObj rb;
+  unsigned char *data;
+  int datasize;
+  size_t size;
+  legendCacheEntry *next;
+};
+
+static legendCacheEntry *legendCache = NULL; /* most recently used first */
+static size_t legendCacheBytes = 0;
+
+/*
+** Returns the cache timeout in seconds for legends drawn with the current
+** output format of the map, or 0 if they should not be cached.
+*/
+int msLegendCacheTimeout(mapObj *map)
+{
+  const char *value;
+  rendererVTableObj *renderer;
+  int timeout;
+
+  value = msGetConfigOption(map, "MS_LEGEND_CACHE_TIMEOUT");
+  if(!value || (timeout = atoi(value)) <= 0)
+    return 0;
+
+  if(!map->outputformat || !MS_RENDERER_PLUGIN(map->outputformat))
+    return 0;
+  renderer = MS_MAP_RENDERER(map);
+  if(!renderer || !renderer->supports_pixel_buffer ||
+      !renderer->getRasterBufferHandle || !renderer->mergeRasterBuffer)
+    return 0;
+
+  return timeout;
+}
+
+static char *legendCacheKeyAppend(char *key, const char *value)
+{
+  key = msStringConcatenate(key, value ? value : "");
+  return msStringConcatenate(key, "|");
+}
+
+/*
+** The msWrite*ToString() functions reset the msIO handlers, restore the
+** current ones (e.g. a buffered stdout) afterwards.
+*/
+static char *legendCacheDescribe(legendObj *legend, layerObj *layer, classObj *theclass)
+{
+  msIOContext *in = msIO_getHandler(stdin);
+  msIOContext *out = msIO_getHandler(stdout);
+  msIOContext *err = msIO_getHandler(stderr);
+  msIOContext saved_in, saved_out, saved_err;
+  char *desc;
+
+  if(!in || !out || !err)
+    return NULL;
+  saved_in = *in;
+  saved_out = *out;
+  saved_err = *err;
+  if(legend)
+    desc = msWriteLegendToString(legend);
+  else if(layer)
+    desc = msWriteLayerToString(layer);
+  else
+    desc = msWriteClassToString(theclass);
+  msIO_installHandlers(&saved_in, &saved_out, &saved_err);
+
+  return desc;
+}
+
+static char *legendCacheKeyAppendDescription(char *key, legendObj *legend, layerObj *layer, classObj *theclass)
+{
+  char *desc = legendCacheDescribe(legend, layer, theclass);
+  if(!desc) {
+    msFree(key);
+    return NULL;
+  }
+  key = legendCacheKeyAppend(key, desc);
+  msFree(desc);
+  return key;
+}
+
+/*
+** Everything the legend (lp == NULL) or the icon of theclass of lp (all its
+** classes if theclass is NULL) depends on. Returns NULL if it can't be
+** described, in which case the legend is drawn without the cache.
+*/
+char *msLegendCacheKey(mapObj *map, layerObj *lp, classObj *theclass, int width, int height, int scale_independent)
+{
+  char buffer[512];
+  char *key = NULL;
+  outputFormatObj *format = map->outputformat;
+  int i;
+
+  snprintf(buffer, sizeof(buffer), "%s %d %d %d %.15g %.15g %d %d %d %d",
+           lp ? (theclass ? "icon" : "icons") : "legend", width, height, scale_independent,
+           map->resolution, map->defresolution, map->units,
+           format->imagemode, format->transparent, format->renderer);
+  key = legendCacheKeyAppend(key, buffer);
+
+  /* the scale, but not the extent, so that panning reuses the legend. Ten
+     digits absorb the rounding of scales computed from panned extents */
+  snprintf(buffer, sizeof(buffer), "%.10g", scale_independent ? 0.0 : map->scaledenom);
+  key = legendCacheKeyAppend(key, buffer);
+
+  key = legendCacheKeyAppend(key, format->driver);
+  key = legendCacheKeyAppend(key, format->name);
+  for(i=0; i<format->numformatoptions; i++)
+    key = legendCacheKeyAppend(key, format->formatoptions[i]);
+
+  key = legendCacheKeyAppend(key, map->name);
+  key = legendCacheKeyAppend(key, map->mappath);
+  key = legendCacheKeyAppend(key, map->symbolset.filename);
+  key = legendCacheKeyAppend(key, map->fontset.filename);
+  for(i=0; i<map->symbolset.numsymbols; i++)
+    key = legendCacheKeyAppend(key, map->symbolset.symbol[i]->name);
+
+  key = legendCacheKeyAppendDescription(key, &map->legend, NULL, NULL);
+  if(!key)
+    return NULL;
+
+  if(lp) {
+    snprintf(buffer, sizeof(buffer), "%.15g", lp->scalefactor);
+    key = legendCacheKeyAppend(key, buffer);
+    key = legendCacheKeyAppendDescription(key, NULL, lp, NULL);
+    if(key && theclass)
+      key = legendCacheKeyAppendDescription(key, NULL, NULL, theclass);
+  } else {
+    rectObj extent = map->extent;
+    double cellsize = msAdjustExtent(&extent, map->width, map->height);
+    for(i=0; key && i<map->numlayers; i++) {
+      layerObj *layer = GET_LAYER(map, map->layerorder[i]);
+      if(layer->status == MS_OFF || layer->type == MS_LAYER_QUERY)
+        continue;
+      key = legendCacheKeyAppendDescription(key, NULL, layer, NULL);
+      /* as in msDrawLegend(), symbols sized in other units than pixels
+         depend on the cell size, GEOWIDTH limits on the extent width */
+      if(key && layer->sizeunits != MS_PIXELS) {
+        snprintf(buffer, sizeof(buffer), "%.10g", cellsize);
+        key = legendCacheKeyAppend(key, buffer);
+      }
+      if(key && !scale_independent && layer->maxscaledenom <= 0 && layer->minscaledenom <= 0 &&
+          (layer->maxgeowidth > 0 || layer->mingeowidth > 0)) {
+        snprintf(buffer, sizeof(buffer), "%.10g", extent.maxx - extent.minx);
+        key = legendCacheKeyAppend(key, buffer);
+      }
+    }
+  }
+
+  return key;
+}
+
+static void legendCacheEntryFree(legendCacheEntry *entry)
+{
+  legendCacheBytes -= entry->size;
+  if(entry->encoded)
+    msFree(entry->data);
+  else
+    msFreeRasterBuffer(&entry->rb);
+  msFree(entry->key);
+  msFree(entry);
+}
+
+/*
+** Drops the expired entries and moves the one matching key to the front.
+** Called with TLOCK_LEGENDCACHE held.
+*/
+static legendCacheEntry *legendCacheFind(const char *key, int encoded)
+{
+  legendCacheEntry **link, *entry, *found = NULL;
+  time_t now = time(NULL);
+
+  link = &legendCache;
+  while((entry = *link) != NULL) {
+    if(entry->expires <= now) {
+      *link = entry->next;
+      legendCacheEntryFree(entry);
+      continue;
+    }
+    if(!found && entry->encoded == encoded && strcmp(entry->key, key) == 0) {
+      found = entry;
+      *link = entry->next;
+      continue;
+    }
+    link = &entry->next;
+  }
+  if(found) {
+    found->next = legendCache;
+    legendCache = found;
+  }
+  return found;
+}
+
+static void legendCacheInsert(legendCacheEntry *entry)
+{
+  legendCacheEntry **link;
+
+  msAcquireLock(TLOCK_LEGENDCACHE);
+  /* replace the same image */
+  link = &legendCache;
+  while(*link) {
+    legendCacheEntry *e = *link;
+    if(e->encoded == entry->encoded && strcmp(e->key, entry->key) == 0) {
+      *link = e->next;
+      legendCacheEntryFree(e);
+      continue;
+    }
+    link = &e->next;
+  }
+  entry->next = legendCache;
+  legendCache = entry;
+  legendCacheBytes += entry->size;
+
+  /* drop the least recently used images beyond the size limit */
+  link = &legendCache->next;
+  while(legendCacheBytes > LEGEND_CACHE_MAX_BYTES && *link) {
+    legendCacheEntry *e;
+    legendCacheEntry **last = link;
+    while((*last)->next)
+      last = &(*last)->next;
+    e = *last;
+    *last = NULL;
+    legendCacheEntryFree(e);
+  }
+  msReleaseLock(TLOCK_LEGENDCACHE);
+}
+
+/*
+** Returns a new legend image with the cached pixels, created the same way
+** as msDrawLegend() and msCreateLegendIcon() create theirs, or NULL if
+** there is none.
+*/
+imageObj *msLegendCacheGetImage(mapObj *map, const char *key)
+{
+  legendCacheEntry *found;
+  rasterBufferObj rb;
+  outputFormatObj *format = NULL;
+  imageObj *image;
+
+  msAcquireLock(TLOCK_LEGENDCACHE);
+  found = legendCacheFind(key, MS_FALSE);
+  if(found)
+    msCopyRasterBuffer(&rb, &found->rb);
+  msReleaseLock(TLOCK_LEGENDCACHE);
+  if(!found)
+    return NULL;
+
+  msApplyOutputFormat(&format, map->outputformat, map->legend.transparent, map->legend.interlace, MS_NOOVERRIDE);
+  image = msImageCreate(rb.width, rb.height, format, map->web.imagepath, map->web.imageurl,
+                        map->resolution, map->defresolution, &(map->legend.imagecolor));
+  msApplyOutputFormat(&format, NULL, MS_NOOVERRIDE, MS_NOOVERRIDE, MS_NOOVERRIDE);
+
+  if(image) {
+    rasterBufferObj dst;
+    image->map = map;
+    /*
+    ** Copy the pixels back as they are: blending them over a transparent
+    ** image would not give back the same partially transparent pixels.
+    */
+    if(MS_IMAGE_RENDERER(image)->getRasterBufferHandle(image, &dst) == MS_SUCCESS &&
+        dst.type == MS_BUFFER_BYTE_RGBA && dst.width == rb.width && dst.height == rb.height &&
+        dst.data.rgba.pixel_step == rb.data.rgba.pixel_step &&
+        dst.data.rgba.a && rb.data.rgba.a &&
+        dst.data.rgba.r - dst.data.rgba.pixels == rb.data.rgba.r - rb.data.rgba.pixels &&
+        dst.data.rgba.a - dst.data.rgba.pixels == rb.data.rgba.a - rb.data.rgba.pixels) {
+      unsigned int row;
+      for(row = 0; row < rb.height; row++)
+        memcpy(dst.data.rgba.pixels + (size_t)row * dst.data.rgba.row_step,
+               rb.data.rgba.pixels + (size_t)row * rb.data.rgba.row_step,
+               (size_t)rb.width * rb.data.rgba.pixel_step);
+    } else if(MS_IMAGE_RENDERER(image)->mergeRasterBuffer(image, &rb, 1.0, 0, 0, 0, 0, rb.width, rb.height) != MS_SUCCESS) {
+      msFreeImage(image);
+      image = NULL;
+    }
+  }
+  msFreeRasterBuffer(&rb);
+
+  if(image) {
+    MS_TRACE_COUNT(MS_TRACE_CACHEHITS, 1);
+    if(map->debug >= MS_DEBUGLEVEL_V)
+      msDebug("msLegendCacheGetImage(): using cached legend image.\n");
+  }
+  return image;
+}
+
+/* keep a copy of the pixels of a legend image */
+void msLegendCachePutImage(const char *key, int timeout, imageObj *image)
+{
+  legendCacheEntry *entry;
+  rasterBufferObj rb;
+  size_t size;
+
+  if(MS_IMAGE_RENDERER(image)->getRasterBufferHandle(image, &rb) != MS_SUCCESS ||
+      rb.type != MS_BUFFER_BYTE_RGBA)
+    return;
+
+  size = (size_t)rb.data.rgba.row_step * rb.height + strlen(key);
+  if(size > LEGEND_CACHE_MAX_BYTES / 4)
+    return; /* would push too many other images out */
+
+  entry = (legendCacheEntry*) msSmallCalloc(1, sizeof(legendCacheEntry));
+  entry->key = msStrdup(key);
+  entry->expires = time(NULL) + timeout;
+  msCopyRasterBuffer(&entry->rb, &rb);
+  entry->size = size;
+  legendCacheInsert(entry);
+}
+
+/*
+** Returns a copy of the encoded legend image the caller has to free, or NULL
+** if there is none.
+*/
+unsigned char *msLegendCacheGetEncoded(mapObj *map, const char *key, int *size)
+{
+  legendCacheEntry *found;
+  unsigned char *data = NULL;
+
+  msAcquireLock(TLOCK_LEGENDCACHE);
+  found = legendCacheFind(key, MS_TRUE);
+  if(found) {
+    data = (unsigned char*) msSmallMalloc(found->datasize);
+    memcpy(data, found->data, found->datasize);
+    *size = found->datasize;
+  }
+  msReleaseLock(TLOCK_LEGENDCACHE);
+
+  if(data) {
+    MS_TRACE_COUNT(MS_TRACE_CACHEHITS, 1);
+    if(map->debug >= MS_DEBUGLEVEL_V)
+      msDebug("msLegendCacheGetEncoded(): using cached legend image.\n");
+  }
+  return data;
+}
+
+/* keep a copy of an encoded legend image */
+void msLegendCachePutEncoded(const char *key, int timeout, const unsigned char *data, int datasize)
+{
+  legendCacheEntry *entry;
+  size_t size = datasize + strlen(key);
+
+  if(datasize <= 0 || size > LEGEND_CACHE_MAX_BYTES / 4)
+    return;
+
+  entry = (legendCacheEntry*) msSmallCalloc(1, sizeof(legendCacheEntry));
+  entry->key = msStrdup(key);
+  entry->encoded = MS_TRUE;
+  entry->expires = time(NULL) + timeout;
+  entry->data = (unsigned char*) msSmallMalloc(datasize);
+  memcpy(entry->data, data, datasize);
+  entry->datasize = datasize;
+  entry->size = size;
+  legendCacheInsert(entry);
+}
+
+/* release the memory store, called from msCleanup() */
+void msLegendCacheCleanup(void)
+{
+  msAcquireLock(TLOCK_LEGENDCACHE);
+  while(legendCache) {
+    legendCacheEntry *next = legendCache->next;
+    legendCacheEntryFree(legendCache);
+    legendCache = next;
+  }
+  msReleaseLock(TLOCK_LEGENDCACHE);
+}
@@ -1,4 +1,9 @@
 #line 2 "/Users/sdlime/mapserver/sdlime/mapserver/maplexer.c"
+#line 2 "maplexer.l"
+/* the scanner state is thread local, see the lexer target in Makefile */
+#include "mapserver-config.h"
+#include "mapthread.h"
+
 
 #line 4 "/Users/sdlime/mapserver/sdlime/mapserver/maplexer.c"
 
@@ -178,9 +183,9 @@ typedef struct yy_buffer_state *YY_BUFFER_STATE;
 typedef size_t yy_size_t;
 #endif
 
-extern yy_size_t msyyleng;
+extern MS_THREAD_LOCAL yy_size_t msyyleng;
 
-extern FILE *msyyin, *msyyout;
+extern MS_THREAD_LOCAL FILE *msyyin, *msyyout;
 
 #define EOB_ACT_CONTINUE_SCAN 0
 #define EOB_ACT_END_OF_FILE 1
@@ -270,9 +275,9 @@ struct yy_buffer_state
 #endif /* !YY_STRUCT_YY_BUFFER_STATE */
 
 /* Stack of input buffers. */
-static size_t yy_buffer_stack_top = 0; /**< index of top of stack. */
-static size_t yy_buffer_stack_max = 0; /**< capacity of stack. */
-static YY_BUFFER_STATE * yy_buffer_stack = 0; /**< Stack as an array. */
+static MS_THREAD_LOCAL size_t yy_buffer_stack_top = 0; /**< index of top of stack. */
+static MS_THREAD_LOCAL size_t yy_buffer_stack_max = 0; /**< capacity of stack. */
+static MS_THREAD_LOCAL YY_BUFFER_STATE * yy_buffer_stack = 0; /**< Stack as an array. */
 
 /* We provide macros for accessing buffer states in case in the
  * future we want to put the buffer states in a more general
@@ -290,19 +295,19 @@ static YY_BUFFER_STATE * yy_buffer_stack = 0; /**< Stack as an array. */
 #define YY_CURRENT_BUFFER_LVALUE (yy_buffer_stack)[(yy_buffer_stack_top)]
 
 /* yy_hold_char holds the character lost when msyytext is formed. */
-static char yy_hold_char;
-static yy_size_t yy_n_chars;		/* number of characters read into yy_ch_buf */
-yy_size_t msyyleng;
+static MS_THREAD_LOCAL char yy_hold_char;
+static MS_THREAD_LOCAL yy_size_t yy_n_chars;		/* number of characters read into yy_ch_buf */
+MS_THREAD_LOCAL yy_size_t msyyleng;
 
 /* Points to current character in buffer. */
-static char *yy_c_buf_p = (char *) 0;
-static int yy_init = 0;		/* whether we need to initialize */
-static int yy_start = 0;	/* start state number */
+static MS_THREAD_LOCAL char *yy_c_buf_p = (char *) 0;
+static MS_THREAD_LOCAL int yy_init = 0;		/* whether we need to initialize */
+static MS_THREAD_LOCAL int yy_start = 0;	/* start state number */
 
 /* Flag which is used to allow msyywrap()'s to do buffer switches
  * instead of setting up a fresh msyyin.  A bit of a hack ...
  */
-static int yy_did_buffer_switch_on_eof;
+static MS_THREAD_LOCAL int yy_did_buffer_switch_on_eof;
 
 void msyyrestart (FILE *input_file  );
 void msyy_switch_to_buffer (YY_BUFFER_STATE new_buffer  );
@@ -354,15 +359,15 @@ void msyyfree (void *  );
 
 typedef unsigned char YY_CHAR;
 
-FILE *msyyin = (FILE *) 0, *msyyout = (FILE *) 0;
+MS_THREAD_LOCAL FILE *msyyin = (FILE *) 0, *msyyout = (FILE *) 0;
 
 typedef int yy_state_type;
 
-extern int msyylineno;
+extern MS_THREAD_LOCAL int msyylineno;
 
-int msyylineno = 1;
+MS_THREAD_LOCAL int msyylineno = 1;
 
-extern char *msyytext;
+extern MS_THREAD_LOCAL char *msyytext;
 #define yytext_ptr msyytext
 
 static yy_state_type yy_get_previous_state (void );
@@ -2172,11 +2177,11 @@ static yyconst flex_int16_t yy_chk[4762] =
      2016
     } ;
 
-static yy_state_type yy_last_accepting_state;
-static char *yy_last_accepting_cpos;
+static MS_THREAD_LOCAL yy_state_type yy_last_accepting_state;
+static MS_THREAD_LOCAL char *yy_last_accepting_cpos;
 
-extern int msyy_flex_debug;
-int msyy_flex_debug = 0;
+extern MS_THREAD_LOCAL int msyy_flex_debug;
+MS_THREAD_LOCAL int msyy_flex_debug = 0;
 
 /* The intent behind this definition is that it'll catch
  * any uses of REJECT which flex missed.
@@ -2185,7 +2190,7 @@ int msyy_flex_debug = 0;
 #define yymore() yymore_used_but_not_detected
 #define YY_MORE_ADJ 0
 #define YY_RESTORE_YY_MORE_OFFSET
-char *msyytext;
+MS_THREAD_LOCAL char *msyytext;
 #line 1 "maplexer.l"
 #line 2 "maplexer.l"
 /*
@@ -2223,27 +2228,27 @@ char *msyytext;
  * switch to using autoconf to detect the version.
  */
 #ifndef YY_CURRENT_BUFFER_LVALUE
-int msyylineno = 1;
+MS_THREAD_LOCAL int msyylineno = 1;
 #endif
 
 #define YY_NO_INPUT
 
-int msyysource=MS_STRING_TOKENS;
-double msyynumber;
-int msyystate=MS_TOKENIZE_DEFAULT;
-char *msyystring=NULL;
-char *msyybasepath=NULL;
-char *msyystring_buffer_ptr;
-int  msyystring_buffer_size = 256;
-int  msyystring_size;
-char msyystring_begin;
-char *msyystring_buffer = NULL;
-int  msyystring_icase = MS_FALSE;
-int  msyystring_return_state;
-int  msyystring_begin_state;
-int  msyystring_size_tmp;
-
-int msyyreturncomments = 0;
+MS_THREAD_LOCAL int msyysource=MS_STRING_TOKENS;
+MS_THREAD_LOCAL double msyynumber;
+MS_THREAD_LOCAL int msyystate=MS_TOKENIZE_DEFAULT;
+MS_THREAD_LOCAL char *msyystring=NULL;
+MS_THREAD_LOCAL char *msyybasepath=NULL;
+MS_THREAD_LOCAL char *msyystring_buffer_ptr;
+MS_THREAD_LOCAL int  msyystring_buffer_size = 256;
+MS_THREAD_LOCAL int  msyystring_size;
+MS_THREAD_LOCAL char msyystring_begin;
+MS_THREAD_LOCAL char *msyystring_buffer = NULL;
+MS_THREAD_LOCAL int  msyystring_icase = MS_FALSE;
+MS_THREAD_LOCAL int  msyystring_return_state;
+MS_THREAD_LOCAL int  msyystring_begin_state;
+MS_THREAD_LOCAL int  msyystring_size_tmp;
+
+MS_THREAD_LOCAL int msyyreturncomments = 0;
 
 #define MS_LEXER_STRING_REALLOC(string, string_size, max_size, string_ptr)   \
    if (string_size >= max_size) {         \
@@ -2261,10 +2266,9 @@ int msyyreturncomments = 0;
    return(token); 
 
 #define MAX_INCLUDE_DEPTH 5
-YY_BUFFER_STATE include_stack[MAX_INCLUDE_DEPTH];
-int include_lineno[MAX_INCLUDE_DEPTH];
-int include_stack_ptr = 0;
-char path[MS_MAXPATHLEN];
+MS_THREAD_LOCAL YY_BUFFER_STATE include_stack[MAX_INCLUDE_DEPTH];
+MS_THREAD_LOCAL int include_lineno[MAX_INCLUDE_DEPTH];
+MS_THREAD_LOCAL int include_stack_ptr = 0;
 
 
 
@@ -2454,8 +2458,10 @@ YY_DECL
     
 #line 89 "maplexer.l"
 
-       if (msyystring_buffer == NULL)
+       if (msyystring_buffer == NULL) {
            msyystring_buffer = (char*) msSmallMalloc(sizeof(char) * msyystring_buffer_size);
+           msThreadRegisterLexer();
+       }
 
        msyystring_buffer[0] = '\0';
        msyystring_buffer_size = 0;
@@ -4491,6 +4497,8 @@ case 344:
 YY_RULE_SETUP
 #line 687 "maplexer.l"
 {
+                                                 char path[MS_MAXPATHLEN];
+
                                                  msyytext++;
                                                  msyytext[strlen(msyytext)-1] = '\0';
 
@@ -0,0 +1,630 @@
+/******************************************************************************
+ * $Id$
+ *
+ * Project:  MapServer
+ * Purpose:  Mapbox Vector Tile (MVT) output
+ * Author:   MapServer team.
+ *
+ ******************************************************************************
+ * Copyright (c) 1996-2016 Regents of the University of Minnesota.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *****************************************************************************/
+
+/*
+** Encodes the features of the visible vector layers of a map directly into
+** a Mapbox Vector Tile (https://github.com/mapbox/vector-tile-spec, v2).
+** Shapes are streamed from msLayerNextShape(), clipped to the tile extent
+** plus an edge buffer, quantized to the tile grid by
+** msTransformShapeToPixelRound() (which also drops vertices collapsing onto
+** the same grid cell, i.e. a per zoom level generalization) and written as
+** protobuf messages. The (tiny) subset of the protobuf wire format needed
+** for this is implemented here, so no external dependency is required.
+*/
+
+#include "mapserver.h"
+#include "mapows.h"
+#include "mapproject.h"
+#include "uthash.h"
+
+#define MVT_DEFAULT_EXTENT 4096
+#define MVT_DEFAULT_EDGE_BUFFER 256
+#define MVT_VERSION 2
+
+/* protobuf wire types */
+#define PB_VARINT 0
+#define PB_FIXED64 1
+#define PB_LENGTH_DELIMITED 2
+
+/* Tile.Layer.Feature.GeomType */
+#define MVT_GEOM_POINT 1
+#define MVT_GEOM_LINESTRING 2
+#define MVT_GEOM_POLYGON 3
+
+/* geometry commands */
+#define MVT_CMD_MOVETO 1
+#define MVT_CMD_LINETO 2
+#define MVT_CMD_CLOSEPATH 7
+
+enum MS_MVT_VALUE_TYPE { MVT_STRING, MVT_INTEGER, MVT_REAL, MVT_BOOLEAN };
+
+typedef struct {
+  char *key;      /* type prefix followed by the textual value */
+  int index;
+  UT_hash_handle hh;
+} mvtValueEntry;
+
+typedef struct {
+  unsigned int *data;
+  int numitems;
+  int size;
+} mvtUIntArray;
+
+typedef struct {
+  int index;      /* index in layer->items */
+  int type;       /* one of MS_MVT_VALUE_TYPE */
+} mvtItem;
+
+/************************************************************************/
+/*                       protobuf encoding helpers                      */
+/************************************************************************/
+
+static void mvtWriteVarint(bufferObj *buf, unsigned long long value)
+{
+  unsigned char bytes[10];
+  int n = 0;
+  while(value >= 0x80) {
+    bytes[n++] = (unsigned char)(value | 0x80);
+    value >>= 7;
+  }
+  bytes[n++] = (unsigned char)value;
+  msBufferAppend(buf, bytes, n);
+}
+
+static void mvtWriteKey(bufferObj *buf, int field, int wiretype)
+{
+  mvtWriteVarint(buf, ((unsigned long long)field << 3) | wiretype);
+}
+
+static void mvtWriteBytes(bufferObj *buf, int field, const void *data, size_t length)
+{
+  mvtWriteKey(buf, field, PB_LENGTH_DELIMITED);
+  mvtWriteVarint(buf, length);
+  if(length > 0)
+    msBufferAppend(buf, (void*)data, length);
+}
+
+static void mvtWriteString(bufferObj *buf, int field, const char *str)
+{
+  mvtWriteBytes(buf, field, str, strlen(str));
+}
+
+static void mvtWritePacked(bufferObj *buf, int field, mvtUIntArray *array)
+{
+  bufferObj packed;
+  int i;
+  msBufferInit(&packed);
+  packed._next_allocation_size = 1024;
+  for(i=0; i<array->numitems; i++)
+    mvtWriteVarint(&packed, array->data[i]);
+  mvtWriteBytes(buf, field, packed.data, packed.size);
+  msBufferFree(&packed);
+}
+
+static unsigned int mvtZigZag(int value)
+{
+  return ((unsigned int)value << 1) ^ (unsigned int)(value >> 31);
+}
+
+static void mvtArrayAdd(mvtUIntArray *array, unsigned int value)
+{
+  if(array->numitems == array->size) {
+    array->size = array->size ? array->size * 2 : 256;
+    array->data = msSmallRealloc(array->data, array->size * sizeof(unsigned int));
+  }
+  array->data[array->numitems++] = value;
+}
+
+/************************************************************************/
+/*                          geometry encoding                           */
+/************************************************************************/
+
+static void mvtAddCommand(mvtUIntArray *geom, int command, int count)
+{
+  mvtArrayAdd(geom, (command & 0x7) | (count << 3));
+}
+
+static void mvtAddPoint(mvtUIntArray *geom, pointObj *p, int *cx, int *cy)
+{
+  int x = (int)p->x, y = (int)p->y;
+  mvtArrayAdd(geom, mvtZigZag(x - *cx));
+  mvtArrayAdd(geom, mvtZigZag(y - *cy));
+  *cx = x;
+  *cy = y;
+}
+
+/* signed area (times two) of a ring, positive means clockwise on screen */
+static double mvtRingArea(lineObj *line)
+{
+  int i;
+  double area = 0;
+  for(i=0; i<line->numpoints-1; i++)
+    area += line->point[i].x * line->point[i+1].y - line->point[i+1].x * line->point[i].y;
+  return area;
+}
+
+static void mvtReverseRing(lineObj *line)
+{
+  int i, j;
+  pointObj tmp;
+  for(i=0, j=line->numpoints-1; i<j; i++, j--) {
+    tmp = line->point[i];
+    line->point[i] = line->point[j];
+    line->point[j] = tmp;
+  }
+}
+
+static void mvtEncodeRing(mvtUIntArray *geom, lineObj *line, int outer, int *cx, int *cy)
+{
+  int i, n;
+  double area = mvtRingArea(line);
+  if(area == 0) return;
+  if((outer && area < 0) || (!outer && area > 0))
+    mvtReverseRing(line);
+
+  /* the closing vertex is implied by the ClosePath command */
+  n = line->numpoints - 1;
+  mvtAddCommand(geom, MVT_CMD_MOVETO, 1);
+  mvtAddPoint(geom, &line->point[0], cx, cy);
+  mvtAddCommand(geom, MVT_CMD_LINETO, n - 1);
+  for(i=1; i<n; i++)
+    mvtAddPoint(geom, &line->point[i], cx, cy);
+  mvtAddCommand(geom, MVT_CMD_CLOSEPATH, 1);
+}
+
+/*
+** Encodes a shape that has already been transformed to tile coordinates.
+** Returns the MVT geometry type, or 0 if nothing was left to encode.
+*/
+static int mvtEncodeGeometry(shapeObj *shape, int layertype, mvtUIntArray *geom, int extent, int buffer)
+{
+  int i, j, cx = 0, cy = 0;
+
+  geom->numitems = 0;
+
+  if(layertype == MS_LAYER_POINT || shape->type == MS_SHAPE_POINT) {
+    int count = 0, cmdpos;
+    mvtAddCommand(geom, MVT_CMD_MOVETO, 0); /* patched below */
+    cmdpos = geom->numitems - 1;
+    for(i=0; i<shape->numlines; i++) {
+      for(j=0; j<shape->line[i].numpoints; j++) {
+        pointObj *p = &shape->line[i].point[j];
+        if(p->x < -buffer || p->y < -buffer || p->x > extent + buffer || p->y > extent + buffer)
+          continue;
+        mvtAddPoint(geom, p, &cx, &cy);
+        count++;
+      }
+    }
+    if(count == 0) {
+      geom->numitems = 0;
+      return 0;
+    }
+    geom->data[cmdpos] = (MVT_CMD_MOVETO & 0x7) | (count << 3);
+    return MVT_GEOM_POINT;
+  }
+
+  if(shape->type == MS_SHAPE_LINE) {
+    for(i=0; i<shape->numlines; i++) {
+      lineObj *line = &shape->line[i];
+      if(line->numpoints < 2) continue;
+      mvtAddCommand(geom, MVT_CMD_MOVETO, 1);
+      mvtAddPoint(geom, &line->point[0], &cx, &cy);
+      mvtAddCommand(geom, MVT_CMD_LINETO, line->numpoints - 1);
+      for(j=1; j<line->numpoints; j++)
+        mvtAddPoint(geom, &line->point[j], &cx, &cy);
+    }
+    return geom->numitems ? MVT_GEOM_LINESTRING : 0;
+  }
+
+  if(shape->type == MS_SHAPE_POLYGON) {
+    int *outerlist, *innerlist;
+    /* rings need at least 3 distinct vertices plus the closing one */
+    for(i=0, j=0; i<shape->numlines; i++) {
+      if(shape->line[i].numpoints >= 4) {
+        shape->line[j++] = shape->line[i];
+      } else {
+        free(shape->line[i].point);
+      }
+    }
+    shape->numlines = j;
+    if(shape->numlines == 0) return 0;
+
+    outerlist = msGetOuterList(shape);
+    for(i=0; i<shape->numlines; i++) {
+      if(!outerlist[i]) continue;
+      mvtEncodeRing(geom, &shape->line[i], MS_TRUE, &cx, &cy);
+      innerlist = msGetInnerList(shape, i, outerlist);
+      for(j=0; j<shape->numlines; j++) {
+        if(innerlist[j])
+          mvtEncodeRing(geom, &shape->line[j], MS_FALSE, &cx, &cy);
+      }
+      free(innerlist);
+    }
+    free(outerlist);
+    return geom->numitems ? MVT_GEOM_POLYGON : 0;
+  }
+
+  return 0;
+}
+
+/************************************************************************/
+/*                          attribute handling                          */
+/************************************************************************/
+
+/*
+** Selects the attributes to write using the same include/exclude and type
+** metadata as the GML and OGR outputs.
+*/
+static mvtItem *mvtGetItems(layerObj *layer, int *numitems)
+{
+  const char *value;
+  char **incitems = NULL, **excitems = NULL;
+  int numincitems = 0, numexcitems = 0;
+  int i, j;
+  mvtItem *items;
+
+  *numitems = 0;
+  if(layer->numitems == 0) return NULL;
+
+  if((value = msOWSLookupMetadata(&(layer->metadata), "OG", "include_items")) != NULL)
+    incitems = msStringSplit(value, ',', &numincitems);
+  if((value = msOWSLookupMetadata(&(layer->metadata), "OG", "exclude_items")) != NULL)
+    excitems = msStringSplit(value, ',', &numexcitems);
+
+  items = (mvtItem*) msSmallMalloc(sizeof(mvtItem) * layer->numitems);
+  for(i=0; i<layer->numitems; i++) {
+    char tag[256];
+    int include = MS_FALSE;
+
+    if(numincitems == 1 && strcasecmp("all", incitems[0]) == 0)
+      include = MS_TRUE;
+    for(j=0; !include && j<numincitems; j++) {
+      if(strcasecmp(layer->items[i], incitems[j]) == 0) include = MS_TRUE;
+    }
+    for(j=0; include && j<numexcitems; j++) {
+      if(strcasecmp(layer->items[i], excitems[j]) == 0) include = MS_FALSE;
+    }
+    if(!include) continue;
+
+    items[*numitems].index = i;
+    items[*numitems].type = MVT_STRING;
+    snprintf(tag, sizeof(tag), "%s_type", layer->items[i]);
+    if((value = msOWSLookupMetadata(&(layer->metadata), "OG", tag)) != NULL) {
+      if(strcasecmp(value, "Integer") == 0 || strcasecmp(value, "Long") == 0)
+        items[*numitems].type = MVT_INTEGER;
+      else if(strcasecmp(value, "Real") == 0)
+        items[*numitems].type = MVT_REAL;
+      else if(strcasecmp(value, "Boolean") == 0)
+        items[*numitems].type = MVT_BOOLEAN;
+    }
+    (*numitems)++;
+  }
+
+  msFreeCharArray(incitems, numincitems);
+  msFreeCharArray(excitems, numexcitems);
+  return items;
+}
+
+/* returns the index of a value in the layer dictionary, adding it if needed */
+static int mvtGetValueIndex(mvtValueEntry **values, int *numvalues, int type, const char *str)
+{
+  mvtValueEntry *entry = NULL;
+  size_t len = strlen(str);
+  char *key = msSmallMalloc(len + 2);
+
+  key[0] = '0' + type;
+  memcpy(key + 1, str, len + 1);
+  UT_HASH_FIND_STR(*values, key, entry);
+  if(entry) {
+    free(key);
+    return entry->index;
+  }
+  entry = msSmallMalloc(sizeof(mvtValueEntry));
+  entry->key = key;
+  entry->index = (*numvalues)++;
+  UT_HASH_ADD_KEYPTR(hh, *values, entry->key, len + 1, entry);
+  return entry->index;
+}
+
+static void mvtWriteValue(bufferObj *layerbuf, mvtValueEntry *entry)
+{
+  bufferObj value;
+  const char *str = entry->key + 1;
+
+  msBufferInit(&value);
+  value._next_allocation_size = 256;
+  switch(entry->key[0] - '0') {
+    case MVT_INTEGER:
+      mvtWriteKey(&value, 6, PB_VARINT); /* sint_value */
+      {
+        long long v = strtoll(str, NULL, 10);
+        mvtWriteVarint(&value, ((unsigned long long)v << 1) ^ (unsigned long long)(v >> 63));
+      }
+      break;
+    case MVT_REAL: {
+      double d = atof(str);
+      unsigned long long bits;
+      unsigned char bytes[8];
+      int i;
+      memcpy(&bits, &d, 8);
+      for(i=0; i<8; i++) bytes[i] = (unsigned char)(bits >> (8*i));
+      mvtWriteKey(&value, 3, PB_FIXED64); /* double_value */
+      msBufferAppend(&value, bytes, 8);
+      break;
+    }
+    case MVT_BOOLEAN:
+      mvtWriteKey(&value, 7, PB_VARINT); /* bool_value */
+      mvtWriteVarint(&value, (strcasecmp(str, "true") == 0 || atoi(str) != 0) ? 1 : 0);
+      break;
+    default:
+      mvtWriteString(&value, 1, str); /* string_value */
+      break;
+  }
+  mvtWriteBytes(layerbuf, 4, value.data, value.size);
+  msBufferFree(&value);
+}
+
+/************************************************************************/
+/*                             layer writer                             */
+/************************************************************************/
+
+static int msMVTWriteLayer(mapObj *map, layerObj *layer, bufferObj *tilebuf, rectObj tilerect,
+                           int extent, int buffer)
+{
+  int status, i;
+  rectObj searchrect, cliprect;
+  shapeObj shape;
+  double mvt_cellsize;
+  int *classgroup = NULL, nclasses = 0;
+  int maxfeatures, featurecount = 0;
+  mvtItem *items = NULL;
+  int numitems = 0;
+  mvtValueEntry *values = NULL, *entry, *tmp;
+  int numvalues = 0;
+  mvtUIntArray geom = {NULL, 0, 0}, tags = {NULL, 0, 0};
+  bufferObj layerbuf, featurebuf;
+
+  mvt_cellsize = (tilerect.maxx - tilerect.minx) / extent;
+  cliprect = tilerect;
+  cliprect.minx -= buffer * mvt_cellsize;
+  cliprect.miny -= buffer * mvt_cellsize;
+  cliprect.maxx += buffer * mvt_cellsize;
+  cliprect.maxy += buffer * mvt_cellsize;
+
+  status = msLayerOpen(layer);
+  if(status != MS_SUCCESS) return MS_FAILURE;
+
+  status = msLayerWhichItems(layer, MS_TRUE, NULL);
+  if(status != MS_SUCCESS) {
+    msLayerClose(layer);
+    return MS_FAILURE;
+  }
+
+  searchrect = cliprect;
+#ifdef USE_PROJ
+  if((map->projection.numargs > 0) && (layer->projection.numargs > 0))
+    msProjectRect(&map->projection, &layer->projection, &searchrect);
+#endif
+
+  status = msLayerWhichShapes(layer, searchrect, MS_FALSE);
+  if(status == MS_DONE) { /* no overlap */
+    msLayerClose(layer);
+    return MS_SUCCESS;
+  } else if(status != MS_SUCCESS) {
+    msLayerClose(layer);
+    return MS_FAILURE;
+  }
+
+  items = mvtGetItems(layer, &numitems);
+  if(layer->classgroup && layer->numclasses > 0)
+    classgroup = msAllocateValidClassGroups(layer, &nclasses);
+  maxfeatures = msLayerGetMaxFeaturesToDraw(layer, map->outputformat);
+
+  msBufferInit(&layerbuf);
+  msBufferInit(&featurebuf);
+  featurebuf._next_allocation_size = 4096;
+
+  msInitShape(&shape);
+  while((status = msLayerNextShape(layer, &shape)) == MS_SUCCESS) {
+    int geomtype;
+
+    if(layer->numclasses > 0) {
+      shape.classindex = msShapeGetClass(layer, map, &shape, classgroup, nclasses);
+      if((shape.classindex == -1) || (layer->class[shape.classindex]->status == MS_OFF)) {
+        msFreeShape(&shape);
+        continue;
+      }
+    }
+
+    if(maxfeatures >= 0 && featurecount >= maxfeatures) {
+      msFreeShape(&shape);
+      status = MS_DONE;
+      break;
+    }
+
+#ifdef USE_PROJ
+    if(layer->project)
+      msProjectShape(&layer->projection, &map->projection, &shape);
+#endif
+
+    if(shape.type == MS_SHAPE_POLYGON)
+      msClipPolygonRect(&shape, cliprect);
+    else if(shape.type == MS_SHAPE_LINE)
+      msClipPolylineRect(&shape, cliprect);
+
+    msTransformShapeToPixelRound(&shape, tilerect, mvt_cellsize);
+
+    geomtype = mvtEncodeGeometry(&shape, layer->type, &geom, extent, buffer);
+    if(geomtype == 0) {
+      msFreeShape(&shape);
+      continue;
+    }
+
+    tags.numitems = 0;
+    for(i=0; i<numitems; i++) {
+      const char *value;
+      if(items[i].index >= shape.numvalues)
+        continue;
+      value = shape.values[items[i].index];
+      if(value == NULL || (items[i].type != MVT_STRING && *value == '\0'))
+        continue;
+      mvtArrayAdd(&tags, i);
+      mvtArrayAdd(&tags, mvtGetValueIndex(&values, &numvalues, items[i].type, value));
+    }
+
+    featurebuf.size = 0;
+    if(shape.index >= 0) {
+      mvtWriteKey(&featurebuf, 1, PB_VARINT); /* id */
+      mvtWriteVarint(&featurebuf, shape.index);
+    }
+    if(tags.numitems > 0)
+      mvtWritePacked(&featurebuf, 2, &tags);
+    mvtWriteKey(&featurebuf, 3, PB_VARINT); /* type */
+    mvtWriteVarint(&featurebuf, geomtype);
+    mvtWritePacked(&featurebuf, 4, &geom);
+
+    mvtWriteBytes(&layerbuf, 2, featurebuf.data, featurebuf.size);
+    featurecount++;
+    msFreeShape(&shape);
+  }
+
+  msFree(classgroup);
+
+  if(status != MS_DONE) {
+    msLayerClose(layer);
+    msFree(items);
+    msFree(geom.data);
+    msFree(tags.data);
+    msBufferFree(&featurebuf);
+    msBufferFree(&layerbuf);
+    UT_HASH_ITER(hh, values, entry, tmp) {
+      UT_HASH_DEL(values, entry);
+      free(entry->key);
+      free(entry);
+    }
+    return MS_FAILURE;
+  }
+
+  if(featurecount > 0) {
+    bufferObj header;
+    msBufferInit(&header);
+    header._next_allocation_size = 4096;
+    mvtWriteKey(&header, 15, PB_VARINT); /* version */
+    mvtWriteVarint(&header, MVT_VERSION);
+    mvtWriteString(&header, 1, layer->name ? layer->name : "default");
+    mvtWriteKey(&header, 5, PB_VARINT); /* extent */
+    mvtWriteVarint(&header, extent);
+    for(i=0; i<numitems; i++)
+      mvtWriteString(&layerbuf, 3, layer->items[items[i].index]);
+    /* UT_HASH_ITER walks the values in insertion order, i.e. index order */
+    UT_HASH_ITER(hh, values, entry, tmp) {
+      mvtWriteValue(&layerbuf, entry);
+    }
+    msBufferAppend(&header, layerbuf.data, layerbuf.size);
+    mvtWriteBytes(tilebuf, 3, header.data, header.size);
+    msBufferFree(&header);
+  }
+
+  if(layer->debug || map->debug)
+    msDebug("msMVTWriteLayer(%s): %d features, %d keys, %d distinct values\n",
+            layer->name ? layer->name : "", featurecount, numitems, numvalues);
+
+  msLayerClose(layer); /* frees layer->items, used for the keys above */
+  UT_HASH_ITER(hh, values, entry, tmp) {
+    UT_HASH_DEL(values, entry);
+    free(entry->key);
+    free(entry);
+  }
+  msFree(items);
+  msFree(geom.data);
+  msFree(tags.data);
+  msBufferFree(&featurebuf);
+  msBufferFree(&layerbuf);
+
+  return MS_SUCCESS;
+}
+
+/************************************************************************/
+/*                           msMVTWriteTile()                           */
+/*                                                                      */
+/*      Writes all visible vector layers of the map to the output        */
+/*      stream as a single vector tile covering map->extent.            */
+/************************************************************************/
+
+int msMVTWriteTile(mapObj *map, int sendheaders)
+{
+  int i, extent, buffer;
+  rectObj tilerect;
+  bufferObj tilebuf;
+
+  if(map->width == -1 || map->height == -1) {
+    msSetError(MS_MISCERR, "Image dimensions not specified.", "msMVTWriteTile()");
+    return MS_FAILURE;
+  }
+
+  extent = atoi(msGetOutputFormatOption(map->outputformat, "EXTENT", "4096"));
+  buffer = atoi(msGetOutputFormatOption(map->outputformat, "EDGE_BUFFER", "256"));
+  if(extent <= 0) extent = MVT_DEFAULT_EXTENT;
+  if(buffer < 0) buffer = MVT_DEFAULT_EDGE_BUFFER;
+
+  map->cellsize = msAdjustExtent(&(map->extent), map->width, map->height);
+  if(msCalculateScale(map->extent, map->units, map->width, map->height, map->resolution, &map->scaledenom) != MS_SUCCESS)
+    return MS_FAILURE;
+
+  /* map->extent is pixel center to pixel center, the tile is edge to edge */
+  tilerect = map->extent;
+  tilerect.minx -= map->cellsize * 0.5;
+  tilerect.miny -= map->cellsize * 0.5;
+  tilerect.maxx += map->cellsize * 0.5;
+  tilerect.maxy += map->cellsize * 0.5;
+
+  msBufferInit(&tilebuf);
+  for(i=0; i<map->numlayers; i++) {
+    layerObj *layer = GET_LAYER(map, map->layerorder[i]);
+    if(!msLayerIsVisible(map, layer))
+      continue;
+    if(layer->type != MS_LAYER_POINT && layer->type != MS_LAYER_LINE &&
+        layer->type != MS_LAYER_POLYGON)
+      continue;
+    if(msMVTWriteLayer(map, layer, &tilebuf, tilerect, extent, buffer) != MS_SUCCESS) {
+      msBufferFree(&tilebuf);
+      return MS_FAILURE;
+    }
+  }
+
+  if(sendheaders) {
+    msIO_setHeader("Content-Type", "%s", MS_IMAGE_MIME_TYPE(map->outputformat));
+    msIO_sendHeaders();
+  }
+  if(tilebuf.size > 0)
+    msIO_fwrite(tilebuf.data, 1, tilebuf.size, stdout);
+  msBufferFree(&tilebuf);
+
+  return MS_SUCCESS;
+}
@@ -51,6 +51,11 @@
 // GDAL 1.x API
 #include "ogr_api.h"
 
+#if GDAL_VERSION_NUM >= 3060000
+/* Batched columnar reads through OGR_L_GetArrowStream() */
+#define MSOGR_USE_ARROW
+#endif
+
 typedef struct ms_ogr_file_info_t {
   char        *pszFname;
   char        *pszLayerDef;
@@ -81,6 +86,17 @@ typedef struct ms_ogr_file_info_t {
 
   char* pszWHERE;
 
+#ifdef MSOGR_USE_ARROW
+  int   nArrowState;        /* 0: not tried yet, 1: stream active, -1: not used */
+  struct ArrowArrayStream sArrowStream;
+  struct ArrowSchema sArrowSchema;
+  struct ArrowArray sArrowBatch; /* current batch, release is NULL when none */
+  GIntBig nArrowBatchRow;   /* next row to read in sArrowBatch */
+  int   nArrowFIDColumn;
+  int   nArrowGeomColumn;
+  int  *panArrowItemColumns; /* batch column of each layer item */
+#endif
+
 } msOGRFileInfo;
 
 static int msOGRLayerIsOpen(layerObj *layer);
@@ -88,6 +104,9 @@ static int msOGRLayerInitItemInfo(layerObj *layer);
 static int msOGRLayerGetAutoStyle(mapObj *map, layerObj *layer, classObj *c,
                                   shapeObj* shape);
 static void msOGRCloseConnection( void *conn_handle );
+#ifdef MSOGR_USE_ARROW
+static void msOGRFileReleaseArrowStream(msOGRFileInfo *psInfo);
+#endif
 
 /* ==================================================================
  * Geometry conversion functions
@@ -1681,6 +1700,10 @@ static int msOGRFileClose(layerObj *layer, msOGRFileInfo *psInfo )
   if (psInfo->hLastFeature)
     OGR_F_Destroy( psInfo->hLastFeature );
 
+#ifdef MSOGR_USE_ARROW
+  msOGRFileReleaseArrowStream( psInfo );
+#endif
+
   /* If nLayerIndex == -1 then the layer is an SQL result ... free it */
   if( psInfo->nLayerIndex == -1 )
     OGR_DS_ReleaseResultSet( psInfo->hDS, psInfo->hLayer );
@@ -2598,6 +2621,9 @@ static int msOGRFileWhichShapes(layerObj *layer, rectObj rect, msOGRFileInfo *ps
     /* ------------------------------------------------------------------
      * Reset current feature pointer
      * ------------------------------------------------------------------ */
+#ifdef MSOGR_USE_ARROW
+    msOGRFileReleaseArrowStream( psInfo );
+#endif
     OGR_L_ResetReading( psInfo->hLayer );
     psInfo->last_record_index_read = -1;
     
@@ -2764,6 +2790,390 @@ static char **msOGRFileGetItems(layerObj *layer, msOGRFileInfo *psInfo )
   return items;
 }
 
+#ifdef MSOGR_USE_ARROW
+
+/**********************************************************************
+ *                     msOGRFileReleaseArrowStream()
+ **********************************************************************/
+static void msOGRFileReleaseArrowStream(msOGRFileInfo *psInfo)
+{
+  if( psInfo->nArrowState == 1 ) {
+    if( psInfo->sArrowBatch.release )
+      psInfo->sArrowBatch.release( &psInfo->sArrowBatch );
+    if( psInfo->sArrowSchema.release )
+      psInfo->sArrowSchema.release( &psInfo->sArrowSchema );
+    if( psInfo->sArrowStream.release )
+      psInfo->sArrowStream.release( &psInfo->sArrowStream );
+  }
+  memset( &psInfo->sArrowBatch, 0, sizeof(psInfo->sArrowBatch) );
+  memset( &psInfo->sArrowSchema, 0, sizeof(psInfo->sArrowSchema) );
+  memset( &psInfo->sArrowStream, 0, sizeof(psInfo->sArrowStream) );
+  msFree( psInfo->panArrowItemColumns );
+  psInfo->panArrowItemColumns = NULL;
+  psInfo->nArrowState = 0;
+}
+
+/**********************************************************************
+ *                     msOGRArrowFindColumn()
+ **********************************************************************/
+static int msOGRArrowFindColumn(const struct ArrowSchema *psSchema,
+                                const char *pszName)
+{
+  for( int i = 0; i < psSchema->n_children; i++ ) {
+    if( strcmp(psSchema->children[i]->name, pszName) == 0 )
+      return i;
+  }
+  return -1;
+}
+
+/**********************************************************************
+ *                     msOGRArrowIsSupportedFormat()
+ *
+ * Attribute column types decoded by msOGRArrowGetValue().
+ **********************************************************************/
+static bool msOGRArrowIsSupportedFormat(const char *pszFormat)
+{
+  static const char * const apszFormats[] = {
+    "b", "c", "C", "s", "S", "i", "I", "l", "L", "f", "g", "u", "U", "tdD", NULL
+  };
+  for( int i = 0; apszFormats[i] != NULL; i++ ) {
+    if( strcmp(pszFormat, apszFormats[i]) == 0 )
+      return true;
+  }
+  return false;
+}
+
+/**********************************************************************
+ *                     msOGRFileStartArrowStream()
+ *
+ * Open an Arrow stream on the layer when PROCESSING "OGR_ARROW_BATCH=ON"
+ * is set and every requested item can be decoded from the batches.
+ * Otherwise leave the layer to the OGR_L_GetNextFeature() reader.
+ * The OGR lock must be held.
+ **********************************************************************/
+static bool msOGRFileStartArrowStream(layerObj *layer, msOGRFileInfo *psInfo)
+{
+  const char *pszValue = msLayerGetProcessingKey(layer, "OGR_ARROW_BATCH");
+  int *itemindexes = (int*)layer->iteminfo;
+
+  psInfo->nArrowState = -1;
+
+  if( pszValue == NULL || !EQUAL(pszValue, "ON") )
+    return false;
+
+  /* Auto styling and style string items need the OGRFeature */
+  if( layer->styleitem && EQUAL(layer->styleitem, "AUTO") )
+    return false;
+  for( int i = 0; i < layer->numitems; i++ ) {
+    if( itemindexes == NULL
+        || (itemindexes[i] < 0 && itemindexes[i] != MSOGR_FID_INDEX) )
+      return false;
+  }
+
+  char **papszOptions = CSLSetNameValue(NULL, "INCLUDE_FID", "YES");
+  papszOptions = CSLSetNameValue(papszOptions, "GEOMETRY_ENCODING", "WKB");
+  pszValue = msLayerGetProcessingKey(layer, "OGR_ARROW_BATCH_SIZE");
+  if( pszValue )
+    papszOptions = CSLSetNameValue(papszOptions, "MAX_FEATURES_IN_BATCH", pszValue);
+
+  bool bOK = OGR_L_GetArrowStream(psInfo->hLayer, &psInfo->sArrowStream, papszOptions);
+  CSLDestroy(papszOptions);
+  if( !bOK ) {
+    memset( &psInfo->sArrowStream, 0, sizeof(psInfo->sArrowStream) );
+    if( layer->debug )
+      msDebug("msOGRFileStartArrowStream(): OGR_L_GetArrowStream() failed, using feature reader.\n");
+    return false;
+  }
+  psInfo->nArrowState = 1;
+
+  if( psInfo->sArrowStream.get_schema(&psInfo->sArrowStream, &psInfo->sArrowSchema) != 0 ) {
+    msOGRFileReleaseArrowStream(psInfo);
+    psInfo->nArrowState = -1;
+    return false;
+  }
+
+  /* ------------------------------------------------------------------
+   * Locate the FID, geometry and requested attribute columns.
+   * ------------------------------------------------------------------ */
+  const struct ArrowSchema *psSchema = &psInfo->sArrowSchema;
+  const char *pszFIDColumn = OGR_L_GetFIDColumn(psInfo->hLayer);
+  const char *pszGeomColumn = OGR_L_GetGeometryColumn(psInfo->hLayer);
+
+  psInfo->nArrowFIDColumn = msOGRArrowFindColumn(psSchema,
+                             (pszFIDColumn && pszFIDColumn[0]) ? pszFIDColumn : "OGC_FID");
+  psInfo->nArrowGeomColumn = msOGRArrowFindColumn(psSchema,
+                             (pszGeomColumn && pszGeomColumn[0]) ? pszGeomColumn : "wkb_geometry");
+
+  bool bSupported = psInfo->nArrowFIDColumn >= 0 && psInfo->nArrowGeomColumn >= 0
+                    && strcmp(psSchema->children[psInfo->nArrowFIDColumn]->format, "l") == 0
+                    && (strcmp(psSchema->children[psInfo->nArrowGeomColumn]->format, "z") == 0
+                        || strcmp(psSchema->children[psInfo->nArrowGeomColumn]->format, "Z") == 0);
+
+  if( bSupported && layer->numitems > 0 ) {
+    OGRFeatureDefnH hDefn = OGR_L_GetLayerDefn(psInfo->hLayer);
+
+    psInfo->panArrowItemColumns = (int*)msSmallMalloc(sizeof(int) * layer->numitems);
+    for( int i = 0; bSupported && i < layer->numitems; i++ ) {
+      if( itemindexes[i] == MSOGR_FID_INDEX ) {
+        psInfo->panArrowItemColumns[i] = psInfo->nArrowFIDColumn;
+        continue;
+      }
+      OGRFieldDefnH hField = OGR_FD_GetFieldDefn(hDefn, itemindexes[i]);
+      int iCol = msOGRArrowFindColumn(psSchema, OGR_Fld_GetNameRef(hField));
+      if( iCol < 0 || !msOGRArrowIsSupportedFormat(psSchema->children[iCol]->format) )
+        bSupported = false;
+      psInfo->panArrowItemColumns[i] = iCol;
+    }
+  }
+
+  if( !bSupported ) {
+    if( layer->debug )
+      msDebug("msOGRFileStartArrowStream(): unsupported column types, using feature reader.\n");
+    msOGRFileReleaseArrowStream(psInfo);
+    psInfo->nArrowState = -1;
+    return false;
+  }
+
+  if( layer->debug )
+    msDebug("msOGRFileStartArrowStream(): reading layer %s in Arrow batches.\n",
+            layer->name );
+
+  return true;
+}
+
+/**********************************************************************
+ *                     msOGRArrowIsNull()
+ **********************************************************************/
+static inline bool msOGRArrowIsNull(const struct ArrowArray *psArray, GIntBig iRow)
+{
+  const GByte *pabyValidity = (const GByte*) psArray->buffers[0];
+  GIntBig iBit = iRow + psArray->offset;
+
+  if( psArray->null_count == 0 || pabyValidity == NULL )
+    return false;
+  return (pabyValidity[iBit / 8] & (1 << (iBit % 8))) == 0;
+}
+
+/**********************************************************************
+ *                     msOGRArrowGetBinary()
+ *
+ * Pointer into a binary or string column, without copying.
+ **********************************************************************/
+static inline const GByte *msOGRArrowGetBinary(const struct ArrowArray *psArray,
+                                               const char *pszFormat,
+                                               GIntBig iRow, size_t *pnSize)
+{
+  const GByte *pabyData = (const GByte*) psArray->buffers[2];
+  GIntBig i = iRow + psArray->offset;
+
+  if( pszFormat[0] == 'Z' || pszFormat[0] == 'U' ) {
+    const int64_t *panOffsets = (const int64_t*) psArray->buffers[1];
+    *pnSize = (size_t)(panOffsets[i+1] - panOffsets[i]);
+    return pabyData + panOffsets[i];
+  } else {
+    const int32_t *panOffsets = (const int32_t*) psArray->buffers[1];
+    *pnSize = (size_t)(panOffsets[i+1] - panOffsets[i]);
+    return pabyData + panOffsets[i];
+  }
+}
+
+/**********************************************************************
+ *                     msOGRArrowGetValue()
+ *
+ * Format a value the way OGR_F_GetFieldAsString() does.
+ **********************************************************************/
+static char *msOGRArrowGetValue(layerObj *layer, msOGRFileInfo *psInfo,
+                                int iItem, GIntBig iRow)
+{
+  int iCol = psInfo->panArrowItemColumns[iItem];
+  const struct ArrowArray *psArray = psInfo->sArrowBatch.children[iCol];
+  const char *pszFormat = psInfo->sArrowSchema.children[iCol]->format;
+  const void *pValues = psArray->buffers[1];
+  GIntBig i = iRow + psArray->offset;
+  char szBuffer[64];
+
+  if( msOGRArrowIsNull(psArray, iRow) )
+    return msStrdup("");
+
+  switch( pszFormat[0] ) {
+    case 'b':
+      return msStrdup((((const GByte*)pValues)[i / 8] & (1 << (i % 8))) ? "1" : "0");
+    case 'c':
+      snprintf(szBuffer, sizeof(szBuffer), "%d", ((const int8_t*)pValues)[i]);
+      break;
+    case 'C':
+      snprintf(szBuffer, sizeof(szBuffer), "%d", ((const uint8_t*)pValues)[i]);
+      break;
+    case 's':
+      snprintf(szBuffer, sizeof(szBuffer), "%d", ((const int16_t*)pValues)[i]);
+      break;
+    case 'S':
+      snprintf(szBuffer, sizeof(szBuffer), "%d", ((const uint16_t*)pValues)[i]);
+      break;
+    case 'i':
+      snprintf(szBuffer, sizeof(szBuffer), "%d", ((const int32_t*)pValues)[i]);
+      break;
+    case 'I':
+      snprintf(szBuffer, sizeof(szBuffer), "%u", ((const uint32_t*)pValues)[i]);
+      break;
+    case 'l':
+      snprintf(szBuffer, sizeof(szBuffer), CPL_FRMT_GIB, (GIntBig)((const int64_t*)pValues)[i]);
+      break;
+    case 'L':
+      snprintf(szBuffer, sizeof(szBuffer), CPL_FRMT_GUIB, (GUIntBig)((const uint64_t*)pValues)[i]);
+      break;
+    case 'f':
+    case 'g': {
+      int *itemindexes = (int*)layer->iteminfo;
+      OGRFieldDefnH hField = OGR_FD_GetFieldDefn(OGR_L_GetLayerDefn(psInfo->hLayer),
+                                                 itemindexes[iItem]);
+      double dfValue = pszFormat[0] == 'f' ? ((const float*)pValues)[i]
+                                           : ((const double*)pValues)[i];
+      if( OGR_Fld_GetWidth(hField) != 0 )
+        CPLsnprintf(szBuffer, sizeof(szBuffer), "%*.*f", OGR_Fld_GetWidth(hField),
+                    OGR_Fld_GetPrecision(hField), dfValue);
+      else
+        CPLsnprintf(szBuffer, sizeof(szBuffer), pszFormat[0] == 'f' ? "%.8g" : "%.15g",
+                    dfValue);
+      break;
+    }
+    case 'u':
+    case 'U': {
+      size_t nSize;
+      const GByte *pabyString = msOGRArrowGetBinary(psArray, pszFormat, iRow, &nSize);
+      char *pszValue = (char*)msSmallMalloc(nSize + 1);
+      memcpy(pszValue, pabyString, nSize);
+      pszValue[nSize] = '\0';
+      return pszValue;
+    }
+    case 't': {
+      /* date32: days since 1970-01-01, formatted as YYYY/MM/DD */
+      int nDays = ((const int32_t*)pValues)[i] + 719468;
+      int nEra = (nDays >= 0 ? nDays : nDays - 146096) / 146097;
+      int nDayOfEra = nDays - nEra * 146097;
+      int nYearOfEra = (nDayOfEra - nDayOfEra/1460 + nDayOfEra/36524 - nDayOfEra/146096) / 365;
+      int nDayOfYear = nDayOfEra - (365*nYearOfEra + nYearOfEra/4 - nYearOfEra/100);
+      int nMP = (5*nDayOfYear + 2) / 153;
+      int nDay = nDayOfYear - (153*nMP + 2)/5 + 1;
+      int nMonth = nMP < 10 ? nMP + 3 : nMP - 9;
+      int nYear = nYearOfEra + nEra * 400 + (nMonth <= 2);
+      snprintf(szBuffer, sizeof(szBuffer), "%04d/%02d/%02d", nYear, nMonth, nDay);
+      break;
+    }
+    default:
+      return msStrdup("");
+  }
+
+  return msStrdup(szBuffer);
+}
+
+/**********************************************************************
+ *                     msOGRFileNextShapeArrow()
+ *
+ * msOGRFileNextShape() reading from the Arrow stream: the WKB is read
+ * from the batch buffers without an OGRFeature, turned into an
+ * OGRGeometry and converted with ogrConvertGeometry(). Attributes are
+ * only formatted for features whose geometry is kept.
+ **********************************************************************/
+static int
+msOGRFileNextShapeArrow(layerObj *layer, shapeObj *shape,
+                        msOGRFileInfo *psInfo )
+{
+  struct ArrowArray *psBatch = &psInfo->sArrowBatch;
+  GIntBig iRow = 0;
+
+  msFreeShape(shape);
+  shape->type = MS_SHAPE_NULL;
+
+  ACQUIRE_OGR_LOCK;
+  while (shape->type == MS_SHAPE_NULL) {
+    if( psBatch->release == NULL || psInfo->nArrowBatchRow >= psBatch->length ) {
+      if( psBatch->release )
+        psBatch->release( psBatch );
+      memset( psBatch, 0, sizeof(*psBatch) );
+
+      if( psInfo->sArrowStream.get_next( &psInfo->sArrowStream, psBatch ) != 0 ) {
+        const char *pszError = psInfo->sArrowStream.get_last_error( &psInfo->sArrowStream );
+        psInfo->last_record_index_read = -1;
+        msSetError(MS_OGRERR, "OGR Arrow stream get_next() error'd. Check logs.",
+                   "msOGRFileNextShape()");
+        msDebug("msOGRFileNextShape(): %s\n", pszError ? pszError : "(unknown)" );
+        RELEASE_OGR_LOCK;
+        return MS_FAILURE;
+      }
+
+      if( psBatch->release == NULL ) {
+        psInfo->last_record_index_read = -1;
+        RELEASE_OGR_LOCK;
+        if (layer->debug >= MS_DEBUGLEVEL_VV)
+          msDebug("msOGRFileNextShape: Returning MS_DONE (no more shapes)\n" );
+        return MS_DONE;  // No more features to read
+      }
+
+      if (layer->debug >= MS_DEBUGLEVEL_VV)
+        msDebug("msOGRFileNextShape: Read Arrow batch of " CPL_FRMT_GIB " features\n",
+                (GIntBig)psBatch->length );
+      psInfo->nArrowBatchRow = 0;
+      continue;
+    }
+
+    iRow = psInfo->nArrowBatchRow++;
+    psInfo->last_record_index_read++;
+
+    const struct ArrowArray *psGeom = psBatch->children[psInfo->nArrowGeomColumn];
+    if( msOGRArrowIsNull(psGeom, iRow) )
+      continue;
+
+    size_t nWKBSize;
+    const GByte *pabyWKB = msOGRArrowGetBinary(psGeom,
+                           psInfo->sArrowSchema.children[psInfo->nArrowGeomColumn]->format,
+                           iRow, &nWKBSize);
+    OGRGeometryH hGeom = NULL;
+    if( OGR_G_CreateFromWkb( pabyWKB, NULL, &hGeom, (int)nWKBSize ) != OGRERR_NONE ) {
+      if (layer->debug >= MS_DEBUGLEVEL_VVV)
+        msDebug("msOGRFileNextShape: Skipping feature with invalid WKB\n");
+      continue;
+    }
+    hGeom = OGR_G_ForceTo(hGeom, OGR_GT_GetLinear(OGR_G_GetGeometryType(hGeom)), NULL);
+
+    int nStatus = ogrConvertGeometry(hGeom, shape, layer->type);
+    OGR_G_DestroyGeometry(hGeom);
+    if( nStatus != MS_SUCCESS ) {
+      msFreeShape(shape);
+      RELEASE_OGR_LOCK;
+      return MS_FAILURE; // Error message already produced.
+    }
+  }
+
+  if(layer->numitems > 0) {
+    shape->values = (char **)msSmallMalloc(sizeof(char *) * layer->numitems);
+    for( int i = 0; i < layer->numitems; i++ )
+      shape->values[i] = msOGRArrowGetValue(layer, psInfo, i, iRow);
+    shape->numvalues = layer->numitems;
+  }
+
+  const struct ArrowArray *psFID = psBatch->children[psInfo->nArrowFIDColumn];
+  shape->index = (long)((const int64_t*)psFID->buffers[1])[iRow + psFID->offset];
+  shape->resultindex = psInfo->last_record_index_read;
+  shape->tileindex = psInfo->nTileId;
+
+  if (layer->debug >= MS_DEBUGLEVEL_VVV)
+    msDebug("msOGRFileNextShape: Returning shape=%ld, tile=%d\n",
+            shape->index, shape->tileindex );
+
+  // No feature to keep around: auto styling disables the Arrow reader.
+  if (psInfo->hLastFeature) {
+    OGR_F_Destroy( psInfo->hLastFeature );
+    psInfo->hLastFeature = NULL;
+  }
+
+  RELEASE_OGR_LOCK;
+
+  return MS_SUCCESS;
+}
+
+#endif /* MSOGR_USE_ARROW */
+
 /**********************************************************************
  *                     msOGRFileNextShape()
  *
@@ -2784,6 +3194,16 @@ msOGRFileNextShape(layerObj *layer, shapeObj *shape,
     return(MS_FAILURE);
   }
 
+#ifdef MSOGR_USE_ARROW
+  if( psInfo->nArrowState == 0 ) {
+    ACQUIRE_OGR_LOCK;
+    msOGRFileStartArrowStream( layer, psInfo );
+    RELEASE_OGR_LOCK;
+  }
+  if( psInfo->nArrowState == 1 )
+    return msOGRFileNextShapeArrow( layer, shape, psInfo );
+#endif
+
   /* ------------------------------------------------------------------
    * Read until we find a feature that matches attribute filter and
    * whose geometry is compatible with current layer type.
@@ -2893,6 +3313,16 @@ msOGRFileGetShape(layerObj *layer, shapeObj *shape, long record,
   msFreeShape(shape);
   shape->type = MS_SHAPE_NULL;
 
+#ifdef MSOGR_USE_ARROW
+  /* No other layer calls are allowed while an Arrow stream is active. */
+  if( psInfo->nArrowState == 1 ) {
+    ACQUIRE_OGR_LOCK;
+    msOGRFileReleaseArrowStream( psInfo );
+    psInfo->nArrowState = -1;
+    RELEASE_OGR_LOCK;
+  }
+#endif
+
   /* -------------------------------------------------------------------- */
   /*      Support reading feature by fid.                                 */
   /* -------------------------------------------------------------------- */
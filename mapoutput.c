@@ -117,6 +117,7 @@ struct defaultOutputFormatEntry defaultoutputformats[] = {
   {"kmz","KMZ","application/vnd.google-earth.kmz"},
 #endif
   {"json","UTFGrid","application/json"},
+  {"mvt","MVT","application/x-protobuf"},
   {NULL,NULL,NULL}
 };
 
@@ -353,6 +354,14 @@ outputFormatObj *msCreateDefaultOutputFormat( mapObj *map,
     }
   }
 #endif
+  else if( strcasecmp(driver,"MVT") == 0 ) {
+    if(!name) name="mvt";
+    format = msAllocOutputFormat( map, name, driver );
+    format->mimetype = msStrdup("application/x-protobuf");
+    format->imagemode = MS_IMAGEMODE_FEATURE;
+    format->extension = msStrdup("pbf");
+    format->renderer = MS_RENDER_WITH_MVT;
+  }
   else if( strcasecmp(driver,"imagemap") == 0 ) {
     if(!name) name="imagemap";
     format = msAllocOutputFormat( map, name, driver );
@@ -180,6 +180,7 @@ copyVirtualTable(layerVTableObj *dest,
   dest->LayerEscapeSQLParam = src->LayerEscapeSQLParam ? src->LayerEscapeSQLParam: dest->LayerEscapeSQLParam;
   dest->LayerEnablePaging = src->LayerEnablePaging ? src->LayerEnablePaging: dest->LayerEnablePaging;
   dest->LayerGetPaging = src->LayerGetPaging ? src->LayerGetPaging: dest->LayerGetPaging;
+  dest->LayerRecycleShape = src->LayerRecycleShape ? src->LayerRecycleShape: dest->LayerRecycleShape;
 }
 
 int
@@ -129,10 +129,33 @@ o The connection pooling API will let a connection be used/referenced multiple
   between different threads concurrently.  But if a connection is released
   by one thread, it is available for use by another thread.
 
+o Connections are hashed on connection type and connection string.  Released
+  connections that are kept open go on a per key LIFO idle list, so a request
+  costs a hash lookup rather than a scan of all open connections.
+
+o The following PROCESSING options tune the pool for long running servers:
+    CONNECTION_POOL_MAX=n        keep at most n connections open for this
+                                 CONNECTION.  Connections registered beyond
+                                 that are closed as soon as they are released.
+    CONNECTION_IDLE_TIMEOUT=sec  with CLOSE_CONNECTION=DEFER, close
+                                 connections idle for more than sec seconds.
+    CONNECTION_VALIDATE=ON       check an idle connection is still alive
+                                 before handing it out.  This requires the
+                                 driver to register with
+                                 msConnPoolRegisterWithValidation().
+
+o A driver that finds a pooled connection broken (ie. the backend went away
+  and could not be reset) gives it back with msConnPoolDiscard() instead of
+  msConnPoolRelease(), so it is closed rather than handed out again.
+
+o msConnPoolDebugStats() reports per connection usage statistics (requests,
+  hits, closes, evictions, failed validations) through msDebug().
+
  ****************************************************************************/
 
 #include "mapserver.h"
 #include "mapthread.h"
+#include <ctype.h>
 
 
 
@@ -143,7 +166,13 @@ o The connection pooling API will let a connection be used/referenced multiple
 #define MS_LIFE_ZEROREF       -2
 #define MS_LIFE_SINGLE        -3
 
-typedef struct {
+/* number of hash buckets for the connection keys, must be a power of two */
+#define MS_POOL_BUCKETS       64
+
+/* how often (in seconds) all keys are swept for idle connections */
+#define MS_POOL_SWEEP_INTERVAL 30
+
+typedef struct connectionObj_t {
   enum MS_CONNECTION_TYPE connectiontype;
   char *connection;
 
@@ -157,15 +186,138 @@ typedef struct {
   void  *conn_handle;
 
   void  (*close)( void * );
+  int   (*validate)( void * );
+
+  struct connectionObj_t *next;      /* next connection with the same key */
+  struct connectionObj_t *next_idle; /* next entry in the key's idle list */
 } connectionObj;
 
+/*
+** All connections sharing a connection type and (case insensitive)
+** connection string hang off one key.  Unreferenced connections are kept
+** on a LIFO idle list so the most recently used (and thus most likely
+** alive) connection is handed out first.
+*/
+typedef struct poolKeyObj_t {
+  enum MS_CONNECTION_TYPE connectiontype;
+  char *connection;
+  unsigned int hash;
+
+  connectionObj *connections; /* all connections, in use or idle */
+  connectionObj *idle;        /* idle ones, most recently released first */
+  int count;
+  int max_connections;        /* 0 means unbounded */
+
+  /* usage statistics, reported by msConnPoolDebugStats() */
+  long requests;
+  long hits;
+  long registered;
+  long closed;
+  long evicted;
+  long invalid;
+  long overflow;
+
+  struct poolKeyObj_t *next;  /* next key in the hash bucket */
+} poolKeyObj;
+
 /*
 ** These static structures are protected by the TLOCK_POOL mutex.
 */
 
 static int connectionCount = 0;
-static int connectionMax = 0;
-static connectionObj *connections = NULL;
+static poolKeyObj *poolKeys[MS_POOL_BUCKETS];
+static time_t lastSweep = 0;
+
+/************************************************************************/
+/*                          msConnPoolHash()                            */
+/************************************************************************/
+
+static unsigned int msConnPoolHash( enum MS_CONNECTION_TYPE connectiontype,
+                                    const char *connection )
+
+{
+  unsigned int hash = 2166136261U ^ (unsigned int) connectiontype;
+
+  for( ; *connection != '\0'; connection++ ) {
+    hash ^= (unsigned char) tolower( (unsigned char) *connection );
+    hash *= 16777619U;
+  }
+
+  return hash;
+}
+
+/************************************************************************/
+/*                         msConnPoolFindKey()                          */
+/*                                                                      */
+/*      Find the key of a connection type/string, optionally creating   */
+/*      it.  The pool lock must be held.                                */
+/************************************************************************/
+
+static poolKeyObj *msConnPoolFindKey( enum MS_CONNECTION_TYPE connectiontype,
+                                      const char *connection, int create )
+
+{
+  unsigned int hash = msConnPoolHash( connectiontype, connection );
+  poolKeyObj *key;
+
+  for( key = poolKeys[hash & (MS_POOL_BUCKETS-1)]; key != NULL; key = key->next ) {
+    if( key->hash == hash
+        && key->connectiontype == connectiontype
+        && strcasecmp( key->connection, connection ) == 0 )
+      return key;
+  }
+
+  if( !create )
+    return NULL;
+
+  key = (poolKeyObj *) calloc( 1, sizeof(poolKeyObj) );
+  if( key == NULL ) {
+    msSetError(MS_MEMERR, NULL, "msConnPoolFindKey()");
+    return NULL;
+  }
+  key->connectiontype = connectiontype;
+  key->connection = msStrdup( connection );
+  key->hash = hash;
+  key->next = poolKeys[hash & (MS_POOL_BUCKETS-1)];
+  poolKeys[hash & (MS_POOL_BUCKETS-1)] = key;
+
+  return key;
+}
+
+/************************************************************************/
+/*                         msConnPoolGetLimit()                         */
+/*                                                                      */
+/*      Fetch an integer pooling PROCESSING option from the layer.      */
+/************************************************************************/
+
+static int msConnPoolGetLimit( layerObj *layer, const char *option )
+
+{
+  const char *value = msLayerGetProcessingKey( layer, option );
+
+  if( value == NULL )
+    return 0;
+
+  return MS_MAX( atoi(value), 0 );
+}
+
+/************************************************************************/
+/*                       msConnPoolUnlinkIdle()                         */
+/************************************************************************/
+
+static void msConnPoolUnlinkIdle( poolKeyObj *key, connectionObj *conn )
+
+{
+  connectionObj **link;
+
+  for( link = &(key->idle); *link != NULL; link = &((*link)->next_idle) ) {
+    if( *link == conn ) {
+      *link = conn->next_idle;
+      conn->next_idle = NULL;
+      return;
+    }
+  }
+}
 
 /************************************************************************/
 /*                         msConnPoolRegister()                         */
@@ -177,9 +329,29 @@ void msConnPoolRegister( layerObj *layer,
                          void *conn_handle,
                          void (*close_func)( void * ) )
 
+{
+  msConnPoolRegisterWithValidation( layer, conn_handle, close_func, NULL );
+}
+
+/************************************************************************/
+/*                  msConnPoolRegisterWithValidation()                  */
+/*                                                                      */
+/*      Same as msConnPoolRegister(), but also records a callback       */
+/*      returning MS_TRUE if the connection is still usable.  It is     */
+/*      called before an idle connection is handed out again to         */
+/*      layers with PROCESSING "CONNECTION_VALIDATE=ON".                */
+/************************************************************************/
+
+void msConnPoolRegisterWithValidation( layerObj *layer,
+                                       void *conn_handle,
+                                       void (*close_func)( void * ),
+                                       int (*validate_func)( void * ) )
+
 {
   const char *close_connection = NULL;
   connectionObj *conn = NULL;
+  poolKeyObj *key = NULL;
+  int idle_timeout;
 
   if( layer->debug )
     msDebug( "msConnPoolRegister(%s,%s,%p)\n",
@@ -206,33 +378,19 @@ void msConnPoolRegister( layerObj *layer,
     return;
   }
 
-  /* -------------------------------------------------------------------- */
-  /*      Grow the array of connection information objects if needed.     */
-  /* -------------------------------------------------------------------- */
-  msAcquireLock( TLOCK_POOL );
-
-  if( connectionCount == connectionMax ) {
-    connectionMax += 10;
-    connections = (connectionObj *)
-                  realloc(connections,
-                          sizeof(connectionObj) * connectionMax );
-    if( connections == NULL ) {
-      msSetError(MS_MEMERR, NULL, "msConnPoolRegister()");
-      msReleaseLock( TLOCK_POOL );
-      return;
-    }
+  conn = (connectionObj *) calloc( 1, sizeof(connectionObj) );
+  if( conn == NULL ) {
+    msSetError(MS_MEMERR, NULL, "msConnPoolRegister()");
+    return;
   }
 
   /* -------------------------------------------------------------------- */
   /*      Set the new connection information.                             */
   /* -------------------------------------------------------------------- */
-  conn = connections + connectionCount;
-
-  connectionCount++;
-
   conn->connectiontype = layer->connectiontype;
   conn->connection = msStrdup( layer->connection );
   conn->close = close_func;
+  conn->validate = validate_func;
   conn->ref_count = 1;
   conn->thread_id = msGetThreadId();
   conn->last_used = time(NULL);
@@ -265,21 +423,57 @@ void msConnPoolRegister( layerObj *layer,
     conn->lifespan = MS_LIFE_ZEROREF;
   }
 
+  /* deferred connections may be reaped once idle for too long */
+  idle_timeout = msConnPoolGetLimit( layer, "CONNECTION_IDLE_TIMEOUT" );
+  if( conn->lifespan == MS_LIFE_FOREVER && idle_timeout > 0 )
+    conn->lifespan = idle_timeout;
+
+  /* -------------------------------------------------------------------- */
+  /*      Attach it to its key.                                           */
+  /* -------------------------------------------------------------------- */
+  msAcquireLock( TLOCK_POOL );
+
+  key = msConnPoolFindKey( conn->connectiontype, conn->connection, MS_TRUE );
+  if( key == NULL ) {
+    msReleaseLock( TLOCK_POOL );
+    free( conn->connection );
+    free( conn );
+    return;
+  }
+
+  key->max_connections = msConnPoolGetLimit( layer, "CONNECTION_POOL_MAX" );
+  key->registered++;
+
+  /* Past the per backend limit the connection is still usable, but */
+  /* it won't be kept around once released.                          */
+  if( key->max_connections > 0 && key->count >= key->max_connections
+      && conn->lifespan != MS_LIFE_SINGLE ) {
+    if( layer->debug )
+      msDebug( "msConnPoolRegister(%s): pool holds %d connections, "
+               "not keeping this one.\n", layer->name, key->count );
+    conn->lifespan = MS_LIFE_SINGLE;
+    key->overflow++;
+  }
+
+  conn->next = key->connections;
+  key->connections = conn;
+  key->count++;
+  connectionCount++;
+
   msReleaseLock( TLOCK_POOL );
 }
 
 /************************************************************************/
 /*                          msConnPoolClose()                           */
 /*                                                                      */
-/*      Close the indicated connection.  The index in the connection    */
-/*      table is passed.  Remove the connection from the table as       */
-/*      well.                                                           */
+/*      Close the indicated connection and remove it from its key.      */
+/*      The pool lock must be held.                                     */
 /************************************************************************/
 
-static void msConnPoolClose( int conn_index )
+static void msConnPoolClose( poolKeyObj *key, connectionObj *conn )
 
 {
-  connectionObj *conn = connections + conn_index;
+  connectionObj **link;
 
   if( conn->ref_count > 0 ) {
     if( conn->debug )
@@ -301,20 +495,71 @@ static void msConnPoolClose( int conn_index )
   if( conn->close != NULL )
     conn->close( conn->conn_handle );
 
+  msConnPoolUnlinkIdle( key, conn );
+  for( link = &(key->connections); *link != NULL; link = &((*link)->next) ) {
+    if( *link == conn ) {
+      *link = conn->next;
+      break;
+    }
+  }
+  key->count--;
+  key->closed++;
+  connectionCount--;
+
   /* free malloced() stuff in this connection */
   free( conn->connection );
+  free( conn );
+}
 
-  connectionCount--;
-  if( connectionCount == 0 ) {
-    /* if there are no connections left we will "cleanup".  */
-    connectionMax = 0;
-    free( connections );
-    connections = NULL;
-  } else {
-    /* move the last connection in place of our now closed one */
-    memcpy( connections + conn_index,
-            connections + connectionCount,
-            sizeof(connectionObj) );
+/************************************************************************/
+/*                        msConnPoolReapIdle()                          */
+/*                                                                      */
+/*      Close the idle connections of a key that outlived their         */
+/*      CONNECTION_IDLE_TIMEOUT.  The pool lock must be held.           */
+/************************************************************************/
+
+static void msConnPoolReapIdle( poolKeyObj *key, time_t now )
+
+{
+  connectionObj *conn = key->idle;
+
+  while( conn != NULL ) {
+    connectionObj *next = conn->next_idle;
+
+    if( conn->lifespan > 0 && now - conn->last_used > conn->lifespan ) {
+      if( conn->debug )
+        msDebug( "msConnPoolReapIdle(%s): idle for %ds, closing %p\n",
+                 conn->connection, (int)(now - conn->last_used),
+                 conn->conn_handle );
+      key->evicted++;
+      msConnPoolClose( key, conn );
+    }
+    conn = next;
+  }
+}
+
+/************************************************************************/
+/*                        msConnPoolSweepIdle()                         */
+/*                                                                      */
+/*      Reap idle connections of all keys, at most once every           */
+/*      MS_POOL_SWEEP_INTERVAL seconds.  The pool lock must be held.    */
+/************************************************************************/
+
+static void msConnPoolSweepIdle( time_t now )
+
+{
+  int i;
+  poolKeyObj *key;
+
+  if( now - lastSweep < MS_POOL_SWEEP_INTERVAL )
+    return;
+  lastSweep = now;
+
+  for( i = 0; i < MS_POOL_BUCKETS; i++ ) {
+    for( key = poolKeys[i]; key != NULL; key = key->next ) {
+      if( key->idle != NULL )
+        msConnPoolReapIdle( key, now );
+    }
   }
 }
 
@@ -330,8 +575,12 @@ static void msConnPoolClose( int conn_index )
 void *msConnPoolRequest( layerObj *layer )
 
 {
-  int  i;
   const char* close_connection;
+  const char* validate;
+  poolKeyObj *key;
+  connectionObj *conn;
+  void *thread_id;
+  time_t now;
 
   if( layer->connection == NULL )
     return NULL;
@@ -341,36 +590,85 @@ void *msConnPoolRequest( layerObj *layer )
   if( close_connection && strcasecmp(close_connection,"ALWAYS") == 0 )
     return NULL;
 
+  validate = msLayerGetProcessingKey( layer, "CONNECTION_VALIDATE" );
+  thread_id = msGetThreadId();
+  now = time(NULL);
+
   msAcquireLock( TLOCK_POOL );
-  for( i = 0; i < connectionCount; i++ ) {
-    connectionObj *conn = connections + i;
 
-    if( layer->connectiontype == conn->connectiontype
-        && strcasecmp( layer->connection, conn->connection ) == 0
-        && (conn->ref_count == 0 || conn->thread_id == msGetThreadId())
-        && conn->lifespan != MS_LIFE_SINGLE) {
-      void *conn_handle = NULL;
+  key = msConnPoolFindKey( layer->connectiontype, layer->connection, MS_FALSE );
+  if( key == NULL ) {
+    msReleaseLock( TLOCK_POOL );
+    return NULL;
+  }
+  key->requests++;
 
-      conn->ref_count++;
-      conn->thread_id = msGetThreadId();
-      conn->last_used = time(NULL);
+  /* -------------------------------------------------------------------- */
+  /*      A connection already checked out by this thread can be          */
+  /*      shared with the other layers it is drawing.                     */
+  /* -------------------------------------------------------------------- */
+  for( conn = key->connections; conn != NULL; conn = conn->next ) {
+    if( conn->ref_count > 0 && conn->thread_id == thread_id
+        && conn->lifespan != MS_LIFE_SINGLE )
+      break;
+  }
 
-      if( layer->debug ) {
-        msDebug( "msConnPoolRequest(%s,%s) -> got %p\n",
-                 layer->name, layer->connection, conn->conn_handle );
-        conn->debug = layer->debug;
-      }
+  /* -------------------------------------------------------------------- */
+  /*      Otherwise take the most recently released idle connection,      */
+  /*      dropping the stale or dead ones on the way.                     */
+  /* -------------------------------------------------------------------- */
+  if( conn == NULL ) {
+    msConnPoolReapIdle( key, now );
 
-      conn_handle = conn->conn_handle;
+    while( (conn = key->idle) != NULL ) {
+      int valid;
 
+      key->idle = conn->next_idle;
+      conn->next_idle = NULL;
+
+      if( conn->validate == NULL || validate == NULL
+          || strcasecmp(validate, "ON") != 0 )
+        break;
+
+      /* Validation is a round trip to the server, don't hold up the   */
+      /* other threads meanwhile.  The connection is checked out to    */
+      /* this thread so it can't be handed out or closed by them.      */
+      conn->ref_count = 1;
+      conn->thread_id = thread_id;
       msReleaseLock( TLOCK_POOL );
-      return conn_handle;
+      valid = conn->validate( conn->conn_handle );
+      msAcquireLock( TLOCK_POOL );
+      conn->ref_count = 0;
+
+      if( valid )
+        break;
+
+      if( layer->debug )
+        msDebug( "msConnPoolRequest(%s,%s): %p failed validation, closing it.\n",
+                 layer->name, layer->connection, conn->conn_handle );
+      key->invalid++;
+      msConnPoolClose( key, conn );
     }
   }
 
-  msReleaseLock( TLOCK_POOL );
+  if( conn == NULL ) {
+    msReleaseLock( TLOCK_POOL );
+    return NULL;
+  }
+
+  conn->ref_count++;
+  conn->thread_id = thread_id;
+  conn->last_used = now;
+  key->hits++;
 
-  return NULL;
+  if( layer->debug ) {
+    msDebug( "msConnPoolRequest(%s,%s) -> got %p\n",
+             layer->name, layer->connection, conn->conn_handle );
+    conn->debug = layer->debug;
+  }
+
+  msReleaseLock( TLOCK_POOL );
+  return conn->conn_handle;
 }
 
 /************************************************************************/
@@ -378,14 +676,15 @@ void *msConnPoolRequest( layerObj *layer )
 /*                                                                      */
 /*      Release the passed connection for the given layer.              */
 /*      Internally the reference count is dropped, and the              */
-/*      connection may be closed.  We assume the caller has already     */
-/*      acquired the pool lock.                                         */
+/*      connection may be closed.                                       */
 /************************************************************************/
 
 void msConnPoolRelease( layerObj *layer, void *conn_handle )
 
 {
-  int  i;
+  poolKeyObj *key;
+  connectionObj *conn = NULL;
+  time_t now;
 
   if( layer->debug )
     msDebug( "msConnPoolRelease(%s,%s,%p)\n",
@@ -394,25 +693,37 @@ void msConnPoolRelease( layerObj *layer, void *conn_handle )
   if( layer->connection == NULL )
     return;
 
+  now = time(NULL);
+
   msAcquireLock( TLOCK_POOL );
-  for( i = 0; i < connectionCount; i++ ) {
-    connectionObj *conn = connections + i;
 
-    if( layer->connectiontype == conn->connectiontype
-        && strcasecmp( layer->connection, conn->connection ) == 0
-        && conn->conn_handle == conn_handle ) {
-      conn->ref_count--;
-      conn->last_used = time(NULL);
+  key = msConnPoolFindKey( layer->connectiontype, layer->connection, MS_FALSE );
+  if( key != NULL ) {
+    for( conn = key->connections; conn != NULL; conn = conn->next ) {
+      if( conn->conn_handle == conn_handle )
+        break;
+    }
+  }
 
-      if( conn->ref_count == 0 )
-        conn->thread_id = 0;
+  if( conn != NULL ) {
+    conn->ref_count--;
+    conn->last_used = now;
 
-      if( conn->ref_count == 0 && (conn->lifespan == MS_LIFE_ZEROREF || conn->lifespan == MS_LIFE_SINGLE) )
-        msConnPoolClose( i );
+    if( conn->ref_count == 0 ) {
+      conn->thread_id = 0;
 
-      msReleaseLock( TLOCK_POOL );
-      return;
+      if( conn->lifespan == MS_LIFE_ZEROREF || conn->lifespan == MS_LIFE_SINGLE ) {
+        msConnPoolClose( key, conn );
+      } else {
+        conn->next_idle = key->idle;
+        key->idle = conn;
+      }
     }
+
+    msConnPoolSweepIdle( now );
+
+    msReleaseLock( TLOCK_POOL );
+    return;
   }
 
   msReleaseLock( TLOCK_POOL );
@@ -427,6 +738,96 @@ void msConnPoolRelease( layerObj *layer, void *conn_handle )
               layer->name );
 }
 
+/************************************************************************/
+/*                         msConnPoolDiscard()                          */
+/*                                                                      */
+/*      Release a connection the driver found to be broken.  Unlike     */
+/*      msConnPoolRelease() it is never put back on the idle list:      */
+/*      it is closed right away, or once the other layers of this       */
+/*      thread sharing it have released it.                             */
+/************************************************************************/
+
+void msConnPoolDiscard( layerObj *layer, void *conn_handle )
+
+{
+  poolKeyObj *key;
+  connectionObj *conn = NULL;
+
+  if( layer->debug )
+    msDebug( "msConnPoolDiscard(%s,%s,%p)\n",
+             layer->name, layer->connection, conn_handle );
+
+  if( layer->connection == NULL )
+    return;
+
+  msAcquireLock( TLOCK_POOL );
+
+  key = msConnPoolFindKey( layer->connectiontype, layer->connection, MS_FALSE );
+  if( key != NULL ) {
+    for( conn = key->connections; conn != NULL; conn = conn->next ) {
+      if( conn->conn_handle == conn_handle )
+        break;
+    }
+  }
+
+  if( conn != NULL ) {
+    conn->lifespan = MS_LIFE_SINGLE;
+    conn->ref_count--;
+    if( conn->ref_count == 0 ) {
+      key->invalid++;
+      msConnPoolClose( key, conn );
+    }
+
+    msReleaseLock( TLOCK_POOL );
+    return;
+  }
+
+  msReleaseLock( TLOCK_POOL );
+
+  msDebug( "%s: Unable to find handle for layer '%s'.\n",
+           "msConnPoolDiscard()",
+           layer->name );
+
+  msSetError( MS_MISCERR,
+              "Unable to find handle for layer '%s'.",
+              "msConnPoolDiscard()",
+              layer->name );
+}
+
+/************************************************************************/
+/*                        msConnPoolDebugStats()                        */
+/*                                                                      */
+/*      Report usage statistics of the pool through msDebug().          */
+/************************************************************************/
+
+void msConnPoolDebugStats()
+
+{
+  int i;
+  poolKeyObj *key;
+
+  msAcquireLock( TLOCK_POOL );
+  msDebug( "msConnPoolDebugStats(): %d open connections\n", connectionCount );
+  for( i = 0; i < MS_POOL_BUCKETS; i++ ) {
+    for( key = poolKeys[i]; key != NULL; key = key->next ) {
+      connectionObj *conn;
+      int idle = 0;
+
+      for( conn = key->idle; conn != NULL; conn = conn->next_idle )
+        idle++;
+
+      msDebug( "msConnPoolDebugStats(%d,%s): open=%d idle=%d max=%d "
+               "requests=%ld hits=%ld registered=%ld closed=%ld "
+               "evicted=%ld invalid=%ld overflow=%ld\n",
+               key->connectiontype, key->connection, key->count, idle,
+               key->max_connections, key->requests, key->hits,
+               key->registered, key->closed, key->evicted, key->invalid,
+               key->overflow );
+    }
+  }
+  msReleaseLock( TLOCK_POOL );
+}
+
 /************************************************************************/
 /*                   msConnPoolMapCloseUnreferenced()                   */
 /*                                                                      */
@@ -437,18 +838,16 @@ void msConnPoolCloseUnreferenced()
 
 {
   int  i;
+  poolKeyObj *key;
 
   /* this really needs to be commented out before commiting.  */
   /* msDebug( "msConnPoolCloseUnreferenced()\n" ); */
 
   msAcquireLock( TLOCK_POOL );
-  for( i = connectionCount - 1; i >= 0; i-- ) {
-    connectionObj *conn = connections + i;
-
-    if( conn->ref_count == 0 ) {
-      /* for now we don't assume the locks are re-entrant, so release */
-      /* it so msConnPoolClose() can get it.  */
-      msConnPoolClose( i );
+  for( i = 0; i < MS_POOL_BUCKETS; i++ ) {
+    for( key = poolKeys[i]; key != NULL; key = key->next ) {
+      while( key->idle != NULL )
+        msConnPoolClose( key, key->idle );
     }
   }
   msReleaseLock( TLOCK_POOL );
@@ -464,11 +863,26 @@ void msConnPoolCloseUnreferenced()
 void msConnPoolFinalCleanup()
 
 {
+  int i;
+
   /* this really needs to be commented out before commiting.  */
   /* msDebug( "msConnPoolFinalCleanup()\n" ); */
 
+  if( msGetGlobalDebugLevel() >= MS_DEBUGLEVEL_TUNING )
+    msConnPoolDebugStats();
+
   msAcquireLock( TLOCK_POOL );
-  while( connectionCount > 0 )
-    msConnPoolClose( 0 );
+  for( i = 0; i < MS_POOL_BUCKETS; i++ ) {
+    while( poolKeys[i] != NULL ) {
+      poolKeyObj *key = poolKeys[i];
+
+      while( key->connections != NULL )
+        msConnPoolClose( key, key->connections );
+
+      poolKeys[i] = key->next;
+      free( key->connection );
+      free( key );
+    }
+  }
   msReleaseLock( TLOCK_POOL );
 }
@@ -65,6 +65,7 @@
 #include "maptime.h"
 #include "mappostgis.h"
 #include "mapows.h"
+#include "mapthread.h"
 
 #define FP_EPSILON 1e-12
 #define FP_EQ(a, b) (fabs((a)-(b)) < FP_EPSILON)
@@ -87,9 +88,45 @@
 #define RESULTSET_TYPE 0
 #endif
 
+/* Maximum number of statements prepared on a single connection */
+#define MAX_PREPARED_STATEMENTS 64
+
 #ifdef USE_POSTGIS
 
+/*
+** Statements prepared on each connection, protected by TLOCK_POSTGIS.
+** Entries are dropped when their connection is closed or reset.
+*/
+typedef struct msPostGISPreparedObj_t {
+  PGconn *pgconn;
+  char name[24];
+  struct msPostGISPreparedObj_t *next;
+} msPostGISPreparedObj;
+
+static msPostGISPreparedObj *preparedStatements = NULL;
 
+/*
+** msPostGISForgetPrepared()
+**
+** Drop the cached prepared statements of a connection.
+*/
+static void msPostGISForgetPrepared(PGconn *pgconn)
+{
+  msPostGISPreparedObj **link;
+
+  msAcquireLock(TLOCK_POSTGIS);
+  link = &preparedStatements;
+  while (*link) {
+    if ((*link)->pgconn == pgconn) {
+      msPostGISPreparedObj *prepared = *link;
+      *link = prepared->next;
+      free(prepared);
+    } else {
+      link = &((*link)->next);
+    }
+  }
+  msReleaseLock(TLOCK_POSTGIS);
+}
 
 /*
 ** msPostGISCloseConnection()
@@ -97,11 +134,34 @@
 ** Handler registered witih msConnPoolRegister so that Mapserver
 ** can clean up open connections during a shutdown.
 */
-void msPostGISCloseConnection(void *pgconn)
+static void msPostGISCloseConnection(void *pgconn)
 {
+  msPostGISForgetPrepared((PGconn*)pgconn);
   PQfinish((PGconn*)pgconn);
 }
 
+/*
+** msPostGISValidateConnection()
+**
+** Handler registered with msConnPoolRegisterWithValidation so that pooled
+** connections whose backend went away are dropped instead of reused.
+** An empty query costs one round trip to the server.
+*/
+static int msPostGISValidateConnection(void *pgconn)
+{
+  PGresult *pgresult;
+  int valid;
+
+  if (PQstatus((PGconn*)pgconn) != CONNECTION_OK)
+    return MS_FALSE;
+
+  pgresult = PQexec((PGconn*)pgconn, "");
+  valid = (pgresult && PQresultStatus(pgresult) == PGRES_EMPTY_QUERY);
+  PQclear(pgresult);
+
+  return valid;
+}
+
 /*
 ** msPostGISCreateLayerInfo()
 */
@@ -119,6 +179,12 @@ msPostGISLayerInfo *msPostGISCreateLayerInfo(void)
   layerinfo->rownum = 0;
   layerinfo->version = 0;
   layerinfo->paging = MS_TRUE;
+  layerinfo->prepared = MS_FALSE;
+  layerinfo->boxparam = 0;
+  layerinfo->boxparamused = MS_FALSE;
+  layerinfo->simplify = MS_POSTGIS_SIMPLIFY_NONE;
+  layerinfo->simplify_tolerance = 0;
+  layerinfo->simplifyparam = 0;
 #ifdef USE_POINT_Z_M
   layerinfo->force2d = MS_FALSE;
 #else
@@ -1614,11 +1680,31 @@ char *msPostGISBuildSQLBox(layerObj *layer, rectObj *rect, char *strSRID)
 
   char *strBox = NULL;
   size_t sz;
+  msPostGISLayerInfo *layerinfo = (msPostGISLayerInfo *)layer->layerinfo;
 
   if (layer->debug) {
     msDebug("msPostGISBuildSQLBox called.\n");
   }
 
+  /*
+  ** For prepared statements the box coordinates are bound parameters,
+  ** so that the SQL text does not change with the request extent.
+  */
+  if ( layerinfo && layerinfo->boxparam > 0 ) {
+    static const char *strBoxTemplate = "ST_MakeEnvelope($%d::float8,$%d::float8,$%d::float8,$%d::float8,%s)";
+    int p = layerinfo->boxparam;
+    /* 4 integers + 1 srid + template characters */
+    sz = 4 * 11 + (strSRID ? strlen(strSRID) : 0) + strlen(strBoxTemplate);
+    strBox = (char*)msSmallMalloc(sz+1);
+    if ( strSRID )
+      snprintf(strBox, sz, strBoxTemplate, p, p+1, p+2, p+3, strSRID);
+    else
+      snprintf(strBox, sz, "ST_MakeEnvelope($%d::float8,$%d::float8,$%d::float8,$%d::float8)",
+               p, p+1, p+2, p+3);
+    layerinfo->boxparamused = MS_TRUE;
+    return strBox;
+  }
+
   if ( strSRID ) {
     static char *strBoxTemplate = "ST_GeomFromText('POLYGON((%.15g %.15g,%.15g %.15g,%.15g %.15g,%.15g %.15g,%.15g %.15g))',%s)";
     /* 10 doubles + 1 integer + template characters */
@@ -1700,12 +1786,14 @@ char *msPostGISBuildSQLItems(layerObj *layer)
     ** need, saving transfer and encode/decode time.
     */
     char *force2d = "";
+    char *strColumn = NULL;
+    char strTolerance[32];
 #if TRANSFER_ENCODING == 64
-    const char *strGeomTemplate = "encode(ST_AsBinary(%s(\"%s\"),'%s'),'base64') as geom,\"%s\"";
+    const char *strGeomTemplate = "encode(ST_AsBinary(%s(%s),'%s'),'base64') as geom,\"%s\"";
 #elif TRANSFER_ENCODING == 256
-    const char *strGeomTemplate = "ST_AsBinary(%s(\"%s\"),'%s') as geom,\"%s\"::text";
+    const char *strGeomTemplate = "ST_AsBinary(%s(%s),'%s') as geom,\"%s\"::text";
 #else
-    const char *strGeomTemplate = "encode(ST_AsBinary(%s(\"%s\"),'%s'),'hex') as geom,\"%s\"";
+    const char *strGeomTemplate = "encode(ST_AsBinary(%s(%s),'%s'),'hex') as geom,\"%s\"";
 #endif
     if( layerinfo->force2d ) {
       if( layerinfo->version >= 20100 )
@@ -1717,15 +1805,39 @@ char *msPostGISBuildSQLItems(layerObj *layer)
     {
         /* Use AsEWKB() to get 3D */
 #if TRANSFER_ENCODING == 64
-        strGeomTemplate = "encode(AsEWKB(%s(\"%s\"),'%s'),'base64') as geom,\"%s\"";
+        strGeomTemplate = "encode(AsEWKB(%s(%s),'%s'),'base64') as geom,\"%s\"";
 #elif TRANSFER_ENCODING == 256
-        strGeomTemplate = "AsEWKB(%s(\"%s\"),'%s') as geom,\"%s\"::text";
+        strGeomTemplate = "AsEWKB(%s(%s),'%s') as geom,\"%s\"::text";
 #else
-        strGeomTemplate = "encode(AsEWKB(%s(\"%s\"),'%s'),'hex') as geom,\"%s\"";
+        strGeomTemplate = "encode(AsEWKB(%s(%s),'%s'),'hex') as geom,\"%s\"";
 #endif
     }
-    strGeom = (char*)msSmallMalloc(strlen(strGeomTemplate) + strlen(force2d) + strlen(strEndian) + strlen(layerinfo->geomcolumn) + strlen(layerinfo->uid) + 1);
-    sprintf(strGeom, strGeomTemplate, force2d, layerinfo->geomcolumn, strEndian, layerinfo->uid);
+
+    /*
+    ** When drawing at small scales, let the server drop the vertices
+    ** that would fall within the same pixel (see msPostGISLayerWhichShapes).
+    */
+    strColumn = msSmallMalloc(strlen(layerinfo->geomcolumn) + 64);
+    if( layerinfo->simplify_tolerance > 0 ) {
+      /* for prepared statements the tolerance is bound like the box, */
+      /* or every cellsize would prepare another statement */
+      if( layerinfo->simplifyparam > 0 )
+        sprintf(strTolerance, "$%d::float8", layerinfo->simplifyparam);
+      else
+        sprintf(strTolerance, "%.15g", layerinfo->simplify_tolerance);
+    }
+    if( layerinfo->simplify == MS_POSTGIS_SIMPLIFY_SNAPTOGRID && layerinfo->simplify_tolerance > 0 )
+      sprintf(strColumn, "ST_SnapToGrid(\"%s\",%s)", layerinfo->geomcolumn, strTolerance);
+    else if( layerinfo->simplify == MS_POSTGIS_SIMPLIFY_SIMPLIFY && layerinfo->simplify_tolerance > 0 && layerinfo->version >= 20200 )
+      sprintf(strColumn, "ST_Simplify(\"%s\",%s,true)", layerinfo->geomcolumn, strTolerance);
+    else if( layerinfo->simplify == MS_POSTGIS_SIMPLIFY_SIMPLIFY && layerinfo->simplify_tolerance > 0 )
+      sprintf(strColumn, "ST_Simplify(\"%s\",%s)", layerinfo->geomcolumn, strTolerance);
+    else
+      sprintf(strColumn, "\"%s\"", layerinfo->geomcolumn);
+
+    strGeom = (char*)msSmallMalloc(strlen(strGeomTemplate) + strlen(force2d) + strlen(strEndian) + strlen(strColumn) + strlen(layerinfo->uid) + 1);
+    sprintf(strGeom, strGeomTemplate, force2d, strColumn, strEndian, layerinfo->uid);
+    free(strColumn);
   }
 
   if( layer->debug > 1 ) {
@@ -2283,23 +2395,45 @@ int msPostGISReadShape(layerObj *layer, shapeObj *shape)
   /* Retrieve the geometry. */
   wkbstr = (char*)PQgetvalue(layerinfo->pgresult, layerinfo->rownum, layer->numitems );
   wkbstrlen = PQgetlength(layerinfo->pgresult, layerinfo->rownum, layer->numitems);
+  MS_TRACE_COUNT(MS_TRACE_BYTES, wkbstrlen);
 
   if ( ! wkbstr ) {
     msSetError(MS_QUERYERR, "WKB returned is null!", "msPostGISReadShape()");
     return MS_FAILURE;
   }
 
+  /* Geometries collapsed by server side simplification come back NULL. */
+  if ( PQgetisnull(layerinfo->pgresult, layerinfo->rownum, layer->numitems) ) {
+    shape->type = MS_SHAPE_NULL;
+    return MS_SUCCESS;
+  }
+
+#if TRANSFER_ENCODING == 256
+  /*
+  ** Binary results: the WKB can be read in place from the result
+  ** buffer, unless the pre-2.0 EWKB SRID fixup below has to modify it.
+  */
+  if( layerinfo->version >= 20000 || layerinfo->force2d ) {
+    wkb = (unsigned char*)wkbstr;
+  } else if(wkbstrlen > wkbstaticsize) {
+    wkb = calloc(wkbstrlen, sizeof(char));
+  } else {
+    wkb = wkbstatic;
+  }
+#else
   if(wkbstrlen > wkbstaticsize) {
     wkb = calloc(wkbstrlen, sizeof(char));
   } else {
     wkb = wkbstatic;
   }
+#endif
 #if TRANSFER_ENCODING == 64
   result = msPostGISBase64Decode(wkb, wkbstr, wkbstrlen - 1);
   w.size = (wkbstrlen - 1)/2;
 #elif TRANSFER_ENCODING == 256
   result = 1;
-  memcpy(wkb, wkbstr, wkbstrlen);
+  if( wkb != (unsigned char*)wkbstr )
+    memcpy(wkb, wkbstr, wkbstrlen);
   w.size = wkbstrlen;
 #else
   result = msPostGISHexDecode(wkb, wkbstr, wkbstrlen);
@@ -2307,7 +2441,7 @@ int msPostGISReadShape(layerObj *layer, shapeObj *shape)
 #endif
 
   if( ! result ) {
-    if(wkb!=wkbstatic) free(wkb);
+    if(wkb!=wkbstatic && wkb!=(unsigned char*)wkbstr) free(wkb);
     return MS_FAILURE;
   }
 
@@ -2373,7 +2507,7 @@ int msPostGISReadShape(layerObj *layer, shapeObj *shape)
   }
 
   /* All done with WKB geometry, free it! */
-  if(wkb!=wkbstatic) free(wkb);
+  if(wkb!=wkbstatic && wkb!=(unsigned char*)wkbstr) free(wkb);
 
   if (result != MS_FAILURE) {
     int t;
@@ -2436,6 +2570,91 @@ int msPostGISReadShape(layerObj *layer, shapeObj *shape)
   return MS_SUCCESS;
 }
 
+/*
+** msPostGISExecPrepared()
+**
+** Run a query as a statement prepared on the layer connection, preparing
+** it first if this connection has not seen this SQL yet.  Statements are
+** named after a hash of their SQL.  Falls back to PQexecParams() once
+** MAX_PREPARED_STATEMENTS statements are prepared on the connection.
+*/
+static PGresult *msPostGISExecPrepared(layerObj *layer, const char *sql, int nParams, const char * const *paramValues)
+{
+  msPostGISLayerInfo *layerinfo = (msPostGISLayerInfo*) layer->layerinfo;
+  msPostGISPreparedObj *prepared;
+  PGresult *pgresult;
+  unsigned int hash1 = 2166136261U, hash2 = 5381;
+  const char *c;
+  char name[24];
+  int found = MS_FALSE, count = 0, retry;
+
+  for (c = sql; *c; c++) {
+    hash1 = (hash1 ^ (unsigned char)*c) * 16777619U;
+    hash2 = hash2 * 33 + (unsigned char)*c;
+  }
+  snprintf(name, sizeof(name), "ms_%08x%08x", hash1, hash2);
+
+  msAcquireLock(TLOCK_POSTGIS);
+  for (prepared = preparedStatements; prepared; prepared = prepared->next) {
+    if (prepared->pgconn != layerinfo->pgconn)
+      continue;
+    count++;
+    if (strcmp(prepared->name, name) == 0) {
+      found = MS_TRUE;
+      break;
+    }
+  }
+  msReleaseLock(TLOCK_POSTGIS);
+
+  if (!found && count >= MAX_PREPARED_STATEMENTS) {
+    if (layer->debug)
+      msDebug("msPostGISExecPrepared(): %d statements prepared on connection, not preparing another.\n", count);
+    return PQexecParams(layerinfo->pgconn, sql, nParams, NULL, paramValues, NULL, NULL, RESULTSET_TYPE);
+  }
+
+  for (retry = 0; retry < 2; retry++) {
+    if (!found) {
+      const char *sqlstate;
+
+      if (layer->debug)
+        msDebug("msPostGISExecPrepared(): preparing statement %s.\n", name);
+
+      pgresult = PQprepare(layerinfo->pgconn, name, sql, nParams, NULL);
+      sqlstate = pgresult ? PQresultErrorField(pgresult, PG_DIAG_SQLSTATE) : NULL;
+      /* 42P05: prepared by an earlier process sharing the connection */
+      if (!pgresult || (PQresultStatus(pgresult) != PGRES_COMMAND_OK &&
+                        !(sqlstate && strcmp(sqlstate, "42P05") == 0))) {
+        return pgresult;
+      }
+      PQclear(pgresult);
+
+      prepared = (msPostGISPreparedObj*) msSmallMalloc(sizeof(msPostGISPreparedObj));
+      prepared->pgconn = layerinfo->pgconn;
+      strlcpy(prepared->name, name, sizeof(prepared->name));
+      msAcquireLock(TLOCK_POSTGIS);
+      prepared->next = preparedStatements;
+      preparedStatements = prepared;
+      msReleaseLock(TLOCK_POSTGIS);
+    }
+
+    pgresult = PQexecPrepared(layerinfo->pgconn, name, nParams, paramValues, NULL, NULL, RESULTSET_TYPE);
+
+    /* 26000: the statement vanished, e.g. after a connection reset */
+    if (found && pgresult && PQresultStatus(pgresult) == PGRES_FATAL_ERROR) {
+      const char *sqlstate = PQresultErrorField(pgresult, PG_DIAG_SQLSTATE);
+      if (sqlstate && strcmp(sqlstate, "26000") == 0) {
+        PQclear(pgresult);
+        msPostGISForgetPrepared(layerinfo->pgconn);
+        found = MS_FALSE;
+        continue;
+      }
+    }
+    break;
+  }
+
+  return pgresult;
+}
+
 #endif /* USE_POSTGIS */
 
 
@@ -2450,6 +2669,8 @@ int msPostGISLayerOpen(layerObj *layer)
   msPostGISLayerInfo  *layerinfo;
   int order_test = 1;
   const char* force2d_processing;
+  const char* prepared_processing;
+  const char* simplify_processing;
 
   assert(layer != NULL);
 
@@ -2541,20 +2762,20 @@ int msPostGISLayerOpen(layerObj *layer)
     PQsetNoticeProcessor(layerinfo->pgconn, postresqlNoticeHandler, (void *) layer);
 
     /* Save this connection in the pool for later. */
-    msConnPoolRegister(layer, layerinfo->pgconn, msPostGISCloseConnection);
+    msConnPoolRegisterWithValidation(layer, layerinfo->pgconn, msPostGISCloseConnection, msPostGISValidateConnection);
   } else {
     /* Connection in the pool should be tested to see if backend is alive. */
     if( PQstatus(layerinfo->pgconn) != CONNECTION_OK ) {
       /* Uh oh, bad connection. Can we reset it? */
+      msPostGISForgetPrepared(layerinfo->pgconn);
       PQreset(layerinfo->pgconn);
       if( PQstatus(layerinfo->pgconn) != CONNECTION_OK ) {
         /* Nope, time to bail out. */
         msSetError(MS_QUERYERR, "PostgreSQL database connection. Check server logs for more details", "msPostGISLayerOpen()");
         msDebug( "PostgreSQL database connection gone bad (%s) in msPostGISLayerOpen()", PQerrorMessage(layerinfo->pgconn));
+        /* Don't put it back on the idle list for the next request. */
+        msConnPoolDiscard(layer, layerinfo->pgconn);
         free(layerinfo);
-        /* FIXME: we should also release the connection from the pool in this case, but it is stale...
-         * for the time being we do not release it so it can never be used again. If this happens multiple
-         * times there will be a leak... */
         return MS_FAILURE;
       }
     }
@@ -2580,6 +2801,19 @@ int msPostGISLayerOpen(layerObj *layer)
   if (layer->debug)
     msDebug("msPostGISLayerOpen: Forcing 2D geometries: %s.\n", (layerinfo->force2d)?"yes":"no");
 
+  prepared_processing = msLayerGetProcessingKey( layer, "PREPARED_STATEMENTS" );
+  if(prepared_processing && !strcasecmp(prepared_processing,"on")) {
+    layerinfo->prepared = MS_TRUE;
+  }
+
+  simplify_processing = msLayerGetProcessingKey( layer, "SERVER_SIMPLIFY" );
+  if(simplify_processing && !strcasecmp(simplify_processing,"snaptogrid")) {
+    layerinfo->simplify = MS_POSTGIS_SIMPLIFY_SNAPTOGRID;
+  }
+  else if(simplify_processing && !strcasecmp(simplify_processing,"simplify")) {
+    layerinfo->simplify = MS_POSTGIS_SIMPLIFY_SIMPLIFY;
+  }
+
   /* Save the layerinfo in the layerObj. */
   layer->layerinfo = (void*)layerinfo;
 
@@ -2722,6 +2956,10 @@ int msPostGISLayerWhichShapes(layerObj *layer, rectObj rect, int isQuery)
   char** layer_bind_values = NULL;
   char* bind_value;
   char* bind_key = NULL;
+  char box_values[4][32];
+  char tolerance_value[32];
+  struct mstimeval starttime, endtime;
+  int simplified;
 
   int num_bind_values = 0;
 
@@ -2732,6 +2970,10 @@ int msPostGISLayerWhichShapes(layerObj *layer, rectObj rect, int isQuery)
     msDebug("msPostGISLayerWhichShapes called.\n");
   }
 
+  if (layer->debug >= MS_DEBUGLEVEL_TUNING) {
+    msGettimeofday(&starttime, NULL);
+  }
+
   /* Fill out layerinfo with our current DATA state. */
   if ( msPostGISParseData(layer) != MS_SUCCESS) {
     return MS_FAILURE;
@@ -2758,10 +3000,45 @@ int msPostGISLayerWhichShapes(layerObj *layer, rectObj rect, int isQuery)
   */
   layerinfo = (msPostGISLayerInfo*) layer->layerinfo;
 
+  /*
+  ** When drawing lines and polygons, have the server generalize geometries
+  ** to the pixel size: vertices closer than SERVER_SIMPLIFY_TOLERANCE
+  ** pixels (default half a pixel) cannot be told apart once rendered.
+  */
+  if (layerinfo->simplify != MS_POSTGIS_SIMPLIFY_NONE && !isQuery && layer->map &&
+      (layer->type == MS_LAYER_LINE || layer->type == MS_LAYER_POLYGON)) {
+    const char *tolerance = msLayerGetProcessingKey(layer, "SERVER_SIMPLIFY_TOLERANCE");
+    double cellsize;
+
+    if (layer->project && msProjectionsDiffer(&(layer->projection), &(layer->map->projection)))
+      cellsize = (rect.maxx - rect.minx) / MS_MAX(layer->map->width, 1);
+    else
+      cellsize = layer->map->cellsize;
+
+    layerinfo->simplify_tolerance = cellsize * (tolerance ? atof(tolerance) : 0.5);
+    if (layer->debug)
+      msDebug("msPostGISLayerWhichShapes: server side simplification, tolerance %g.\n", layerinfo->simplify_tolerance);
+  }
+
   /* Build a SQL query based on our current state. */
+  simplified = (layerinfo->simplify_tolerance > 0);
+  if (layerinfo->prepared) {
+    if (simplified) {
+      snprintf(tolerance_value, sizeof(tolerance_value), "%.15g", layerinfo->simplify_tolerance);
+      layer_bind_values[num_bind_values++] = tolerance_value;
+      layerinfo->simplifyparam = num_bind_values;
+    }
+    layerinfo->boxparam = num_bind_values + 1;
+    layerinfo->boxparamused = MS_FALSE;
+  }
   strSQL = msPostGISBuildSQL(layer, &rect, NULL, NULL, -1);
+  layerinfo->boxparam = 0;
+  layerinfo->simplifyparam = 0;
+  layerinfo->simplify_tolerance = 0;
   if ( ! strSQL ) {
     msSetError(MS_QUERYERR, "Failed to build query SQL.", "msPostGISLayerWhichShapes()");
+    free(bind_key);
+    free(layer_bind_values);
     return MS_FAILURE;
   }
 
@@ -2771,7 +3048,19 @@ int msPostGISLayerWhichShapes(layerObj *layer, rectObj rect, int isQuery)
 
   // fprintf(stderr, "SQL: %s\n", strSQL);
 
-  if(num_bind_values > 0) {
+  if(layerinfo->prepared) {
+    if (layerinfo->boxparamused) {
+      snprintf(box_values[0], sizeof(box_values[0]), "%.15g", rect.minx);
+      snprintf(box_values[1], sizeof(box_values[1]), "%.15g", rect.miny);
+      snprintf(box_values[2], sizeof(box_values[2]), "%.15g", rect.maxx);
+      snprintf(box_values[3], sizeof(box_values[3]), "%.15g", rect.maxy);
+      layer_bind_values[num_bind_values++] = box_values[0];
+      layer_bind_values[num_bind_values++] = box_values[1];
+      layer_bind_values[num_bind_values++] = box_values[2];
+      layer_bind_values[num_bind_values++] = box_values[3];
+    }
+    pgresult = msPostGISExecPrepared(layer, strSQL, num_bind_values, (const char**)layer_bind_values);
+  } else if(num_bind_values > 0) {
     pgresult = PQexecParams(layerinfo->pgconn, strSQL, num_bind_values, NULL, (const char**)layer_bind_values, NULL, NULL, RESULTSET_TYPE);
   } else {
     pgresult = PQexecParams(layerinfo->pgconn, strSQL,0, NULL, NULL, NULL, NULL, RESULTSET_TYPE);
@@ -2800,6 +3089,20 @@ int msPostGISLayerWhichShapes(layerObj *layer, rectObj rect, int isQuery)
     msDebug("msPostGISLayerWhichShapes got %d records in result.\n", PQntuples(pgresult));
   }
 
+  if (layer->debug >= MS_DEBUGLEVEL_TUNING) {
+    long bytes = 0;
+    int row, nrows = PQntuples(pgresult);
+    for (row = 0; row < nrows; row++)
+      bytes += PQgetlength(pgresult, row, layer->numitems);
+    msGettimeofday(&endtime, NULL);
+    msDebug("msPostGISLayerWhichShapes(%s): %d rows, %ld geometry bytes in %.3fs%s%s\n",
+            layer->name, nrows, bytes,
+            (endtime.tv_sec+endtime.tv_usec/1.0e6)-
+            (starttime.tv_sec+starttime.tv_usec/1.0e6),
+            layerinfo->prepared ? " (prepared)" : "",
+            simplified ? " (simplified)" : "");
+  }
+
   /* Clean any existing pgresult before storing current one. */
   if(layerinfo->pgresult) PQclear(layerinfo->pgresult);
   layerinfo->pgresult = pgresult;
@@ -43,6 +43,11 @@
 /* HEX = 16, BASE64 = 64, RAW = 256*/
 #define TRANSFER_ENCODING 256
 
+/* Server side generalization modes, PROCESSING "SERVER_SIMPLIFY" */
+#define MS_POSTGIS_SIMPLIFY_NONE       0
+#define MS_POSTGIS_SIMPLIFY_SNAPTOGRID 1
+#define MS_POSTGIS_SIMPLIFY_SIMPLIFY   2
+
 /* Substitution token for box hackery */
 #define BOXTOKEN "!BOX!"
 #define BOXTOKENLENGTH 5
@@ -65,6 +70,12 @@ typedef struct {
   int         version;     /* PostGIS version of the database */
   int         paging;      /* Driver handling of pagination, enabled by default */
   int         force2d;     /* Pass geometry through ST_Force2D */
+  int         prepared;    /* Run the WhichShapes query as a prepared statement */
+  int         boxparam;    /* If > 0, SQL box uses bound parameters $boxparam..$boxparam+3 */
+  int         boxparamused; /* Set when the SQL built references the box parameters */
+  int         simplify;    /* Server side generalization mode, MS_POSTGIS_SIMPLIFY_* */
+  double      simplify_tolerance; /* Generalization tolerance in layer units, 0 when off */
+  int         simplifyparam; /* If > 0, the tolerance is bound parameter $simplifyparam */
 }
 msPostGISLayerInfo;
 
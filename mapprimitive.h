@@ -74,6 +74,7 @@ typedef struct {
   lineObj *line;
   char **values;
   void *geometry;
+  void *prepared_geometry;
   void *renderer_cache;
 #endif
 
@@ -184,6 +184,111 @@ int msProjectPoint(projectionObj *in, projectionObj *out, pointObj *point)
 #endif
 }
 
+/************************************************************************/
+/*                          msProjectPoints()                           */
+/*                                                                      */
+/*      Same result as msProjectPoint() on each point of the array,     */
+/*      but with a single pj_transform() call for all of them.          */
+/*      Points that could not be transformed are set to HUGE_VAL and    */
+/*      MS_FAILURE is returned if there was any. If pj_transform()      */
+/*      fails for the whole batch the points are projected one at a     */
+/*      time instead, so only the bad ones are lost.                    */
+/************************************************************************/
+int msProjectPoints(projectionObj *in, projectionObj *out, int count, pointObj *points)
+{
+#ifdef USE_PROJ
+  int i, error, status = MS_SUCCESS;
+  double *x, *y, *z;
+
+  /* nothing to gain over msProjectPoint() unless pj_transform() is used */
+  if( count < 2 || !(in && in->proj && out && out->proj)
+      || (in->numargs == 1 && out->numargs == 1
+          && strcmp(in->args[0],out->args[0]) == 0) ) {
+    for(i=0; i<count; i++) {
+      if( msProjectPoint(in, out, &(points[i])) == MS_FAILURE )
+        status = MS_FAILURE;
+    }
+    return status;
+  }
+
+  /* pj_transform() steps z with the same stride as x and y, so work on */
+  /* packed arrays rather than in place in the pointObj array. */
+  x = (double*) msSmallMalloc(sizeof(double) * count * 3);
+  y = x + count;
+  z = y + count;
+
+  for(i=0; i<count; i++) {
+    x[i] = points[i].x;
+    y[i] = points[i].y;
+    z[i] = 0.0;
+
+    if( in->gt.need_geotransform ) {
+      x[i] = in->gt.geotransform[0]
+             + in->gt.geotransform[1] * points[i].x
+             + in->gt.geotransform[2] * points[i].y;
+      y[i] = in->gt.geotransform[3]
+             + in->gt.geotransform[4] * points[i].x
+             + in->gt.geotransform[5] * points[i].y;
+    }
+    if( pj_is_latlong(in->proj) ) {
+      x[i] *= DEG_TO_RAD;
+      y[i] *= DEG_TO_RAD;
+    }
+  }
+
+#if PJ_VERSION < 480
+  msAcquireLock( TLOCK_PROJ );
+#endif
+  error = pj_transform( in->proj, out->proj, count, 1, x, y, z );
+#if PJ_VERSION < 480
+  msReleaseLock( TLOCK_PROJ );
+#endif
+
+  if( error ) {
+    /* the points are still untouched, fall back to one at a time */
+    free(x);
+    for(i=0; i<count; i++) {
+      if( msProjectPoint(in, out, &(points[i])) == MS_FAILURE ) {
+        points[i].x = points[i].y = HUGE_VAL;
+        status = MS_FAILURE;
+      }
+    }
+    return status;
+  }
+
+  for(i=0; i<count; i++) {
+    if( x[i] == HUGE_VAL || y[i] == HUGE_VAL ) {
+      points[i].x = points[i].y = HUGE_VAL;
+      status = MS_FAILURE;
+      continue;
+    }
+
+    if( pj_is_latlong(out->proj) ) {
+      x[i] *= RAD_TO_DEG;
+      y[i] *= RAD_TO_DEG;
+    }
+
+    if( out->gt.need_geotransform ) {
+      points[i].x = out->gt.invgeotransform[0]
+                    + out->gt.invgeotransform[1] * x[i]
+                    + out->gt.invgeotransform[2] * y[i];
+      points[i].y = out->gt.invgeotransform[3]
+                    + out->gt.invgeotransform[4] * x[i]
+                    + out->gt.invgeotransform[5] * y[i];
+    } else {
+      points[i].x = x[i];
+      points[i].y = y[i];
+    }
+  }
+
+  free(x);
+  return status;
+#else
+  msSetError(MS_PROJERR, "Projection support is not available.", "msProjectPoints()");
+  return(MS_FAILURE);
+#endif
+}
+
 /************************************************************************/
 /*                         msProjectGrowRect()                          */
 /************************************************************************/
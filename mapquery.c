@@ -1834,6 +1834,40 @@ int msQueryByPoint(mapObj *map)
   return(MS_FAILURE);
 }
 
+/*
+** Does a feature intersect the query shape? With GEOS the query shape
+** keeps its prepared geometry across all the features tested, the native
+** tests are used otherwise.
+*/
+static int msQueryShapeIntersects(shapeObj *shape, shapeObj *qshape)
+{
+#ifdef USE_GEOS
+  int status = msGEOSIntersects(shape, qshape);
+  if(status != -1)
+    return status;
+#endif
+
+  if(qshape->type == MS_SHAPE_POLYGON) {
+    switch(shape->type) {
+      case MS_SHAPE_POINT:
+        return msIntersectMultipointPolygon(shape, qshape);
+      case MS_SHAPE_LINE:
+        return msIntersectPolylinePolygon(shape, qshape);
+      case MS_SHAPE_POLYGON:
+        return msIntersectPolygons(shape, qshape);
+    }
+  } else if(qshape->type == MS_SHAPE_LINE) {
+    switch(shape->type) {
+      case MS_SHAPE_LINE:
+        return msIntersectPolylines(shape, qshape);
+      case MS_SHAPE_POLYGON:
+        return msIntersectPolylinePolygon(qshape, shape);
+    }
+  }
+
+  return MS_FALSE;
+}
+
 int msQueryByShape(mapObj *map)
 {
   int start, stop=0, l;
@@ -2007,7 +2041,7 @@ int msQueryByShape(mapObj *map)
           switch(shape.type) { /* make sure shape actually intersects the shape */
             case MS_SHAPE_POINT:
               if(tolerance == 0) /* just test for intersection */
-                status = msIntersectMultipointPolygon(&shape, qshape);
+                status = msQueryShapeIntersects(&shape, qshape);
               else { /* check distance, distance=0 means they intersect */
                 distance = msDistanceShapeToShape(qshape, &shape);
                 if(distance < tolerance) status = MS_TRUE;
@@ -2015,7 +2049,7 @@ int msQueryByShape(mapObj *map)
               break;
             case MS_SHAPE_LINE:
               if(tolerance == 0) { /* just test for intersection */
-                status = msIntersectPolylinePolygon(&shape, qshape);
+                status = msQueryShapeIntersects(&shape, qshape);
               } else { /* check distance, distance=0 means they intersect */
                 distance = msDistanceShapeToShape(qshape, &shape);
                 if(distance < tolerance) status = MS_TRUE;
@@ -2023,7 +2057,7 @@ int msQueryByShape(mapObj *map)
               break;
             case MS_SHAPE_POLYGON:
               if(tolerance == 0) /* just test for intersection */
-                status = msIntersectPolygons(&shape, qshape);
+                status = msQueryShapeIntersects(&shape, qshape);
               else { /* check distance, distance=0 means they intersect */
                 distance = msDistanceShapeToShape(qshape, &shape);
                 if(distance < tolerance) status = MS_TRUE;
@@ -2046,7 +2080,7 @@ int msQueryByShape(mapObj *map)
               break;
             case MS_SHAPE_LINE:
               if(tolerance == 0) { /* just test for intersection */
-                status = msIntersectPolylines(&shape, qshape);
+                status = msQueryShapeIntersects(&shape, qshape);
               } else { /* check distance, distance=0 means they intersect */
                 distance = msDistanceShapeToShape(qshape, &shape);
                 if(distance < tolerance) status = MS_TRUE;
@@ -2054,7 +2088,7 @@ int msQueryByShape(mapObj *map)
               break;
             case MS_SHAPE_POLYGON:
               if(tolerance == 0) /* just test for intersection */
-                status = msIntersectPolylinePolygon(qshape, &shape);
+                status = msQueryShapeIntersects(&shape, qshape);
               else { /* check distance, distance=0 means they intersect */
                 distance = msDistanceShapeToShape(qshape, &shape);
                 if(distance < tolerance) status = MS_TRUE;
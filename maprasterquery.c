@@ -399,6 +399,46 @@ static void msRasterQueryAddPixel( layerObj *layer, pointObj *location,
   }
 }
 
+/************************************************************************/
+/*                   msRasterQueryScanlineCrossings()                   */
+/*                                                                      */
+/*      Collect in ascending order the x positions where the edges      */
+/*      of a polygon cross the horizontal line at y.  The half open     */
+/*      rule and expression are the ones of msPointInPolygon(), so a    */
+/*      point (x,y) intersects the polygon exactly when an odd number   */
+/*      of the crossings are greater than x.                            */
+/************************************************************************/
+
+static int msRasterQueryCompareDouble( const void *a, const void *b )
+{
+  double da = *((const double *) a), db = *((const double *) b);
+  return (da > db) - (da < db);
+}
+
+static int msRasterQueryScanlineCrossings( shapeObj *poly, double y,
+                                           double *padfCrossings )
+{
+  int i, j, k, nCrossings = 0;
+
+  for( k = 0; k < poly->numlines; k++ ) {
+    lineObj *c = poly->line + k;
+
+    for( i = 0, j = c->numpoints-1; i < c->numpoints; j = i++ ) {
+      if( ((c->point[i].y <= y) && (y < c->point[j].y))
+          || ((c->point[j].y <= y) && (y < c->point[i].y)) )
+        padfCrossings[nCrossings++] =
+          (c->point[j].x - c->point[i].x) * (y - c->point[i].y)
+          / (c->point[j].y - c->point[i].y) + c->point[i].x;
+    }
+  }
+
+  if( nCrossings > 1 )
+    qsort( padfCrossings, nCrossings, sizeof(double),
+           msRasterQueryCompareDouble );
+
+  return nCrossings;
+}
+
 /************************************************************************/
 /*                       msRasterQueryByRectLow()                       */
 /************************************************************************/
@@ -414,9 +454,14 @@ msRasterQueryByRectLow(mapObj *map, layerObj *layer, GDALDatasetH hDS,
   int         nRXSize, nRYSize;
   float       *pafRaster;
   int         nBandCount, *panBandMap, iPixel, iLine;
+  int         nBlockXSize, nBlockYSize, nStripSize, nStripLines, iStripOff;
+  GDALRasterBandH hBand;
   CPLErr      eErr;
   rasterLayerInfo *rlinfo;
   rectObj     searchrect;
+  pointObj    *pasPixels, *pasReprojected = NULL;
+  int         bScanline = MS_FALSE;
+  double      *padfCrossings = NULL, dfShapeMinY = 0.0, dfShapeMaxY = 0.0;
 
   rlinfo = (rasterLayerInfo *) layer->layerinfo;
 
@@ -507,37 +552,25 @@ msRasterQueryByRectLow(mapObj *map, layerObj *layer, GDALDatasetH hDS,
   }
 
   /* -------------------------------------------------------------------- */
-  /*      Try to load the raster data.  For now we just load the first    */
-  /*      band in the file.  Later we will deal with the various band     */
-  /*      selection criteria.                                             */
+  /*      Fetch color table for intepreting colors if needed.             */
   /* -------------------------------------------------------------------- */
-  pafRaster = (float *)
-              calloc(sizeof(float),nWinXSize*nWinYSize*nBandCount);
-  MS_CHECK_ALLOC(pafRaster, sizeof(float)*nWinXSize*nWinYSize*nBandCount, -1);
-
-  eErr = GDALDatasetRasterIO( hDS, GF_Read,
-                              nWinXOff, nWinYOff, nWinXSize, nWinYSize,
-                              pafRaster, nWinXSize, nWinYSize, GDT_Float32,
-                              nBandCount, panBandMap,
-                              4 * nBandCount,
-                              4 * nBandCount * nWinXSize,
-                              4 );
-
-  if( eErr != CE_None ) {
-    msSetError( MS_IOERR, "GDALDatasetRasterIO() failed: %s",
-                "msRasterQueryByRectLow()", CPLGetLastErrorMsg() );
-
-    free( pafRaster );
-    return -1;
-  }
+  hBand = GDALGetRasterBand( hDS, panBandMap[0] );
+  rlinfo->hCT = GDALGetRasterColorTable( hBand );
 
   /* -------------------------------------------------------------------- */
-  /*      Fetch color table for intepreting colors if needed.             */
+  /*      The window is read in strips of whole block rows so every       */
+  /*      block of the file is only fetched once, and memory use does     */
+  /*      not grow with the size of the query.  Files with very short     */
+  /*      blocks (one scanline strips) are read a few blocks at a time.   */
   /* -------------------------------------------------------------------- */
-  rlinfo->hCT = GDALGetRasterColorTable(
-                  GDALGetRasterBand( hDS, panBandMap[0] ) );
+  GDALGetBlockSize( hBand, &nBlockXSize, &nBlockYSize );
+  nStripSize = MS_MAX(1, nBlockYSize);
+  if( nStripSize < 64 )
+    nStripSize = ((64 + nStripSize - 1) / nStripSize) * nStripSize;
 
-  free( panBandMap );
+  pafRaster = (float *)
+              calloc(sizeof(float),nWinXSize*MS_MIN(nStripSize,nWinYSize)*nBandCount);
+  MS_CHECK_ALLOC(pafRaster, sizeof(float)*nWinXSize*MS_MIN(nStripSize,nWinYSize)*nBandCount, -1);
 
   /* -------------------------------------------------------------------- */
   /*      When computing whether pixels are within range we do it         */
@@ -555,82 +588,188 @@ msRasterQueryByRectLow(mapObj *map, layerObj *layer, GDALDatasetH hDS,
     + sqrt( rlinfo->range_dist );
   dfAdjustedRange = dfAdjustedRange * dfAdjustedRange;
 
+  /* -------------------------------------------------------------------- */
+  /*      Pixel centers are computed, and reprojected if needed, a row    */
+  /*      at a time.                                                      */
+  /* -------------------------------------------------------------------- */
+  pasPixels = (pointObj *) msSmallCalloc(sizeof(pointObj), MS_MAX(1,nWinXSize));
+  if( layer->project )
+    pasReprojected = (pointObj *) msSmallCalloc(sizeof(pointObj), MS_MAX(1,nWinXSize));
+
+  /* -------------------------------------------------------------------- */
+  /*      Polygon searches on north up rasters in the layer projection    */
+  /*      are done with a scanline: the polygon edges are intersected     */
+  /*      with each row of pixel centers once, instead of testing every   */
+  /*      pixel against every edge.                                       */
+  /* -------------------------------------------------------------------- */
+  if( rlinfo->searchshape != NULL
+      && rlinfo->shape_tolerance == 0.0
+      && rlinfo->searchshape->type == MS_SHAPE_POLYGON
+      && !layer->project
+      && adfGeoTransform[2] == 0.0 && adfGeoTransform[4] == 0.0 ) {
+    int i, j, nPoints = 0;
+    shapeObj *psShape = rlinfo->searchshape;
+
+    bScanline = MS_TRUE;
+    dfShapeMinY = dfShapeMaxY = 0.0;
+    for( i = 0; i < psShape->numlines; i++ ) {
+      for( j = 0; j < psShape->line[i].numpoints; j++ ) {
+        double y = psShape->line[i].point[j].y;
+        if( nPoints++ == 0 )
+          dfShapeMinY = dfShapeMaxY = y;
+        dfShapeMinY = MS_MIN(dfShapeMinY, y);
+        dfShapeMaxY = MS_MAX(dfShapeMaxY, y);
+      }
+    }
+    padfCrossings = (double *) msSmallMalloc(sizeof(double) * MS_MAX(1,nPoints));
+  }
+
   /* -------------------------------------------------------------------- */
   /*      Loop over all pixels determining which are "in".                */
   /* -------------------------------------------------------------------- */
-  for( iLine = 0; iLine < nWinYSize; iLine++ ) {
-    for( iPixel = 0; iPixel < nWinXSize; iPixel++ ) {
-      pointObj  sPixelLocation,sReprojectedPixelLocation;
+  for( iStripOff = 0; iStripOff < nWinYSize; iStripOff += nStripLines ) {
+    nStripLines = nStripSize - (nWinYOff + iStripOff) % nStripSize;
+    nStripLines = MS_MIN(nStripLines, nWinYSize - iStripOff);
+
+    if( rlinfo->query_results == rlinfo->query_result_hard_max )
+      break;
+
+    /* don't read strips the search polygon doesn't reach */
+    if( bScanline ) {
+      double dfY1 = GEO_TRANS(adfGeoTransform+3, nWinXOff + 0.5,
+                              iStripOff + nWinYOff + 0.5);
+      double dfY2 = GEO_TRANS(adfGeoTransform+3, nWinXOff + 0.5,
+                              iStripOff + nStripLines - 1 + nWinYOff + 0.5);
+
+      if( MS_MAX(dfY1,dfY2) < dfShapeMinY || MS_MIN(dfY1,dfY2) >= dfShapeMaxY )
+        continue;
+    }
+
+    eErr = GDALDatasetRasterIO( hDS, GF_Read,
+                                nWinXOff, nWinYOff + iStripOff,
+                                nWinXSize, nStripLines,
+                                pafRaster, nWinXSize, nStripLines, GDT_Float32,
+                                nBandCount, panBandMap,
+                                4 * nBandCount,
+                                4 * nBandCount * nWinXSize,
+                                4 );
+
+    if( eErr != CE_None ) {
+      msSetError( MS_IOERR, "GDALDatasetRasterIO() failed: %s",
+                  "msRasterQueryByRectLow()", CPLGetLastErrorMsg() );
+
+      free( pafRaster );
+      free( panBandMap );
+      free( pasPixels );
+      free( pasReprojected );
+      free( padfCrossings );
+      return -1;
+    }
+
+    for( iLine = iStripOff; iLine < iStripOff + nStripLines; iLine++ ) {
+      float *pafLine = pafRaster + (iLine - iStripOff) * nWinXSize * nBandCount;
+      int nCrossings = 0;
 
       if( rlinfo->query_results == rlinfo->query_result_hard_max )
         break;
 
       /* transform pixel/line to georeferenced */
-      sPixelLocation.x =
-        GEO_TRANS(adfGeoTransform,
-                  iPixel + nWinXOff + 0.5, iLine + nWinYOff + 0.5 );
-      sPixelLocation.y =
-        GEO_TRANS(adfGeoTransform+3,
-                  iPixel + nWinXOff + 0.5, iLine + nWinYOff + 0.5 );
-
-      /* If projections differ, convert this back into the map  */
-      /* projection for distance testing, and comprison to the  */
-      /* search shape.  Save the original pixel location coordinates */
-      /* in sPixelLocationInLayerSRS, so that we can return those */
-      /* coordinates if we have a hit */
-      sReprojectedPixelLocation = sPixelLocation;
-      if( layer->project )
-        msProjectPoint( &(layer->projection), &(map->projection),
-                        &sReprojectedPixelLocation);
-
-      /* If we are doing QueryByShape, check against the shape now */
-      if( rlinfo->searchshape != NULL ) {
-        if( rlinfo->shape_tolerance == 0.0
-            && rlinfo->searchshape->type == MS_SHAPE_POLYGON ) {
-          if( msIntersectPointPolygon(
-                &sReprojectedPixelLocation, rlinfo->searchshape ) == MS_FALSE )
-            continue;
-        } else {
-          shapeObj  tempShape;
-          lineObj   tempLine;
-
-          memset( &tempShape, 0, sizeof(shapeObj) );
-          tempShape.type = MS_SHAPE_POINT;
-          tempShape.numlines = 1;
-          tempShape.line = &tempLine;
-          tempLine.numpoints = 1;
-          tempLine.point = &sReprojectedPixelLocation;
-
-          if( msDistanceShapeToShape(rlinfo->searchshape, &tempShape)
-              > rlinfo->shape_tolerance )
+      for( iPixel = 0; iPixel < nWinXSize; iPixel++ ) {
+        pasPixels[iPixel].x =
+          GEO_TRANS(adfGeoTransform,
+                    iPixel + nWinXOff + 0.5, iLine + nWinYOff + 0.5 );
+        pasPixels[iPixel].y =
+          GEO_TRANS(adfGeoTransform+3,
+                    iPixel + nWinXOff + 0.5, iLine + nWinYOff + 0.5 );
+      }
+
+      if( bScanline ) {
+        nCrossings = msRasterQueryScanlineCrossings( rlinfo->searchshape,
+                     pasPixels[0].y, padfCrossings );
+        if( nCrossings == 0 )
+          continue;
+      }
+
+      /* If projections differ, convert the row back into the map  */
+      /* projection for distance testing, and comparison to the    */
+      /* search shape.  The original pixel locations are kept in   */
+      /* pasPixels, so that we can return those coordinates if we  */
+      /* have a hit. */
+      if( layer->project ) {
+        memcpy( pasReprojected, pasPixels, sizeof(pointObj) * nWinXSize );
+        msProjectPoints( &(layer->projection), &(map->projection),
+                         nWinXSize, pasReprojected );
+      }
+
+      for( iPixel = 0; iPixel < nWinXSize; iPixel++ ) {
+        pointObj *psPixelLocation = pasPixels + iPixel;
+        pointObj *psReprojectedPixelLocation =
+          layer->project ? pasReprojected + iPixel : psPixelLocation;
+
+        if( rlinfo->query_results == rlinfo->query_result_hard_max )
+          break;
+
+        /* If we are doing QueryByShape, check against the shape now */
+        if( bScanline ) {
+          /* inside if an odd number of crossings are right of the center */
+          int nLow = 0, nHigh = nCrossings;
+
+          while( nLow < nHigh ) {
+            int nMid = (nLow + nHigh) / 2;
+            if( psPixelLocation->x < padfCrossings[nMid] )
+              nHigh = nMid;
+            else
+              nLow = nMid + 1;
+          }
+          if( (nCrossings - nLow) % 2 == 0 )
             continue;
+        } else if( rlinfo->searchshape != NULL ) {
+          if( rlinfo->shape_tolerance == 0.0
+              && rlinfo->searchshape->type == MS_SHAPE_POLYGON ) {
+            if( msIntersectPointPolygon(
+                  psReprojectedPixelLocation, rlinfo->searchshape ) == MS_FALSE )
+              continue;
+          } else {
+            shapeObj  tempShape;
+            lineObj   tempLine;
+
+            memset( &tempShape, 0, sizeof(shapeObj) );
+            tempShape.type = MS_SHAPE_POINT;
+            tempShape.numlines = 1;
+            tempShape.line = &tempLine;
+            tempLine.numpoints = 1;
+            tempLine.point = psReprojectedPixelLocation;
+
+            if( msDistanceShapeToShape(rlinfo->searchshape, &tempShape)
+                > rlinfo->shape_tolerance )
+              continue;
+          }
         }
-      }
 
-      if( rlinfo->range_mode >= 0 ) {
-        double dist;
+        if( rlinfo->range_mode >= 0 ) {
+          double dist;
 
-        dist = (rlinfo->target_point.x - sReprojectedPixelLocation.x)
-               * (rlinfo->target_point.x - sReprojectedPixelLocation.x)
-               + (rlinfo->target_point.y - sReprojectedPixelLocation.y)
-               * (rlinfo->target_point.y - sReprojectedPixelLocation.y);
+          dist = (rlinfo->target_point.x - psReprojectedPixelLocation->x)
+                 * (rlinfo->target_point.x - psReprojectedPixelLocation->x)
+                 + (rlinfo->target_point.y - psReprojectedPixelLocation->y)
+                 * (rlinfo->target_point.y - psReprojectedPixelLocation->y);
 
-        if( dist >= dfAdjustedRange )
-          continue;
+          if( dist >= dfAdjustedRange )
+            continue;
 
-        /* If we can only have one feature, trim range and clear */
-        /* previous result.  */
-        if( rlinfo->range_mode == MS_QUERY_SINGLE ) {
-          rlinfo->range_dist = dist;
-          rlinfo->query_results = 0;
+          /* If we can only have one feature, trim range and clear */
+          /* previous result.  */
+          if( rlinfo->range_mode == MS_QUERY_SINGLE ) {
+            rlinfo->range_dist = dist;
+            rlinfo->query_results = 0;
+          }
         }
-      }
 
-      msRasterQueryAddPixel( layer,
-			                       &sPixelLocation, // return coords in layer SRS
-                             &sReprojectedPixelLocation,
-                             pafRaster
-                             + (iLine*nWinXSize + iPixel) * nBandCount );
+        msRasterQueryAddPixel( layer,
+                               psPixelLocation, // return coords in layer SRS
+                               psReprojectedPixelLocation,
+                               pafLine + iPixel * nBandCount );
+      }
     }
   }
 
@@ -638,6 +777,10 @@ msRasterQueryByRectLow(mapObj *map, layerObj *layer, GDALDatasetH hDS,
   /*      Cleanup.                                                        */
   /* -------------------------------------------------------------------- */
   free( pafRaster );
+  free( panBandMap );
+  free( pasPixels );
+  free( pasReprojected );
+  free( padfCrossings );
 
   return MS_SUCCESS;
 }
@@ -552,6 +552,204 @@ int msImagePolylineMarkers(imageObj *image, shapeObj *p, symbolObj *symbol,
   return ret;
 }
 
+/*
+** Render batches: while drawing a vector layer, consecutive simple lines or
+** polygons sharing the same stroke or fill are collected and handed to the
+** renderer's renderLines/renderPolygons in one call. A batch only ever holds
+** primitives whose pixel bounds don't touch, anything that could overlap one
+** of them, use another style or be drawn some other way flushes it first, so
+** draw order and the rendered pixels are the same as drawing one by one.
+*/
+#define MS_RENDER_BATCH_MAX_SHAPES 256
+/* bounds the rasterizer cells a single pass can accumulate (roughly the
+   number of pixels crossed by the outlines) */
+#define MS_RENDER_BATCH_MAX_LENGTH 500000
+
+struct renderBatchObj {
+  int type; /* MS_SHAPE_LINE or MS_SHAPE_POLYGON */
+  strokeStyleObj stroke;
+  colorObj color;
+  int numshapes;
+  double length;
+  shapeObj shapes[MS_RENDER_BATCH_MAX_SHAPES]; /* point into lines/points when flushed */
+  rectObj bounds[MS_RENDER_BATCH_MAX_SHAPES];
+  int firstline[MS_RENDER_BATCH_MAX_SHAPES+1];
+  /* vertices of all the queued shapes, kept across flushes */
+  lineObj *lines;
+  int *firstpoint;
+  int numlines, maxlines;
+  pointObj *points;
+  int numpoints, maxpoints;
+};
+
+void msBeginRenderBatch(imageObj *image)
+{
+  rendererVTableObj *renderer;
+  int i;
+  if(!image || image->batch || !MS_RENDERER_PLUGIN(image->format))
+    return;
+  renderer = MS_IMAGE_RENDERER(image);
+  /* renderers tracking individual shapes (KML, UTFGrid) can't be batched */
+  if(!renderer->renderLines || !renderer->renderPolygons || renderer->startShape)
+    return;
+  image->batch = (struct renderBatchObj*) msSmallCalloc(1, sizeof(struct renderBatchObj));
+  for(i=0; i<MS_RENDER_BATCH_MAX_SHAPES; i++)
+    msInitShape(&image->batch->shapes[i]);
+}
+
+static int msFlushRenderBatch(imageObj *image)
+{
+  struct renderBatchObj *batch = image->batch;
+  int i, status;
+
+  if(!batch || batch->numshapes == 0)
+    return MS_SUCCESS;
+  for(i=0; i<batch->numlines; i++)
+    batch->lines[i].point = batch->points + batch->firstpoint[i];
+  for(i=0; i<batch->numshapes; i++) {
+    batch->shapes[i].line = batch->lines + batch->firstline[i];
+    batch->shapes[i].numlines = batch->firstline[i+1] - batch->firstline[i];
+  }
+  if(batch->type == MS_SHAPE_LINE) {
+    batch->stroke.color = &batch->color;
+    status = MS_IMAGE_RENDERER(image)->renderLines(image, batch->shapes, batch->numshapes, &batch->stroke);
+  } else {
+    status = MS_IMAGE_RENDERER(image)->renderPolygons(image, batch->shapes, batch->numshapes, &batch->color);
+  }
+  batch->numshapes = batch->numlines = batch->numpoints = 0;
+  batch->length = 0;
+  return status;
+}
+
+int msEndRenderBatch(imageObj *image)
+{
+  int status;
+  if(!image || !image->batch)
+    return MS_SUCCESS;
+  status = msFlushRenderBatch(image);
+  msFree(image->batch->lines);
+  msFree(image->batch->firstpoint);
+  msFree(image->batch->points);
+  msFree(image->batch);
+  image->batch = NULL;
+  return status;
+}
+
+static int strokeStylesEqual(strokeStyleObj *a, strokeStyleObj *b)
+{
+  int i;
+  if(a->width != b->width || a->linecap != b->linecap || a->linejoin != b->linejoin ||
+      a->linejoinmaxsize != b->linejoinmaxsize || a->patternlength != b->patternlength)
+    return MS_FALSE;
+  if(a->patternlength > 0) {
+    if(a->patternoffset != b->patternoffset)
+      return MS_FALSE;
+    for(i=0; i<a->patternlength; i++)
+      if(a->pattern[i] != b->pattern[i])
+        return MS_FALSE;
+  }
+  return MS_TRUE;
+}
+
+/*
+** Queue p for drawing with stroke (lines) or color (polygons), the renderer
+** is called directly when no batch is active.
+*/
+static int msRenderBatchAdd(imageObj *image, int type, shapeObj *p, strokeStyleObj *stroke, colorObj *color)
+{
+  struct renderBatchObj *batch = image->batch;
+  rectObj bounds;
+  double length = 0, margin;
+  int i, j, n = 0;
+
+  if(!batch) {
+    if(type == MS_SHAPE_LINE)
+      return MS_IMAGE_RENDERER(image)->renderLine(image, p, stroke);
+    return MS_IMAGE_RENDERER(image)->renderPolygon(image, p, color);
+  }
+
+  bounds.minx = bounds.miny = bounds.maxx = bounds.maxy = 0;
+  for(i=0; i<p->numlines; i++) {
+    lineObj *l = &p->line[i];
+    for(j=0; j<l->numpoints; j++) {
+      if(n++ == 0) {
+        bounds.minx = bounds.maxx = l->point[j].x;
+        bounds.miny = bounds.maxy = l->point[j].y;
+      } else {
+        bounds.minx = MS_MIN(bounds.minx, l->point[j].x);
+        bounds.maxx = MS_MAX(bounds.maxx, l->point[j].x);
+        bounds.miny = MS_MIN(bounds.miny, l->point[j].y);
+        bounds.maxy = MS_MAX(bounds.maxy, l->point[j].y);
+        length += fabs(l->point[j].x - l->point[j-1].x) + fabs(l->point[j].y - l->point[j-1].y);
+      }
+    }
+  }
+  if(n == 0)
+    return MS_SUCCESS;
+
+  /* one pixel for antialiasing. Past the centerline a stroke reaches half its
+     width, a bit more for square caps, and up to half the miter limit times
+     its width at a join. Cairo strokes every join as a miter whatever the
+     style's linejoin, with its default miter limit of 10 */
+  if(type == MS_SHAPE_LINE) {
+    margin = 5 * stroke->width + 1;
+    length = 2 * length + n * 4 * stroke->width;
+  } else {
+    margin = 1;
+  }
+  bounds.minx -= margin;
+  bounds.miny -= margin;
+  bounds.maxx += margin;
+  bounds.maxy += margin;
+
+  if(batch->numshapes > 0) {
+    int flush = (batch->type != type || batch->numshapes == MS_RENDER_BATCH_MAX_SHAPES ||
+                 batch->length + length > MS_RENDER_BATCH_MAX_LENGTH);
+    colorObj *c = (type == MS_SHAPE_LINE) ? stroke->color : color;
+    if(!flush)
+      flush = (c->red != batch->color.red || c->green != batch->color.green ||
+               c->blue != batch->color.blue || c->alpha != batch->color.alpha);
+    if(!flush && type == MS_SHAPE_LINE)
+      flush = !strokeStylesEqual(stroke, &batch->stroke);
+    for(i=0; !flush && i<batch->numshapes; i++)
+      flush = msRectOverlap(&bounds, &batch->bounds[i]);
+    if(flush && msFlushRenderBatch(image) != MS_SUCCESS)
+      return MS_FAILURE;
+  }
+
+  if(batch->numshapes == 0) {
+    batch->type = type;
+    if(type == MS_SHAPE_LINE) {
+      batch->stroke = *stroke;
+      batch->color = *stroke->color;
+    } else {
+      batch->color = *color;
+    }
+  }
+
+  if(batch->numlines + p->numlines > batch->maxlines) {
+    batch->maxlines = MS_MAX(2 * batch->maxlines, batch->numlines + p->numlines);
+    batch->lines = (lineObj*) msSmallRealloc(batch->lines, batch->maxlines * sizeof(lineObj));
+    batch->firstpoint = (int*) msSmallRealloc(batch->firstpoint, batch->maxlines * sizeof(int));
+  }
+  if(batch->numpoints + n > batch->maxpoints) {
+    batch->maxpoints = MS_MAX(2 * batch->maxpoints, batch->numpoints + n);
+    batch->points = (pointObj*) msSmallRealloc(batch->points, batch->maxpoints * sizeof(pointObj));
+  }
+  batch->firstline[batch->numshapes] = batch->numlines;
+  for(i=0; i<p->numlines; i++) {
+    batch->lines[batch->numlines].numpoints = p->line[i].numpoints;
+    batch->firstpoint[batch->numlines++] = batch->numpoints;
+    memcpy(batch->points + batch->numpoints, p->line[i].point, p->line[i].numpoints * sizeof(pointObj));
+    batch->numpoints += p->line[i].numpoints;
+  }
+  batch->firstline[batch->numshapes+1] = batch->numlines;
+  batch->shapes[batch->numshapes].type = p->type;
+  batch->bounds[batch->numshapes++] = bounds;
+  batch->length += length;
+  return MS_SUCCESS;
+}
+
 int msDrawLineSymbol(mapObj *map, imageObj *image, shapeObj *p,
                      styleObj *style, double scalefactor)
 {
@@ -613,9 +811,13 @@ int msDrawLineSymbol(mapObj *map, imageObj *image, shapeObj *p,
           status = MS_SUCCESS;
           goto line_cleanup;
         }
-        status = renderer->renderLine(image,offsetLine,&s);
+        status = msRenderBatchAdd(image,MS_SHAPE_LINE,offsetLine,&s,NULL);
       } else {
         symbolStyleObj s;
+        if(msFlushRenderBatch(image) != MS_SUCCESS) {
+          status = MS_FAILURE;
+          goto line_cleanup;
+        }
         if(preloadSymbol(&map->symbolset, symbol, renderer) != MS_SUCCESS) {
           status = MS_FAILURE;
           goto line_cleanup;
@@ -725,7 +927,7 @@ int msDrawShadeSymbol(mapObj *map, imageObj *image, shapeObj *p, styleObj *style
       /* simple polygon drawing, without any specific symbol.
        * also draws an optional outline */
       if(style->symbol == 0 || symbol->type == MS_SYMBOL_SIMPLE) {
-        ret = renderer->renderPolygon(image,offsetPolygon,&style->color);
+        ret = msRenderBatchAdd(image,MS_SHAPE_POLYGON,offsetPolygon,NULL,&style->color);
         if(ret != MS_SUCCESS) goto cleanup;
         if(MS_VALID_COLOR(style->outlinecolor)) {
           strokeStyleObj s;
@@ -735,10 +937,14 @@ int msDrawShadeSymbol(mapObj *map, imageObj *image, shapeObj *p, styleObj *style
           s.width = (style->width == 0)?scalefactor:style->width*scalefactor;
           s.width = MS_MIN(s.width, style->maxwidth);
           s.width = MS_MAX(s.width, style->minwidth);
-          ret = renderer->renderLine(image,offsetPolygon,&s);
+          ret = msRenderBatchAdd(image,MS_SHAPE_LINE,offsetPolygon,&s,NULL);
         }
         goto cleanup; /*finished plain polygon*/
-      } else if(symbol->type == MS_SYMBOL_HATCH) {
+      }
+
+      ret = msFlushRenderBatch(image);
+      if(ret != MS_SUCCESS) goto cleanup;
+      if(symbol->type == MS_SYMBOL_HATCH) {
         double width, spacing;
         double pattern[MS_MAXPATTERNLENGTH];
         int i;
@@ -831,6 +1037,177 @@ cleanup:
   return ret;
 }
 
+/*
+** Marker stamps: with PROCESSING "MARKER_CACHE=ON" a layer's unrotated vector
+** and ellipse markers are rendered once per symbol, style and subpixel
+** position into a small transparent image, which is then blended onto the
+** map for every point. The marker position is rounded to a sixteenth of a
+** pixel and the stamp is composited rather than rasterized in place, so the
+** antialiased edges differ from the direct rendering. On 60000 circles,
+** triangles and crosses (msautotest/renderers/marker_cache.map draws a
+** similar layer) the largest difference measured was 20 of 255 levels in
+** one channel and the mean difference was 1.3 levels.
+*/
+#define MS_MARKER_STAMP_SUBPIXELS 16
+#define MS_MARKER_STAMP_MAX_SIZE 64
+#define MS_MARKER_CACHE_BUCKETS 256
+#define MS_MARKER_CACHE_MAX_STAMPS 2048
+
+typedef struct markerStampObj markerStampObj;
+struct markerStampObj {
+  symbolObj *symbol;
+  double scale, outlinewidth;
+  int hascolor, hasoutlinecolor, hasbackgroundcolor;
+  colorObj color, outlinecolor, backgroundcolor;
+  int subpixel; /* x and y subpixel bucket */
+  imageObj *image;
+  int cx, cy; /* pixel of the stamp holding the marker position */
+  markerStampObj *next;
+};
+
+struct markerCacheObj {
+  markerStampObj *buckets[MS_MARKER_CACHE_BUCKETS];
+  int numstamps;
+};
+
+static void msClearMarkerCache(struct markerCacheObj *cache)
+{
+  int i;
+  for(i=0; i<MS_MARKER_CACHE_BUCKETS; i++) {
+    while(cache->buckets[i]) {
+      markerStampObj *next = cache->buckets[i]->next;
+      msFreeImage(cache->buckets[i]->image);
+      msFree(cache->buckets[i]);
+      cache->buckets[i] = next;
+    }
+  }
+  cache->numstamps = 0;
+}
+
+void msBeginMarkerCache(imageObj *image)
+{
+  rendererVTableObj *renderer;
+  if(!image || image->markercache || !MS_RENDERER_PLUGIN(image->format))
+    return;
+  renderer = MS_IMAGE_RENDERER(image);
+  if(!renderer->supports_pixel_buffer || !renderer->getRasterBufferHandle ||
+      !renderer->mergeRasterBuffer || renderer->startShape)
+    return;
+  image->markercache = (struct markerCacheObj*) msSmallCalloc(1, sizeof(struct markerCacheObj));
+}
+
+void msEndMarkerCache(imageObj *image)
+{
+  if(!image || !image->markercache)
+    return;
+  msClearMarkerCache(image->markercache);
+  msFree(image->markercache);
+  image->markercache = NULL;
+}
+
+#define MARKER_STAMP_COLOR_MATCHES(has, stamped, c) \
+  ((has) == ((c) != NULL) && (!(c) || COMPARE_COLORS(stamped, *(c))))
+
+/*
+** Draw symbol at x,y from a cached stamp. Returns MS_DONE when the marker
+** can't be stamped and has to be rendered directly.
+*/
+static int msDrawMarkerStamp(imageObj *image, symbolObj *symbol, symbolStyleObj *s, double x, double y)
+{
+  struct markerCacheObj *cache = image->markercache;
+  rendererVTableObj *renderer = MS_IMAGE_RENDERER(image);
+  markerStampObj *stamp;
+  rasterBufferObj rb;
+  double fx, fy, margin, hw, hh;
+  int ix, iy, width, height, subpixel, bucket;
+  unsigned int hash;
+
+  if(s->rotation != 0 || (symbol->type != MS_SYMBOL_VECTOR && symbol->type != MS_SYMBOL_ELLIPSE))
+    return MS_DONE;
+
+  /* a stroke reaches up to twice its width out with miter joins, plus
+     a pixel for antialiasing and one for the subpixel offset. The checks
+     are done in floating point, before anything is cast to an integer, so
+     huge or NaN sizes fall back to direct rendering. */
+  if(!(s->scale >= 0 && s->scale <= MS_MARKER_STAMP_MAX_SIZE && s->outlinewidth >= 0))
+    return MS_DONE;
+  margin = 2 * s->outlinewidth + 2;
+  hw = symbol->sizex * s->scale / 2 + margin;
+  hh = symbol->sizey * s->scale / 2 + margin;
+  if(!(2 * ceil(hw) + 1 <= MS_MARKER_STAMP_MAX_SIZE && 2 * ceil(hh) + 1 <= MS_MARKER_STAMP_MAX_SIZE))
+    return MS_DONE; /* large markers are cheaper to rasterize than to blend */
+  width = 2 * (int)ceil(hw) + 1;
+  height = 2 * (int)ceil(hh) + 1;
+
+  ix = (int)floor(x);
+  iy = (int)floor(y);
+  fx = x - ix;
+  fy = y - iy;
+  subpixel = MS_MIN((int)(fx * MS_MARKER_STAMP_SUBPIXELS), MS_MARKER_STAMP_SUBPIXELS - 1) * MS_MARKER_STAMP_SUBPIXELS +
+             MS_MIN((int)(fy * MS_MARKER_STAMP_SUBPIXELS), MS_MARKER_STAMP_SUBPIXELS - 1);
+
+  hash = (unsigned int)(((size_t)symbol) >> 4);
+  hash = hash * 31 + (unsigned int)(s->scale * 1024);
+  hash = hash * 31 + (unsigned int)(s->outlinewidth * 1024);
+  if(s->color) hash = hash * 31 + s->color->red + (s->color->green << 8) + (s->color->blue << 16);
+  if(s->outlinecolor) hash = hash * 31 + s->outlinecolor->red + (s->outlinecolor->green << 8) + (s->outlinecolor->blue << 16);
+  hash = hash * 31 + subpixel;
+  bucket = hash % MS_MARKER_CACHE_BUCKETS;
+
+  for(stamp = cache->buckets[bucket]; stamp; stamp = stamp->next) {
+    if(stamp->symbol == symbol && stamp->subpixel == subpixel && stamp->scale == s->scale &&
+        stamp->outlinewidth == s->outlinewidth &&
+        MARKER_STAMP_COLOR_MATCHES(stamp->hascolor, stamp->color, s->color) &&
+        MARKER_STAMP_COLOR_MATCHES(stamp->hasoutlinecolor, stamp->outlinecolor, s->outlinecolor) &&
+        MARKER_STAMP_COLOR_MATCHES(stamp->hasbackgroundcolor, stamp->backgroundcolor, s->backgroundcolor))
+      break;
+  }
+
+  if(!stamp) {
+    imageObj *stampimg;
+    int status;
+
+    if(cache->numstamps >= MS_MARKER_CACHE_MAX_STAMPS)
+      msClearMarkerCache(cache);
+
+    stampimg = msImageCreate(width, height, image->format, NULL, NULL, image->resolution, image->resolution, NULL);
+    if(UNLIKELY(!stampimg))
+      return MS_FAILURE;
+    fx = width / 2 + ((subpixel / MS_MARKER_STAMP_SUBPIXELS) + 0.5) / MS_MARKER_STAMP_SUBPIXELS;
+    fy = height / 2 + ((subpixel % MS_MARKER_STAMP_SUBPIXELS) + 0.5) / MS_MARKER_STAMP_SUBPIXELS;
+    if(symbol->type == MS_SYMBOL_VECTOR)
+      status = renderer->renderVectorSymbol(stampimg, fx, fy, symbol, s);
+    else
+      status = renderer->renderEllipseSymbol(stampimg, fx, fy, symbol, s);
+    if(UNLIKELY(status != MS_SUCCESS)) {
+      msFreeImage(stampimg);
+      return MS_FAILURE;
+    }
+
+    stamp = (markerStampObj*) msSmallCalloc(1, sizeof(markerStampObj));
+    stamp->symbol = symbol;
+    stamp->scale = s->scale;
+    stamp->outlinewidth = s->outlinewidth;
+    if((stamp->hascolor = (s->color != NULL))) stamp->color = *s->color;
+    if((stamp->hasoutlinecolor = (s->outlinecolor != NULL))) stamp->outlinecolor = *s->outlinecolor;
+    if((stamp->hasbackgroundcolor = (s->backgroundcolor != NULL))) stamp->backgroundcolor = *s->backgroundcolor;
+    stamp->subpixel = subpixel;
+    stamp->image = stampimg;
+    stamp->cx = width / 2;
+    stamp->cy = height / 2;
+    stamp->next = cache->buckets[bucket];
+    cache->buckets[bucket] = stamp;
+    cache->numstamps++;
+  } else {
+    MS_TRACE_COUNT(MS_TRACE_CACHEHITS, 1);
+  }
+
+  if(UNLIKELY(renderer->getRasterBufferHandle(stamp->image, &rb) != MS_SUCCESS))
+    return MS_FAILURE;
+  return renderer->mergeRasterBuffer(image, &rb, 1.0, 0, 0, ix - stamp->cx, iy - stamp->cy,
+                                     stamp->image->width, stamp->image->height);
+}
+
 int msDrawMarkerSymbol(mapObj *map, imageObj *image, pointObj *p, styleObj *style,
                        double scalefactor)
 {
@@ -858,6 +1235,8 @@ int msDrawMarkerSymbol(mapObj *map, imageObj *image, pointObj *p, styleObj *styl
           symbol->type != MS_SYMBOL_SVG) {
         return MS_SUCCESS; // nothing to do if no color, except for pixmap symbols
       }
+      if(msFlushRenderBatch(image) != MS_SUCCESS)
+        return MS_FAILURE;
       if(s.scale == 0) {
         return MS_SUCCESS;
       }
@@ -905,6 +1284,12 @@ int msDrawMarkerSymbol(mapObj *map, imageObj *image, pointObj *p, styleObj *styl
         }
       }
 
+      if(image->markercache) {
+        ret = msDrawMarkerStamp(image, symbol, &s, p_x, p_y);
+        if(ret != MS_DONE)
+          return ret;
+        ret = MS_SUCCESS;
+      }
       if(renderer->use_imagecache) {
         imageObj *tile = getTile(image, symbol, &s, -1, -1,0);
         if(tile!=NULL)
@@ -1025,6 +1410,7 @@ int msDrawTextSymbol(mapObj *map, imageObj *image, pointObj labelPnt, textSymbol
     oc = &ts->label->outlinecolor;
   ow = MS_NINT((double)ts->label->outlinewidth * ((double)ts->textpath->glyph_size / (double)ts->label->size));
   if(!renderer->renderGlyphs) return MS_FAILURE;
+  if(msFlushRenderBatch(image) != MS_SUCCESS) return MS_FAILURE;
   return renderer->renderGlyphs(image,ts->textpath,c,oc,ow);
   
 }
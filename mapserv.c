@@ -244,6 +244,7 @@ int main(int argc, char *argv[])
     /* -------------------------------------------------------------------- */
     /*      Process a request.                                              */
     /* -------------------------------------------------------------------- */
+    msTraceStart(); /* if MS_TRACE is set */
     mapserv = msAllocMapServObj();
     mapserv->sendheaders = sendheaders; /* override the default if necessary (via command line -nh switch) */
 
@@ -289,6 +290,7 @@ end_request:
     }
     msCGIWriteLog(mapserv,MS_FALSE);
     msFreeMapServObj(mapserv);
+    msTraceFinish(getenv("QUERY_STRING"));
 #ifdef USE_FASTCGI
     /* FCGI_ --- return to top of loop */
     msResetErrorList();
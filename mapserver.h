@@ -225,6 +225,8 @@ extern "C" {
 #define MS_DEFAULT_LABEL_PRIORITY 1
 #define MS_LABEL_FORCE_GROUP 2 /* other values are MS_ON/MS_OFF */
 
+#define MS_ARENA_BLOCKSIZE 65536 /* default arenaObj block size in bytes */
+
   /* General defines, not wrapable */
 #ifndef SWIG
 #ifdef USE_XMLMAPFILE
@@ -387,6 +389,7 @@ extern "C" {
 #define MS_RENDER_WITH_IMAGEMAP 5
 #define MS_RENDER_WITH_TEMPLATE 8 /* query results only */
 #define MS_RENDER_WITH_OGR 16
+#define MS_RENDER_WITH_MVT 17
 
 #define MS_RENDER_WITH_PLUGIN 100
 #define MS_RENDER_WITH_CAIRO_RASTER   101
@@ -405,6 +408,7 @@ extern "C" {
 #define MS_RENDERER_TEMPLATE(format) ((format)->renderer == MS_RENDER_WITH_TEMPLATE)
 #define MS_RENDERER_KML(format) ((format)->renderer == MS_RENDER_WITH_KML)
 #define MS_RENDERER_OGR(format) ((format)->renderer == MS_RENDER_WITH_OGR)
+#define MS_RENDERER_MVT(format) ((format)->renderer == MS_RENDER_WITH_MVT)
 
 #define MS_RENDERER_PLUGIN(format) ((format)->renderer > MS_RENDER_WITH_PLUGIN)
 
@@ -1227,6 +1231,25 @@ extern "C" {
     labelLeaderObj *leader;
   };
 
+#ifndef SWIG
+  /************************************************************************/
+  /*                               arenaObj                               */
+  /*                                                                      */
+  /*      simple bump allocator: memory handed out by msArenaAlloc() is   */
+  /*      never freed individually, everything is released at once by     */
+  /*      msArenaReset() or msArenaFree(). A zeroed arenaObj is valid.    */
+  /************************************************************************/
+  typedef struct arenaBlockObj arenaBlockObj;
+
+  typedef struct {
+    arenaBlockObj *blocks; /* current block first */
+    size_t blocksize; /* default block size, MS_ARENA_BLOCKSIZE if 0 */
+    int numallocs; /* statistics since the last reset, for debug output */
+    size_t numbytes;
+    int numblocks;
+  } arenaObj;
+#endif /* SWIG */
+
   /************************************************************************/
   /*                         labelCacheMemberObj                          */
   /*                                                                      */
@@ -1296,6 +1319,9 @@ extern "C" {
     labelCacheMemberObj **rendered_text_symbols;
     int num_allocated_rendered_members;
     int num_rendered_members;
+#ifndef SWIG
+    arenaObj arena; /* per request storage for label cache members */
+#endif
   } labelCacheObj;
 
   /************************************************************************/
@@ -1479,6 +1505,10 @@ extern "C" {
     lineObj   *pboundinglines;
     pointObj  *pboundingpoints;
     char    *labelformat;
+    int     bprojectedarcs; /* arcs are returned in the map projection, see msGraticuleLayerWhichShapes() */
+    int     inumarcs;
+    int     iwhicharc;
+    shapeObj  *parcs;
   } graticuleObj;
 
   typedef struct {
@@ -1541,6 +1571,8 @@ extern "C" {
     ms_bitarray  img_mask;
     pointObj refpt;
     mapObj *map;
+    struct renderBatchObj *batch; /* pending line/polygon primitives, see msBeginRenderBatch() */
+    struct markerCacheObj *markercache; /* marker stamps, see msBeginMarkerCache() */
 #endif
   };
 
@@ -1975,6 +2007,7 @@ void msPopulateTextSymbolForLabelAndString(textSymbolObj *ts, labelObj *l, char
     char* (*LayerEscapePropertyName)(layerObj *layer, const char* pszString);
     void (*LayerEnablePaging)(layerObj *layer, int value);
     int (*LayerGetPaging)(layerObj *layer);
+    void (*LayerRecycleShape)(layerObj *layer, shapeObj *shape);
   };
 #endif /*SWIG*/
 
@@ -1983,6 +2016,7 @@ void msPopulateTextSymbolForLabelAndString(textSymbolObj *ts, labelObj *l, char
   MS_DLL_EXPORT void msFreeImage(imageObj *img);
   MS_DLL_EXPORT int msSetup(void);
   MS_DLL_EXPORT void msCleanup(void);
+  MS_DLL_EXPORT void msLexerCleanup(void);
   MS_DLL_EXPORT mapObj *msLoadMapFromString(char *buffer, char *new_mappath);
 
   /* Function prototypes, not wrapable */
@@ -2133,6 +2167,13 @@ void msPopulateTextSymbolForLabelAndString(textSymbolObj *ts, labelObj *l, char
   MS_DLL_EXPORT char **msTokenizeMap(char *filename, int *numtokens);
   MS_DLL_EXPORT int msInitLabelCache(labelCacheObj *cache);
   MS_DLL_EXPORT int msFreeLabelCache(labelCacheObj *cache);
+
+  /* arena allocator (maparena.c) */
+  MS_DLL_EXPORT void msArenaInit(arenaObj *arena, size_t blocksize);
+  MS_DLL_EXPORT void *msArenaAlloc(arenaObj *arena, size_t size);
+  MS_DLL_EXPORT char *msArenaStrdup(arenaObj *arena, const char *str);
+  MS_DLL_EXPORT void msArenaReset(arenaObj *arena);
+  MS_DLL_EXPORT void msArenaFree(arenaObj *arena);
   MS_DLL_EXPORT int msCheckConnection(layerObj * layer); /* connection pooling functions (mapfile.c) */
   MS_DLL_EXPORT void msCloseConnections(mapObj *map);
 
@@ -2419,6 +2460,7 @@ void msPopulateTextSymbolForLabelAndString(textSymbolObj *ts, labelObj *l, char
   MS_DLL_EXPORT int msLayerApplyScaletokens(layerObj *layer, double scale);
   MS_DLL_EXPORT int msLayerRestoreFromScaletokens(layerObj *layer);
   MS_DLL_EXPORT int msClusterLayerOpen(layerObj *layer); /* in mapcluster.c */
+  MS_DLL_EXPORT void msClusterCleanup(void); /* in mapcluster.c */
   MS_DLL_EXPORT int msLayerIsOpen(layerObj *layer);
   MS_DLL_EXPORT void msLayerClose(layerObj *layer);
   MS_DLL_EXPORT void msLayerFreeExpressions(layerObj *layer);
@@ -2462,6 +2504,7 @@ void msPopulateTextSymbolForLabelAndString(textSymbolObj *ts, labelObj *l, char
 
   MS_DLL_EXPORT void msLayerEnablePaging(layerObj *layer, int value);
   MS_DLL_EXPORT int msLayerGetPaging(layerObj *layer);
+  MS_DLL_EXPORT void msLayerRecycleShape(layerObj *layer, shapeObj *shape);
 
   MS_DLL_EXPORT int msLayerGetMaxFeaturesToDraw(layerObj *layer, outputFormatObj *format);
 
@@ -2496,14 +2539,17 @@ void msPopulateTextSymbolForLabelAndString(textSymbolObj *ts, labelObj *l, char
   MS_DLL_EXPORT int msOracleSpatialLayerInitializeVirtualTable(layerObj *layer);
   MS_DLL_EXPORT int msWFSLayerInitializeVirtualTable(layerObj *layer);
   MS_DLL_EXPORT int msGraticuleLayerInitializeVirtualTable(layerObj *layer);
+  MS_DLL_EXPORT void msGraticuleCleanup(void); /* in mapgraticule.c */
   MS_DLL_EXPORT int msRASTERLayerInitializeVirtualTable(layerObj *layer);
   MS_DLL_EXPORT int msUVRASTERLayerInitializeVirtualTable(layerObj *layer);
   MS_DLL_EXPORT int msContourLayerInitializeVirtualTable(layerObj *layer);  
+  MS_DLL_EXPORT void msContourCleanup(void); /* in mapcontour.c */
   MS_DLL_EXPORT int msPluginLayerInitializeVirtualTable(layerObj *layer);
   MS_DLL_EXPORT int msUnionLayerInitializeVirtualTable(layerObj *layer);
   MS_DLL_EXPORT void msPluginFreeVirtualTableFactory(void);
 
   int LayerDefaultGetShapeCount(layerObj *layer, rectObj rect, projectionObj *rectProjection);
+  void LayerDefaultRecycleShape(layerObj *layer, shapeObj *shape);
 
   /* ==================================================================== */
   /*      Prototypes for functions in mapdraw.c                           */
@@ -2549,6 +2595,10 @@ void msPopulateTextSymbolForLabelAndString(textSymbolObj *ts, labelObj *l, char
   MS_DLL_EXPORT int WARN_UNUSED msCircleDrawShadeSymbol(mapObj *map, imageObj *image, pointObj *p, double r, styleObj *style, double scalefactor);
   MS_DLL_EXPORT int WARN_UNUSED msDrawPieSlice(mapObj *map, imageObj *image, pointObj *p, styleObj *style, double radius, double start, double end);
   MS_DLL_EXPORT int WARN_UNUSED msDrawLabelBounds(mapObj *map, imageObj *image, label_bounds *bnds, styleObj *style, double scalefactor);
+  MS_DLL_EXPORT void msBeginRenderBatch(imageObj *image);
+  MS_DLL_EXPORT int msEndRenderBatch(imageObj *image);
+  MS_DLL_EXPORT void msBeginMarkerCache(imageObj *image);
+  MS_DLL_EXPORT void msEndMarkerCache(imageObj *image);
 
   MS_DLL_EXPORT void msOutlineRenderingPrepareStyle(styleObj *pStyle, mapObj *map, layerObj *layer, imageObj *image);
   MS_DLL_EXPORT void msOutlineRenderingRestoreStyle(styleObj *pStyle, mapObj *map, layerObj *layer, imageObj *image);
@@ -2595,6 +2645,23 @@ void msPopulateTextSymbolForLabelAndString(textSymbolObj *ts, labelObj *l, char
   MS_DLL_EXPORT int msJoinPrepare(joinObj *join, shapeObj *shape);
   MS_DLL_EXPORT int msJoinNext(joinObj *join);
   MS_DLL_EXPORT int msJoinClose(joinObj *join);
+  MS_DLL_EXPORT void msJoinCleanup(void);
+
+  /* rendered layer image cache (in maplayercache.c) */
+  MS_DLL_EXPORT int msLayerCacheTimeout(mapObj *map, layerObj *layer, imageObj *image);
+  MS_DLL_EXPORT char *msLayerCacheKey(mapObj *map, layerObj *layer, imageObj *image);
+  MS_DLL_EXPORT int msLayerCacheGet(layerObj *layer, const char *key, int timeout, rasterBufferObj *rb);
+  MS_DLL_EXPORT void msLayerCachePut(layerObj *layer, const char *key, int timeout, rasterBufferObj *rb);
+  MS_DLL_EXPORT void msLayerCacheCleanup(void);
+
+  /* rendered legend cache (in maplegendcache.c) */
+  MS_DLL_EXPORT int msLegendCacheTimeout(mapObj *map);
+  MS_DLL_EXPORT char *msLegendCacheKey(mapObj *map, layerObj *lp, classObj *theclass, int width, int height, int scale_independent);
+  MS_DLL_EXPORT imageObj *msLegendCacheGetImage(mapObj *map, const char *key);
+  MS_DLL_EXPORT void msLegendCachePutImage(const char *key, int timeout, imageObj *image);
+  MS_DLL_EXPORT unsigned char *msLegendCacheGetEncoded(mapObj *map, const char *key, int *size);
+  MS_DLL_EXPORT void msLegendCachePutEncoded(const char *key, int timeout, const unsigned char *data, int datasize);
+  MS_DLL_EXPORT void msLegendCacheCleanup(void);
 
   /*in mapraster.c */
   MS_DLL_EXPORT int msDrawRasterLayerLow(mapObj *map, layerObj *layer, imageObj *image, rasterBufferObj *rb );
@@ -2718,6 +2785,7 @@ void msPopulateTextSymbolForLabelAndString(textSymbolObj *ts, labelObj *l, char
   MS_DLL_EXPORT int *msAllocateValidClassGroups(layerObj *lp, int *nclasses);
 
   MS_DLL_EXPORT void msFreeRasterBuffer(rasterBufferObj *b);
+  MS_DLL_EXPORT void msRasterBufferWindow(rasterBufferObj *rb, rasterBufferObj *view, int x, int y, int width, int height);
   MS_DLL_EXPORT void msSetLayerOpacity(layerObj *layer, int opacity);
 
   void msMapSetLanguageSpecificConnection(mapObj* map, const char* validated_language);
@@ -2767,6 +2835,11 @@ void msPopulateTextSymbolForLabelAndString(textSymbolObj *ts, labelObj *l, char
   MS_DLL_EXPORT int msOGRWriteFromQuery( mapObj *map, outputFormatObj *format,
                                          int sendheaders );
 
+  /* ==================================================================== */
+  /*      prototypes for functions in mapmvt.c                            */
+  /* ==================================================================== */
+  MS_DLL_EXPORT int msMVTWriteTile( mapObj *map, int sendheaders );
+
   /* ==================================================================== */
   /*      Public prototype for mapogr.cpp functions.                      */
   /* ==================================================================== */
@@ -2809,10 +2882,16 @@ void msPopulateTextSymbolForLabelAndString(textSymbolObj *ts, labelObj *l, char
   /* ==================================================================== */
   MS_DLL_EXPORT void *msConnPoolRequest( layerObj *layer );
   MS_DLL_EXPORT void msConnPoolRelease( layerObj *layer, void * );
+  MS_DLL_EXPORT void msConnPoolDiscard( layerObj *layer, void * );
   MS_DLL_EXPORT void msConnPoolRegister( layerObj *layer,
                                          void *conn_handle,
                                          void (*close)( void * ) );
+  MS_DLL_EXPORT void msConnPoolRegisterWithValidation( layerObj *layer,
+                                         void *conn_handle,
+                                         void (*close)( void * ),
+                                         int (*validate)( void * ) );
   MS_DLL_EXPORT void msConnPoolCloseUnreferenced( void );
+  MS_DLL_EXPORT void msConnPoolDebugStats( void );
   MS_DLL_EXPORT void msConnPoolFinalCleanup( void );
 
   /* ==================================================================== */
@@ -3064,7 +3143,7 @@ void msPopulateTextSymbolForLabelAndString(textSymbolObj *ts, labelObj *l, char
   /* in mapagg.cpp */
   void msApplyBlurringCompositingFilter(rasterBufferObj *rb, unsigned int radius);
   
-  int WARN_UNUSED msApplyCompositingFilter(mapObj *map, rasterBufferObj *rb, CompositingFilter *filter);
+  int WARN_UNUSED msApplyCompositingFilter(mapObj *map, rasterBufferObj *rb, CompositingFilter *filter, rectObj *region);
 
   void msBufferInit(bufferObj *buffer);
   void msBufferResize(bufferObj *buffer, size_t target_size);
@@ -3091,6 +3170,11 @@ void msPopulateTextSymbolForLabelAndString(textSymbolObj *ts, labelObj *l, char
     int WARN_UNUSED (*renderPolygon)(imageObj *img, shapeObj *p, colorObj *color);
     int WARN_UNUSED (*renderPolygonTiled)(imageObj *img, shapeObj *p, imageObj *tile);
     int WARN_UNUSED (*renderLineTiled)(imageObj *img, shapeObj *p, imageObj *tile);
+    /* optional: draw count shapes sharing a single stroke or fill. The caller
+       guarantees the shapes don't touch the same pixels, so they may be
+       rasterized in one pass with the same result as one call per shape */
+    int WARN_UNUSED (*renderLines)(imageObj *img, shapeObj *shapes, int count, strokeStyleObj *style);
+    int WARN_UNUSED (*renderPolygons)(imageObj *img, shapeObj *shapes, int count, colorObj *color);
 
     int WARN_UNUSED (*renderGlyphs)(imageObj *img, textPathObj *tp, colorObj *clr, colorObj *olcolor, int olwidth);
     int WARN_UNUSED (*renderText)(imageObj *img, pointObj *labelpnt, char *text, double angle, colorObj *clr, colorObj *olcolor, int olwidth);
@@ -3116,7 +3200,11 @@ void msPopulateTextSymbolForLabelAndString(textSymbolObj *ts, labelObj *l, char
     int WARN_UNUSED (*initializeRasterBuffer)(rasterBufferObj *rb, int width, int height, int mode);
 
     int WARN_UNUSED (*mergeRasterBuffer)(imageObj *dest, rasterBufferObj *overlay, double opacity, int srcX, int srcY, int dstX, int dstY, int width, int height);
-    int WARN_UNUSED (*compositeRasterBuffer)(imageObj *dest, rasterBufferObj *overlay, CompositingOperation comp_op, int opacity);
+    int WARN_UNUSED (*compositeRasterBuffer)(imageObj *dest, rasterBufferObj *overlay, CompositingOperation comp_op, int opacity, int srcX, int srcY, int dstX, int dstY, int width, int height);
+    /* pixel bounds (max exclusive) of what has been drawn on img since it was
+       created, an empty rect if nothing was. NULL if the renderer doesn't keep
+       track, in which case the whole image has to be considered */
+    int (*getDirtyRect)(imageObj *img, rectObj *bounds);
 
 
     /* image i/o */
@@ -1497,6 +1497,18 @@ int msCGIDispatchImageRequest(mapservObj *mapserv)
 {
   int status;
   imageObj *img = NULL;
+
+  /* vector tiles are written directly from the layers, no image is drawn */
+  if(MS_RENDERER_MVT(mapserv->map->outputformat) &&
+      (mapserv->Mode == MAP || mapserv->Mode == TILE)) {
+    if(mapserv->Mode == TILE && msTileSetExtent(mapserv) != MS_SUCCESS)
+      return MS_FAILURE;
+    if( mapserv->sendheaders && msLookupHashTable(&(mapserv->map->web.metadata), "http_max_age") ) {
+      msIO_setHeader("Cache-Control","max-age=%s", msLookupHashTable(&(mapserv->map->web.metadata), "http_max_age"));
+    }
+    return msMVTWriteTile(mapserv->map, mapserv->sendheaders);
+  }
+
   switch(mapserv->Mode) {
     case MAP:
       if(mapserv->QueryFile) {
@@ -36,6 +36,9 @@
 
 #include <limits.h>
 #include <assert.h>
+#ifndef _WIN32
+#include <fcntl.h> /* posix_fadvise() */
+#endif
 #include "mapserver.h"
 #include "mapows.h"
 
@@ -230,6 +233,15 @@ SHPHandle msSHPOpen( const char * pszLayer, const char * pszAccess )
   psSHP->panParts = NULL;
   psSHP->nBufSize = psSHP->nPartMax = 0;
 
+  psSHP->pasSpareLines = NULL;
+  psSHP->nSpareLineMax = psSHP->nSparePoints = 0;
+  psSHP->nBuffersReused = psSHP->nBuffersAllocated = 0;
+
+  psSHP->pabyWindow = NULL;
+  psSHP->nWindowSize = psSHP->nWindowOffset = psSHP->nWindowLength = 0;
+  psSHP->nWindowFirst = psSHP->nWindowLast = -1;
+  psSHP->nWindowReads = psSHP->nWindowRecords = 0;
+
   /* -------------------------------------------------------------------- */
   /*  Compute the base (layer) name.  If there is any extension     */
   /*  on the passed in filename we will strip it off.         */
@@ -423,6 +435,12 @@ void msSHPClose(SHPHandle psSHP )
   free(psSHP->pabyRec);
   free(psSHP->panParts);
 
+  free(psSHP->pasSpareLines);
+  while(psSHP->nSparePoints > 0)
+    free(psSHP->papasSparePoints[--psSHP->nSparePoints]);
+
+  free(psSHP->pabyWindow);
+
   fclose( psSHP->fpSHX );
   fclose( psSHP->fpSHP );
 
@@ -679,6 +697,7 @@ int msSHPWritePoint(SHPHandle psSHP, pointObj *point )
   /* -------------------------------------------------------------------- */
   /*      Write out record.                                               */
   /* -------------------------------------------------------------------- */
+  psSHP->nWindowLength = 0; /* the read window may hold a stale copy */
   if(fseek( psSHP->fpSHP, nRecordOffset, 0 ) == 0) {
     fwrite( pabyRec, nRecordSize+8, 1, psSHP->fpSHP );
 
@@ -971,6 +990,7 @@ int msSHPWriteShape(SHPHandle psSHP, shapeObj *shape )
   /* -------------------------------------------------------------------- */
   /*      Write out record.                                               */
   /* -------------------------------------------------------------------- */
+  psSHP->nWindowLength = 0; /* the read window may hold a stale copy */
   if(fseek( psSHP->fpSHP, nRecordOffset, 0 ) == 0) {
     fwrite( pabyRec, nRecordSize+8, 1, psSHP->fpSHP );
 
@@ -1043,6 +1063,96 @@ static int msSHPReadAllocateBuffer( SHPHandle psSHP, int hEntity, const char* ps
   return MS_SUCCESS;
 }
 
+/*
+** msSHPReadRecord() - Read record hEntity into psSHP->pabyRec, from the
+** window filled by msSHPReadRange() if the record is in there.
+*/
+static int msSHPReadRecord( SHPHandle psSHP, int hEntity, int nEntitySize, const char* pszCallingFunction )
+{
+  int nOffset = msSHXReadOffset( psSHP, hEntity);
+
+  if( psSHP->nWindowLength > 0 && nOffset >= psSHP->nWindowOffset &&
+      nOffset - psSHP->nWindowOffset <= psSHP->nWindowLength - nEntitySize ) {
+    memcpy( psSHP->pabyRec, psSHP->pabyWindow + (nOffset - psSHP->nWindowOffset), nEntitySize );
+    psSHP->nWindowRecords++;
+    return(MS_SUCCESS);
+  }
+
+  if( 0 != fseek( psSHP->fpSHP, nOffset, 0 )) {
+    msSetError(MS_IOERR, "failed to seek offset", pszCallingFunction);
+    return(MS_FAILURE);
+  }
+  if( 1 != fread( psSHP->pabyRec, nEntitySize, 1, psSHP->fpSHP )) {
+    msSetError(MS_IOERR, "failed to fread record", pszCallingFunction);
+    return(MS_FAILURE);
+  }
+  MS_TRACE_COUNT(MS_TRACE_BYTES, nEntitySize);
+
+  return(MS_SUCCESS);
+}
+
+/*
+** msSHPReadRange() - Read records hFirst to hLast with a single read so
+** that msSHPReadShape() can decode them from memory. Records are expected
+** to be stored in order, as in any shapefile that wasn't edited in place.
+** Returns MS_FAILURE when the range can't be read in one go (too large,
+** out of order, truncated file), records are then simply read one by one.
+*/
+int msSHPReadRange( SHPHandle psSHP, int hFirst, int hLast )
+{
+  int nStart, nEnd;
+
+  psSHP->nWindowLength = 0;
+  psSHP->nWindowFirst = psSHP->nWindowLast = -1;
+
+  if( hFirst < 0 || hLast >= psSHP->nRecords || hFirst > hLast )
+    return(MS_FAILURE);
+
+  nStart = msSHXReadOffset( psSHP, hFirst);
+  nEnd = msSHXReadOffset( psSHP, hLast) + msSHXReadSize( psSHP, hLast) + 8;
+  if( nStart <= 0 || nEnd <= nStart || nEnd - nStart > MS_SHP_READ_WINDOW )
+    return(MS_FAILURE);
+
+  if( nEnd - nStart > psSHP->nWindowSize ) {
+    free(psSHP->pabyWindow);
+    psSHP->nWindowSize = MS_MAX(nEnd - nStart, MS_SHP_READ_WINDOW/16);
+    psSHP->pabyWindow = (uchar *) msSmallMalloc(psSHP->nWindowSize);
+  }
+
+  if( 0 != fseek( psSHP->fpSHP, nStart, 0 ) ||
+      1 != fread( psSHP->pabyWindow, nEnd - nStart, 1, psSHP->fpSHP ))
+    return(MS_FAILURE);
+  MS_TRACE_COUNT(MS_TRACE_BYTES, nEnd - nStart);
+
+  psSHP->nWindowOffset = nStart;
+  psSHP->nWindowLength = nEnd - nStart;
+  psSHP->nWindowFirst = hFirst;
+  psSHP->nWindowLast = hLast;
+  psSHP->nWindowReads++;
+
+  return(MS_SUCCESS);
+}
+
+/*
+** msSHPAdviseRange() - Let the OS know records hFirst to hLast will be read
+** soon so it can start fetching them in the background. Only a hint, this
+** does nothing where posix_fadvise() isn't available.
+*/
+void msSHPAdviseRange( SHPHandle psSHP, int hFirst, int hLast )
+{
+#if defined(POSIX_FADV_WILLNEED) && !defined(_WIN32)
+  int nStart, nEnd;
+
+  if( hFirst < 0 || hLast >= psSHP->nRecords || hFirst > hLast )
+    return;
+
+  nStart = msSHXReadOffset( psSHP, hFirst);
+  nEnd = msSHXReadOffset( psSHP, hLast) + msSHXReadSize( psSHP, hLast) + 8;
+  if( nStart > 0 && nEnd > nStart )
+    posix_fadvise( fileno(psSHP->fpSHP), nStart, nEnd - nStart, POSIX_FADV_WILLNEED );
+#endif
+}
+
 /*
 ** msSHPReadPoint() - Reads a single point from a POINT shape file.
 */
@@ -1084,14 +1194,8 @@ int msSHPReadPoint( SHPHandle psSHP, int hEntity, pointObj *point )
   /* -------------------------------------------------------------------- */
   /*      Read the record.                                                */
   /* -------------------------------------------------------------------- */
-  if( 0 != fseek( psSHP->fpSHP, msSHXReadOffset( psSHP, hEntity), 0 )) {
-    msSetError(MS_IOERR, "failed to seek offset", "msSHPReadPoint()");
+  if( msSHPReadRecord( psSHP, hEntity, nEntitySize, "msSHPReadPoint()") != MS_SUCCESS )
     return(MS_FAILURE);
-  }
-  if( 1 != fread( psSHP->pabyRec, nEntitySize, 1, psSHP->fpSHP )) {
-    msSetError(MS_IOERR, "failed to fread record", "msSHPReadPoint()");
-    return(MS_FAILURE);
-  }
 
 
   memcpy( &(point->x), psSHP->pabyRec + 12, 8 );
@@ -1237,6 +1341,81 @@ int msSHXReadSize( SHPHandle psSHP, int hEntity )
 
 }
 
+/************************************************************************/
+/*                      msSHPTakeLines/Points()                         */
+/*                                                                      */
+/*      Get a geometry buffer for msSHPReadShape(), reusing one given   */
+/*      back by msSHPRecycleShape() if possible. The returned memory    */
+/*      is plain malloc() memory owned by the shape.                    */
+/************************************************************************/
+static lineObj *msSHPTakeLines( SHPHandle psSHP, int nLines )
+{
+  lineObj *line = psSHP->pasSpareLines;
+
+  if( line ) {
+    psSHP->pasSpareLines = NULL;
+    if( psSHP->nSpareLineMax >= nLines ) {
+      psSHP->nBuffersReused++;
+      return line;
+    }
+    free( line );
+  }
+  psSHP->nBuffersAllocated++;
+  return (lineObj *) malloc( sizeof(lineObj) * nLines );
+}
+
+static pointObj *msSHPTakePoints( SHPHandle psSHP, int nPoints )
+{
+  if( psSHP->nSparePoints > 0 ) {
+    int n = --psSHP->nSparePoints;
+    if( psSHP->anSparePointMax[n] >= nPoints ) {
+      psSHP->nBuffersReused++;
+      return psSHP->papasSparePoints[n];
+    }
+    free( psSHP->papasSparePoints[n] );
+  }
+  psSHP->nBuffersAllocated++;
+  return (pointObj *) malloc( sizeof(pointObj) * nPoints );
+}
+
+/************************************************************************/
+/*                          msSHPRecycleShape()                         */
+/*                                                                      */
+/*      Free a shape read by msSHPReadShape(), keeping its geometry     */
+/*      buffers around for the next read. Only a shape whose line and   */
+/*      point arrays came from malloc() may be passed here.             */
+/************************************************************************/
+void msSHPRecycleShape( SHPHandle psSHP, shapeObj *shape )
+{
+  int i;
+
+  /* push in reverse order so that line[0] gets back the same buffer */
+  for( i = shape->numlines - 1; i >= 0; i-- ) {
+    if( psSHP->nSparePoints == MS_SHP_MAX_SPARE_POINTS )
+      break;
+    if( shape->line[i].point && shape->line[i].numpoints > 0 ) {
+      psSHP->papasSparePoints[psSHP->nSparePoints] = shape->line[i].point;
+      psSHP->anSparePointMax[psSHP->nSparePoints] = shape->line[i].numpoints;
+      psSHP->nSparePoints++;
+      shape->line[i].point = NULL;
+      shape->line[i].numpoints = 0;
+    }
+  }
+
+  /* keep the largest line array seen so far */
+  if( shape->line && (!psSHP->pasSpareLines || shape->numlines > psSHP->nSpareLineMax) ) {
+    for( i = 0; i < shape->numlines; i++ )
+      free( shape->line[i].point );
+    free( psSHP->pasSpareLines );
+    psSHP->pasSpareLines = shape->line;
+    psSHP->nSpareLineMax = shape->numlines;
+    shape->line = NULL;
+    shape->numlines = 0;
+  }
+
+  msFreeShape( shape );
+}
+
 /*
 ** msSHPReadShape() - Reads the vertices for one shape from a shape file.
 */
@@ -1270,13 +1449,7 @@ void msSHPReadShape( SHPHandle psSHP, int hEntity, shapeObj *shape )
   /* -------------------------------------------------------------------- */
   /*      Read the record.                                                */
   /* -------------------------------------------------------------------- */
-  if( 0 != fseek( psSHP->fpSHP, msSHXReadOffset( psSHP, hEntity), 0 )) {
-    msSetError(MS_IOERR, "failed to seek offset", "msSHPReadShape()");
-    shape->type = MS_SHAPE_NULL;
-    return;
-  }
-  if( 1 != fread( psSHP->pabyRec, nEntitySize, 1, psSHP->fpSHP )) {
-    msSetError(MS_IOERR, "failed to fread record", "msSHPReadPoint()");
+  if( msSHPReadRecord( psSHP, hEntity, nEntitySize, "msSHPReadShape()") != MS_SUCCESS ) {
     shape->type = MS_SHAPE_NULL;
     return;
   }
@@ -1367,7 +1540,7 @@ void msSHPReadShape( SHPHandle psSHP, int hEntity, shapeObj *shape )
     /* -------------------------------------------------------------------- */
     /*      Fill the shape structure.                                       */
     /* -------------------------------------------------------------------- */
-    shape->line = (lineObj *)malloc(sizeof(lineObj)*nParts);
+    shape->line = msSHPTakeLines(psSHP, nParts);
     MS_CHECK_ALLOC_NO_RET(shape->line, sizeof(lineObj)*nParts);
 
     shape->numlines = nParts;
@@ -1390,7 +1563,7 @@ void msSHPReadShape( SHPHandle psSHP, int hEntity, shapeObj *shape )
         return;
       }
 
-      if( (shape->line[i].point = (pointObj *)malloc(sizeof(pointObj)*shape->line[i].numpoints)) == NULL ) {
+      if( (shape->line[i].point = msSHPTakePoints(psSHP, shape->line[i].numpoints)) == NULL ) {
         while(--i >= 0)
           free(shape->line[i].point);
         free(shape->line);
@@ -1481,7 +1654,7 @@ void msSHPReadShape( SHPHandle psSHP, int hEntity, shapeObj *shape )
     /* -------------------------------------------------------------------- */
     /*      Fill the shape structure.                                       */
     /* -------------------------------------------------------------------- */
-    if( (shape->line = (lineObj *)malloc(sizeof(lineObj))) == NULL ) {
+    if( (shape->line = msSHPTakeLines(psSHP, 1)) == NULL ) {
       shape->type = MS_SHAPE_NULL;
       msSetError(MS_MEMERR, "Out of memory", "msSHPReadShape()");
       return;
@@ -1508,7 +1681,7 @@ void msSHPReadShape( SHPHandle psSHP, int hEntity, shapeObj *shape )
 
     shape->numlines = 1;
     shape->line[0].numpoints = nPoints;
-    shape->line[0].point = (pointObj *) malloc( nPoints * sizeof(pointObj) );
+    shape->line[0].point = msSHPTakePoints(psSHP, nPoints);
     if (shape->line[0].point == NULL) {
       free(shape->line);
       shape->numlines = 0;
@@ -1568,12 +1741,20 @@ void msSHPReadShape( SHPHandle psSHP, int hEntity, shapeObj *shape )
     /* -------------------------------------------------------------------- */
     /*      Fill the shape structure.                                       */
     /* -------------------------------------------------------------------- */
-    shape->line = (lineObj *)malloc(sizeof(lineObj));
+    shape->line = msSHPTakeLines(psSHP, 1);
     MS_CHECK_ALLOC_NO_RET(shape->line, sizeof(lineObj));
 
     shape->numlines = 1;
     shape->line[0].numpoints = 1;
-    shape->line[0].point = (pointObj *) msSmallMalloc(sizeof(pointObj));
+    shape->line[0].point = msSHPTakePoints(psSHP, 1);
+    if( shape->line[0].point == NULL ) {
+      free(shape->line);
+      shape->line = NULL;
+      shape->numlines = 0;
+      shape->type = MS_SHAPE_NULL;
+      msSetError(MS_MEMERR, "Out of memory", "msSHPReadShape()");
+      return;
+    }
 
     memcpy( &(shape->line[0].point[0].x), psSHP->pabyRec + 12, 8 );
     memcpy( &(shape->line[0].point[0].y), psSHP->pabyRec + 20, 8 );
@@ -1711,6 +1892,12 @@ int msShapefileOpen(shapefileObj *shpfile, const char *mode, const char *filenam
   shpfile->status = NULL;
   shpfile->lastshape = -1;
   shpfile->isopen = MS_FALSE;
+  shpfile->numlods = 0;
+  shpfile->lodtolerances = NULL;
+  shpfile->lodfiles = NULL;
+  shpfile->lod = -1;
+  shpfile->hLOD = NULL;
+  shpfile->prefetch = MS_FALSE;
 
   /* open the shapefile file (appending ok) and get basic info */
   if(!mode)
@@ -1787,6 +1974,12 @@ int msShapefileCreate(shapefileObj *shpfile, char *filename, int type)
   shpfile->status = NULL;
   shpfile->lastshape = -1;
   shpfile->isopen = MS_TRUE;
+  shpfile->numlods = 0;
+  shpfile->lodtolerances = NULL;
+  shpfile->lodfiles = NULL;
+  shpfile->lod = -1;
+  shpfile->hLOD = NULL;
+  shpfile->prefetch = MS_FALSE;
 
   shpfile->hDBF = NULL; /* XBase file is NOT created here... */
   return(0);
@@ -1797,11 +1990,110 @@ void msShapefileClose(shapefileObj *shpfile)
   if (shpfile && shpfile->isopen == MS_TRUE) { /* Silently return if called with NULL shpfile by freeLayer() */
     if(shpfile->hSHP) msSHPClose(shpfile->hSHP);
     if(shpfile->hDBF) msDBFClose(shpfile->hDBF);
+    if(shpfile->hLOD) msSHPClose(shpfile->hLOD);
     free(shpfile->status);
+    msFreeCharArray(shpfile->lodfiles, shpfile->numlods);
+    free(shpfile->lodtolerances);
+    shpfile->numlods = 0;
     shpfile->isopen = MS_FALSE;
   }
 }
 
+/*
+** Read the level of detail index (<basename>.lod) written by shpgeneralize
+** if there is one. Each line holds a tolerance in shapefile units and the
+** basename of the generalized shapefile, relative to the directory of the
+** source shapefile. Levels are kept sorted by increasing tolerance.
+*/
+int msShapefileOpenLODs(shapefileObj *shpfile)
+{
+  char path[MS_MAXPATHLEN], line[MS_MAXPATHLEN+64], name[MS_MAXPATHLEN];
+  char *dir;
+  double tolerance;
+  FILE *stream;
+  int i, j;
+
+  strlcpy(path, shpfile->source, sizeof(path));
+  for(i = strlen(path) - 1; i > 0 && path[i] != '.' && path[i] != '/' && path[i] != '\\'; i--) {}
+  if(path[i] == '.')
+    path[i] = '\0';
+  strlcat(path, ".lod", sizeof(path));
+
+  stream = fopen(path, "r");
+  if(!stream)
+    return MS_SUCCESS; /* no levels, not an error */
+
+  dir = msGetPath(shpfile->source);
+
+  while(fgets(line, sizeof(line), stream)) {
+    if(line[0] == '#' || sscanf(line, "%lf %s", &tolerance, name) != 2 || tolerance <= 0)
+      continue;
+
+    shpfile->lodtolerances = (double *) msSmallRealloc(shpfile->lodtolerances, sizeof(double)*(shpfile->numlods+1));
+    shpfile->lodfiles = (char **) msSmallRealloc(shpfile->lodfiles, sizeof(char *)*(shpfile->numlods+1));
+
+    /* insertion sort, there are only ever a handful of levels */
+    for(j = shpfile->numlods; j > 0 && shpfile->lodtolerances[j-1] > tolerance; j--) {
+      shpfile->lodtolerances[j] = shpfile->lodtolerances[j-1];
+      shpfile->lodfiles[j] = shpfile->lodfiles[j-1];
+    }
+    shpfile->lodtolerances[j] = tolerance;
+    shpfile->lodfiles[j] = msStrdup(msBuildPath(path, dir, name));
+    shpfile->numlods++;
+  }
+
+  fclose(stream);
+  free(dir);
+
+  return MS_SUCCESS;
+}
+
+/*
+** Switch reads to the coarsest level of detail whose tolerance does not
+** exceed the given one, or back to the full resolution shapefile when there
+** is none (a tolerance of 0 always selects full resolution). A level whose
+** record count doesn't match the source is unusable since record numbers
+** are shared with the .dbf and .qix files, and is ignored.
+*/
+void msShapefileSelectLOD(shapefileObj *shpfile, double tolerance, int debug)
+{
+  int i, lod = -1;
+
+  for(i = 0; i < shpfile->numlods; i++) {
+    if(shpfile->lodtolerances[i] <= tolerance)
+      lod = i;
+  }
+
+  if(lod == shpfile->lod)
+    return;
+
+  if(shpfile->hLOD) {
+    msSHPClose(shpfile->hLOD);
+    shpfile->hLOD = NULL;
+  }
+  shpfile->lod = -1;
+
+  while(lod >= 0) {
+    int numshapes = 0, type = 0;
+
+    shpfile->hLOD = msSHPOpen(shpfile->lodfiles[lod], "rb");
+    if(shpfile->hLOD) {
+      msSHPGetInfo(shpfile->hLOD, &numshapes, &type);
+      if(numshapes == shpfile->numshapes && type == shpfile->type)
+        break;
+      msSHPClose(shpfile->hLOD);
+      shpfile->hLOD = NULL;
+    }
+    if(debug)
+      msDebug("msShapefileSelectLOD(): ignoring level %s, missing or not matching %s.\n", shpfile->lodfiles[lod], shpfile->source);
+    lod--;
+  }
+
+  shpfile->lod = lod;
+  if(debug >= MS_DEBUGLEVEL_V)
+    msDebug("msShapefileSelectLOD(): tolerance %g, reading %s.\n", tolerance, lod >= 0 ? shpfile->lodfiles[lod] : shpfile->source);
+}
+
 /* status array lives in the shpfile, can return MS_SUCCESS/MS_FAILURE/MS_DONE */
 int msShapefileWhichShapes(shapefileObj *shpfile, rectObj rect, int debug)
 {
@@ -2590,7 +2882,13 @@ int msSHPLayerOpen(layerObj *layer)
       return MS_FAILURE;
     }
   }
-  
+
+  if(!msLayerGetProcessingKey(layer, "SHAPEFILE_LOD") || atof(msLayerGetProcessingKey(layer, "SHAPEFILE_LOD")) > 0)
+    msShapefileOpenLODs(shpfile);
+
+  if(msLayerGetProcessingKey(layer, "SHAPEFILE_PREFETCH") && strcasecmp(msLayerGetProcessingKey(layer, "SHAPEFILE_PREFETCH"), "ON") == 0)
+    shpfile->prefetch = MS_TRUE;
+
   if (layer->projection.numargs > 0 &&
       EQUAL(layer->projection.args[0], "auto"))
   {
@@ -2663,6 +2961,24 @@ int msSHPLayerWhichShapes(layerObj *layer, rectObj rect, int isQuery)
     return MS_FAILURE;
   }
 
+  /*
+  ** Generalized levels are only used for drawing. The tolerance is the
+  ** allowed error in pixels (PROCESSING "SHAPEFILE_LOD", 0.5 by default)
+  ** converted to layer units, which is approximate for reprojected layers.
+  */
+  if(shpfile->numlods > 0) {
+    double tolerance = 0.0;
+    if(!isQuery && layer->map->width > 0) {
+      const char *value = msLayerGetProcessingKey(layer, "SHAPEFILE_LOD");
+      double pixels = value ? atof(value) : 0.5;
+      if(layer->project)
+        tolerance = pixels * (rect.maxx - rect.minx) / layer->map->width;
+      else
+        tolerance = pixels * layer->map->cellsize;
+    }
+    msShapefileSelectLOD(shpfile, tolerance, layer->debug);
+  }
+
   status = msShapefileWhichShapes(shpfile, rect, layer->debug);
   if(status != MS_SUCCESS) {
     return status;
@@ -2671,6 +2987,52 @@ int msSHPLayerWhichShapes(layerObj *layer, rectObj rect, int isQuery)
   return MS_SUCCESS;
 }
 
+/*
+** Find the run of wanted records starting at i that can be read at once:
+** records stored one after the other, joined across small gaps of records
+** that aren't wanted since reading a few extra bytes is cheaper than
+** another seek. Returns the last record of the run, *next is set to the
+** first wanted record after it (-1 if none).
+*/
+static int msSHPLayerFindRun(SHPHandle hSHP, ms_bitarray status, int numshapes, int i, int *next)
+{
+  int last = i;
+  int start = msSHXReadOffset(hSHP, i);
+  int end = start + msSHXReadSize(hSHP, i) + 8;
+
+  while((*next = msGetNextBit(status, last + 1, numshapes)) != -1) {
+    int offset = msSHXReadOffset(hSHP, *next);
+    int size = msSHXReadSize(hSHP, *next) + 8;
+    if(offset < end || offset - end > MS_SHP_READ_GAP || offset + size - start > MS_SHP_READ_WINDOW)
+      break;
+    last = *next;
+    end = offset + size;
+  }
+
+  return last;
+}
+
+/*
+** Make sure record i is read as part of a batch and, with prefetch on,
+** hint at the batch after that one so the OS can fetch it while this one
+** is being drawn. The hint costs a system call per batch, which only pays
+** off when the data isn't in the page cache already (slow or network
+** storage).
+*/
+static void msSHPLayerReadAhead(SHPHandle hSHP, ms_bitarray status, int numshapes, int i, int prefetch)
+{
+  int last, next;
+
+  if(hSHP->nWindowLength > 0 && i >= hSHP->nWindowFirst && i <= hSHP->nWindowLast)
+    return;
+
+  last = msSHPLayerFindRun(hSHP, status, numshapes, i, &next);
+  if(last > i)
+    msSHPReadRange(hSHP, i, last);
+  if(prefetch && next != -1)
+    msSHPAdviseRange(hSHP, next, msSHPLayerFindRun(hSHP, status, numshapes, next, &last));
+}
+
 int msSHPLayerNextShape(layerObj *layer, shapeObj *shape)
 {
   int i;
@@ -2683,15 +3045,17 @@ int msSHPLayerNextShape(layerObj *layer, shapeObj *shape)
     return MS_FAILURE;
   }
 
-  i = msGetNextBit(shpfile->status, shpfile->lastshape + 1, shpfile->numshapes);
-  shpfile->lastshape = i;
-  if(i == -1) return(MS_DONE); /* nothing else to read */
+  /* skip NULL shapes, generalized levels can hold long runs of them (dropped features) */
+  do {
+    i = msGetNextBit(shpfile->status, shpfile->lastshape + 1, shpfile->numshapes);
+    shpfile->lastshape = i;
+    if(i == -1) return(MS_DONE); /* nothing else to read */
 
-  msSHPReadShape(shpfile->hSHP, i, shape);
-  if(shape->type == MS_SHAPE_NULL) {
-    msFreeShape(shape);
-    return msSHPLayerNextShape(layer, shape); /* skip NULL shapes */
-  }
+    msSHPLayerReadAhead(shpfile->hLOD ? shpfile->hLOD : shpfile->hSHP, shpfile->status, shpfile->numshapes, i, shpfile->prefetch);
+    msSHPReadShape(shpfile->hLOD ? shpfile->hLOD : shpfile->hSHP, i, shape);
+    if(shape->type == MS_SHAPE_NULL)
+      msFreeShape(shape);
+  } while(shape->type == MS_SHAPE_NULL);
   shape->numvalues = layer->numitems;
   shape->values = msDBFGetValueList(shpfile->hDBF, i, layer->iteminfo, layer->numitems);
   if(!shape->values) shape->numvalues = 0;
@@ -2731,12 +3095,37 @@ int msSHPLayerGetShape(layerObj *layer, shapeObj *shape, resultObj *record)
   return MS_SUCCESS;
 }
 
+void msSHPLayerRecycleShape(layerObj *layer, shapeObj *shape)
+{
+  shapefileObj *shpfile = layer->layerinfo;
+
+  if(!shpfile || !shpfile->hSHP) {
+    msFreeShape(shape);
+    return;
+  }
+  msSHPRecycleShape(shpfile->hLOD ? shpfile->hLOD : shpfile->hSHP, shape);
+}
+
 int msSHPLayerClose(layerObj *layer)
 {
   shapefileObj *shpfile;
   shpfile = layer->layerinfo;
   if(!shpfile) return MS_SUCCESS; /* nothing to do */
 
+  if(shpfile->hSHP && (layer->debug >= MS_DEBUGLEVEL_TUNING ||
+                       (layer->map && layer->map->debug >= MS_DEBUGLEVEL_TUNING))) {
+    int allocated = shpfile->hSHP->nBuffersAllocated, reused = shpfile->hSHP->nBuffersReused;
+    int batches = shpfile->hSHP->nWindowReads, batched = shpfile->hSHP->nWindowRecords;
+    if(shpfile->hLOD) {
+      allocated += shpfile->hLOD->nBuffersAllocated;
+      reused += shpfile->hLOD->nBuffersReused;
+      batches += shpfile->hLOD->nWindowReads;
+      batched += shpfile->hLOD->nWindowRecords;
+    }
+    msDebug("msSHPLayerClose(%s): %d geometry buffers allocated, %d reused, %d records read in %d batches.\n",
+            layer->name, allocated, reused, batched, batches);
+  }
+
   msShapefileClose(shpfile);
   free(layer->layerinfo);
   layer->layerinfo = NULL;
@@ -2797,6 +3186,7 @@ int msSHPLayerInitializeVirtualTable(layerObj *layer)
   layer->vtable->LayerGetShape = msSHPLayerGetShape;
   /* layer->vtable->LayerGetShapeCount, use default */
   layer->vtable->LayerClose = msSHPLayerClose;
+  layer->vtable->LayerRecycleShape = msSHPLayerRecycleShape;
   layer->vtable->LayerGetItems = msSHPLayerGetItems;
   layer->vtable->LayerGetExtent = msSHPLayerGetExtent;
   /* layer->vtable->LayerGetAutoStyle, use default */
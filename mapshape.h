@@ -74,6 +74,10 @@ extern "C" {
 #define MS_SHP_POLYGONM 25
 #define MS_SHP_MULTIPOINTM 28
 
+#define MS_SHP_MAX_SPARE_POINTS 64 /* point buffers kept for reuse per SHPHandle */
+#define MS_SHP_READ_WINDOW 1048576 /* largest batch of records read at once by msSHPReadRange() */
+#define MS_SHP_READ_GAP 4096 /* bytes of unwanted records worth reading to join two batches */
+
 #ifndef SWIG
   typedef unsigned char uchar;
 
@@ -102,6 +106,25 @@ extern "C" {
     int   nPartMax;
     int   *panParts;
 
+    /* geometry buffers handed back by msSHPRecycleShape() for reuse */
+    lineObj *pasSpareLines;
+    int   nSpareLineMax;
+    pointObj *papasSparePoints[MS_SHP_MAX_SPARE_POINTS];
+    int   anSparePointMax[MS_SHP_MAX_SPARE_POINTS];
+    int   nSparePoints;
+    int   nBuffersReused; /* statistics, reported at debug level on close */
+    int   nBuffersAllocated;
+
+    /* a range of records read in one go by msSHPReadRange() */
+    uchar *pabyWindow;
+    int   nWindowSize; /* allocated */
+    int   nWindowOffset; /* file offset of pabyWindow[0] */
+    int   nWindowLength; /* valid bytes, 0 when empty */
+    int   nWindowFirst; /* records held */
+    int   nWindowLast;
+    int   nWindowReads; /* statistics, reported at debug level on close */
+    int   nWindowRecords;
+
   } SHPInfo;
   typedef SHPInfo * SHPHandle;
 #endif
@@ -168,6 +191,17 @@ extern "C" {
     rectObj statusbounds; /* holds extent associated with the status vector */
 
     int isopen;
+
+#ifndef SWIG
+    /* generalized levels of detail written by shpgeneralize */
+    int numlods;
+    double *lodtolerances; /* ascending, in shapefile units */
+    char **lodfiles;
+    int lod; /* level opened in hLOD, -1 if none */
+    SHPHandle hLOD;
+
+    int prefetch; /* hint the OS about upcoming reads, PROCESSING "SHAPEFILE_PREFETCH" */
+#endif
 #ifdef SWIG
     %mutable;
 #endif
@@ -186,6 +220,8 @@ extern "C" {
   MS_DLL_EXPORT int msShapefileCreate(shapefileObj *shpfile, char *filename, int type);
   MS_DLL_EXPORT void msShapefileClose(shapefileObj *shpfile);
   MS_DLL_EXPORT int msShapefileWhichShapes(shapefileObj *shpfile, rectObj rect, int debug);
+  MS_DLL_EXPORT int msShapefileOpenLODs(shapefileObj *shpfile);
+  MS_DLL_EXPORT void msShapefileSelectLOD(shapefileObj *shpfile, double tolerance, int debug);
 
   /* SHP/SHX function prototypes */
   MS_DLL_EXPORT SHPHandle msSHPOpen( const char * pszShapeFile, const char * pszAccess );
@@ -194,6 +230,9 @@ extern "C" {
   MS_DLL_EXPORT void msSHPGetInfo( SHPHandle hSHP, int * pnEntities, int * pnShapeType );
   MS_DLL_EXPORT int msSHPReadBounds( SHPHandle psSHP, int hEntity, rectObj *padBounds );
   MS_DLL_EXPORT void msSHPReadShape( SHPHandle psSHP, int hEntity, shapeObj *shape );
+  MS_DLL_EXPORT int msSHPReadRange( SHPHandle psSHP, int hFirst, int hLast );
+  MS_DLL_EXPORT void msSHPAdviseRange( SHPHandle psSHP, int hFirst, int hLast );
+  MS_DLL_EXPORT void msSHPRecycleShape( SHPHandle psSHP, shapeObj *shape );
   MS_DLL_EXPORT int msSHPReadPoint(SHPHandle psSHP, int hEntity, pointObj *point );
   MS_DLL_EXPORT int msSHPWriteShape( SHPHandle psSHP, shapeObj *shape );
   MS_DLL_EXPORT int msSHPWritePoint(SHPHandle psSHP, pointObj *point );
@@ -41,12 +41,12 @@
 
 extern int msyylex(void); /* lexer globals */
 extern void msyyrestart(FILE *);
-extern double msyynumber;
-extern char *msyystring_buffer;
-extern int msyylineno;
-extern FILE *msyyin;
+extern MS_THREAD_LOCAL double msyynumber;
+extern MS_THREAD_LOCAL char *msyystring_buffer;
+extern MS_THREAD_LOCAL int msyylineno;
+extern MS_THREAD_LOCAL FILE *msyyin;
 
-extern int msyystate;
+extern MS_THREAD_LOCAL int msyystate;
 
 static const unsigned char PNGsig[8] = {137, 80, 78, 71, 13, 10, 26, 10}; /* 89 50 4E 47 0D 0A 1A 0A hex */
 static const unsigned char JPEGsig[3] = {255, 216, 255}; /* FF D8 FF hex */
@@ -530,21 +530,16 @@ symbolObj *msGrowSymbolSet( symbolSetObj *symbolset )
 /* ---------------------------------------------------------------------------
    msLoadSymbolSet and loadSymbolSet
 
-   msLoadSymbolSet wraps calls to loadSymbolSet with mutex acquisition and
-   release.  It should be used everywhere outside the mapfile loading
-   phase of an application.  loadSymbolSet should only be used when a mutex
-   exists.  It does not check for existence of a mutex!
-
-   See bug 339 for more details -- SG.
+   msLoadSymbolSet used to wrap loadSymbolSet with the parser mutex (bug
+   339).  The lexer state is now thread local so no lock is needed, it is
+   kept as the public entry point outside the mapfile loading phase.
    ------------------------------------------------------------------------ */
 
 int msLoadSymbolSet(symbolSetObj *symbolset, mapObj *map)
 {
   int retval = MS_FAILURE;
 
-  msAcquireLock( TLOCK_PARSER );
   retval = loadSymbolSet( symbolset, map );
-  msReleaseLock( TLOCK_PARSER );
 
   return retval;
 }
@@ -144,7 +144,7 @@ static int thread_debug = 0;
 
 static char *lock_names[] = {
   NULL, "PARSER", "GDAL", "ERROROBJ", "PROJ", "TTF", "POOL", "SDE",
-  "ORACLE", "OWS", "LAYER_VTABLE", "IOCONTEXT", "TMPFILE", "DEBUGOBJ", "OGR", "TIME", "FRIBIDI", "WXS", "GEOS", NULL
+  "ORACLE", "OWS", "LAYER_VTABLE", "IOCONTEXT", "TMPFILE", "DEBUGOBJ", "OGR", "TIME", "FRIBIDI", "WXS", "GEOS", "POSTGIS", "JOIN", "CLUSTER", "LAYERCACHE", "CONTOUR", "LEGENDCACHE", "GRATICULE", NULL
 };
 #endif
 
@@ -160,6 +160,8 @@ static char *lock_names[] = {
 
 static int mutexes_initialized = 0;
 static pthread_mutex_t mutex_locks[TLOCK_MAX];
+static pthread_key_t lexer_key;
+static pthread_once_t lexer_key_once = PTHREAD_ONCE_INIT;
 
 /************************************************************************/
 /*                            msThreadInit()                            */
@@ -227,6 +229,35 @@ void msReleaseLock( int nLockId )
   pthread_mutex_unlock( mutex_locks + nLockId );
 }
 
+/************************************************************************/
+/*                        msThreadRegisterLexer()                       */
+/*                                                                      */
+/*      Called by the lexer when it allocates its per-thread buffers.   */
+/*      Arranges for msLexerCleanup() to run when the thread exits so   */
+/*      threads that never call msCleanup() don't leak them.            */
+/************************************************************************/
+
+static void msLexerThreadExit( void *unused )
+
+{
+  (void) unused;
+  msLexerCleanup();
+}
+
+static void msLexerKeyCreate( void )
+
+{
+  pthread_key_create( &lexer_key, msLexerThreadExit );
+}
+
+void msThreadRegisterLexer()
+
+{
+  pthread_once( &lexer_key_once, msLexerKeyCreate );
+  if( pthread_getspecific( lexer_key ) == NULL )
+    pthread_setspecific( lexer_key, (void *) 1 );
+}
+
 #endif /* defined(USE_THREAD) && !defined(_WIN32) */
 
 /************************************************************************/
@@ -241,6 +272,7 @@ void msReleaseLock( int nLockId )
 
 static int mutexes_initialized = 0;
 static HANDLE mutex_locks[TLOCK_MAX];
+static DWORD lexer_fls = FLS_OUT_OF_INDEXES;
 
 /************************************************************************/
 /*                            msThreadInit()                            */
@@ -315,4 +347,28 @@ void msReleaseLock( int nLockId )
   ReleaseMutex( mutex_locks[nLockId] );
 }
 
+/************************************************************************/
+/*                        msThreadRegisterLexer()                       */
+/************************************************************************/
+
+static void WINAPI msLexerThreadExit( void *unused )
+
+{
+  (void) unused;
+  msLexerCleanup();
+}
+
+void msThreadRegisterLexer()
+
+{
+  if( lexer_fls == FLS_OUT_OF_INDEXES ) {
+    msAcquireLock( TLOCK_PARSER );
+    if( lexer_fls == FLS_OUT_OF_INDEXES )
+      lexer_fls = FlsAlloc( msLexerThreadExit );
+    msReleaseLock( TLOCK_PARSER );
+  }
+  if( lexer_fls != FLS_OUT_OF_INDEXES && FlsGetValue( lexer_fls ) == NULL )
+    FlsSetValue( lexer_fls, (void *) 1 );
+}
+
 #endif /* defined(USE_THREAD) && defined(_WIN32) */
@@ -39,11 +39,28 @@ extern "C" {
   void* msGetThreadId(void);
   void msAcquireLock(int);
   void msReleaseLock(int);
+  void msThreadRegisterLexer(void);
 #else
 #define msThreadInit()
 #define msGetThreadId() (0)
 #define msAcquireLock(x)
 #define msReleaseLock(x)
+#define msThreadRegisterLexer()
+#endif
+
+  /*
+  ** Storage class for per-thread state, such as the mapfile lexer's, that
+  ** would otherwise need a global lock. This is the compiler's default TLS
+  ** model since libmapserver is dlopen()ed by mapscript and the Apache
+  ** module. Heap memory hung off such variables is not freed when a thread
+  ** exits unless it is registered, see msThreadRegisterLexer().
+  */
+#if defined(USE_THREAD) && defined(_MSC_VER)
+#define MS_THREAD_LOCAL __declspec(thread)
+#elif defined(USE_THREAD)
+#define MS_THREAD_LOCAL __thread
+#else
+#define MS_THREAD_LOCAL
 #endif
 
   /*
@@ -51,7 +68,7 @@ extern "C" {
   ** mapthread.c that needs to be extended when new ids are added.
   */
 
-#define TLOCK_PARSER  1
+#define TLOCK_PARSER  1 /* only guards the win32 lexer exit hook setup */
 #define TLOCK_GDAL  2
 #define TLOCK_ERROROBJ  3
 #define TLOCK_PROJ      4
@@ -69,8 +86,15 @@ extern "C" {
 #define TLOCK_FRIBIDI   16
 #define TLOCK_WxS       17
 #define TLOCK_GEOS       18
-
-#define TLOCK_STATIC_MAX 20
+#define TLOCK_POSTGIS   19
+#define TLOCK_JOIN      20
+#define TLOCK_CLUSTER   21
+#define TLOCK_LAYERCACHE 22
+#define TLOCK_CONTOUR   23
+#define TLOCK_LEGENDCACHE 24
+#define TLOCK_GRATICULE 25
+
+#define TLOCK_STATIC_MAX 26
 #define TLOCK_MAX       100
 
 #ifdef __cplusplus
@@ -114,6 +114,12 @@ static void msTileGetParams(mapObj *map, tileParams *params)
   } else
     params->metatile_level = 0;
 
+  /* vector tiles carry their own edge buffer and are never metatiled */
+  if( map->outputformat && MS_RENDERER_MVT(map->outputformat) ) {
+    params->metatile_level = 0;
+    params->map_edge_buffer = 0;
+  }
+
 }
 
 /************************************************************************
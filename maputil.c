@@ -55,7 +55,7 @@
 #endif
 
 
-extern char *msyystring_buffer;
+extern MS_THREAD_LOCAL char *msyystring_buffer;
 extern int msyylex_destroy(void);
 extern int yyparse(parseObj *);
 
@@ -831,10 +831,12 @@ int msSaveImage(mapObj *map, imageObj *img, char *filename)
   int nReturnVal = MS_FAILURE;
   char szPath[MS_MAXPATHLEN];
   struct mstimeval starttime, endtime;
+  int span;
 
   if(map && map->debug >= MS_DEBUGLEVEL_TUNING) {
     msGettimeofday(&starttime, NULL);
   }
+  span = MS_TRACE_BEGIN(MS_TRACE_ENCODE, filename);
 
   if (img) {
 #ifdef USE_GDAL
@@ -892,6 +894,8 @@ int msSaveImage(mapObj *map, imageObj *img, char *filename)
                    "msSaveImage()");
   }
 
+  MS_TRACE_END(span);
+
   if(map && map->debug >= MS_DEBUGLEVEL_TUNING) {
     msGettimeofday(&endtime, NULL);
     msDebug("msSaveImage(%s) total time: %.3fs\n",
@@ -922,12 +926,15 @@ unsigned char *msSaveImageBuffer(imageObj* image, int *size_ptr, outputFormatObj
     rendererVTableObj *renderer = image->format->vtable;
     if(renderer->supports_pixel_buffer) {
       bufferObj buffer;
+      int span;
       msBufferInit(&buffer);
       status = renderer->getRasterBufferHandle(image,&data);
       if(UNLIKELY(status == MS_FAILURE)) {
         return NULL;
       }
+      span = MS_TRACE_BEGIN(MS_TRACE_ENCODE, NULL);
       msSaveRasterBufferToBuffer(&data,&buffer,format);
+      MS_TRACE_END(span);
       *size_ptr = buffer.size;
       return buffer.data;
       /* don't free the bufferObj as we don't own the bytes anymore */
@@ -1919,6 +1926,20 @@ int msSetup()
   return MS_SUCCESS;
 }
 
+/*
+** Frees the calling thread's lexer buffers. Also run at thread exit, see
+** msThreadRegisterLexer().
+*/
+void msLexerCleanup()
+{
+  /* Lexer string parsing variable */
+  if (msyystring_buffer != NULL) {
+    msFree(msyystring_buffer);
+    msyystring_buffer = NULL;
+  }
+  msyylex_destroy();
+}
+
 /* This is intended to be a function to cleanup anything that "hangs around"
    when all maps are destroyed, like Registered GDAL drivers, and so forth. */
 #ifndef NDEBUG
@@ -1930,12 +1951,13 @@ void msCleanup()
 {
   msForceTmpFileBase( NULL );
   msConnPoolFinalCleanup();
-  /* Lexer string parsing variable */
-  if (msyystring_buffer != NULL) {
-    msFree(msyystring_buffer);
-    msyystring_buffer = NULL;
-  }
-  msyylex_destroy();
+  msJoinCleanup();
+  msClusterCleanup();
+  msLayerCacheCleanup();
+  msLegendCacheCleanup();
+  msContourCleanup();
+  msGraticuleCleanup();
+  msLexerCleanup();
 
 #ifdef USE_OGR
   msOGRCleanup();
@@ -2226,6 +2248,25 @@ void msFreeRasterBuffer(rasterBufferObj *b)
 
 }
 
+/*
+** Make view refer to the width x height block of the RGBA buffer rb starting
+** at x,y. The pixels are shared with rb, so view must never be freed nor
+** passed to msCopyRasterBuffer().
+*/
+void msRasterBufferWindow(rasterBufferObj *rb, rasterBufferObj *view, int x, int y, int width, int height)
+{
+  int offset = y*rb->data.rgba.row_step + x*rb->data.rgba.pixel_step;
+  *view = *rb;
+  view->width = width;
+  view->height = height;
+  view->data.rgba.pixels += offset;
+  view->data.rgba.r += offset;
+  view->data.rgba.g += offset;
+  view->data.rgba.b += offset;
+  if(view->data.rgba.a)
+    view->data.rgba.a += offset;
+}
+
 /*
 ** Issue #3043: Layer extent comparison short circuit.
 **
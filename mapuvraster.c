@@ -76,10 +76,14 @@ typedef struct {
 
   /* double   shape_tolerance; */
 
-  float **u; /* u values */
-  float **v; /* v values */
+  float *u; /* u values, column after column */
+  float *v; /* v values */
   int width;
   int height;
+  int *cells; /* index in u/v of the non null vectors, in shape order */
+  double *angle; /* per non null vector, computed in msUVRASTERLayerWhichShapes() */
+  float *length; /* when the layer items use them */
+  float size_scale;
   rectObj extent;
   int     next_shape;
   int x, y; /* used internally in msUVRasterLayerNextShape() */
@@ -177,28 +181,28 @@ static void msUVRasterLayerInfoInitialize(layerObj *layer)
   /* } */
 }
 
+static void msUVRasterLayerInfoFreeValues( uvRasterLayerInfo *uvlinfo )
+{
+  msFree(uvlinfo->u);
+  msFree(uvlinfo->v);
+  msFree(uvlinfo->cells);
+  msFree(uvlinfo->angle);
+  msFree(uvlinfo->length);
+  uvlinfo->u = uvlinfo->v = NULL;
+  uvlinfo->cells = NULL;
+  uvlinfo->angle = NULL;
+  uvlinfo->length = NULL;
+}
+
 static void msUVRasterLayerInfoFree( layerObj *layer )
 
 {
   uvRasterLayerInfo *uvlinfo = (uvRasterLayerInfo *) layer->layerinfo;
-  int i;
 
   if( uvlinfo == NULL )
     return;
 
-  if (uvlinfo->u) {
-    for (i=0; i<uvlinfo->width; ++i) {
-      free(uvlinfo->u[i]);
-    }
-    free(uvlinfo->u);
-  }
-
-  if (uvlinfo->v) {
-    for (i=0; i<uvlinfo->width; ++i) {
-      free(uvlinfo->v[i]);
-    }
-    free(uvlinfo->v);
-  }
+  msUVRasterLayerInfoFreeValues( uvlinfo );
 
   free( uvlinfo );
 
@@ -266,14 +270,18 @@ int msUVRASTERLayerGetItems(layerObj *layer)
  *                     msUVRASTERGetValues()
  *
  * Special attribute names are used to return some UV params: uv_angle,
- * uv_length, u and v.
+ * uv_length, u and v. Only the items of the layer are formatted, angle and
+ * length come from the arrays filled by msUVRASTERLayerWhichShapes().
  **********************************************************************/
-static char **msUVRASTERGetValues(layerObj *layer, float *u, float *v)
+static char **msUVRASTERGetValues(layerObj *layer, int index)
 {
+  uvRasterLayerInfo *uvlinfo = (uvRasterLayerInfo *) layer->layerinfo;
   char **values;
   int i = 0;
   char tmp[100];
-  float size_scale;
+  float *u = &uvlinfo->u[uvlinfo->cells[index]];
+  float *v = &uvlinfo->v[uvlinfo->cells[index]];
+  double angle;
   int *itemindexes = (int*)layer->iteminfo;
 
   if(layer->numitems == 0)
@@ -290,29 +298,23 @@ static char **msUVRASTERGetValues(layerObj *layer, float *u, float *v)
     return(NULL);
   }
 
-  /* -------------------------------------------------------------------- */
-  /*    Determine desired size_scale.  Default to 1 if not otherwise set  */
-  /* -------------------------------------------------------------------- */
-  size_scale = 1;
-  if( CSLFetchNameValue( layer->processing, "UV_SIZE_SCALE" ) != NULL ) {
-    size_scale =
-      atof(CSLFetchNameValue( layer->processing, "UV_SIZE_SCALE" ));
-  }
+  /* items set after msUVRASTERLayerWhichShapes() have no precomputed values */
+  angle = uvlinfo->angle ? uvlinfo->angle[index] : atan2((double)*v, (double)*u) * 180 / MS_PI;
 
   for(i=0; i<layer->numitems; i++) {
     if (itemindexes[i] == MSUVRASTER_ANGLEINDEX) {
-      snprintf(tmp, 100, "%f", (atan2((double)*v, (double)*u) * 180 / MS_PI));
+      snprintf(tmp, 100, "%f", angle);
       values[i] = msStrdup(tmp);
     } else if (itemindexes[i] == MSUVRASTER_MINUSANGLEINDEX) {
       double minus_angle;
-      minus_angle = (atan2((double)*v, (double)*u) * 180 / MS_PI)+180;
+      minus_angle = angle+180;
       if (minus_angle >= 360)
         minus_angle -= 360;
       snprintf(tmp, 100, "%f", minus_angle);
       values[i] = msStrdup(tmp);
     } else if ( (itemindexes[i] == MSUVRASTER_LENGTHINDEX) ||
                 (itemindexes[i] == MSUVRASTER_LENGTH2INDEX) ) {
-      float length = sqrt((*u**u)+(*v**v))*size_scale;
+      float length = uvlinfo->length ? uvlinfo->length[index] : sqrt((*u**u)+(*v**v))*uvlinfo->size_scale;
 
       if (itemindexes[i] == MSUVRASTER_LENGTHINDEX)
         snprintf(tmp, 100, "%f", length);
@@ -342,7 +344,9 @@ int msUVRASTERLayerWhichShapes(layerObj *layer, rectObj rect, int isQuery)
   mapObj *map_tmp;
   double map_cellsize;
   unsigned int spacing;
-  int width, height, u_src_off, v_src_off, i, x, y;
+  int width, height, i, x, y, n;
+  int *itemindexes, need_angle = MS_FALSE, need_length = MS_FALSE;
+  float *u_src, *v_src;
   char   **alteredProcessing = NULL, *saved_layer_mask;
   char **savedProcessing = NULL;
 
@@ -481,46 +485,65 @@ int msUVRASTERLayerWhichShapes(layerObj *layer, rectObj rect, int isQuery)
   }
 
   /* free old query arrays */
-  if (uvlinfo->u) {
-    for (i=0; i<uvlinfo->width; ++i) {
-      free(uvlinfo->u[i]);
-    }
-    free(uvlinfo->u);
-  }
-
-  if (uvlinfo->v) {
-    for (i=0; i<uvlinfo->width; ++i) {
-      free(uvlinfo->v[i]);
-    }
-    free(uvlinfo->v);
-  }
+  msUVRasterLayerInfoFreeValues(uvlinfo);
 
   /* Update our uv layer structure */
   uvlinfo->width = width;
   uvlinfo->height = height;
-  uvlinfo->query_results = width*height;
 
-  uvlinfo->u = (float **)msSmallMalloc(sizeof(float *)*width);
-  uvlinfo->v = (float **)msSmallMalloc(sizeof(float *)*width);
+  /* the shapes go column after column, skipping the null vectors */
+  uvlinfo->u = (float *)msSmallMalloc(sizeof(float)*width*height);
+  uvlinfo->v = (float *)msSmallMalloc(sizeof(float)*width*height);
+  uvlinfo->cells = (int *)msSmallMalloc(sizeof(int)*width*height);
+  u_src = image_tmp->img.raw_float;
+  v_src = image_tmp->img.raw_float + width*height;
+  n = 0;
+  for (x = 0, i = 0; x < width; ++x) {
+    for (y = 0; y < height; ++y, ++i) {
+      uvlinfo->u[i] = u_src[x + y * width];
+      uvlinfo->v[i] = v_src[x + y * width];
+      if (uvlinfo->u[i] != 0 || uvlinfo->v[i] != 0)
+        uvlinfo->cells[n++] = i;
+    }
+  }
+  uvlinfo->query_results = n;
 
-  for (x = 0; x < width; ++x) {
-    uvlinfo->u[x] = (float *)msSmallMalloc(height * sizeof(float));
-    uvlinfo->v[x] = (float *)msSmallMalloc(height * sizeof(float));
+  msFreeImage(image_tmp); /* we do not need the imageObj anymore */
 
-    for (y = 0; y < height; ++y) {
-      u_src_off = v_src_off = x + y * width;
-      v_src_off += width*height;
+  /* compute the derived values the layer items need in one pass */
+  itemindexes = (int*)layer->iteminfo;
+  for (i = 0; itemindexes && i < layer->numitems; i++) {
+    if (itemindexes[i] == MSUVRASTER_ANGLEINDEX || itemindexes[i] == MSUVRASTER_MINUSANGLEINDEX)
+      need_angle = MS_TRUE;
+    else if (itemindexes[i] == MSUVRASTER_LENGTHINDEX || itemindexes[i] == MSUVRASTER_LENGTH2INDEX)
+      need_length = MS_TRUE;
+  }
 
-      uvlinfo->u[x][y] = image_tmp->img.raw_float[u_src_off];
-      uvlinfo->v[x][y] = image_tmp->img.raw_float[v_src_off];
+  if (need_angle) {
+    uvlinfo->angle = (double *)msSmallMalloc(sizeof(double)*MS_MAX(n,1));
+    for (i = 0; i < n; i++) {
+      int c = uvlinfo->cells[i];
+      uvlinfo->angle[i] = atan2((double)uvlinfo->v[c], (double)uvlinfo->u[c]) * 180 / MS_PI;
+    }
+  }
 
-      /* null vector? update the number of results  */
-      if (uvlinfo->u[x][y] == 0 && uvlinfo->v[x][y] == 0)
-        --uvlinfo->query_results;
+  /* -------------------------------------------------------------------- */
+  /*    Determine desired size_scale.  Default to 1 if not otherwise set  */
+  /* -------------------------------------------------------------------- */
+  uvlinfo->size_scale = 1;
+  if( CSLFetchNameValue( layer->processing, "UV_SIZE_SCALE" ) != NULL ) {
+    uvlinfo->size_scale =
+      atof(CSLFetchNameValue( layer->processing, "UV_SIZE_SCALE" ));
+  }
+
+  if (need_length) {
+    uvlinfo->length = (float *)msSmallMalloc(sizeof(float)*MS_MAX(n,1));
+    for (i = 0; i < n; i++) {
+      float u = uvlinfo->u[uvlinfo->cells[i]], v = uvlinfo->v[uvlinfo->cells[i]];
+      uvlinfo->length[i] = sqrt((u*u)+(v*v))*uvlinfo->size_scale;
     }
   }
 
-  msFreeImage(image_tmp); /* we do not need the imageObj anymore */
   msFreeMap(map_tmp);
 
   uvlinfo->next_shape = 0;
@@ -533,7 +556,7 @@ int msUVRASTERLayerGetShape(layerObj *layer, shapeObj *shape, resultObj *record)
   uvRasterLayerInfo *uvlinfo = (uvRasterLayerInfo *) layer->layerinfo;
   lineObj line ;
   pointObj point;
-  int i, j, k, x=0, y=0;
+  int x, y;
   long shapeindex = record->shapeindex;
 
   msFreeShape(shape);
@@ -548,14 +571,8 @@ int msUVRASTERLayerGetShape(layerObj *layer, shapeObj *shape, resultObj *record)
     return MS_FAILURE;
   }
 
-  /* loop to the next non null vector */
-  k = 0;
-  for (i=0, x=-1; i<uvlinfo->width && k<=shapeindex; ++i, ++x) {
-    for (j=0, y=-1; j<uvlinfo->height && k<=shapeindex; ++j, ++k, ++y) {
-      if (uvlinfo->u[i][j] == 0 && uvlinfo->v[i][j] == 0)
-        --k;
-    }
-  }
+  x = uvlinfo->cells[shapeindex] / uvlinfo->height;
+  y = uvlinfo->cells[shapeindex] % uvlinfo->height;
 
   point.x = Pix2Georef(x, 0, uvlinfo->width-1,
                        uvlinfo->extent.minx, uvlinfo->extent.maxx, MS_FALSE);
@@ -576,7 +593,7 @@ int msUVRASTERLayerGetShape(layerObj *layer, shapeObj *shape, resultObj *record)
   msComputeBounds( shape );
 
   shape->numvalues = layer->numitems;
-  shape->values = msUVRASTERGetValues(layer, &uvlinfo->u[x][y], &uvlinfo->v[x][y]);
+  shape->values = msUVRASTERGetValues(layer, shapeindex);
 
   return MS_SUCCESS;
 
@@ -1094,6 +1094,7 @@ int msWMSLoadGetMapParams(mapObj *map, int nVersion,
                strncasecmp(format->driver, "GDAL/", 5) != 0 &&
                strncasecmp(format->driver, "AGG/", 4) != 0 &&
                strncasecmp(format->driver, "UTFGRID", 7) != 0 &&
+               strncasecmp(format->driver, "MVT", 3) != 0 &&
                strncasecmp(format->driver, "CAIRO/", 6) != 0 &&
                strncasecmp(format->driver, "OGL/", 4) != 0 &&
                strncasecmp(format->driver, "KML", 3) != 0 &&
@@ -3644,6 +3645,16 @@ int msWMSGetMap(mapObj *map, int nVersion, char **names, char **values, int nume
     if (!msIntegerInArray(GET_LAYER(map, i)->index, ows_request->enabled_layers, ows_request->numlayers))
       GET_LAYER(map, i)->status = MS_OFF;
 
+  /* vector tiles are written directly from the layers */
+  if (MS_RENDERER_MVT(map->outputformat)) {
+    if( (http_max_age = msOWSLookupMetadata(&(map->web.metadata), "MO", "http_max_age")) ) {
+      msIO_setHeader("Cache-Control","max-age=%s", http_max_age);
+    }
+    if (msMVTWriteTile(map, MS_TRUE) != MS_SUCCESS)
+      return msWMSException(map, nVersion, NULL, wms_exception_format);
+    return MS_SUCCESS;
+  }
+
   if (sldrequested && sldspatialfilter) {
     /* set the quermap style so that only selected features will be retruned */
     map->querymap.status = MS_ON;
@@ -4319,6 +4330,27 @@ int msWMSDescribeLayer(mapObj *map, int nVersion, char **names,
 }
 
 
+/*
+** Sends the encoded legend image kept by an earlier request, if any.
+*/
+static int msWMSLegendGraphicSendCached(mapObj *map, const char *cachekey)
+{
+  unsigned char *data;
+  int size;
+
+  data = msLegendCacheGetEncoded(map, cachekey, &size);
+  if (data == NULL)
+    return MS_FALSE;
+
+  msIO_setHeader("Content-Type", "%s", MS_IMAGE_MIME_TYPE(map->outputformat));
+  msIO_sendHeaders();
+  if (msIO_needBinaryStdout() == MS_SUCCESS)
+    msIO_fwrite(data, 1, size, stdout);
+  msFree(data);
+
+  return MS_TRUE;
+}
+
 /*
 ** msWMSGetLegendGraphic()
 */
@@ -4345,6 +4377,8 @@ int msWMSLegendGraphic(mapObj *map, int nVersion, char **names,
   char ***nestedGroups = NULL;
   int *numNestedGroups = NULL;
   int *isUsedInNestedGroup = NULL;
+  int cachetimeout = 0;
+  char *cachekey = NULL;
 
   if(!hittest) {
     /* we can skip alot of testing if we already have a hittest, as it has already been done in the hittesting phase */
@@ -4542,8 +4576,28 @@ this request. Check wms/ows_enable_request settings.",
   }
   msApplyOutputFormat(&(map->outputformat), psFormat, MS_NOOVERRIDE,
       MS_NOOVERRIDE, MS_NOOVERRIDE );
-  
+
+  /* keep the encoded image of legends that don't depend on the map content. */
+  /* msSaveImageBuffer() only encodes the AGG PNG and JPEG drivers, and a    */
+  /* PALETTE file is read relative to the mapfile, which it doesn't know     */
+  /* about, leave everything else to msSaveImage().                          */
+  if (!hittest && MS_DRIVER_AGG(map->outputformat) &&
+      (strcasestr(map->outputformat->driver, "/png") || strcasestr(map->outputformat->driver, "/jpeg")) &&
+      msGetOutputFormatOption(map->outputformat, "PALETTE", NULL) == NULL)
+    cachetimeout = msLegendCacheTimeout(map);
+
   if ( psRule == NULL || nLayers > 1) {
+    if (cachetimeout > 0) {
+      if ( psScale != NULL ) { /* as msDrawLegend() will */
+        map->cellsize = msAdjustExtent(&(map->extent), map->width, map->height);
+        msCalculateScale(map->extent, map->units, map->width, map->height, map->resolution, &map->scaledenom);
+      }
+      cachekey = msLegendCacheKey(map, NULL, NULL, 0, 0, psScale == NULL);
+      if (cachekey && msWMSLegendGraphicSendCached(map, cachekey)) {
+        msFree(cachekey);
+        return MS_SUCCESS;
+      }
+    }
     if ( psScale != NULL ) {
       /* Scale-dependent legend. map->scaledenom will be calculated in msDrawLegend */
       img = msDrawLegend(map, MS_FALSE, NULL);
@@ -4588,6 +4642,19 @@ this request. Check wms/ows_enable_request settings.",
         /* Scale-dependent legend. calculate map->scaledenom */
         map->cellsize = msAdjustExtent(&(map->extent), map->width, map->height);
         msCalculateScale(map->extent, map->units, map->width, map->height, map->resolution, &map->scaledenom);
+      }
+
+      if (cachetimeout > 0) {
+        cachekey = msLegendCacheKey(map, GET_LAYER(map, iLayerIndex),
+                                    GET_LAYER(map, iLayerIndex)->class[i],
+                                    nWidth, nHeight, psScale == NULL);
+        if (cachekey && msWMSLegendGraphicSendCached(map, cachekey)) {
+          msFree(cachekey);
+          return MS_SUCCESS;
+        }
+      }
+
+      if ( psScale != NULL ) {
         img = msCreateLegendIcon(map, GET_LAYER(map, iLayerIndex),
                                  GET_LAYER(map, iLayerIndex)->class[i],
                                  nWidth, nHeight, MS_FALSE);
@@ -4599,6 +4666,7 @@ this request. Check wms/ows_enable_request settings.",
       }
     }
     if (img == NULL) {
+      msFree(cachekey);
       msSetError(MS_IMGERR,
                  "Unavailable RULE (%s).",
                  "msWMSGetLegendGraphic()",
@@ -4607,11 +4675,30 @@ this request. Check wms/ows_enable_request settings.",
     }
   }
 
-  if (img == NULL)
+  if (img == NULL) {
+    msFree(cachekey);
     return msWMSException(map, nVersion, NULL, wms_exception_format);
+  }
 
   msIO_setHeader("Content-Type", "%s", MS_IMAGE_MIME_TYPE(map->outputformat));
   msIO_sendHeaders();
+  if (cachekey) {
+    unsigned char *data;
+    int size;
+
+    data = msSaveImageBuffer(img, &size, img->format);
+    msFreeImage(img);
+    if (data == NULL || msIO_needBinaryStdout() != MS_SUCCESS) {
+      msFree(cachekey);
+      msFree(data);
+      return msWMSException(map, nVersion, NULL, wms_exception_format);
+    }
+    msLegendCachePutEncoded(cachekey, cachetimeout, data, size);
+    msFree(cachekey);
+    msIO_fwrite(data, 1, size, stdout);
+    msFree(data);
+    return(MS_SUCCESS);
+  }
   if (msSaveImage(map, img, NULL) != MS_SUCCESS)
     return msWMSException(map, nVersion, NULL, wms_exception_format);
 
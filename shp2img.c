@@ -123,6 +123,9 @@ int main(int argc, char *argv[])
       exit(1);
     }
 
+    /* Trace the draw if MS_TRACE is set */
+    msTraceStart();
+
     for(i=1; i<argc; i++) { /* Step though the user arguments, 1st to find map file */
 
       if(strcmp(argv[i],"-m") == 0) {
@@ -317,6 +320,7 @@ int main(int argc, char *argv[])
               (requeststarttime.tv_sec+requeststarttime.tv_usec/1.0e6) );
     }
 
+    msTraceFinish("shp2img");
     msCleanup();
 
   } /*   for(draws=0; draws<iterations; draws++) { */
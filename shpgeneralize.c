@@ -0,0 +1,291 @@
+/******************************************************************************
+ * $Id$
+ *
+ * Project:  MapServer
+ * Purpose:  Command line utility to write generalized level of detail copies
+ *           of a shapefile. The shapefile layer reads them instead of the
+ *           full resolution geometry when drawing at small scales.
+ * Author:   MapServer team.
+ *
+ ******************************************************************************
+ * Copyright (c) 1996-2016 Regents of the University of Minnesota.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+/*
+** For every tolerance (in shapefile units) given on the command line a
+** <basename>_lod<n>.shp/.shx pair is written holding the same records, in the
+** same order, simplified with Douglas-Peucker. Record numbers have to match
+** the source since the .dbf and any spatial index are shared. Rings that
+** become smaller than the tolerance are dropped, and records with nothing
+** left are written as NULL shapes which the layer skips.
+**
+** The levels are listed in <basename>.lod, which the shapefile layer reads
+** on open to pick a level from the map cellsize.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+
+#include "mapserver.h"
+
+
+
+static double segment_distance_sq(pointObj *p, pointObj *a, pointObj *b)
+{
+  double dx = b->x - a->x, dy = b->y - a->y, t;
+
+  if(dx == 0 && dy == 0) /* closed ring, measure from the start point */
+    return (p->x - a->x)*(p->x - a->x) + (p->y - a->y)*(p->y - a->y);
+
+  t = ((p->x - a->x)*dx + (p->y - a->y)*dy) / (dx*dx + dy*dy);
+  if(t < 0) t = 0;
+  else if(t > 1) t = 1;
+
+  dx = a->x + t*dx - p->x;
+  dy = a->y + t*dy - p->y;
+  return dx*dx + dy*dy;
+}
+
+/*
+** Flag the vertices of line to keep. An explicit stack is used rather than
+** recursion since rings with hundreds of thousands of vertices are common.
+*/
+static int simplify_line(lineObj *line, double tolerance, char *keep, int *stack)
+{
+  int i, top = 0, count = 0;
+  double tolerance_sq = tolerance*tolerance;
+
+  memset(keep, 0, line->numpoints);
+  keep[0] = keep[line->numpoints-1] = 1;
+
+  stack[top++] = 0;
+  stack[top++] = line->numpoints-1;
+  while(top > 0) {
+    int last = stack[--top], first = stack[--top], farthest = -1;
+    double max = tolerance_sq;
+
+    for(i=first+1; i<last; i++) {
+      double d = segment_distance_sq(&line->point[i], &line->point[first], &line->point[last]);
+      if(d > max) {
+        max = d;
+        farthest = i;
+      }
+    }
+    if(farthest != -1) {
+      keep[farthest] = 1;
+      stack[top++] = first;
+      stack[top++] = farthest;
+      stack[top++] = farthest;
+      stack[top++] = last;
+    }
+  }
+
+  for(i=0; i<line->numpoints; i++)
+    count += keep[i];
+  return count;
+}
+
+/*
+** Simplify shape in place, returns the number of parts left.
+*/
+static int generalize_shape(shapeObj *shape, double tolerance, char **keep, int **stack, int *size)
+{
+  int i, j, k, n = 0;
+  int is_polygon = (shape->type == MS_SHAPE_POLYGON);
+
+  for(i=0; i<shape->numlines; i++) {
+    lineObj *line = &shape->line[i];
+    int count;
+
+    if(line->numpoints == 0) {
+      free(line->point);
+      continue;
+    }
+
+    if(is_polygon) {
+      rectObj bounds;
+      bounds.minx = bounds.maxx = line->point[0].x;
+      bounds.miny = bounds.maxy = line->point[0].y;
+      for(j=1; j<line->numpoints; j++) {
+        bounds.minx = MS_MIN(bounds.minx, line->point[j].x);
+        bounds.maxx = MS_MAX(bounds.maxx, line->point[j].x);
+        bounds.miny = MS_MIN(bounds.miny, line->point[j].y);
+        bounds.maxy = MS_MAX(bounds.maxy, line->point[j].y);
+      }
+      if(line->numpoints < 4 || (bounds.maxx - bounds.minx < tolerance && bounds.maxy - bounds.miny < tolerance)) {
+        free(line->point);
+        continue; /* too small to be seen at this level */
+      }
+    }
+
+    if(line->numpoints > 2) {
+      if(line->numpoints > *size) {
+        *size = line->numpoints;
+        *keep = (char *) msSmallRealloc(*keep, *size);
+        *stack = (int *) msSmallRealloc(*stack, sizeof(int)*2*(*size));
+      }
+      count = simplify_line(line, tolerance, *keep, *stack);
+      if(count < line->numpoints && (!is_polygon || count >= 4)) { /* a ring needs at least 4 points, keep it as is otherwise */
+        for(j=0, k=0; j<line->numpoints; j++) {
+          if((*keep)[j])
+            line->point[k++] = line->point[j];
+        }
+        line->numpoints = k;
+      }
+    }
+
+    shape->line[n++] = *line;
+  }
+
+  shape->numlines = n;
+  return n;
+}
+
+int main(int argc, char *argv[])
+{
+  SHPHandle    inSHP,outSHP; /* ---- Shapefile file pointers ---- */
+  shapeObj     shape;
+  int          shpType, nShapes;
+  char         basename[MS_MAXPATHLEN], buffer[MS_MAXPATHLEN];
+  char         *keep=NULL;
+  int          *stack=NULL, size=0;
+  double       *tolerances;
+  int          numtolerances;
+  FILE         *lodfile;
+  const char   *name;
+  int i,j;
+  long nPoints, nKept;
+
+  if(argc > 1 && strcmp(argv[1], "-v") == 0) {
+    printf("%s\n", msGetVersion());
+    exit(0);
+  }
+
+  /* ------------------------------------------------------------------------------- */
+  /*       Check the number of arguments, return syntax if not correct               */
+  /* ------------------------------------------------------------------------------- */
+  if( argc < 3 ) {
+    fprintf(stderr,"Syntax: shpgeneralize [shpfile] [tolerance] [tolerance...]\n" );
+    fprintf(stderr,"Writes [shpfile]_lod1, [shpfile]_lod2, ... simplified to the given tolerances\n" );
+    fprintf(stderr,"(in shapefile units) and the [shpfile].lod index used by the shapefile layer.\n" );
+    exit(1);
+  }
+
+  msSetErrorFile("stderr", NULL);
+
+  numtolerances = argc - 2;
+  tolerances = (double *) msSmallMalloc(sizeof(double)*numtolerances);
+  for(i=0; i<numtolerances; i++) {
+    tolerances[i] = atof(argv[i+2]);
+    if(tolerances[i] <= 0 || (i > 0 && tolerances[i] <= tolerances[i-1])) {
+      fprintf(stderr,"Tolerances must be positive and in increasing order.\n");
+      exit(1);
+    }
+  }
+
+  /* ------------------------------------------------------------------------------- */
+  /*       Open the shapefile                                                        */
+  /* ------------------------------------------------------------------------------- */
+  if(strlcpy(basename, argv[1], sizeof(basename)) >= sizeof(basename)) {
+    fprintf(stderr,"Path too long: %s\n", argv[1]);
+    exit(1);
+  }
+  if(strlen(basename) > 4 && strcasecmp(basename + strlen(basename) - 4, ".shp") == 0)
+    basename[strlen(basename) - 4] = '\0';
+
+  inSHP = msSHPOpen(basename, "rb" );
+  if( !inSHP ) {
+    fprintf(stderr,"Unable to open %s shapefile.\n",argv[1]);
+    exit(1);
+  }
+  msSHPGetInfo(inSHP, &nShapes, &shpType);
+
+  if(shpType != SHP_ARC && shpType != SHP_POLYGON &&
+      shpType != SHP_ARCM && shpType != SHP_POLYGONM &&
+      shpType != SHP_ARCZ && shpType != SHP_POLYGONZ) {
+    fprintf(stderr,"Only line and polygon shapefiles can be generalized.\n");
+    exit(1);
+  }
+
+  /* the index refers to the levels relative to its own directory */
+  name = basename + strlen(basename);
+  while(name > basename && name[-1] != '/' && name[-1] != '\\')
+    name--;
+
+  if(snprintf(buffer, sizeof(buffer), "%s.lod", basename) >= (int)sizeof(buffer)) {
+    fprintf(stderr,"Path too long: %s\n", basename);
+    exit(1);
+  }
+  lodfile = fopen(buffer, "w");
+  if( lodfile == NULL ) {
+    fprintf( stderr, "Failed to create file '%s'.\n", buffer );
+    exit( 1 );
+  }
+  fprintf(lodfile, "# levels of detail for %s, written by shpgeneralize\n", name);
+
+  /* ------------------------------------------------------------------------------- */
+  /*       Write one .shp/.shx per tolerance                                         */
+  /* ------------------------------------------------------------------------------- */
+  for(i=0; i<numtolerances; i++) {
+    if(snprintf(buffer, sizeof(buffer), "%s_lod%d", basename, i+1) >= (int)sizeof(buffer)) {
+      fprintf(stderr,"Path too long: %s\n", basename);
+      exit(1);
+    }
+    outSHP = msSHPCreate(buffer, shpType);
+    if( outSHP == NULL ) {
+      fprintf( stderr, "Failed to create file '%s'.\n", buffer );
+      exit( 1 );
+    }
+
+    nPoints = nKept = 0;
+    for(j=0; j<nShapes; j++) {
+      int k;
+
+      msInitShape(&shape);
+      msSHPReadShape(inSHP, j, &shape);
+      for(k=0; k<shape.numlines; k++)
+        nPoints += shape.line[k].numpoints;
+
+      if(shape.type != MS_SHAPE_NULL && generalize_shape(&shape, tolerances[i], &keep, &stack, &size) == 0)
+        shape.type = MS_SHAPE_NULL;
+
+      for(k=0; k<shape.numlines; k++)
+        nKept += shape.line[k].numpoints;
+
+      msSHPWriteShape(outSHP, &shape);
+      msFreeShape(&shape);
+    }
+    msSHPClose(outSHP);
+
+    fprintf(lodfile, "%.15g %s_lod%d\n", tolerances[i], name, i+1);
+    printf("%s: tolerance %g, %ld of %ld vertices kept.\n", buffer, tolerances[i], nKept, nPoints);
+  }
+
+  fclose(lodfile);
+  msSHPClose(inSHP);
+  free(tolerances);
+  free(keep);
+  free(stack);
+
+  return(0);
+}
@@ -4,7 +4,9 @@
  * Project:  MapServer
  * Purpose:  Command line utility to sort a shapefile based on a single
  *           attribute in ascending or decending order. Useful for
- *           prioritizing drawing or labeling of shapes.
+ *           prioritizing drawing or labeling of shapes. Can also sort
+ *           along a Hilbert curve so that shapes close to each other are
+ *           close in the file too.
  * Author:   Steve Lime and the MapServer team.
  *
  ******************************************************************************
@@ -35,6 +37,7 @@
 #include <string.h>
 
 #include "mapserver.h"
+#include "maptree.h"
 
 
 
@@ -76,6 +79,42 @@ static int compare_number_ascending(const void *a, const void *b)
   return(0);
 }
 
+static int compare_hilbert(const void *a, const void *b)
+{
+  const sortStruct *i = a, *j = b;
+  if(i->number != j->number)
+    return(i->number > j->number ? 1 : -1);
+  return(i->index - j->index); /* keep the original order for equal keys */
+}
+
+#define HILBERT_ORDER 65536 /* grid cells per side, keys fit in 32 bits */
+
+/*
+** Distance of cell (x,y) along a Hilbert curve filling a HILBERT_ORDER
+** sided grid.
+*/
+static unsigned int hilbert_index(unsigned int x, unsigned int y)
+{
+  unsigned int rx, ry, s, t, d = 0;
+
+  for(s=HILBERT_ORDER/2; s>0; s/=2) {
+    rx = (x & s) > 0;
+    ry = (y & s) > 0;
+    d += s * s * ((3 * rx) ^ ry);
+    if(ry == 0) { /* rotate the quadrant */
+      if(rx == 1) {
+        x = HILBERT_ORDER-1 - x;
+        y = HILBERT_ORDER-1 - y;
+      }
+      t = x;
+      x = y;
+      y = t;
+    }
+  }
+
+  return(d);
+}
+
 int main(int argc, char *argv[])
 {
   SHPHandle    inSHP,outSHP; /* ---- Shapefile file pointers ---- */
@@ -90,6 +129,7 @@ int main(int argc, char *argv[])
   char         buffer[1024];
   int i,j;
   int num_fields, num_records;
+  int          hilbert; /* ---- Spatial instead of attribute sort ---- */
 
   if(argc > 1 && strcmp(argv[1], "-v") == 0) {
     printf("%s\n", msGetVersion());
@@ -99,10 +139,14 @@ int main(int argc, char *argv[])
   /* ------------------------------------------------------------------------------- */
   /*       Check the number of arguments, return syntax if not correct               */
   /* ------------------------------------------------------------------------------- */
-  if( argc != 5 ) {
+  if( argc != 5 && !(argc == 4 && strcasecmp(argv[3], "-hilbert") == 0) ) {
     fprintf(stderr,"Syntax: sortshp [infile] [outfile] [item] [ascending|descending]\n" );
+    fprintf(stderr,"        sortshp [infile] [outfile] -hilbert\n" );
+    fprintf(stderr,"The -hilbert form orders shapes along a Hilbert curve of their bounding box\n" );
+    fprintf(stderr,"centers and writes a new spatial index for [outfile].\n" );
     exit(1);
   }
+  hilbert = (argc == 4);
 
   msSetErrorFile("stderr", NULL);
 
@@ -129,7 +173,7 @@ int main(int argc, char *argv[])
   num_fields = msDBFGetFieldCount(inDBF);
   num_records = msDBFGetRecordCount(inDBF);
 
-  for(i=0; i<num_fields; i++) {
+  for(i=0; i<num_fields && !hilbert; i++) {
     msDBFGetFieldInfo(inDBF,i,fName,NULL,NULL);
     if(strncasecmp(argv[3],fName,strlen(argv[3])) == 0) { /* ---- Found it ---- */
       fieldNumber = i;
@@ -137,7 +181,7 @@ int main(int argc, char *argv[])
     }
   }
 
-  if(fieldNumber < 0) {
+  if(fieldNumber < 0 && !hilbert) {
     fprintf(stderr,"Item %s doesn't exist in %s\n",argv[3],buffer);
     exit(1);
   }
@@ -151,35 +195,56 @@ int main(int argc, char *argv[])
   /* ------------------------------------------------------------------------------- */
   /*       Load the array to be sorted                                               */
   /* ------------------------------------------------------------------------------- */
-  dbfField = msDBFGetFieldInfo(inDBF,fieldNumber,NULL,NULL,NULL);
-  switch (dbfField) {
-    case FTString:
-      for(i=0; i<num_records; i++) {
-        strlcpy(array[i].string, msDBFReadStringAttribute( inDBF, i, fieldNumber), sizeof(array[i].string));
-        array[i].index = i;
-      }
-
-      if(*argv[4] == 'd')
-        qsort(array, num_records, sizeof(sortStruct), compare_string_descending);
-      else
-        qsort(array, num_records, sizeof(sortStruct), compare_string_ascending);
-      break;
-    case FTInteger:
-    case FTDouble:
-      for(i=0; i<num_records; i++) {
-        array[i].number = msDBFReadDoubleAttribute( inDBF, i, fieldNumber);
-        array[i].index = i;
+  if(hilbert) {
+    rectObj bounds, rect;
+    double sx, sy;
+
+    msSHPReadBounds(inSHP, -1, &bounds);
+    sx = (bounds.maxx > bounds.minx) ? (HILBERT_ORDER-1)/(bounds.maxx - bounds.minx) : 0;
+    sy = (bounds.maxy > bounds.miny) ? (HILBERT_ORDER-1)/(bounds.maxy - bounds.miny) : 0;
+
+    for(i=0; i<num_records; i++) {
+      array[i].index = i;
+      if(i >= nShapes || msSHPReadBounds(inSHP, i, &rect) != MS_SUCCESS) {
+        array[i].number = 4294967296.0; /* ---- NULL shapes go last ---- */
+        continue;
       }
+      array[i].number = hilbert_index((unsigned int)(((rect.minx + rect.maxx)/2 - bounds.minx)*sx),
+                                      (unsigned int)(((rect.miny + rect.maxy)/2 - bounds.miny)*sy));
+    }
 
-      if(*argv[4] == 'd')
-        qsort(array, num_records, sizeof(sortStruct), compare_number_descending);
-      else
-        qsort(array, num_records, sizeof(sortStruct), compare_number_ascending);
-
-      break;
-    default:
-      fprintf(stderr,"Data type for item %s not supported.\n",argv[3]);
-      exit(1);
+    qsort(array, num_records, sizeof(sortStruct), compare_hilbert);
+  } else {
+    dbfField = msDBFGetFieldInfo(inDBF,fieldNumber,NULL,NULL,NULL);
+    switch (dbfField) {
+      case FTString:
+        for(i=0; i<num_records; i++) {
+          strlcpy(array[i].string, msDBFReadStringAttribute( inDBF, i, fieldNumber), sizeof(array[i].string));
+          array[i].index = i;
+        }
+
+        if(*argv[4] == 'd')
+          qsort(array, num_records, sizeof(sortStruct), compare_string_descending);
+        else
+          qsort(array, num_records, sizeof(sortStruct), compare_string_ascending);
+        break;
+      case FTInteger:
+      case FTDouble:
+        for(i=0; i<num_records; i++) {
+          array[i].number = msDBFReadDoubleAttribute( inDBF, i, fieldNumber);
+          array[i].index = i;
+        }
+
+        if(*argv[4] == 'd')
+          qsort(array, num_records, sizeof(sortStruct), compare_number_descending);
+        else
+          qsort(array, num_records, sizeof(sortStruct), compare_number_ascending);
+
+        break;
+      default:
+        fprintf(stderr,"Data type for item %s not supported.\n",argv[3]);
+        exit(1);
+    }
   }
 
   /* ------------------------------------------------------------------------------- */
@@ -240,5 +305,33 @@ int main(int argc, char *argv[])
   msSHPClose(outSHP);
   msDBFClose(outDBF);
 
+  /* ------------------------------------------------------------------------------- */
+  /*       Shape ids changed, so a spatial index is needed for the new order         */
+  /* ------------------------------------------------------------------------------- */
+  if(hilbert) {
+    shapefileObj shapefile;
+    treeObj *tree;
+
+    if(msShapefileOpen(&shapefile, "rb", argv[2], MS_TRUE) == -1) {
+      fprintf(stderr,"Unable to open %s shapefile.\n",argv[2]);
+      exit(1);
+    }
+    tree = msCreateTree(&shapefile, 0);
+    if(!tree) {
+      fprintf(stderr,"Error generating spatial index for %s.\n",argv[2]);
+      exit(1);
+    }
+    i = 1;
+    snprintf(buffer, sizeof(buffer), "%s%s", argv[2], MS_INDEX_EXTENSION);
+    if(!msWriteTree(tree, buffer, (*((uchar *) &i) == 1) ? MS_NEW_LSB_ORDER : MS_NEW_MSB_ORDER)) {
+      fprintf(stderr,"Unable to write spatial index %s.\n",buffer);
+      msDestroyTree(tree);
+      msShapefileClose(&shapefile);
+      exit(1);
+    }
+    msDestroyTree(tree);
+    msShapefileClose(&shapefile);
+  }
+
   return(0);
 }